@@ -4,16 +4,102 @@
 #include "Log.h"
 #include "Bridge.h"
 #include "Digitizer.h"
+#include "Crate.h"
+#include "BufferPool.h"
+#include "RunControl.h"
+#include "ThreadPlacement.h"
+
+namespace {
+
+    void MeasureBaseline(Digitizer& digitizer)
+    {
+	CAEN_DGTZ_SetChannelSelfTrigger(digitizer.GetHandle(), CAEN_DGTZ_TRGMODE_ACQ_ONLY, 0xFF);  // Tutti i canali
+	CAEN_DGTZ_SetExtTriggerInputMode(digitizer.GetHandle(), CAEN_DGTZ_TRGMODE_DISABLED);
+	uint32_t trigStatus = 0;
+	CAEN_DGTZ_ReadRegister(digitizer.GetHandle(), 0x812C, &trigStatus);
+	//Log::OutDebug("Trigger Status Register (0x812C): " + std::to_string(trigStatus));
+	digitizer.SetTriggerThreshold(0.1);
+    }
+
+    void ArmExternalTrigger(Digitizer& digitizer)
+    {
+	CAEN_DGTZ_SetChannelSelfTrigger(digitizer.GetHandle(), CAEN_DGTZ_TRGMODE_DISABLED, 0xFF);
+	CAEN_DGTZ_SetExtTriggerInputMode(digitizer.GetHandle(), CAEN_DGTZ_TRGMODE_ACQ_ONLY);
+	//    Log::OutDebug("Trigger configuration: ExternalTrigger = ON, SelfTrigger = OFF (mode = NIM)");
+
+	uint32_t trigStatus = 0;
+	CAEN_DGTZ_ReadRegister(digitizer.GetHandle(), 0x812C, &trigStatus);
+	//Log::OutDebug("Trigger Status Register (0x812C): " + std::to_string(trigStatus));
+    }
+
+    // board: baseline and trigger; replay: the next recorded run
+    void StartRun(Digitizer& digitizer)
+    {
+	if (digitizer.IsReplay()) {
+	    digitizer.PrepareReplay();
+	    return;
+	}
+	MeasureBaseline(digitizer);
+	ArmExternalTrigger(digitizer);
+    }
+
+    void Run(Digitizer& digitizer)
+    {
+	// a board without its output does not acquire: ForEach reports the
+	// error, the other boards run on
+	try {
+	    digitizer.PrepareOutput();     // crea file HDF5, directory, gruppo "/events"
+	} catch (...) {
+	    digitizer.Disarm();
+	    throw;
+	}
+	digitizer.AcquireEvents();     // scrive gli eventi nel file HDF5
+	digitizer.CloseOutputFile();   // chiude il gruppo e il file HDF5
+    }
+
+    // every board, concurrently: StartRun on all of them before any Run,
+    // and with SyncStart the other boards armed before board 0 starts
+    void RunCrate(Crate& crate)
+    {
+	const std::vector<std::string> errors = crate.ForEach(StartRun);
+	for (auto& err : errors)
+	    Log::OutError(err);
+	if (!errors.empty()) {
+	    Log::OutError("Run not started.");
+	    return;
+	}
+	// one run number for the files of every board
+	try {
+	    crate.AllocateRunNumber();
+	} catch (const std::exception& e) {
+	    Log::OutError(std::string(e.what()) + ". Run not started.");
+	    return;
+	}
+	for (auto& err : crate.Arm())
+	    Log::OutError(err);
+	if (RunControl::StopRequested())
+	    return;
+	for (auto& err : crate.ForEach(Run))
+	    Log::OutError(err);
+	crate.CheckAlignment();
+    }
+
+}
 
 int main(int argc, char** argv)
 {
-    if (argc != 2)
+    const bool server = argc == 3 && std::string(argv[2]) == "--server";
+    if (argc != 2 && !server)
     {
         std::cout << "You need to supply the toml config-file (and only that) to the program." << std::endl;
-        std::cout << "Usage: ./GAGG-DAQ /path/to/config-file.toml" << std::endl;
+        std::cout << "Usage: ./GAGG-DAQ /path/to/config-file.toml [--server]" << std::endl;
+        std::cout << "  --server   wait for run-control commands (see daq-ctl) instead of running once" << std::endl;
         return 1;
     }
     
+    // Ctrl-C / SIGTERM: stop the run cleanly, a second signal kills the process
+    RunControl::InstallSignalHandlers();
+
 
     // Ottieni istanza singleton Config e leggi file
     Config& theConfig = Config::GetInstance();
@@ -27,42 +113,67 @@ int main(int argc, char** argv)
     Log::OutSummary("* * * * * * * * * * * * * * *");
     Log::OutSummary();
 
+    // [threads]: CPU e priorità dei thread di lettura e scrittura
+    const ThreadSettings& threads = theConfig.GetThreads();
+    const int node = ThreadPlacement::InterfaceNode(threads.NetworkInterface);
+    if (!threads.NetworkInterface.empty() && node < 0)
+      Log::OutWarning("No NUMA node known for network interface " + threads.NetworkInterface + ".");
+    ThreadPlacement::Configure(threads.ReadoutCPUs, threads.WriteCPUs, threads.ReadoutPriority, node);
+    // [memory]: buffer di lettura e scrittura su huge pages
+    BufferPool::Configure(theConfig.GetMemory().HugePages);
+
+    // [replay]: recorded runs go through the same processing, no hardware
+    const bool replay = theConfig.GetReplay().Enable;
+
     // Inizializza il bridge VME (V4718)
     Bridge bridge(theConfig);
-    bridge.Open();
-
-    Digitizer digitizer;
-    digitizer.SelectBoard();       // 1. Connessione al V1742
-    digitizer.Configure();         // 2. Configurazione base
-    digitizer.InitAcquisition();
-    digitizer.SetTriggerThreshold(0.1);
-
-
-    ///////////////////////////////////////  baseline////////////////////////////
-    CAEN_DGTZ_SetChannelSelfTrigger(digitizer.GetHandle(), CAEN_DGTZ_TRGMODE_ACQ_ONLY, 0xFF);  // Tutti i canali
-    CAEN_DGTZ_SetExtTriggerInputMode(digitizer.GetHandle(), CAEN_DGTZ_TRGMODE_DISABLED);
-    uint32_t trigStatus = 0;
-    CAEN_DGTZ_ReadRegister(digitizer.GetHandle(), 0x812C, &trigStatus);
-    //Log::OutDebug("Trigger Status Register (0x812C): " + std::to_string(trigStatus));
-    digitizer.SetTriggerThreshold(0.1);  
-    /////////////////////////////////////////////////////////////////////////////
-    
-    ////////////////// Main loop ...Acquire events with external trigger////////
-    CAEN_DGTZ_SetChannelSelfTrigger(digitizer.GetHandle(), CAEN_DGTZ_TRGMODE_DISABLED, 0xFF);
-    CAEN_DGTZ_SetExtTriggerInputMode(digitizer.GetHandle(), CAEN_DGTZ_TRGMODE_ACQ_ONLY);
-    //    Log::OutDebug("Trigger configuration: ExternalTrigger = ON, SelfTrigger = OFF (mode = NIM)");
+    // una scheda per indirizzo di [digitizer] VMEBaseAddress
+    Crate crate(replay ? 1 : theConfig.GetDigitizer().VMEBaseAddress.size());
+    if (!replay) {
+      bridge.Open();
+      crate.SetBridge(&bridge);      // accessi ai registri in blocco
+      if (!crate.BringUp()) {        // connessione, calibrazione e configurazione, in parallelo
+        crate.Close(false);
+        bridge.Close();
+        return 1;
+      }
+    } else {
+      Log::OutSummary("Replay mode: " + std::to_string(theConfig.GetReplay().Files.size()) + " recorded run(s), no digitizer.");
+    }
 
-    
-    //uint32_t trigStatus = 0;
-    CAEN_DGTZ_ReadRegister(digitizer.GetHandle(), 0x812C, &trigStatus);
-    //Log::OutDebug("Trigger Status Register (0x812C): " + std::to_string(trigStatus));
-    
 
-    digitizer.PrepareOutput();     // crea file HDF5, directory, gruppo "/events"
-    digitizer.AcquireEvents();     // scrive gli eventi nel file HDF5
-    digitizer.CloseOutputFile();   // chiude il gruppo e il file HDF5
-    digitizer.Close();             // 6. Cleanup
-    digitizer.Reset();
+    if (server || theConfig.GetControl().Enable)
+      RunControl::StartServer(theConfig.GetControl().Socket, server);
+
+    if (!server) {
+      // one run, or one per replayed file
+      const size_t nruns = replay ? theConfig.GetReplay().Files.size() : 1;
+      for (size_t i = 0; i < nruns && !RunControl::StopRequested(); i++)
+        RunCrate(crate);
+    } else {
+      Log::OutSummary("Waiting for run-control commands on " + theConfig.GetControl().Socket);
+      RunControl::Command command;
+      while (RunControl::WaitCommand(command)) {
+        if (command.fType == RunControl::kReconfigure) {
+          RunControl::SetState(RunControl::kConfiguring);
+          if (theConfig.Reload(command.fArgument)) {
+            if (!replay && theConfig.GetDigitizer().VMEBaseAddress.size() != crate.Size())
+              Log::OutWarning("Number of boards changed: restart the DAQ to apply it.");
+            for (auto& err : crate.ForEach([](Digitizer& board) { board.Reconfigure(); }))
+              Log::OutError(err);
+          }
+          RunControl::SetState(RunControl::kIdle);
+          continue;
+        }
+        RunControl::ClearStop();
+        RunControl::SetState(RunControl::kConfiguring);
+        RunCrate(crate);
+        RunControl::SetState(RunControl::kIdle);
+      }
+    }
+
+    RunControl::StopServer();
+    crate.Close(!replay);          // 6. Cleanup (reset delle schede)
 
     bridge.Close();  // opzionale
     return 0;
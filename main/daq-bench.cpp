@@ -0,0 +1,1113 @@
+// daq-bench: throughput of the acquisition pipeline on synthetic X742
+// events, one tab-separated line per measurement so that results of
+// different commits can be compared.
+//
+//   daq-bench [--rl 256,1024] [--channels 4,16] [--rates 1GHz,5GHz]
+//             [--stages convert,write,pipeline] [--formats hdf5,bin-sync,...]
+//             [--events 1000] [--repeat 3] [--threads 0] [--no-raw] [--hugepages off,auto]
+//             [--dir .] [--label $(git rev-parse --short HEAD)] [--out bench.tsv]
+//             [--daq DAQ-WC]
+//
+// Stages:
+//   convert    decoded events -> EventBatch of baseline-corrected int16 (+ raw uint16),
+//              with the kernel of X742Event::SelectConvert(); format "generic"
+//              repeats it with the generic loop when a compiled kernel exists
+//   write      one output alone, fed with converted batches
+//   pipeline   convert + output + a checkpoint every CheckpointEvents, as DAQ-WC
+//   queue      the handoff queues of Queue.h alone (not in the default list)
+//   tasks      TaskPool on uneven tasks, against a static split (not in the default list)
+//   shutdown   DAQ-WC stopped by SIGINT while it replays at full speed (not in the default list)
+//
+// Outputs (--formats, default all):
+//   hdf5              per-event layout
+//   hdf5-gzip         per-event layout, gzip of the file at close (DAQ-WC default)
+//   hdf5-swmr         appendable layout, SWMR
+//   hdf5-deflate1/6   appendable layout, chunks compressed in parallel
+//                     (any hdf5-deflateN can be asked for)
+//   bin-sync, bin-threads, bin-uring, bin-direct   flat BIN through FileSink
+//   journal           checkpoint journal (RunJournal.h)
+//   ring              monitor shared-memory ring (EventRing.h)
+//   histograms        online histograms of [histograms] (Histograms.h), all
+//                     channels correlated; merged at every checkpoint
+//
+// The CAEN decoding itself (CAEN_DGTZ_DecodeEvent) needs an open board and
+// is not measured: events start from the decoded X742 structure. Files are
+// written to --dir and removed after each measurement. Each line holds the
+// median of --repeat runs; MBps counts the sample bytes handled (corrected
+// + raw), ratio the sample bytes per byte on disk.
+//
+// --hugepages repeats everything for each [memory] HugePages mode (column
+// pages): the decoded events, the HDF5 staging buffers and the BIN write
+// blocks then come from BufferPool as in DAQ-WC. Pools under 512 kB stay
+// on normal pages whatever the mode.
+//
+// The queue stage moves 1000 x --events integers through each queue of
+// Queue.h with 1 to 4 producer and consumer threads, against a mutex +
+// condition variable queue for reference. It is also the stress test:
+// every consumer checks the order of each producer's items and the totals
+// must match, or the measurement fails. Its format column names the queue
+// and the threads (mpmc-2x2); events counts the items, so 1e6 / kHz is the
+// ns per item.
+//
+// The tasks stage runs 10 x --events tasks of random cost (most cheap, a
+// few up to 50 times longer, as empty and pile-up chunks) on 1, 2, 4, ...
+// threads up to the core count: "steal" is TaskPool with the results taken
+// in order as the writer does, "static" gives thread i every n-th task.
+// The worker utilization of each steal line follows as a # comment.
+//
+// The shutdown stage is the bounded-shutdown test of DAQ-WC (--daq, by
+// default the DAQ-WC next to daq-bench). The synthetic events are written
+// as a BIN run, which DAQ-WC replays with [replay] Speed = 0 and Loop =
+// true into each output of --formats it has (hdf5-gzip, hdf5-swmr,
+// hdf5-deflateN, bin-*). After a second of running it gets SIGINT: the
+// run must end with StopReason "Stopped" in the .runs.tsv registry and the
+// process exit within [control] ShutdownTimeoutS, or the measurement
+// fails. hdf5-gzip is not held to the timeout: the gzip of the whole file
+// at close is not bounded by it (use chunk compression for that). seconds
+// is the time from SIGINT to exit, events the events recorded, outbytes
+// the size of the closed file.
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <H5Cpp.h>
+
+#include "BufferPool.h"
+#include "Config.h"
+#include "EventBatch.h"
+#include "EventRing.h"
+#include "Queue.h"
+#include "TaskPool.h"
+#include "TimeAlignment.h"
+#include "HDF5Writer.hpp"
+#include "RunBinary.h"
+#include "RunBinaryWriter.h"
+#include "Histograms.h"
+#include "RunJournal.h"
+#include "X742Event.h"
+
+namespace {
+
+    const std::vector<std::string> kFormats = {
+	"hdf5", "hdf5-gzip", "hdf5-swmr", "hdf5-deflate1", "hdf5-deflate6",
+	"bin-sync", "bin-threads", "bin-uring", "bin-direct", "journal", "ring", "histograms"
+    };
+
+    constexpr uint32_t kPoolEvents = 64;     ///< distinct synthetic events, reused in turn
+    constexpr uint32_t kBatchEvents = 256;   ///< events per EventBatch, as Digitizer::BATCH_EVENTS
+    constexpr uint32_t kTTTPerEvent = 117647; ///< 1 kHz in 8.5 ns ticks
+
+    struct Setup {
+	uint32_t RecordLength;
+	std::vector<uint32_t> Channels;
+	std::string SamplingRate;
+	double SamplingTime;
+	bool SaveRaw;
+	unsigned Threads;
+	std::string Dir;
+    };
+
+    // Decoded X742 events: baseline ~3800 with noise, a negative pulse of
+    // random amplitude at the trigger position, DataChannel pointing into fData
+    // (all events in one block, as the decoded events of a readout buffer).
+    struct EventPool {
+	HugeVector<float> fData;
+	std::vector<CAEN_DGTZ_X742_EVENT_t> fEvents;
+	std::vector<double> fBaselines;      ///< in Channels order
+
+	explicit EventPool(const Setup& s)
+	{
+	    std::mt19937 rng(1);
+	    std::normal_distribution<float> noise(0.0f, 1.5f);
+	    std::uniform_real_distribution<float> amplitude(20.0f, 1500.0f);
+	    const double trigger = 0.8 * s.RecordLength * s.SamplingTime;
+	    const double rise = 2e-9, decay = 40e-9;
+
+	    for( uint32_t ch: s.Channels )
+		fBaselines.push_back(3800.0 + 10.0 * ch);
+	    fData.resize(size_t(kPoolEvents) * s.Channels.size() * s.RecordLength);
+	    fEvents.resize(kPoolEvents);
+	    for( uint32_t e = 0; e < kPoolEvents; e++ ) {
+		std::memset(&fEvents[e], 0, sizeof(fEvents[e]));
+		for( size_t c = 0; c < s.Channels.size(); c++ ) {
+		    float* w = fData.data() + (e * s.Channels.size() + c) * s.RecordLength;
+		    const float a = amplitude(rng);
+		    for( uint32_t i = 0; i < s.RecordLength; i++ ) {
+			const double t = i * s.SamplingTime - trigger;
+			const double pulse = t > 0 ? a * (std::exp(-t / decay) - std::exp(-t / rise)) : 0.0;
+			w[i] = std::clamp<float>(fBaselines[c] + noise(rng) - pulse, 0.0f, 4095.0f);
+		    }
+		    int group, local_ch;
+		    X742Event::Slot(s.Channels[c], group, local_ch);
+		    fEvents[e].GrPresent[group] = 1;
+		    fEvents[e].DataGroup[group].ChSize[local_ch] = s.RecordLength;
+		    fEvents[e].DataGroup[group].DataChannel[local_ch] = w;
+		}
+	    }
+	}
+    };
+
+    uint64_t FileSize(const std::string& path)
+    {
+	std::error_code ec;
+	const auto size = std::filesystem::file_size(path, ec);
+	return ec ? 0 : size;
+    }
+
+    // One output format: Write() per batch, Checkpoint() as Digitizer::Checkpoint,
+    // Close() finishes the file and returns its size on disk.
+    class Output {
+    public:
+	virtual ~Output() = default;
+	virtual void Write(const EventBatch& batch) = 0;
+	virtual void Checkpoint() {}
+	virtual uint64_t Close() = 0;
+    };
+
+    class PerEventOutput : public Output {
+    public:
+	PerEventOutput(const std::string& path, bool gzip, bool saveraw, RunJournalWriter* journal)
+	    : fPath(path), fGzip(gzip), fSaveRaw(saveraw), fJournal(journal),
+	      fFile(path, H5F_ACC_TRUNC)
+	{
+	    fFile.createGroup("/events");
+	    fFile.createGroup("/events_raw");
+	}
+	void Write(const EventBatch& batch) override
+	{
+	    for( uint32_t e = 0; e < batch.GetSize(); e++ ) {
+		batch.Gather(e, fCorr, fRaw);
+		HDF5Writer::WritePerEvent(fFile, batch.GetEventNumber(e), fCorr, fSaveRaw ? &fRaw : nullptr);
+	    }
+	    if( fJournal )
+		fJournal->AddBatch(batch);
+	}
+	void Checkpoint() override
+	{
+	    if( fJournal )
+		fJournal->Commit();
+	    fFile.flush(H5F_SCOPE_GLOBAL);
+	}
+	uint64_t Close() override
+	{
+	    fFile.close();
+	    if( fJournal )
+		fJournal->Close(true);
+	    if( !fGzip )
+		return FileSize(fPath);
+	    if( std::system(("gzip -f \"" + fPath + "\"").c_str()) != 0 )
+		throw std::runtime_error("gzip failed on " + fPath);
+	    return FileSize(fPath + ".gz");
+	}
+    private:
+	std::string fPath;
+	bool fGzip;
+	bool fSaveRaw;
+	std::unique_ptr<RunJournalWriter> fJournal;
+	H5::H5File fFile;
+	std::vector<int16_t> fCorr;
+	std::vector<uint16_t> fRaw;
+    };
+
+    class AppendableOutput : public Output {
+    public:
+	AppendableOutput(const std::string& path, const Setup& s, int compression, RunJournalWriter* journal)
+	    : fPath(path), fJournal(journal),
+	      fFile(compression > 0 ? new H5::H5File(path, H5F_ACC_TRUNC) : HDF5Writer::CreateFile(path))
+	{
+	    fFile->createGroup("/events");
+	    fFile->createGroup("/events_raw");
+	    fWriter.reset(new HDF5Writer(*fFile, s.SaveRaw, s.Channels.size() * s.RecordLength,
+					 compression, s.Threads));
+	    if( compression == 0 )
+		fWriter->StartSWMR();
+	}
+	void Write(const EventBatch& batch) override
+	{
+	    fWriter->WriteBatch(batch);
+	    if( fJournal )
+		fJournal->AddBatch(batch);
+	}
+	void Checkpoint() override
+	{
+	    if( fJournal )
+		fJournal->Commit();
+	    fWriter->Flush();
+	    fFile->flush(H5F_SCOPE_GLOBAL);
+	}
+	uint64_t Close() override
+	{
+	    fWriter.reset();
+	    fFile->close();
+	    if( fJournal )
+		fJournal->Close(true);
+	    return FileSize(fPath);
+	}
+    private:
+	std::string fPath;
+	std::unique_ptr<RunJournalWriter> fJournal;
+	std::unique_ptr<H5::H5File> fFile;
+	std::unique_ptr<HDF5Writer> fWriter;
+    };
+
+    class BinOutput : public Output {
+    public:
+	BinOutput(const std::string& path, const Setup& s, const std::string& mode, const std::string& engine)
+	    : fPath(path)
+	{
+	    RunBinary::FileHeader header = {};
+	    header.fNChannels = s.Channels.size();
+	    header.fNSamples = s.RecordLength;
+	    for( size_t i = 0; i < s.Channels.size() && i < RunBinary::kMaxChannels; i++ )
+		header.fChannelList[i] = s.Channels[i];
+	    header.fHasRaw = s.SaveRaw;
+	    header.fSamplingTime = s.SamplingTime;
+	    std::strncpy(header.fSamplingRate, s.SamplingRate.c_str(), sizeof(header.fSamplingRate) - 1);
+	    const OutputSettings out;
+	    fWriter.reset(new RunBinaryWriter(path, header, mode, engine, size_t(out.BlockSizeMB) << 20, out.WriteBuffers));
+	}
+	void Write(const EventBatch& batch) override
+	{
+	    fWriter->WriteBatch(batch);
+	}
+	void Checkpoint() override
+	{
+	    fWriter->Flush();
+	}
+	uint64_t Close() override
+	{
+	    if( !fWriter->Close() )
+		throw std::runtime_error("BIN write error on " + fPath);
+	    fWriter.reset();
+	    return FileSize(fPath) + FileSize(RunBinary::IndexPath(fPath));
+	}
+    private:
+	std::string fPath;
+	std::unique_ptr<RunBinaryWriter> fWriter;
+    };
+
+    // the journal on its own commits at every checkpoint, also in the write stage
+    class JournalOutput : public Output {
+    public:
+	JournalOutput(RunJournalWriter* journal) : fJournal(journal) {}
+	void Write(const EventBatch& batch) override
+	{
+	    fJournal->AddBatch(batch);
+	}
+	void Checkpoint() override
+	{
+	    if( !fJournal->Commit() )
+		throw std::runtime_error("journal write error on " + fJournal->GetPath());
+	}
+	uint64_t Close() override
+	{
+	    Checkpoint();
+	    const uint64_t size = FileSize(fJournal->GetPath());
+	    fJournal->Close(true);
+	    return size;
+	}
+    private:
+	std::unique_ptr<RunJournalWriter> fJournal;
+    };
+
+    class RingOutput : public Output {
+    public:
+	RingOutput(const Setup& s)
+	    : fRing("/daq-bench-" + std::to_string(getpid()), MonitorSettings().Slots, s.Channels.size() * s.RecordLength)
+	{
+	    fRing.SetRunInfo(0, s.RecordLength, s.SamplingTime, s.Channels);
+	}
+	void Write(const EventBatch& batch) override
+	{
+	    fRing.PublishBatch(batch);
+	}
+	uint64_t Close() override { return 0; }
+    private:
+	EventRingWriter fRing;
+    };
+
+    // per-thread filling (negative pulses, as EventPool) and the merge into
+    // HistogramService, nothing on disk
+    class HistogramOutput : public Output {
+    public:
+	HistogramOutput(const Setup& s)
+	    : fSettings(Settings(s)),
+	      fHistograms(s.Channels, fSettings, s.RecordLength, s.SamplingTime, true)
+	{
+	    HistogramService::Clear(kBoard);
+	}
+	void Write(const EventBatch& batch) override
+	{
+	    fHistograms.Fill(batch);
+	}
+	void Checkpoint() override
+	{
+	    HistogramService::Merge(kBoard, fHistograms);
+	}
+	uint64_t Close() override
+	{
+	    Checkpoint();
+	    HistogramService::Clear(kBoard);
+	    return 0;
+	}
+    private:
+	static constexpr int kBoard = 0;
+	static HistogramSettings Settings(const Setup& s)
+	{
+	    HistogramSettings settings;
+	    settings.Enable = true;
+	    settings.CorrelationChannels = s.Channels;
+	    return settings;
+	}
+	HistogramSettings fSettings;
+	RunHistograms fHistograms;
+    };
+
+    RunJournalWriter* OpenJournal(const std::string& path, const Setup& s)
+    {
+	RunJournalInfo info;
+	info.RecordLength = s.RecordLength;
+	info.SamplingTime = s.SamplingTime;
+	info.SamplingRate = s.SamplingRate;
+	info.SaveRaw = s.SaveRaw;
+	info.ChannelList = s.Channels;
+	return new RunJournalWriter(path + ".journal", info);
+    }
+
+    std::string BasePath(const Setup& s, const std::string& format)
+    {
+	return s.Dir + "/daq-bench_" + std::to_string(getpid()) + "_" + format;
+    }
+
+    void Remove(const Setup& s, const std::string& format)
+    {
+	for( const char* ext: { ".h5", ".h5.gz", ".h5.journal", ".bin", ".idx", ".bin.journal" } )
+	    std::filesystem::remove(BasePath(s, format) + ext);
+    }
+
+    // pipeline: HDF5 outputs carry the journal as in DAQ-WC, with the default
+    // [output] Journal and never with SWMR
+    std::unique_ptr<Output> Open(const std::string& format, const Setup& s, bool pipeline)
+    {
+	const std::string path = BasePath(s, format) + (format.compare(0, 3, "bin") == 0 ? ".bin" : ".h5");
+	auto journal = [&]() {
+	    return pipeline && OutputSettings().Journal && format != "hdf5-swmr" ? OpenJournal(path, s) : nullptr;
+	};
+
+	if( format == "hdf5" || format == "hdf5-gzip" )
+	    return std::make_unique<PerEventOutput>(path, format == "hdf5-gzip", s.SaveRaw, journal());
+	if( format == "hdf5-swmr" )
+	    return std::make_unique<AppendableOutput>(path, s, 0, journal());
+	if( format.compare(0, 12, "hdf5-deflate") == 0 )
+	    return std::make_unique<AppendableOutput>(path, s, std::stoi(format.substr(12)), journal());
+	if( format == "bin-direct" )
+	    return std::make_unique<BinOutput>(path, s, "direct", "auto");
+	if( format.compare(0, 4, "bin-") == 0 )
+	    return std::make_unique<BinOutput>(path, s, "buffered", format.substr(4));
+	if( format == "journal" )
+	    return std::make_unique<JournalOutput>(OpenJournal(path, s));
+	if( format == "ring" )
+	    return std::make_unique<RingOutput>(s);
+	if( format == "histograms" )
+	    return std::make_unique<HistogramOutput>(s);
+	throw std::runtime_error("unknown format " + format);
+    }
+
+    struct Result {
+	double Seconds = 0.0;
+	uint64_t OutBytes = 0;
+    };
+
+    // shutdown stage: the [output] keys of DAQ-WC for a format, empty when
+    // DAQ-WC has no such output
+    std::string OutputKeys(const std::string& format)
+    {
+	if( format == "hdf5-gzip" )
+	    return "OutputFormat = \"HDF5\"\n";
+	if( format == "hdf5-swmr" )
+	    return "OutputFormat = \"HDF5\"\nSWMR = true\n";
+	if( format.compare(0, 12, "hdf5-deflate") == 0 )
+	    return "OutputFormat = \"HDF5\"\nCompression = " + format.substr(12) + "\n";
+	if( format == "bin-direct" )
+	    return "OutputFormat = \"BIN\"\nWriteMode = \"direct\"\n";
+	if( format.compare(0, 4, "bin-") == 0 )
+	    return "OutputFormat = \"BIN\"\nWriteEngine = \"" + format.substr(4) + "\"\n";
+	return "";
+    }
+
+    struct Shutdown {
+	double Seconds = 0.0;           ///< SIGINT to exit
+	uint64_t NEvents = 0;           ///< recorded before the stop
+	uint64_t OutBytes = 0;          ///< closed file
+	std::string StopReason;
+    };
+
+    // DAQ-WC replaying run (a BIN file) into format, SIGINT after kLoadS
+    // seconds of running. Throws std::runtime_error when it does not start
+    // or does not exit within killS (it is killed then).
+    Shutdown RunShutdown(const std::string& daq, const std::string& run, const std::string& format,
+			 const Setup& s, const std::string& pages, double timeoutS, double killS)
+    {
+	constexpr double kLoadS = 1.0;
+	constexpr double kStartS = 30.0;
+	const std::string dir = BasePath(s, "shutdown-" + format);
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	const std::string config = dir + "/daq.toml";
+	const std::string registry = dir + "/run.runs.tsv";
+	{
+	    std::ofstream toml(config);
+	    toml << "[digitizer]\nChannelList = [";
+	    for( size_t i = 0; i < s.Channels.size(); i++ )
+		toml << (i ? ", " : "") << s.Channels[i];
+	    toml << "]\nNEvents = 4294967295\n\n"
+		 << "[output]\nOutputDir = \"" << dir << "\"\nOutputFile = \"run\"\nRunCatalog = \"\"\n"
+		 << "SaveRaw = " << (s.SaveRaw ? "true" : "false") << "\n" << OutputKeys(format) << "\n"
+		 << "[control]\nShutdownTimeoutS = " << timeoutS << "\n\n"
+		 << "[memory]\nHugePages = \"" << pages << "\"\n\n"
+		 << "[replay]\nEnable = true\nFiles = [\"" << run << "\"]\nSpeed = 0\nLoop = true\n";
+	}
+
+	const pid_t pid = fork();
+	if( pid < 0 )
+	    throw std::runtime_error("fork failed");
+	if( pid == 0 ) {
+	    const int fd = open((dir + "/daq.log").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	    dup2(fd, 1);
+	    dup2(fd, 2);
+	    execl(daq.c_str(), daq.c_str(), config.c_str(), static_cast<char*>(nullptr));
+	    _exit(127);
+	}
+
+	// running once the registry has the start line of the run
+	auto started = [&]() {
+	    std::ifstream in(registry);
+	    std::string line;
+	    while( std::getline(in, line) )
+		if( line.find("\tstart\t") != std::string::npos )
+		    return true;
+	    return false;
+	};
+	int status = 0;
+	const auto t_launch = std::chrono::steady_clock::now();
+	while( !started() ) {
+	    if( waitpid(pid, &status, WNOHANG) == pid )
+		throw std::runtime_error(daq + " exited before the run started, see " + dir + "/daq.log");
+	    if( std::chrono::steady_clock::now() - t_launch > std::chrono::duration<double>(kStartS) ) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		throw std::runtime_error(daq + " did not start a run, see " + dir + "/daq.log");
+	    }
+	    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	std::this_thread::sleep_for(std::chrono::duration<double>(kLoadS));
+
+	Shutdown result;
+	const auto t0 = std::chrono::steady_clock::now();
+	kill(pid, SIGINT);
+	while( waitpid(pid, &status, WNOHANG) != pid ) {
+	    if( std::chrono::steady_clock::now() - t0 > std::chrono::duration<double>(killS) ) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		throw std::runtime_error(daq + " still running " + std::to_string(killS) + " s after SIGINT");
+	    }
+	    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	// run  status  time  events  config  reason  path
+	std::ifstream in(registry);
+	std::string line;
+	while( std::getline(in, line) ) {
+	    std::vector<std::string> columns;
+	    std::stringstream ss(line);
+	    std::string column;
+	    while( std::getline(ss, column, '\t') )
+		columns.push_back(column);
+	    if( columns.size() < 7 || columns[1] != "stop" )
+		continue;
+	    result.NEvents = std::stoull(columns[3]);
+	    result.StopReason = columns[5];
+	    result.OutBytes = FileSize(columns[6]);
+	}
+	if( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+	    result.StopReason += " (exit status " + std::to_string(status) + ")";
+	std::filesystem::remove_all(dir);
+	return result;
+    }
+
+    // median of repeat runs of f, which returns the bytes written
+    template <typename F>
+    Result Measure(unsigned repeat, F f)
+    {
+	std::vector<Result> results;
+	for( unsigned r = 0; r < repeat; r++ ) {
+	    const auto t0 = std::chrono::steady_clock::now();
+	    const uint64_t bytes = f();
+	    results.push_back({ std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(), bytes });
+	}
+	std::sort(results.begin(), results.end(), [](const Result& a, const Result& b) { return a.Seconds < b.Seconds; });
+	return results[results.size() / 2];
+    }
+
+    // Queue stage adapters: Push() all of items[0..n), Pop() up to n items,
+    // 0 once Close()d and empty.
+    template <typename Q>
+    class SpinningQueue {
+    public:
+	explicit SpinningQueue(size_t capacity) : fQueue(capacity) {}
+	void Push(uint64_t* items, size_t n)
+	{
+	    for( size_t i = 0; i < n; ) {
+		const size_t k = n > 1 ? fQueue.PushBatch(items + i, n - i) : fQueue.TryPush(items[i]) ? 1 : 0;
+		if( k == 0 )
+		    std::this_thread::yield();
+		i += k;
+	    }
+	}
+	size_t Pop(uint64_t* items, size_t n)
+	{
+	    for( ;; ) {
+		const bool closed = fClosed.load(std::memory_order_acquire);
+		const size_t k = fQueue.PopBatch(items, n);
+		if( k > 0 || closed )
+		    return k;
+		std::this_thread::yield();
+	    }
+	}
+	void Close() { fClosed.store(true, std::memory_order_release); }
+    private:
+	Q fQueue;
+	std::atomic<bool> fClosed{false};
+    };
+
+    template <typename Q>
+    class WaitingQueue {
+    public:
+	explicit WaitingQueue(size_t capacity) : fQueue(capacity) {}
+	void Push(uint64_t* items, size_t n)
+	{
+	    if( n == 1 )
+		fQueue.Push(items[0]);
+	    else
+		fQueue.PushBatch(items, n);
+	}
+	size_t Pop(uint64_t* items, size_t n)
+	{
+	    if( n == 1 )
+		return fQueue.Pop(items[0]) ? 1 : 0;
+	    return fQueue.PopBatch(items, n);
+	}
+	void Close() { fQueue.Close(); }
+    private:
+	BlockingQueue<Q> fQueue;
+    };
+
+    // what the pipeline threads use today
+    class MutexQueue {
+    public:
+	explicit MutexQueue(size_t capacity) : fCapacity(capacity) {}
+	void Push(uint64_t* items, size_t n)
+	{
+	    std::unique_lock<std::mutex> lock(fMutex);
+	    for( size_t i = 0; i < n; i++ ) {
+		fNotFull.wait(lock, [this] { return fItems.size() < fCapacity; });
+		fItems.push_back(items[i]);
+		fNotEmpty.notify_one();
+	    }
+	}
+	size_t Pop(uint64_t* items, size_t n)
+	{
+	    std::unique_lock<std::mutex> lock(fMutex);
+	    fNotEmpty.wait(lock, [this] { return !fItems.empty() || fClosed; });
+	    size_t k = 0;
+	    for( ; k < n && !fItems.empty(); k++ ) {
+		items[k] = fItems.front();
+		fItems.pop_front();
+	    }
+	    fNotFull.notify_all();
+	    return k;
+	}
+	void Close()
+	{
+	    std::lock_guard<std::mutex> lock(fMutex);
+	    fClosed = true;
+	    fNotEmpty.notify_all();
+	}
+    private:
+	size_t fCapacity;
+	std::mutex fMutex;
+	std::condition_variable fNotEmpty, fNotFull;
+	std::deque<uint64_t> fItems;
+	bool fClosed = false;
+    };
+
+    // nitems through queue, item = producer << 40 | index; throws if an
+    // item is lost, duplicated or out of its producer's order
+    template <typename Q>
+    void QueueRun(unsigned producers, unsigned consumers, uint64_t nitems, size_t batch)
+    {
+	constexpr size_t kCapacity = 1024;
+	constexpr uint64_t kIndexMask = (uint64_t(1) << 40) - 1;
+	Q queue(kCapacity);
+	std::atomic<uint64_t> sum{0}, count{0};
+	std::atomic<bool> ordered{true};
+	auto share = [&](unsigned p) { return nitems / producers + (p < nitems % producers ? 1 : 0); };
+
+	std::vector<std::thread> senders, receivers;
+	for( unsigned c = 0; c < consumers; c++ )
+	    receivers.emplace_back([&]() {
+		std::vector<uint64_t> items(batch);
+		std::vector<int64_t> last(producers, -1);
+		uint64_t s = 0, n = 0;
+		while( const size_t k = queue.Pop(items.data(), batch) )
+		    for( size_t j = 0; j < k; j++ ) {
+			const uint64_t p = items[j] >> 40;
+			const int64_t i = items[j] & kIndexMask;
+			if( p >= producers || i <= last[p] )
+			    ordered = false;
+			else
+			    last[p] = i;
+			s += items[j];
+			n++;
+		    }
+		sum += s;
+		count += n;
+	    });
+	for( unsigned p = 0; p < producers; p++ )
+	    senders.emplace_back([&, p]() {
+		std::vector<uint64_t> items(batch);
+		const uint64_t n = share(p);
+		for( uint64_t i = 0; i < n; ) {
+		    const size_t k = std::min<uint64_t>(batch, n - i);
+		    for( size_t j = 0; j < k; j++ )
+			items[j] = (uint64_t(p) << 40) | (i + j);
+		    queue.Push(items.data(), k);
+		    i += k;
+		}
+	    });
+	for( auto& t: senders )
+	    t.join();
+	queue.Close();
+	for( auto& t: receivers )
+	    t.join();
+
+	uint64_t expected = 0;
+	for( unsigned p = 0; p < producers; p++ )
+	    expected += (uint64_t(p) << 40) * share(p) + share(p) * (share(p) - 1) / 2;
+	if( !ordered || count != nitems || sum != expected )
+	    throw std::runtime_error("items lost, duplicated or out of order (" + std::to_string(count.load()) +
+				     " of " + std::to_string(nitems) + " received)");
+    }
+
+    struct QueueCase {
+	std::string fName;
+	unsigned fProducers;
+	unsigned fConsumers;
+	void (*fRun)(unsigned, unsigned, uint64_t, size_t);
+	size_t fBatch;
+    };
+
+    std::vector<QueueCase> QueueCases()
+    {
+	std::vector<QueueCase> cases = {
+	    { "spsc", 1, 1, QueueRun<SpinningQueue<SpscQueue<uint64_t>>>, 1 },
+	    { "spsc-batch32", 1, 1, QueueRun<SpinningQueue<SpscQueue<uint64_t>>>, 32 },
+	    { "spsc-blocking", 1, 1, QueueRun<WaitingQueue<SpscQueue<uint64_t>>>, 1 },
+	};
+	for( unsigned n: { 1u, 2u, 4u } ) {
+	    cases.push_back({ "mpmc", n, n, QueueRun<SpinningQueue<MpmcQueue<uint64_t>>>, 1 });
+	    cases.push_back({ "mpmc-blocking", n, n, QueueRun<WaitingQueue<MpmcQueue<uint64_t>>>, 1 });
+	    cases.push_back({ "mpmc-batch32", n, n, QueueRun<WaitingQueue<MpmcQueue<uint64_t>>>, 32 });
+	    cases.push_back({ "mutex", n, n, QueueRun<MutexQueue>, 1 });
+	}
+	return cases;
+    }
+
+    // tasks stage: cost units of about a microsecond
+    uint64_t Burn(uint32_t units)
+    {
+	uint64_t x = units;
+	for( uint32_t i = 0; i < units * 400; i++ )
+	    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+	return x;
+    }
+
+    std::vector<uint32_t> TaskCosts(uint64_t ntasks)
+    {
+	std::mt19937 rng(2);
+	std::uniform_real_distribution<double> u(0.0, 1.0);
+	std::vector<uint32_t> costs(ntasks);
+	for( auto& c: costs )
+	    c = u(rng) < 0.85 ? 1 : 10 + static_cast<uint32_t>(40 * u(rng));
+	return costs;
+    }
+
+    uint64_t RunStealing(TaskPool& pool, const std::vector<uint32_t>& costs)
+    {
+	OrderedTasks<uint64_t> tasks(pool);
+	uint64_t sum = 0, result;
+	for( uint32_t c: costs ) {
+	    tasks.Submit([c]() { return Burn(c); });
+	    while( tasks.Next(result, false) )
+		sum += result;
+	}
+	while( tasks.Next(result, true) )
+	    sum += result;
+	return sum;
+    }
+
+    uint64_t RunStatic(unsigned nthreads, const std::vector<uint32_t>& costs)
+    {
+	std::vector<uint64_t> sums(nthreads, 0);
+	std::vector<std::thread> threads;
+	for( unsigned t = 0; t < nthreads; t++ )
+	    threads.emplace_back([&, t]() {
+		for( size_t i = t; i < costs.size(); i += nthreads )
+		    sums[t] += Burn(costs[i]);
+	    });
+	for( auto& t: threads )
+	    t.join();
+	uint64_t sum = 0;
+	for( uint64_t s: sums )
+	    sum += s;
+	return sum;
+    }
+
+    std::vector<std::string> Split(const std::string& s)
+    {
+	std::vector<std::string> items;
+	std::stringstream ss(s);
+	std::string item;
+	while( std::getline(ss, item, ',') )
+	    if( !item.empty() )
+		items.push_back(item);
+	return items;
+    }
+
+    double SamplingTime(const std::string& rate)
+    {
+	if( rate == "5GHz" ) return 0.2e-9;
+	if( rate == "2.5GHz" ) return 0.4e-9;
+	if( rate == "1GHz" ) return 1.0e-9;
+	throw std::runtime_error("unknown sampling rate " + rate);
+    }
+
+    void Usage()
+    {
+	std::cout << "Usage: daq-bench [--rl 256,1024] [--channels 4,16] [--rates 1GHz,5GHz]" << std::endl
+		  << "                 [--stages convert,write,pipeline] [--formats F,...] [--events N]" << std::endl
+		  << "                 [--repeat N] [--threads N] [--no-raw] [--hugepages off,auto,...]" << std::endl
+		  << "                 [--dir D] [--label L] [--out FILE] [--daq DAQ-WC]" << std::endl
+		  << "Formats:";
+	for( const std::string& f: kFormats )
+	    std::cout << " " << f;
+	std::cout << std::endl;
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<uint32_t> recordlengths = { 256, 1024 };
+    std::vector<uint32_t> nchannels = { 4, 16 };
+    std::vector<std::string> rates = { "1GHz", "5GHz" };
+    std::vector<std::string> stages = { "convert", "write", "pipeline" };
+    std::vector<std::string> formats = kFormats;
+    std::vector<std::string> hugepages = { MemorySettings().HugePages };
+    uint32_t nevents = 1000;
+    unsigned repeat = 3;
+    unsigned threads = 0;
+    bool saveraw = true;
+    std::string dir = ".";
+    std::string label = "-";
+    std::string outpath;
+    std::error_code ec;
+    std::string daq = (std::filesystem::read_symlink("/proc/self/exe", ec).parent_path() / "DAQ-WC").string();
+
+    auto numbers = [](const std::string& s) {
+	std::vector<uint32_t> v;
+	for( const std::string& item: Split(s) )
+	    v.push_back(std::stoul(item));
+	return v;
+    };
+
+    for( int i = 1; i < argc; i++ ) {
+	const std::string opt = argv[i];
+	auto value = [&]() -> std::string {
+	    if( i + 1 >= argc ) {
+		std::cerr << opt << " needs a value" << std::endl;
+		exit(1);
+	    }
+	    return argv[++i];
+	};
+	if( opt == "--rl" )               recordlengths = numbers(value());
+	else if( opt == "--channels" )    nchannels = numbers(value());
+	else if( opt == "--rates" )       rates = Split(value());
+	else if( opt == "--stages" )      stages = Split(value());
+	else if( opt == "--formats" )     formats = Split(value());
+	else if( opt == "--events" )      nevents = std::stoul(value());
+	else if( opt == "--repeat" )      repeat = std::max(1, std::stoi(value()));
+	else if( opt == "--threads" )     threads = std::stoul(value());
+	else if( opt == "--no-raw" )      saveraw = false;
+	else if( opt == "--hugepages" )   hugepages = Split(value());
+	else if( opt == "--dir" )         dir = value();
+	else if( opt == "--label" )       label = value();
+	else if( opt == "--out" )         outpath = value();
+	else if( opt == "--daq" )         daq = value();
+	else {
+	    Usage();
+	    return opt == "-h" || opt == "--help" ? 0 : 1;
+	}
+    }
+
+    // results go to stdout or are appended to --out, the header only once
+    std::ofstream outfile;
+    bool header = true;
+    if( !outpath.empty() ) {
+	header = FileSize(outpath) == 0;
+	outfile.open(outpath, std::ios::app);
+	if( !outfile ) {
+	    std::cerr << "Cannot open " << outpath << std::endl;
+	    return 1;
+	}
+    }
+    std::ostream& out = outfile.is_open() ? outfile : std::cout;
+    if( header )
+	out << "# label\tstage\tformat\trecordlength\tchannels\tsamplingrate\traw\tevents\tseconds\tkHz\tMBps\toutbytes\tratio\tpages" << std::endl;
+
+    H5::Exception::dontPrint();
+    const uint32_t checkpoint = OutputSettings().CheckpointEvents;
+    int failures = 0;
+
+    // the queue stage does not depend on the event shape: once
+    auto queue = std::find(stages.begin(), stages.end(), "queue");
+    if( queue != stages.end() ) {
+	stages.erase(queue);
+	const uint64_t nitems = uint64_t(nevents) * 1000;
+	for( const QueueCase& q: QueueCases() ) {
+	    const std::string format = q.fName + "-" + std::to_string(q.fProducers) + "x" + std::to_string(q.fConsumers);
+	    try {
+		const Result r = Measure(repeat, [&]() -> uint64_t {
+		    q.fRun(q.fProducers, q.fConsumers, nitems, q.fBatch);
+		    return 0;
+		});
+		out << label << "\tqueue\t" << format << "\t-\t-\t-\t-\t" << nitems << "\t" << std::fixed
+		    << std::setprecision(6) << r.Seconds << std::setprecision(3) << "\t" << nitems / r.Seconds / 1e3
+		    << "\t" << nitems * sizeof(uint64_t) / r.Seconds / 1e6 << "\t0\t0.000\t-" << std::endl;
+	    } catch( const std::exception& e ) {
+		std::cerr << "queue " << format << ": " << e.what() << std::endl;
+		failures++;
+	    }
+	}
+	if( stages.empty() )
+	    return failures ? 2 : 0;
+    }
+
+    auto tasks = std::find(stages.begin(), stages.end(), "tasks");
+    if( tasks != stages.end() ) {
+	stages.erase(tasks);
+	const std::vector<uint32_t> costs = TaskCosts(uint64_t(nevents) * 10);
+	uint64_t expected = 0;
+	for( uint32_t c: costs )
+	    expected += Burn(c);
+	const unsigned ncores = std::max(1u, std::thread::hardware_concurrency());
+	auto line = [&](const std::string& format, const Result& r) {
+	    out << label << "\ttasks\t" << format << "\t-\t-\t-\t-\t" << costs.size() << "\t" << std::fixed
+		<< std::setprecision(6) << r.Seconds << std::setprecision(3) << "\t" << costs.size() / r.Seconds / 1e3
+		<< "\t0.000\t0\t0.000\t-" << std::endl;
+	};
+	for( unsigned n = 1; ; n = std::min(2 * n, ncores) ) {
+	    const std::string threads = std::to_string(n) + "w";
+	    std::unique_ptr<TaskPool> pool(new TaskPool(n));
+	    line("steal-" + threads, Measure(repeat, [&]() -> uint64_t {
+		if( RunStealing(*pool, costs) != expected )
+		    failures++;
+		return 0;
+	    }));
+	    out << "# steal-" << threads << ": " << pool->Summary() << std::endl;
+	    pool.reset();
+	    line("static-" + threads, Measure(repeat, [&]() -> uint64_t {
+		if( RunStatic(n, costs) != expected )
+		    failures++;
+		return 0;
+	    }));
+	    if( n == ncores )
+		break;
+	}
+	if( stages.empty() )
+	    return failures ? 2 : 0;
+    }
+
+    for( const std::string& pages: hugepages )
+    for( const std::string& rate: rates )
+    for( uint32_t rl: recordlengths )
+    for( uint32_t nch: nchannels ) {
+	Setup s;
+	try {
+	    BufferPool::Configure(pages);
+	    s.SamplingTime = SamplingTime(rate);
+	} catch( const std::exception& e ) {
+	    std::cerr << e.what() << std::endl;
+	    return 1;
+	}
+	if( rl < X742Event::kMinSamples || rl > X742Event::kMaxSamples || nch == 0 || nch > 4 * MAX_X742_GROUP_SIZE ) {
+	    std::cerr << "Skipping " << nch << " channels x " << rl << " samples: out of range" << std::endl;
+	    continue;
+	}
+	s.RecordLength = rl;
+	for( uint32_t ch = 0; ch < nch; ch++ )
+	    s.Channels.push_back(ch);
+	s.SamplingRate = rate;
+	s.SaveRaw = saveraw;
+	s.Threads = threads;
+	s.Dir = dir;
+
+	EventPool pool(s);
+	// the kernel DAQ-WC picks for this shape
+	const X742Event::ConvertKernel kernel = X742Event::SelectConvert(rl, nch);
+	// events n .. n+count-1 into batch, from the synthetic events
+	auto convert = [&](EventBatch& batch, uint32_t n, uint32_t count, X742Event::ConvertKernel k = nullptr) {
+	    if( k == nullptr )
+		k = kernel;
+	    batch.Clear();
+	    for( uint32_t j = 0; j < count; j++ ) {
+		const uint32_t e = batch.Append(n + j, ((n + j) * kTTTPerEvent) & TimeAlignment::kTTTMask);
+		k(pool.fEvents[(n + j) % kPoolEvents], s.Channels, pool.fBaselines, batch, e);
+	    }
+	};
+	// the write stage cycles through converted batches: whole ones, and
+	// the last, shorter one when kBatchEvents does not divide nevents
+	EventBatch converted(kBatchEvents, nch, rl, s.SaveRaw);
+	EventBatch tail(kBatchEvents, nch, rl, s.SaveRaw);
+	convert(converted, 0, kBatchEvents);
+	convert(tail, 0, nevents % kBatchEvents ? nevents % kBatchEvents : kBatchEvents);
+	const double samplebytes = double(nevents) * nch * rl * (saveraw ? 4 : 2);
+
+	auto report = [&](const std::string& stage, const std::string& format, const Result& r) {
+	    out << label << "\t" << stage << "\t" << format << "\t" << rl << "\t" << nch << "\t" << rate << "\t"
+		<< (saveraw ? 1 : 0) << "\t" << nevents << "\t" << std::fixed << std::setprecision(6) << r.Seconds
+		<< std::setprecision(3) << "\t" << nevents / r.Seconds / 1e3 << "\t" << samplebytes / r.Seconds / 1e6
+		<< "\t" << r.OutBytes << "\t" << (r.OutBytes ? samplebytes / r.OutBytes : 0.0) << "\t" << pages << std::endl;
+	};
+
+	for( const std::string& stage: stages ) {
+	    if( stage == "convert" ) {
+		EventBatch batch(kBatchEvents, nch, rl, s.SaveRaw);
+		report(stage, "-", Measure(repeat, [&]() -> uint64_t {
+		    for( uint32_t n = 0; n < nevents; n += kBatchEvents )
+			convert(batch, n, std::min(kBatchEvents, nevents - n));
+		    return 0;
+		}));
+		// a shape with a compiled kernel: the generic loop for reference
+		if( kernel != X742Event::Convert )
+		    report(stage, "generic", Measure(repeat, [&]() -> uint64_t {
+			for( uint32_t n = 0; n < nevents; n += kBatchEvents )
+			    convert(batch, n, std::min(kBatchEvents, nevents - n), X742Event::Convert);
+			return 0;
+		    }));
+		continue;
+	    }
+	    if( stage == "shutdown" ) {
+		const double timeoutS = ControlSettings().ShutdownTimeoutS;
+		const std::string run = BasePath(s, "replay") + ".bin";
+		for( const std::string& format: formats ) {
+		    if( OutputKeys(format).empty() )
+			continue;
+		    try {
+			if( FileSize(run) == 0 ) {
+			    BinOutput recorded(run, s, "buffered", "auto");
+			    EventBatch batch(kBatchEvents, nch, rl, s.SaveRaw);
+			    for( uint32_t n = 0; n < nevents; n += kBatchEvents ) {
+				convert(batch, n, std::min(kBatchEvents, nevents - n));
+				recorded.Write(batch);
+			    }
+			    recorded.Close();
+			}
+			const bool bounded = format != "hdf5-gzip";
+			const Shutdown r = RunShutdown(daq, run, format, s, pages, timeoutS, bounded ? 2 * timeoutS : 600.0);
+			out << label << "\tshutdown\t" << format << "\t" << rl << "\t" << nch << "\t" << rate << "\t"
+			    << (saveraw ? 1 : 0) << "\t" << r.NEvents << "\t" << std::fixed << std::setprecision(6) << r.Seconds
+			    << std::setprecision(3) << "\t0.000\t0.000\t" << r.OutBytes << "\t0.000\t" << pages << std::endl;
+			if( r.StopReason != "Stopped" || (bounded && r.Seconds > timeoutS) || r.OutBytes == 0 ) {
+			    std::cerr << "shutdown " << format << " (" << nch << " x " << rl << ", " << rate << "): stop reason \""
+				      << r.StopReason << "\", " << r.Seconds << " s after SIGINT (ShutdownTimeoutS " << timeoutS
+				      << "), " << r.OutBytes << " bytes" << std::endl;
+			    failures++;
+			}
+		    } catch( const std::exception& e ) {
+			std::cerr << "shutdown " << format << " (" << nch << " x " << rl << ", " << rate << "): " << e.what() << std::endl;
+			failures++;
+		    }
+		}
+		std::filesystem::remove(run);
+		std::filesystem::remove(RunBinary::IndexPath(run));
+		continue;
+	    }
+	    if( stage != "write" && stage != "pipeline" ) {
+		std::cerr << "Unknown stage " << stage << std::endl;
+		return 1;
+	    }
+	    const bool pipeline = stage == "pipeline";
+
+	    for( const std::string& format: formats ) {
+		try {
+		    EventBatch batch(kBatchEvents, nch, rl, s.SaveRaw);
+		    report(stage, format, Measure(repeat, [&]() -> uint64_t {
+			std::unique_ptr<Output> output = Open(format, s, pipeline);
+			for( uint32_t n = 0; n < nevents; n += kBatchEvents ) {
+			    const uint32_t count = std::min(kBatchEvents, nevents - n);
+			    EventBatch* b = &batch;
+			    if( pipeline )
+				convert(batch, n, count);
+			    else {
+				b = count < kBatchEvents ? &tail : &converted;
+				for( uint32_t e = 0; e < count; e++ ) {
+				    b->SetEventNumber(e, n + e);
+				    b->SetTriggerTimeTag(e, ((n + e) * kTTTPerEvent) & TimeAlignment::kTTTMask);
+				}
+			    }
+			    output->Write(*b);
+			    // as Digitizer: checked once per readout block
+			    if( (pipeline || format == "journal") && checkpoint > 0 && (n + count) / checkpoint > n / checkpoint )
+				output->Checkpoint();
+			}
+			const uint64_t bytes = output->Close();
+			output.reset();
+			Remove(s, format);
+			return bytes;
+		    }));
+		} catch( const std::exception& e ) {
+		    std::cerr << stage << " " << format << " (" << nch << " x " << rl << ", " << rate << "): " << e.what() << std::endl;
+		    Remove(s, format);
+		    failures++;
+		} catch( const H5::Exception& e ) {
+		    std::cerr << stage << " " << format << " (" << nch << " x " << rl << ", " << rate << "): " << e.getDetailMsg() << std::endl;
+		    Remove(s, format);
+		    failures++;
+		}
+	    }
+	}
+    }
+    return failures ? 2 : 0;
+}
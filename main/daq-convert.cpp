@@ -0,0 +1,255 @@
+// daq-convert: convert runs between the HDF5 and the flat BIN format.
+//
+//   daq-convert run.bin [run.h5]     BIN  -> HDF5 (per-event layout, as DAQ-WC writes it)
+//   daq-convert run.h5  [run.bin]    HDF5 -> BIN  (per-event or SWMR layout)
+//
+// Compressed runs (.h5.gz) must be gunzipped first.
+//
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <H5Cpp.h>
+
+#include "RunBinary.h"
+#include "RunBinaryWriter.h"
+
+namespace {
+
+    bool EndsWith(const std::string& s, const std::string& suffix)
+    {
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    std::string ReplaceExtension(const std::string& path, const std::string& from, const std::string& to)
+    {
+	return (EndsWith(path, from) ? path.substr(0, path.size() - from.size()) : path) + to;
+    }
+
+    template <typename T>
+    void WriteAttribute(H5::Group& group, const std::string& name, const H5::PredType& type, const T& value)
+    {
+	group.createAttribute(name, type, H5::DataSpace()).write(type, &value);
+    }
+
+    void WriteAttribute(H5::Group& group, const std::string& name, const std::string& value)
+    {
+	H5::StrType type(0, H5T_VARIABLE);
+	group.createAttribute(name, type, H5::DataSpace()).write(type, value);
+    }
+
+    template <typename T>
+    T ReadAttribute(const H5::Group& group, const std::string& name, const H5::PredType& type, T defvalue)
+    {
+	if( !group.attrExists(name) )
+	    return defvalue;
+	T value;
+	group.openAttribute(name).read(type, &value);
+	return value;
+    }
+
+    std::string ReadAttribute(const H5::Group& group, const std::string& name)
+    {
+	std::string value;
+	if( group.attrExists(name) ) {
+	    H5::Attribute attr = group.openAttribute(name);
+	    attr.read(attr.getStrType(), value);
+	}
+	return value;
+    }
+
+    template <typename T>
+    std::vector<T> ReadDataSet(const H5::DataSet& dataset, const H5::PredType& type, hsize_t start = 0, hsize_t count = 0)
+    {
+	H5::DataSpace filespace = dataset.getSpace();
+	hsize_t size = 0;
+	filespace.getSimpleExtentDims(&size);
+	if( count == 0 )
+	    count = size - start;
+	std::vector<T> data(count);
+	if( count == 0 )
+	    return data;
+	filespace.selectHyperslab(H5S_SELECT_SET, &count, &start);
+	H5::DataSpace memspace(1, &count);
+	dataset.read(data.data(), type, memspace, filespace);
+	return data;
+    }
+
+    uint64_t BinToHDF5(const std::string& input, const std::string& output)
+    {
+	RunBinary::Reader run(input);
+	const RunBinary::FileHeader& h = run.GetHeader();
+
+	H5::H5File file(output, H5F_ACC_EXCL);
+	H5::Group events = file.createGroup("/events");
+	H5::Group raw = file.createGroup("/events_raw");
+	H5::Group config = file.createGroup("/config");
+
+	WriteAttribute(config, "RunNumber", H5::PredType::NATIVE_INT, h.fRunNumber);
+	WriteAttribute(config, "RecordLength", H5::PredType::NATIVE_UINT, h.fNSamples);
+	WriteAttribute(config, "PostTriggerSize", H5::PredType::NATIVE_UINT, h.fPostTriggerSize);
+	WriteAttribute(config, "SamplingTime", H5::PredType::NATIVE_DOUBLE, h.fSamplingTime);
+	WriteAttribute(config, "SamplingRate", std::string(h.fSamplingRate, strnlen(h.fSamplingRate, sizeof(h.fSamplingRate))));
+	WriteAttribute(config, "OutputFormat", std::string("HDF5"));
+	WriteAttribute(config, "TriggerMode", std::string(h.fTriggerMode, strnlen(h.fTriggerMode, sizeof(h.fTriggerMode))));
+	hsize_t nch = h.fNChannels;
+	config.createAttribute("ChannelList", H5::PredType::NATIVE_UINT, H5::DataSpace(1, &nch))
+	    .write(H5::PredType::NATIVE_UINT, h.fChannelList);
+	const uint32_t nevents = static_cast<uint32_t>(run.GetNEvents());
+	WriteAttribute(config, "NEventsRecorded", H5::PredType::NATIVE_UINT, nevents);
+	WriteAttribute(config, "AcquisitionTime", H5::PredType::NATIVE_DOUBLE, h.fAcquisitionTime);
+	WriteAttribute(config, "TriggerRate_kHz", H5::PredType::NATIVE_DOUBLE, h.fTriggerRate_kHz);
+	WriteAttribute(config, "StopReason", std::string(h.fStopReason, strnlen(h.fStopReason, sizeof(h.fStopReason))));
+
+	// the per-event layout stores the channels present, concatenated
+	std::vector<int16_t> corr;
+	std::vector<uint16_t> rawsamples;
+	for( uint64_t i = 0; i < run.GetNEvents(); i++ ) {
+	    const RunBinary::RecordHeader& rec = run.Record(i);
+	    corr.clear();
+	    rawsamples.clear();
+	    for( uint32_t slot = 0; slot < h.fNChannels; slot++ ) {
+		if( !(rec.fChannelMask & (1u << h.fChannelList[slot])) )
+		    continue;
+		const int16_t* wf = run.Samples(i, slot);
+		corr.insert(corr.end(), wf, wf + rec.fNSamples);
+		if( h.fHasRaw ) {
+		    const uint16_t* rwf = run.RawSamples(i, slot);
+		    rawsamples.insert(rawsamples.end(), rwf, rwf + rec.fNSamples);
+		}
+	    }
+	    const std::string name = "event" + std::to_string(rec.fEventNumber);
+	    hsize_t dim = corr.size();
+	    events.createDataSet(name, H5::PredType::NATIVE_INT16, H5::DataSpace(1, &dim))
+		.write(corr.data(), H5::PredType::NATIVE_INT16);
+	    if( h.fHasRaw ) {
+		hsize_t rawdim = rawsamples.size();
+		raw.createDataSet(name, H5::PredType::NATIVE_UINT16, H5::DataSpace(1, &rawdim))
+		    .write(rawsamples.data(), H5::PredType::NATIVE_UINT16);
+	    }
+	}
+	return run.GetNEvents();
+    }
+
+    uint64_t HDF5ToBin(const std::string& input, const std::string& output)
+    {
+	H5::H5File file(input, H5F_ACC_RDONLY);
+	H5::Group config = file.openGroup("/config");
+
+	RunBinary::FileHeader h = {};
+	h.fRunNumber = ReadAttribute<int>(config, "RunNumber", H5::PredType::NATIVE_INT, 0);
+	h.fNSamples = ReadAttribute<uint32_t>(config, "RecordLength", H5::PredType::NATIVE_UINT, 1024);
+	h.fPostTriggerSize = ReadAttribute<uint32_t>(config, "PostTriggerSize", H5::PredType::NATIVE_UINT, 0);
+	h.fSamplingTime = ReadAttribute<double>(config, "SamplingTime", H5::PredType::NATIVE_DOUBLE, 0.0);
+	h.fAcquisitionTime = ReadAttribute<double>(config, "AcquisitionTime", H5::PredType::NATIVE_DOUBLE, 0.0);
+	h.fTriggerRate_kHz = ReadAttribute<double>(config, "TriggerRate_kHz", H5::PredType::NATIVE_DOUBLE, 0.0);
+	std::strncpy(h.fSamplingRate, ReadAttribute(config, "SamplingRate").c_str(), sizeof(h.fSamplingRate) - 1);
+	std::strncpy(h.fTriggerMode, ReadAttribute(config, "TriggerMode").c_str(), sizeof(h.fTriggerMode) - 1);
+
+	std::vector<uint32_t> channels;
+	if( config.attrExists("ChannelList") ) {
+	    H5::Attribute attr = config.openAttribute("ChannelList");
+	    hsize_t n = 0;
+	    attr.getSpace().getSimpleExtentDims(&n);
+	    channels.resize(n);
+	    attr.read(H5::PredType::NATIVE_UINT, channels.data());
+	}
+	if( channels.empty() || channels.size() > RunBinary::kMaxChannels )
+	    throw std::runtime_error(input + ": missing or invalid /config ChannelList");
+	h.fNChannels = static_cast<uint32_t>(channels.size());
+	std::copy(channels.begin(), channels.end(), h.fChannelList);
+
+	const bool swmr = H5Lexists(file.getId(), "/events/samples", H5P_DEFAULT) > 0;
+	h.fHasRaw = swmr ? H5Lexists(file.getId(), "/events_raw/samples", H5P_DEFAULT) > 0
+			 : H5Lexists(file.getId(), "/events_raw/event0", H5P_DEFAULT) > 0;
+
+	RunBinaryWriter writer(output, h);
+	const std::string stopreason = ReadAttribute(config, "StopReason");
+	writer.SetRunStatistics(h.fAcquisitionTime, h.fTriggerRate_kHz, stopreason);
+
+	if( swmr ) {
+	    H5::DataSet samples = file.openDataSet("/events/samples");
+	    std::vector<uint64_t> offset = ReadDataSet<uint64_t>(file.openDataSet("/events/offset"), H5::PredType::NATIVE_UINT64);
+	    std::vector<uint32_t> ttt = ReadDataSet<uint32_t>(file.openDataSet("/events/ttt"), H5::PredType::NATIVE_UINT32);
+	    std::vector<uint32_t> mask = ReadDataSet<uint32_t>(file.openDataSet("/events/channelmask"), H5::PredType::NATIVE_UINT32);
+	    std::unique_ptr<H5::DataSet> raw;
+	    if( h.fHasRaw )
+		raw.reset(new H5::DataSet(file.openDataSet("/events_raw/samples")));
+	    hsize_t total = 0;
+	    samples.getSpace().getSimpleExtentDims(&total);
+	    const size_t nevents = std::min({ offset.size(), ttt.size(), mask.size() });
+	    for( size_t i = 0; i < nevents; i++ ) {
+		const hsize_t end = i + 1 < offset.size() ? offset[i+1] : total;
+		const uint32_t npresent = __builtin_popcount(mask[i]);
+		std::vector<int16_t> corr = ReadDataSet<int16_t>(samples, H5::PredType::NATIVE_INT16, offset[i], end - offset[i]);
+		std::vector<uint16_t> rawsamples;
+		if( raw )
+		    rawsamples = ReadDataSet<uint16_t>(*raw, H5::PredType::NATIVE_UINT16, offset[i], end - offset[i]);
+		const uint32_t nsamples = npresent ? static_cast<uint32_t>(corr.size() / npresent) : 0;
+		writer.WriteEvent(i, ttt[i], mask[i], nsamples, corr.data(), raw ? rawsamples.data() : nullptr);
+	    }
+	} else {
+	    // per-event layout: no channel mask nor trigger time tag stored,
+	    // the channels present are assumed to be the first of ChannelList
+	    for( uint64_t i = 0; ; i++ ) {
+		const std::string name = "/events/event" + std::to_string(i);
+		if( H5Lexists(file.getId(), name.c_str(), H5P_DEFAULT) <= 0 )
+		    break;
+		std::vector<int16_t> corr = ReadDataSet<int16_t>(file.openDataSet(name), H5::PredType::NATIVE_INT16);
+		std::vector<uint16_t> rawsamples;
+		const std::string rawname = "/events_raw/event" + std::to_string(i);
+		if( h.fHasRaw && H5Lexists(file.getId(), rawname.c_str(), H5P_DEFAULT) > 0 )
+		    rawsamples = ReadDataSet<uint16_t>(file.openDataSet(rawname), H5::PredType::NATIVE_UINT16);
+		const uint32_t npresent = std::min<uint32_t>(h.fNChannels, static_cast<uint32_t>(corr.size() / h.fNSamples));
+		uint32_t mask = 0;
+		for( uint32_t k = 0; k < npresent; k++ )
+		    mask |= 1u << channels[k];
+		writer.WriteEvent(i, 0, mask, h.fNSamples, corr.data(),
+				  rawsamples.size() == corr.size() ? rawsamples.data() : nullptr);
+	    }
+	}
+
+	if( !writer.Close() )
+	    throw std::runtime_error("write error on " + output);
+	return writer.GetNEvents();
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    if( argc < 2 || argc > 3 ) {
+	std::cout << "Usage: daq-convert run.bin [run.h5]" << std::endl;
+	std::cout << "       daq-convert run.h5 [run.bin]" << std::endl;
+	return 1;
+    }
+    const std::string input = argv[1];
+
+    try {
+	uint64_t nevents = 0;
+	std::string output;
+	if( EndsWith(input, ".bin") ) {
+	    output = argc == 3 ? argv[2] : ReplaceExtension(input, ".bin", ".h5");
+	    nevents = BinToHDF5(input, output);
+	} else if( EndsWith(input, ".h5") ) {
+	    output = argc == 3 ? argv[2] : ReplaceExtension(input, ".h5", ".bin");
+	    nevents = HDF5ToBin(input, output);
+	} else if( EndsWith(input, ".gz") ) {
+	    std::cerr << "Uncompress the run first: gunzip -k " << input << std::endl;
+	    return 1;
+	} else {
+	    std::cerr << "Unknown input format: " << input << " (expected .bin or .h5)" << std::endl;
+	    return 1;
+	}
+	std::cout << "Converted " << nevents << " events: " << input << " -> " << output << std::endl;
+    } catch( const H5::Exception& e ) {
+	std::cerr << "HDF5 error: " << e.getDetailMsg() << std::endl;
+	return 1;
+    } catch( const std::exception& e ) {
+	std::cerr << "Error: " << e.what() << std::endl;
+	return 1;
+    }
+    return 0;
+}
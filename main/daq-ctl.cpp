@@ -0,0 +1,60 @@
+// daq-ctl: command-line client of the DAQ-WC run-control socket.
+//
+//   daq-ctl [--socket /tmp/daq-wc.sock] <command> [argument]
+//
+// Commands: start, stop, pause, resume, status, reconfigure <file>, dump <N>,
+//           histograms [<board> <channel> amplitude|integral|time], quit
+//
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int main(int argc, char** argv)
+{
+    std::string path = "/tmp/daq-wc.sock";
+    std::string command;
+
+    for( int i = 1; i < argc; i++ ) {
+	std::string arg = argv[i];
+	if( arg == "--socket" && i+1 < argc )
+	    path = argv[++i];
+	else
+	    command += (command.empty() ? "" : " ") + arg;
+    }
+    if( command.empty() ) {
+	std::cout << "Usage: daq-ctl [--socket path] start|stop|pause|resume|status|reconfigure <file>|dump <N>|histograms [<board> <channel> <spectrum>]|quit" << std::endl;
+	return 1;
+    }
+
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if( fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ) {
+	std::cerr << "Cannot connect to " << path << ": " << std::strerror(errno) << std::endl;
+	return 1;
+    }
+
+    command += "\n";
+    if( write(fd, command.data(), command.size()) != static_cast<ssize_t>(command.size()) ) {
+	std::cerr << "Cannot send command: " << std::strerror(errno) << std::endl;
+	close(fd);
+	return 1;
+    }
+
+    std::string reply;
+    char buf[256];
+    ssize_t n;
+    while( (n = read(fd, buf, sizeof(buf))) > 0 )
+	reply.append(buf, n);
+    close(fd);
+
+    std::cout << reply << std::flush;
+    return reply.compare(0, 5, "ERROR") == 0 ? 1 : 0;
+}
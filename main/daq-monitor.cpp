@@ -0,0 +1,172 @@
+// daq-monitor: sample consumer of the shared-memory event ring.
+// Attaches to the ring published by DAQ-WC ([monitor] Enable = true) and
+// prints per-channel amplitude spectra every few seconds. It never slows
+// down the DAQ: if it cannot keep up it skips events.
+//
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+
+#include "EventRing.h"
+#include "ThreadPlacement.h"
+
+namespace {
+
+    volatile std::sig_atomic_t gStop = 0;
+
+    void HandleSignal(int)
+    {
+	gStop = 1;
+    }
+
+    struct Spectrum {
+	std::vector<uint64_t> fBins;
+	uint64_t fEntries = 0;
+	uint64_t fOverflow = 0;
+	double fSum = 0;
+    };
+
+    void Usage()
+    {
+	std::cout << "Usage: daq-monitor [--name /daq-wc-events] [--interval s] [--bins n] [--max adc] [--latest] [--cpus list]" << std::endl;
+	std::cout << "  --latest   sample only the newest event at each poll instead of every event" << std::endl;
+	std::cout << "  --cpus     run on these CPUs only, e.g. 0,1 or 0-3 (away from the DAQ threads)" << std::endl;
+    }
+
+    void Print(const std::map<uint32_t, Spectrum>& spectra, double maxamp, uint64_t nevents, uint64_t lost)
+    {
+	std::cout << "\n=== " << nevents << " events sampled, " << lost << " skipped ===" << std::endl;
+	for( auto& [ch, sp]: spectra ) {
+	    const double mean = sp.fEntries ? sp.fSum / sp.fEntries : 0.0;
+	    std::cout << "ch" << ch << "  entries " << sp.fEntries << "  mean " << std::fixed
+		      << std::setprecision(1) << mean << "  overflow " << sp.fOverflow << std::endl;
+	    uint64_t peak = 1;
+	    for( auto n: sp.fBins )
+		peak = std::max(peak, n);
+	    const double width = maxamp / sp.fBins.size();
+	    for( size_t b = 0; b < sp.fBins.size(); b++ ) {
+		if( sp.fBins[b] == 0 )
+		    continue;
+		const int bar = static_cast<int>(50.0 * sp.fBins[b] / peak);
+		std::cout << "  [" << std::setw(7) << std::setprecision(0) << b*width << ", "
+			  << std::setw(7) << (b+1)*width << ") " << std::string(std::max(bar, 1), '#')
+			  << " " << sp.fBins[b] << std::endl;
+	    }
+	}
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string name = "/daq-wc-events";
+    double interval = 2.0;
+    size_t nbins = 40;
+    double maxamp = 4096.0;
+    bool latest = false;
+
+    for( int i = 1; i < argc; i++ ) {
+	std::string arg = argv[i];
+	if( arg == "--name" && i+1 < argc )
+	    name = argv[++i];
+	else if( arg == "--interval" && i+1 < argc )
+	    interval = std::atof(argv[++i]);
+	else if( arg == "--bins" && i+1 < argc )
+	    nbins = std::max(1, std::atoi(argv[++i]));
+	else if( arg == "--max" && i+1 < argc )
+	    maxamp = std::atof(argv[++i]);
+	else if( arg == "--latest" )
+	    latest = true;
+	else if( arg == "--cpus" && i+1 < argc ) {
+	    cpu_set_t set;
+	    CPU_ZERO(&set);
+	    for( int cpu: ThreadPlacement::ParseCPUList(argv[++i]) )
+		if( cpu >= 0 && cpu < CPU_SETSIZE )
+		    CPU_SET(cpu, &set);
+	    if( sched_setaffinity(0, sizeof(set), &set) != 0 )
+		std::cerr << "Cannot set CPU affinity: " << std::strerror(errno) << std::endl;
+	}
+	else {
+	    Usage();
+	    return 1;
+	}
+    }
+
+    std::signal(SIGINT, HandleSignal);
+    std::signal(SIGTERM, HandleSignal);
+
+    std::unique_ptr<EventRingReader> ring(new EventRingReader(name));
+    while( !ring->IsAttached() && !gStop ) {
+	std::cout << "\rWaiting for event ring " << name << " ..." << std::flush;
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+	ring.reset(new EventRingReader(name));
+    }
+    if( gStop )
+	return 0;
+    EventRingReader& reader = *ring;
+
+    const EventRingLayout::Header* header = reader.GetHeader();
+    std::cout << "\nAttached to " << name << ": run " << header->fRunNumber << ", "
+	      << header->fNSlots << " slots, " << header->fNChannels << " channels" << std::endl;
+
+    std::map<uint32_t, Spectrum> spectra;
+    RingEvent event;
+    uint64_t nevents = 0;
+    auto lastPrint = std::chrono::steady_clock::now();
+
+    while( !gStop ) {
+	const bool got = latest ? reader.ReadLatest(event) : reader.ReadNext(event);
+	if( !got ) {
+	    if( !reader.WriterOpen() )
+		break;
+	    std::this_thread::sleep_for(std::chrono::milliseconds(latest ? 50 : 2));
+	} else {
+	    nevents++;
+	    // the payload holds the ChannelList entries present in the mask, in list order
+	    uint32_t slot = 0;
+	    for( uint32_t i = 0; i < header->fNChannels && slot < event.fNChannels; i++ ) {
+		const uint32_t ch = header->fChannelList[i];
+		if( !(event.fChannelMask & (1u << ch)) )
+		    continue;
+		const int16_t* wf = event.Channel(slot++);
+		int amp = 0;
+		for( uint32_t s = 0; s < event.fNSamples; s++ )
+		    amp = std::max(amp, std::abs(static_cast<int>(wf[s])));
+
+		Spectrum& sp = spectra[ch];
+		if( sp.fBins.empty() )
+		    sp.fBins.resize(nbins, 0);
+		sp.fEntries++;
+		sp.fSum += amp;
+		const size_t bin = static_cast<size_t>(amp / maxamp * nbins);
+		if( bin < nbins )
+		    sp.fBins[bin]++;
+		else
+		    sp.fOverflow++;
+	    }
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if( std::chrono::duration<double>(now - lastPrint).count() >= interval ) {
+	    Print(spectra, maxamp, nevents, reader.GetLost());
+	    lastPrint = now;
+	}
+    }
+
+    Print(spectra, maxamp, nevents, reader.GetLost());
+    if( !reader.WriterOpen() )
+	std::cout << "DAQ closed the event ring." << std::endl;
+    return 0;
+}
@@ -0,0 +1,107 @@
+// daq-recover: rebuild the HDF5 file of a run that did not close cleanly.
+//
+//   daq-recover <run>.h5.journal [output.h5]
+//
+// Every intact checkpoint chunk of the journal is written to a new file with
+// the same layout DAQ-WC produces (/events, /events_raw, /config); a chunk
+// torn by the crash is reported and dropped. The partial .h5 is left alone.
+//
+#include <iostream>
+#include <string>
+#include <vector>
+#include <H5Cpp.h>
+
+#include "RunJournal.h"
+
+namespace {
+
+    std::string DefaultOutput(std::string path)
+    {
+	const std::string suffix = ".journal";
+	if( path.size() > suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0 )
+	    path.erase(path.size() - suffix.size());
+	if( path.size() > 3 && path.compare(path.size() - 3, 3, ".h5") == 0 )
+	    path.erase(path.size() - 3);
+	return path + ".recovered.h5";
+    }
+
+    template <typename T>
+    void WriteAttribute(H5::Group& group, const std::string& name, const H5::PredType& type, const T& value)
+    {
+	group.createAttribute(name, type, H5::DataSpace()).write(type, &value);
+    }
+
+    void WriteAttribute(H5::Group& group, const std::string& name, const std::string& value)
+    {
+	H5::StrType type(0, H5T_VARIABLE);
+	group.createAttribute(name, type, H5::DataSpace()).write(type, value);
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    if( argc < 2 || argc > 3 ) {
+	std::cout << "Usage: daq-recover <run>.h5.journal [output.h5]" << std::endl;
+	return 1;
+    }
+    const std::string input = argv[1];
+    const std::string output = argc == 3 ? argv[2] : DefaultOutput(input);
+
+    try {
+	RunJournalReader journal(input);
+	const RunJournalInfo& info = journal.GetInfo();
+	std::cout << "Run " << info.RunNumber << ": recovering into " << output << std::endl;
+
+	H5::H5File file(output, H5F_ACC_EXCL);
+	H5::Group events = file.createGroup("/events");
+	H5::Group raw = file.createGroup("/events_raw");
+	H5::Group header = file.createGroup("/config");
+
+	WriteAttribute(header, "RunNumber", H5::PredType::NATIVE_INT, info.RunNumber);
+	WriteAttribute(header, "RecordLength", H5::PredType::NATIVE_UINT, info.RecordLength);
+	WriteAttribute(header, "PostTriggerSize", H5::PredType::NATIVE_UINT, info.PostTriggerSize);
+	WriteAttribute(header, "SamplingTime", H5::PredType::NATIVE_DOUBLE, info.SamplingTime);
+	WriteAttribute(header, "SamplingRate", info.SamplingRate);
+	WriteAttribute(header, "OutputFormat", std::string("HDF5"));
+	WriteAttribute(header, "TriggerMode", info.TriggerMode);
+	if( !info.ChannelList.empty() ) {
+	    hsize_t dim = info.ChannelList.size();
+	    header.createAttribute("ChannelList", H5::PredType::NATIVE_UINT, H5::DataSpace(1, &dim))
+		.write(H5::PredType::NATIVE_UINT, info.ChannelList.data());
+	}
+
+	uint32_t nevents = 0;
+	std::vector<JournalEvent> chunk;
+	while( journal.NextChunk(chunk) ) {
+	    for( const JournalEvent& event: chunk ) {
+		const std::string name = "event" + std::to_string(event.fEventNumber);
+		hsize_t dim = event.fCorr.size();
+		events.createDataSet(name, H5::PredType::NATIVE_INT16, H5::DataSpace(1, &dim))
+		    .write(event.fCorr.data(), H5::PredType::NATIVE_INT16);
+		if( !event.fRaw.empty() ) {
+		    hsize_t rawdim = event.fRaw.size();
+		    raw.createDataSet(name, H5::PredType::NATIVE_UINT16, H5::DataSpace(1, &rawdim))
+			.write(event.fRaw.data(), H5::PredType::NATIVE_UINT16);
+		}
+		nevents++;
+	    }
+	}
+
+	WriteAttribute(header, "NEventsRecorded", H5::PredType::NATIVE_UINT, nevents);
+	WriteAttribute(header, "StopReason", std::string("Recovered"));
+	file.close();
+
+	std::cout << "Recovered " << nevents << " events from " << journal.GetChunks() << " chunks." << std::endl;
+	if( journal.GetDiscardedBytes() > 0 )
+	    std::cout << "Discarded " << journal.GetDiscardedBytes()
+		      << " bytes of incomplete data at the end of the journal." << std::endl;
+    } catch( const H5::Exception& e ) {
+	std::cerr << "HDF5 error: " << e.getDetailMsg() << std::endl;
+	return 1;
+    } catch( const std::exception& e ) {
+	std::cerr << "Error: " << e.what() << std::endl;
+	return 1;
+    }
+    return 0;
+}
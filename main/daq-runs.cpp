@@ -0,0 +1,308 @@
+// daq-runs: query the run catalog of an output directory, see RunCatalog.h.
+//
+//   daq-runs [--dir data] [filters]            list matching runs
+//   daq-runs [--dir data] --paths [filters]    file paths only, for scripts
+//   daq-runs [--dir data] --import files...    add existing .h5 / .bin runs
+//
+// Filters: --base WC_proto  --rate 5GHz  --pts 90  --run 12 | --run 10-20
+//          --since 2026-10-12 | --since 7d  --until ...  --reason NEvents
+//          --trigger External  --config <hash>  --min-events N  --running
+//          --limit N
+//
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <H5Cpp.h>
+
+#include "RunBinary.h"
+#include "RunCatalog.h"
+
+namespace {
+
+    void Usage()
+    {
+	std::cout << "Usage: daq-runs [--dir D | --db FILE] [--paths] [filters]" << std::endl
+		  << "       daq-runs [--dir D | --db FILE] --import run.h5|run.bin ..." << std::endl
+		  << "Filters: --base B --rate 5GHz --pts 90 --run N[-M] --since T --until T" << std::endl
+		  << "         --reason R --trigger M --config HASH --min-events N --running --limit N" << std::endl
+		  << "T: YYYY-MM-DD[THH:MM[:SS]] (local time) or a relative 30m, 12h, 7d" << std::endl;
+    }
+
+    /// Absolute or relative time, 0 if it cannot be parsed.
+    int64_t ParseTime(const std::string& s)
+    {
+	if( !s.empty() && (s.back() == 'm' || s.back() == 'h' || s.back() == 'd') ) {
+	    char* end = nullptr;
+	    const double n = std::strtod(s.c_str(), &end);
+	    if( end == s.c_str() + s.size() - 1 ) {
+		const int64_t unit = s.back() == 'm' ? 60 : s.back() == 'h' ? 3600 : 86400;
+		return std::time(nullptr) - static_cast<int64_t>(n * unit);
+	    }
+	}
+	std::tm tm = {};
+	tm.tm_isdst = -1;
+	const char* rest = strptime(s.c_str(), "%Y-%m-%d", &tm);
+	if( rest == nullptr )
+	    return 0;
+	if( *rest == 'T' || *rest == ' ' ) {
+	    const char* t = strptime(rest + 1, "%H:%M:%S", &tm);
+	    if( t == nullptr )
+		t = strptime(rest + 1, "%H:%M", &tm);
+	    rest = t;
+	}
+	if( rest == nullptr || *rest != '\0' )
+	    return 0;
+	return std::mktime(&tm);
+    }
+
+    std::string FormatTime(int64_t t)
+    {
+	if( t <= 0 )
+	    return "-";
+	char buf[32];
+	std::time_t tt = t;
+	std::tm tm;
+	localtime_r(&tt, &tm);
+	std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &tm);
+	return buf;
+    }
+
+    /// "WC_proto_0007_1Gs_20PT.h5" -> base "WC_proto", run 7
+    bool SplitName(const std::string& path, std::string& base, int& run)
+    {
+	const std::string name = std::filesystem::path(path).filename().string();
+	for( size_t pos = name.find('_'); pos != std::string::npos; pos = name.find('_', pos + 1) ) {
+	    size_t end = pos + 1;
+	    while( end < name.size() && std::isdigit(static_cast<unsigned char>(name[end])) )
+		end++;
+	    if( end > pos + 1 && (end == name.size() || name[end] == '_' || name[end] == '.') ) {
+		base = name.substr(0, pos);
+		run = std::stoi(name.substr(pos + 1, end - pos - 1));
+		return true;
+	    }
+	}
+	return false;
+    }
+
+    template <typename T>
+    T ReadAttribute(const H5::Group& group, const std::string& name, const H5::PredType& type, T defvalue)
+    {
+	if( !group.attrExists(name) )
+	    return defvalue;
+	T value;
+	group.openAttribute(name).read(type, &value);
+	return value;
+    }
+
+    std::string ReadAttribute(const H5::Group& group, const std::string& name)
+    {
+	std::string value;
+	if( group.attrExists(name) ) {
+	    H5::Attribute attr = group.openAttribute(name);
+	    attr.read(attr.getStrType(), value);
+	}
+	return value;
+    }
+
+    std::string JoinChannels(const uint32_t* ch, size_t n)
+    {
+	std::string s;
+	for( size_t i = 0; i < n; i++ )
+	    s += (i ? "," : "") + std::to_string(ch[i]);
+	return s;
+    }
+
+    RunRecord ImportHDF5(const std::string& path)
+    {
+	RunRecord r;
+	H5::H5File file(path, H5F_ACC_RDONLY);
+	H5::Group config = file.openGroup("/config");
+	r.Format = "HDF5";
+	r.Run = ReadAttribute(config, "RunNumber", H5::PredType::NATIVE_INT, -1);
+	r.RecordLength = ReadAttribute(config, "RecordLength", H5::PredType::NATIVE_UINT, 0u);
+	r.PostTriggerSize = ReadAttribute(config, "PostTriggerSize", H5::PredType::NATIVE_UINT, 0u);
+	r.SamplingTime = ReadAttribute(config, "SamplingTime", H5::PredType::NATIVE_DOUBLE, 0.0);
+	r.SamplingRate = ReadAttribute(config, "SamplingRate");
+	r.TriggerMode = ReadAttribute(config, "TriggerMode");
+	r.NEvents = ReadAttribute(config, "NEventsRecorded", H5::PredType::NATIVE_UINT, 0u);
+	r.AcquisitionTime = ReadAttribute(config, "AcquisitionTime", H5::PredType::NATIVE_DOUBLE, 0.0);
+	r.TriggerRate_kHz = ReadAttribute(config, "TriggerRate_kHz", H5::PredType::NATIVE_DOUBLE, 0.0);
+	r.StopReason = ReadAttribute(config, "StopReason");
+	if( config.attrExists("ChannelList") ) {
+	    H5::Attribute attr = config.openAttribute("ChannelList");
+	    std::vector<uint32_t> ch(attr.getSpace().getSimpleExtentNpoints());
+	    attr.read(H5::PredType::NATIVE_UINT, ch.data());
+	    r.ChannelList = JoinChannels(ch.data(), ch.size());
+	}
+	r.SaveRaw = file.nameExists("/events_raw") && file.openGroup("/events_raw").getNumObjs() > 0;
+	return r;
+    }
+
+    RunRecord ImportBin(const std::string& path)
+    {
+	RunRecord r;
+	RunBinary::Reader run(path);
+	const RunBinary::FileHeader& h = run.GetHeader();
+	r.Format = "BIN";
+	r.Run = h.fRunNumber;
+	r.RecordLength = h.fNSamples;
+	r.PostTriggerSize = h.fPostTriggerSize;
+	r.SamplingTime = h.fSamplingTime;
+	r.SamplingRate = std::string(h.fSamplingRate, strnlen(h.fSamplingRate, sizeof(h.fSamplingRate)));
+	r.TriggerMode = std::string(h.fTriggerMode, strnlen(h.fTriggerMode, sizeof(h.fTriggerMode)));
+	r.StopReason = std::string(h.fStopReason, strnlen(h.fStopReason, sizeof(h.fStopReason)));
+	r.NEvents = run.GetNEvents();
+	r.AcquisitionTime = h.fAcquisitionTime;
+	r.TriggerRate_kHz = h.fTriggerRate_kHz;
+	r.ChannelList = JoinChannels(h.fChannelList, std::min(h.fNChannels, RunBinary::kMaxChannels));
+	r.SaveRaw = h.fHasRaw != 0;
+	return r;
+    }
+
+    int Import(RunCatalog& catalog, const std::vector<std::string>& files)
+    {
+	int failed = 0;
+	for( const std::string& path: files ) {
+	    try {
+		const std::string ext = std::filesystem::path(path).extension().string();
+		RunRecord r;
+		if( ext == ".h5" )
+		    r = ImportHDF5(path);
+		else if( ext == ".bin" )
+		    r = ImportBin(path);
+		else {
+		    std::cerr << path << ": only .h5 and .bin files can be imported (gunzip .h5.gz first)" << std::endl;
+		    failed++;
+		    continue;
+		}
+		int run = -1;
+		if( !SplitName(path, r.Base, run) )
+		    r.Base = std::filesystem::path(path).stem().string();
+		if( r.Run < 0 )
+		    r.Run = run;
+		r.Path = std::filesystem::absolute(path).string();
+		r.Status = "done";
+		struct stat st;
+		if( stat(path.c_str(), &st) == 0 ) {
+		    r.FileSize = st.st_size;
+		    r.StopTime = st.st_mtime;
+		    r.StartTime = st.st_mtime - static_cast<int64_t>(r.AcquisitionTime);
+		}
+		catalog.Store(r);
+		std::cout << "imported run " << r.Run << ": " << path << std::endl;
+	    } catch( const H5::Exception& e ) {
+		std::cerr << path << ": " << e.getDetailMsg() << std::endl;
+		failed++;
+	    } catch( const std::exception& e ) {
+		std::cerr << path << ": " << e.what() << std::endl;
+		failed++;
+	    }
+	}
+	return failed == 0 ? 0 : 1;
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string dir = ".";
+    std::string db;
+    bool paths = false;
+    bool import = false;
+    std::vector<std::string> files;
+    RunQuery q;
+
+    for( int i = 1; i < argc; i++ ) {
+	const std::string opt = argv[i];
+	auto value = [&]() -> std::string {
+	    if( i + 1 >= argc ) {
+		std::cerr << opt << " needs a value" << std::endl;
+		exit(1);
+	    }
+	    return argv[++i];
+	};
+	if( import )                      files.push_back(opt);
+	else if( opt == "--dir" )         dir = value();
+	else if( opt == "--db" )          db = value();
+	else if( opt == "--paths" )       paths = true;
+	else if( opt == "--import" )      import = true;
+	else if( opt == "--base" )        q.Base = value();
+	else if( opt == "--rate" )        q.SamplingRate = value();
+	else if( opt == "--pts" )         q.PostTriggerSize = std::stoi(value());
+	else if( opt == "--reason" )      q.StopReason = value();
+	else if( opt == "--trigger" )     q.TriggerMode = value();
+	else if( opt == "--config" )      q.ConfigHash = value();
+	else if( opt == "--min-events" )  q.MinEvents = std::stoll(value());
+	else if( opt == "--running" )     q.Status = "running";
+	else if( opt == "--limit" )       q.Limit = std::stoi(value());
+	else if( opt == "--run" ) {
+	    const std::string v = value();
+	    const size_t dash = v.find('-');
+	    q.RunMin = std::stoi(v.substr(0, dash));
+	    q.RunMax = dash == std::string::npos ? q.RunMin : std::stoi(v.substr(dash + 1));
+	} else if( opt == "--since" || opt == "--until" ) {
+	    const std::string v = value();
+	    const int64_t t = ParseTime(v);
+	    if( t == 0 ) {
+		std::cerr << "Cannot parse time " << v << std::endl;
+		return 1;
+	    }
+	    (opt == "--since" ? q.Since : q.Until) = t;
+	} else {
+	    Usage();
+	    return opt == "-h" || opt == "--help" ? 0 : 1;
+	}
+    }
+    if( db.empty() )
+	db = dir + "/runcatalog.sqlite";
+
+    try {
+	if( import ) {
+	    RunCatalog catalog(db);
+	    return Import(catalog, files);
+	}
+
+	if( !std::filesystem::exists(db) ) {
+	    std::cerr << "No run catalog at " << db << std::endl;
+	    return 1;
+	}
+	RunCatalog catalog(db, true);
+	auto t0 = std::chrono::steady_clock::now();
+	const std::vector<RunRecord> runs = catalog.Query(q);
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+	if( paths ) {
+	    for( const RunRecord& r: runs )
+		std::cout << r.Path << std::endl;
+	    return 0;
+	}
+	std::cout << std::left << std::setw(12) << "base" << std::right << std::setw(6) << "run" << "  "
+		  << std::left << std::setw(17) << "start" << std::setw(8) << "rate" << std::right
+		  << std::setw(4) << "PT" << std::setw(10) << "events" << std::setw(10) << "kHz" << "  "
+		  << std::left << std::setw(13) << "stop" << "path" << std::endl;
+	for( const RunRecord& r: runs ) {
+	    std::ostringstream rate;
+	    rate << std::fixed << std::setprecision(2) << r.TriggerRate_kHz;
+	    std::cout << std::left << std::setw(12) << r.Base << std::right << std::setw(6) << r.Run << "  "
+		      << std::left << std::setw(17) << FormatTime(r.StartTime) << std::setw(8) << r.SamplingRate
+		      << std::right << std::setw(4) << r.PostTriggerSize << std::setw(10) << r.NEvents
+		      << std::setw(10) << rate.str() << "  " << std::left << std::setw(13)
+		      << (r.Status == "running" ? "(running)" : r.StopReason) << r.Path << std::endl;
+	}
+	std::cerr << runs.size() << " runs (" << std::fixed << std::setprecision(1) << ms << " ms)" << std::endl;
+    } catch( const std::exception& e ) {
+	std::cerr << "Error: " << e.what() << std::endl;
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "BoardRegisters.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "Bridge.h"
+#include "CAENDigitizer.h"
+
+namespace {
+
+    std::string Hex(uint32_t value) {
+        std::ostringstream s;
+        s << "0x" << std::hex << std::uppercase << value;
+        return s.str();
+    }
+
+}
+
+BoardRegisters::BoardRegisters()
+    : fHandle(0),
+      fBridge(nullptr),
+      fBase(0),
+      fRoundTrips(0),
+      fSkipped(0) {
+}
+
+void BoardRegisters::Attach(int handle, Bridge* bridge, uint32_t baseaddress) {
+    fHandle = handle;
+    fBridge = bridge;
+    fBase = baseaddress;
+    Invalidate();
+}
+
+void BoardRegisters::Invalidate() {
+    fShadow.clear();
+    fPendingOffsets.clear();
+    fPendingValues.clear();
+}
+
+void BoardRegisters::Read(const std::vector<uint32_t>& offsets, bool refresh) {
+    std::vector<uint32_t> missing;
+    for (uint32_t offset : offsets)
+        if ((refresh || !Has(offset)) && std::find(missing.begin(), missing.end(), offset) == missing.end())
+            missing.push_back(offset);
+    if (missing.empty())
+        return;
+
+    if (fBridge && fBridge->IsOpen()) {
+        std::vector<uint32_t> addresses;
+        for (uint32_t offset : missing)
+            addresses.push_back(fBase + offset);
+        const std::vector<uint32_t> values = fBridge->MultiRead(addresses);
+        for (size_t i = 0; i < missing.size(); i++)
+            fShadow[missing[i]] = values[i];
+        fRoundTrips += (missing.size() + Bridge::kMaxCycles - 1) / Bridge::kMaxCycles;
+        return;
+    }
+
+    for (uint32_t offset : missing) {
+        uint32_t value = 0;
+        if (CAEN_DGTZ_ReadRegister(fHandle, offset, &value) != CAEN_DGTZ_Success)
+            throw std::runtime_error("ReadRegister " + Hex(offset) + " failed");
+        fShadow[offset] = value;
+        fRoundTrips++;
+    }
+}
+
+uint32_t BoardRegisters::Get(uint32_t offset) const {
+    auto it = fShadow.find(offset);
+    if (it == fShadow.end())
+        throw std::runtime_error("register " + Hex(offset) + " not read yet");
+    return it->second;
+}
+
+void BoardRegisters::Write(uint32_t offset, uint32_t value) {
+    auto pending = std::find(fPendingOffsets.begin(), fPendingOffsets.end(), offset);
+    if (pending != fPendingOffsets.end()) {
+        fPendingValues[pending - fPendingOffsets.begin()] = value;
+        fShadow[offset] = value;
+        return;
+    }
+    auto it = fShadow.find(offset);
+    if (it != fShadow.end() && it->second == value) {
+        fSkipped++;
+        return;
+    }
+    fShadow[offset] = value;
+    fPendingOffsets.push_back(offset);
+    fPendingValues.push_back(value);
+}
+
+void BoardRegisters::WriteBits(uint32_t offset, uint32_t mask, uint32_t value) {
+    Write(offset, (Get(offset) & ~mask) | (value & mask));
+}
+
+void BoardRegisters::Flush() {
+    if (fPendingOffsets.empty())
+        return;
+
+    std::vector<uint32_t> offsets, values;
+    offsets.swap(fPendingOffsets);
+    values.swap(fPendingValues);
+    try {
+        if (fBridge && fBridge->IsOpen()) {
+            std::vector<uint32_t> addresses;
+            for (uint32_t offset : offsets)
+                addresses.push_back(fBase + offset);
+            fBridge->MultiWrite(addresses, values);
+            fRoundTrips += (offsets.size() + Bridge::kMaxCycles - 1) / Bridge::kMaxCycles;
+            return;
+        }
+        for (size_t i = 0; i < offsets.size(); i++) {
+            if (CAEN_DGTZ_WriteRegister(fHandle, offsets[i], values[i]) != CAEN_DGTZ_Success)
+                throw std::runtime_error("WriteRegister " + Hex(offsets[i]) + " failed");
+            fRoundTrips++;
+        }
+    } catch (const std::exception&) {
+        // the board state of the queued registers is unknown now
+        for (uint32_t offset : offsets)
+            fShadow.erase(offset);
+        throw;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef BOARDREGISTERS_H
+#define BOARDREGISTERS_H
+
+// Shadow copy of the registers of one board. Write() only queues a value
+// that differs from the shadow; Flush() sends the queue and Read() fetches
+// registers, both batched through the bridge (Bridge::MultiWrite /
+// MultiRead at base + offset, one round trip per Bridge::kMaxCycles).
+// Without an open bridge every access is a CAEN_DGTZ_Read/WriteRegister.
+//
+// Only registers the CAENDigitizer library keeps no state for belong here:
+// settings the library also uses (record length, post trigger, DRS4...)
+// go through its setters.
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+class Bridge;
+
+class BoardRegisters {
+public:
+    BoardRegisters();
+
+    /// handle: CAENDigitizer handle; bridge may be nullptr.
+    void Attach(int handle, Bridge* bridge, uint32_t baseaddress);
+
+    /// Forget every shadow value (board reset, reconnection).
+    void Invalidate();
+
+    /// Fetch the registers not in the shadow yet (all of them with refresh).
+    /// Throws std::runtime_error.
+    void Read(const std::vector<uint32_t>& offsets, bool refresh = false);
+
+    /// Shadow value, Read() first.
+    uint32_t Get(uint32_t offset) const;
+    bool Has(uint32_t offset) const { return fShadow.count(offset) > 0; }
+
+    void Write(uint32_t offset, uint32_t value);
+    /// Only the bits of mask; the register must be in the shadow.
+    void WriteBits(uint32_t offset, uint32_t mask, uint32_t value);
+
+    /// Send the queued writes. Throws std::runtime_error; the shadow then
+    /// forgets the registers of the queue.
+    void Flush();
+
+    uint64_t GetRoundTrips() const { return fRoundTrips; }
+    uint64_t GetSkipped() const { return fSkipped; }
+
+private:
+    int fHandle;
+    Bridge* fBridge;
+    uint32_t fBase;
+    std::map<uint32_t, uint32_t> fShadow;
+    std::vector<uint32_t> fPendingOffsets;
+    std::vector<uint32_t> fPendingValues;
+    uint64_t fRoundTrips;
+    uint64_t fSkipped;
+};
+
+#endif // BOARDREGISTERS_H
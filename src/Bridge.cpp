@@ -1,6 +1,8 @@
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <cstdint>
 #include "Log.h"
 #include "Bridge.h"
@@ -10,8 +12,7 @@ Bridge::Bridge(Config& config)
   : fHandle(-1)
   , fConfig(config)
 {
-  //    fIPAddress = fConfig.GetString("bridge", "IPAddress", "192.168.99.105");
-    fIPAddress = fConfig.GetEntry<std::string>("bridge", "IPAddress", "192.168.99.105");
+    fIPAddress = fConfig.GetBridge().IPAddress;
     Log::OutDebug("Bridge IP address set to: " + fIPAddress);
 }
 
@@ -60,6 +61,46 @@ void Bridge::Write(uint32_t address, uint32_t data) {
     }
 }
 
+std::vector<uint32_t> Bridge::MultiRead(const std::vector<uint32_t>& addresses) {
+    std::lock_guard<std::mutex> lock(fMultiMutex);
+    std::vector<uint32_t> data(addresses.size(), 0);
+    std::vector<uint32_t> addr(addresses);
+    for (size_t first = 0; first < addr.size(); first += kMaxCycles) {
+        const int n = static_cast<int>(std::min<size_t>(kMaxCycles, addr.size() - first));
+        std::vector<CVAddressModifier> am(n, cvA32_U_DATA);
+        std::vector<CVDataWidth> dw(n, cvD32);
+        std::vector<CVErrorCodes> ec(n, cvSuccess);
+        CVErrorCodes ret = CAENVME_MultiRead(fHandle, &addr[first], &data[first], n, am.data(), dw.data(), ec.data());
+        for (int i = 0; i < n; i++) {
+            if (ret != cvSuccess || ec[i] != cvSuccess) {
+                throw std::runtime_error("Read error at address 0x" + ToHex(addr[first + i]) + ": " +
+                                         CAENVME_DecodeError(ec[i] != cvSuccess ? ec[i] : ret));
+            }
+        }
+    }
+    return data;
+}
+
+void Bridge::MultiWrite(const std::vector<uint32_t>& addresses, const std::vector<uint32_t>& data) {
+    std::lock_guard<std::mutex> lock(fMultiMutex);
+    std::vector<uint32_t> addr(addresses);
+    std::vector<uint32_t> values(data);
+    values.resize(addr.size(), 0);
+    for (size_t first = 0; first < addr.size(); first += kMaxCycles) {
+        const int n = static_cast<int>(std::min<size_t>(kMaxCycles, addr.size() - first));
+        std::vector<CVAddressModifier> am(n, cvA32_U_DATA);
+        std::vector<CVDataWidth> dw(n, cvD32);
+        std::vector<CVErrorCodes> ec(n, cvSuccess);
+        CVErrorCodes ret = CAENVME_MultiWrite(fHandle, &addr[first], &values[first], n, am.data(), dw.data(), ec.data());
+        for (int i = 0; i < n; i++) {
+            if (ret != cvSuccess || ec[i] != cvSuccess) {
+                throw std::runtime_error("Write error at address 0x" + ToHex(addr[first + i]) + ": " +
+                                         CAENVME_DecodeError(ec[i] != cvSuccess ? ec[i] : ret));
+            }
+        }
+    }
+}
+
 std::string Bridge::ToHex(uint32_t val) {
     std::stringstream ss;
     ss << std::hex << std::uppercase << val;
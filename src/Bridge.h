@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <mutex>
 #include <H5Cpp.h>
 #include "CAENVMElib.h"
 #include "CAENDigitizer.h"
@@ -43,6 +44,13 @@ public:
     // Access to raw VME operations (from VMEBridge)
     uint32_t Read(uint32_t address);
     void Write(uint32_t address, uint32_t data);
+    // A32/D32 cycles batched with CAENVME_MultiRead/MultiWrite, up to
+    // kMaxCycles per round trip. Throw std::runtime_error on any failed cycle.
+    // Serialized: the boards of a crate are configured from several threads.
+    static constexpr int kMaxCycles = 64;
+    std::vector<uint32_t> MultiRead(const std::vector<uint32_t>& addresses);
+    void MultiWrite(const std::vector<uint32_t>& addresses, const std::vector<uint32_t>& data);
+    bool IsOpen() const { return fHandle >= 0; }
     std::string ToHex(uint32_t val);
 
 private:
@@ -50,6 +58,7 @@ private:
     CVBoardTypes fBoardType;
     std::string fIPAddress;
     int32_t fHandle;
+    std::mutex fMultiMutex;
 
     // Pulser parameters
     CVPulserSelect fPulserSelect;
@@ -0,0 +1,154 @@
+#include "Crate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include "Digitizer.h"
+#include "Log.h"
+#include "ThreadPlacement.h"
+
+namespace {
+
+    std::string Seconds(double s) {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2) << s << " s";
+        return out.str();
+    }
+
+}
+
+Crate::Crate(uint32_t nboards) {
+    for (uint32_t i = 0; i < std::max<uint32_t>(1, nboards); i++)
+        fBoards.emplace_back(new Digitizer(i));
+    if (fBoards.size() > 1) {
+        fAlignment.reset(new TimeAlignment(fBoards.size()));
+        fStartGate.reset(new StartGate());
+        for (auto& board : fBoards) {
+            board->SetAlignment(fAlignment.get());
+            board->SetStartGate(fStartGate.get());
+        }
+    }
+}
+
+Crate::~Crate() {
+}
+
+void Crate::SetBridge(Bridge* bridge) {
+    for (auto& board : fBoards)
+        board->SetBridge(bridge);
+}
+
+std::vector<std::string> Crate::ForEach(const std::function<void(Digitizer&)>& task) {
+    std::vector<std::string> errors(fBoards.size());
+    fSeconds.assign(fBoards.size(), 0.0);
+
+    auto run = [&](size_t i) {
+        ThreadPlacement::Apply(ThreadPlacement::kReadout, i);
+        const auto t0 = std::chrono::steady_clock::now();
+        try {
+            task(*fBoards[i]);
+        } catch (const std::exception& e) {
+            errors[i] = e.what();
+        }
+        fSeconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    };
+
+    // a placed thread keeps its CPU and priority: never the main thread
+    if (fBoards.size() == 1 && !ThreadPlacement::IsEnabled()) {
+        run(0);
+    } else {
+        std::vector<std::thread> tasks;
+        for (size_t i = 0; i < fBoards.size(); i++)
+            tasks.emplace_back(run, i);
+        for (auto& t : tasks)
+            t.join();
+    }
+
+    std::vector<std::string> failed;
+    for (size_t i = 0; i < errors.size(); i++)
+        if (!errors[i].empty())
+            failed.push_back("[b" + std::to_string(i) + "] " + errors[i]);
+    return failed;
+}
+
+bool Crate::BringUp() {
+    const auto t0 = std::chrono::steady_clock::now();
+    const std::vector<std::string> errors = ForEach([](Digitizer& board) {
+        board.SelectBoard();       // connessione, DRS4 e calibrazione
+        board.Configure();
+        board.InitAcquisition();
+        board.SetTriggerThreshold(0.1);
+    });
+    const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    double sum = 0.0;
+    for (size_t i = 0; i < fBoards.size() && fBoards.size() > 1; i++) {
+        std::ostringstream base;
+        base << std::hex << std::uppercase << fBoards[i]->GetVMEBaseAddress();
+        Log::OutSummary("[b" + std::to_string(i) + "] 0x" + base.str() + " brought up in " + Seconds(fSeconds[i]));
+        sum += fSeconds[i];
+    }
+
+    for (auto& err : errors)
+        Log::OutError(err);
+    if (!errors.empty()) {
+        Log::OutError(std::to_string(errors.size()) + " of " + std::to_string(fBoards.size()) + " boards failed to start.");
+        return false;
+    }
+    if (fBoards.size() > 1)
+        Log::OutSummary(std::to_string(fBoards.size()) + " boards ready in " + Seconds(total) +
+                        " (" + Seconds(sum) + " one after the other)");
+    return true;
+}
+
+int Crate::AllocateRunNumber() {
+    const int run = fBoards[0]->AllocateRunNumber();
+    for (size_t i = 1; i < fBoards.size(); i++)
+        fBoards[i]->SetRunNumber(run);
+    return run;
+}
+
+std::vector<std::string> Crate::Arm() {
+    if (fAlignment)
+        fAlignment->Reset();
+    // every other board leaves the gate once, when its run ends
+    if (fStartGate)
+        fStartGate->Reset(fBoards.size() - 1);
+    std::vector<std::string> errors;
+    for (size_t i = 1; i < fBoards.size(); i++) {
+        try {
+            fBoards[i]->ArmReadout();
+        } catch (const std::exception& e) {
+            errors.push_back("[b" + std::to_string(i) + "] " + e.what());
+        }
+    }
+    return errors;
+}
+
+bool Crate::CheckAlignment() {
+    if (!fAlignment)
+        return true;
+    if (fAlignment->IsAligned()) {
+        Log::OutSummary("Time tags " + fAlignment->Summary());
+        return true;
+    }
+    Log::OutWarning("Time tags " + fAlignment->Summary());
+    return false;
+}
+
+void Crate::Close(bool reset) {
+    for (auto& board : fBoards) {
+        if (reset) {
+            try {
+                board->Reset();
+            } catch (const std::exception& e) {
+                Log::OutWarning(e.what());
+            }
+        }
+        board->Close();
+    }
+}
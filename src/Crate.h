@@ -0,0 +1,77 @@
+#ifndef CRATE_H
+#define CRATE_H
+
+// The boards of [digitizer] VMEBaseAddress, one Digitizer each. BringUp()
+// opens, calibrates and configures them concurrently, one task per board:
+// the crate is ready after the slowest board instead of after the sum of
+// all of them. ForEach() runs a step of the run on every board the same
+// way. Both return only when every board is done, which is the barrier
+// before the acquisition starts.
+//
+// A single board runs on the calling thread, unless [threads] places the
+// readout threads (ThreadPlacement::Apply at the start of each task).
+//
+// With [digitizer] SyncStart the boards form a TRG-OUT -> S-IN daisy chain:
+// the baselines are measured with every board software-controlled and
+// stopped again, Arm() switches boards 1..N to S_IN_CONTROLLED and arms
+// them, then starting board 0 last starts them all on the same clock edge.
+// A paused run resumes in the same order, through a StartGate.
+// Every run, the time tags of the first events of each board are compared
+// (TimeAlignment) and the offsets are logged and stored with each board's
+// output.
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "StartGate.h"
+#include "TimeAlignment.h"
+
+class Bridge;
+class Digitizer;
+
+class Crate {
+public:
+    /// nboards Digitizer objects, board i at VMEBaseAddress[i].
+    explicit Crate(uint32_t nboards);
+    ~Crate();
+
+    size_t Size() const { return fBoards.size(); }
+    Digitizer& GetBoard(size_t i) { return *fBoards[i]; }
+
+    void SetBridge(Bridge* bridge);
+
+    /// SelectBoard, Configure, InitAcquisition on every board. Failures are
+    /// collected and logged together; returns false if any board failed.
+    bool BringUp();
+
+    /// Run task on every board; returns the errors ("[bN] message"), empty
+    /// when every task succeeded.
+    std::vector<std::string> ForEach(const std::function<void(Digitizer&)>& task);
+
+    /// Before each run: one run number for every board, from the registry
+    /// of board 0; the files of board N end in _bN. Throws
+    /// std::runtime_error.
+    int AllocateRunNumber();
+
+    /// Before each run, after the baseline: forget the previous time
+    /// offsets and arm the synchronized boards. Returns the errors.
+    std::vector<std::string> Arm();
+
+    /// After each run: log the time offsets. Returns false if the boards
+    /// are not aligned (also when nothing could be measured).
+    bool CheckAlignment();
+
+    /// Reset (hardware) and close every board.
+    void Close(bool reset);
+
+private:
+    std::vector<std::unique_ptr<Digitizer>> fBoards;
+    std::vector<double> fSeconds;       ///< duration of each task of the last ForEach()
+    std::unique_ptr<TimeAlignment> fAlignment;      ///< only with several boards
+    std::unique_ptr<StartGate> fStartGate;          ///< only with several boards
+};
+
+#endif // CRATE_H
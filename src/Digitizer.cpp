@@ -4,6 +4,8 @@
 #include <filesystem>
 #define CAEN_USE_X742
 
+#include <algorithm>
+#include <cstring>
 #include <vector>
 #include <sys/time.h>
 #include <ctime>
@@ -13,13 +15,19 @@
 #include <iomanip>
 #include <numeric>
 #include <map>
+#include <memory>
 #include <string>
 #include <sstream>
+#include <stdexcept>
 #include <thread>
 #include <iostream>
 
 #include "Digitizer.h"
 #include "Log.h"
+#include "BufferPool.h"
+#include "RunControl.h"
+#include "TaskPool.h"
+#include "ThreadPlacement.h"
 #include "TParameter.h"
 #include <CAENDigitizer.h>
 #include <CAENDigitizerType.h>
@@ -28,35 +36,35 @@
  
 using namespace H5;
 
-Digitizer::Digitizer() :
+Digitizer::Digitizer(uint32_t board) :
   fConfig(Config::GetInstance()),
   fIsRunning(true),
+  fBoard(board),
 
   fConnectionType(CAEN_DGTZ_ETH_V4718),
-  fIPAddress(fConfig.GetEntry<std::string>("digitizer", "IPAddress", "192.168.99.105")),
-  fConetNode(fConfig.GetEntry<int>("digitizer", "ConetNode", 0)),
-  fVMEBaseAddress(0x32100000),
+  fConetNode(0),
+  fVMEBaseAddress(0),
   fHandle(0),
     
-  fRecordLength(fConfig.GetEntry<uint32_t>("digitizer", "RecordLength", 1024)),
+  fRecordLength(0),
   fNChannels(32),  // V1742 full range
   fChannelMask(0),
   fNActiveChannels(0),
-  fPostTriggerSize(fConfig.GetEntry<uint32_t>("digitizer", "PostTriggerSize", 50)),
+  fPostTriggerSize(0),
   fAcquisitionMode(CAEN_DGTZ_FIRST_TRG_CONTROLLED),
   fNTransferedEvents(1),
   fGroupMask(0),
 
-  fSelfTrigger(fConfig.GetEntry<bool>("digitizer", "SelfTrigger", false)),
-  fSaveRaw(fConfig.GetEntry<bool>("digitizer", "SaveRaw", false)),
-  fExternalTrigger(fConfig.GetEntry<bool>("digitizer", "ExternalTrigger", true)),
+  fSelfTrigger(false),
+  fSaveRaw(false),
+  fExternalTrigger(false),
   fSelfTriggerMode(CAEN_DGTZ_TRGMODE_DISABLED),
   fExternalTriggerMode(CAEN_DGTZ_TRGMODE_ACQ_ONLY),
-  fPulsePolarity(static_cast<CAEN_DGTZ_PulsePolarity_t>(fConfig.GetEntry<uint32_t>("digitizer", "PulsePolarity", 1))),
-  fTriggerPolarity(static_cast<CAEN_DGTZ_TriggerPolarity_t>(fConfig.GetEntry<uint32_t>("digitizer", "TriggerPolarity", 1))),
+  fPulsePolarity(CAEN_DGTZ_PulsePolarityPositive),
+  fTriggerPolarity(CAEN_DGTZ_TriggerOnRisingEdge),
 
-  fNRMSThreshold(fConfig.GetEntry<double>("digitizer", "NRMSThreshold", 3.0)),
-  fIntegralThreshold(fConfig.GetEntry<double>("digitizer", "IntegralThreshold", -100.0)),
+  fNRMSThreshold(0.0),
+  fIntegralThreshold(0.0),
 
   fBuffer(nullptr),
   fBufferSize(0),
@@ -65,19 +73,16 @@ Digitizer::Digitizer() :
   fEvent(nullptr),
   fEventPtr(nullptr),
 
-  fWaitTimeS(fConfig.GetEntry<double>("digitizer", "WaitTimeS", 3.0)),
+  fWaitTimeS(0.0),
   fSamplingTime(0.2e-9),
-  fSamplingRateStr(fConfig.GetEntry<std::string>("digitizer", "SamplingRate", "5GHz")),
   fACQT(),
   fDeadT(0.0),
-  fNNoiseEvents(fConfig.GetEntry<uint32_t>("digitizer", "NNoiseEvents", 100)),
-  fNEvents(fConfig.GetEntry<uint32_t>("digitizer", "NEvents", 100)),
+  fNNoiseEvents(0),
+  fNEvents(0),
   fDuration(0),
 
   fOutputFormat(kROOT),
-  fOutputDir(fConfig.GetEntry<std::string>("digitizer", "OutputDir", "")),
-  fOutputFileName(fConfig.GetEntry<std::string>("digitizer", "OutputFile", "run")),
-  fRunNumber(fConfig.GetEntry<int>("digitizer", "RunNumber", 1)),
+  fRunNumber(0),
   fROOTFile(nullptr),
   fChannelTree(nullptr),
   fEventTree(nullptr),
@@ -87,47 +92,101 @@ Digitizer::Digitizer() :
   fTimestamp_ns(0),
   fTriggerTime(0)
   {
-    // === Lettura ChannelList ===
-    std::vector<int64_t> tmpchlist = fConfig.GetEntryList<int64_t>("digitizer","ChannelList", -1, 0);
-    if (tmpchlist.empty() || tmpchlist[0] == -1) {
-      Log::OutError("No valid 'ChannelList' found in config. You must specify at least one channel.");
-      exit(1);
-    }
+    fReplayMode = fConfig.GetReplay().Enable;
+    LoadSettings();
+  }
 
-    for (auto& c : tmpchlist) {
-      if (c < 0 || c >= 32) {
-	Log::OutError("Invalid channel index " + std::to_string(c) + " in ChannelList (must be 0–31)");
-	exit(1);
-      }
-      fChannelList.push_back(static_cast<uint32_t>(c));
-    }
+// Copy the validated config snapshot into the members. Called by the
+// constructor and again by Reconfigure() after Config::Reload().
+void Digitizer::LoadSettings()
+{
+  const DigitizerSettings& dig = fConfig.GetDigitizer();
+  const OutputSettings& out = fConfig.GetOutput();
+
+  fIPAddress = dig.IPAddress;
+  fConetNode = dig.ConetNode;
+  // a board dropped from the list keeps its address, see Reconfigure()
+  if (fBoard < dig.VMEBaseAddress.size())
+    fVMEBaseAddress = dig.VMEBaseAddress[fBoard];
+  fTag = dig.VMEBaseAddress.size() > 1 ? "[b" + std::to_string(fBoard) + "] " : "";
+  fSyncStart = dig.SyncStart && dig.VMEBaseAddress.size() > 1;
+  fRecordLength = dig.RecordLength;
+  fPostTriggerSize = dig.PostTriggerSize;
+  fSelfTrigger = dig.SelfTrigger;
+  fExternalTrigger = dig.ExternalTrigger;
+  fPulsePolarity = static_cast<CAEN_DGTZ_PulsePolarity_t>(dig.PulsePolarity);
+  fTriggerPolarity = static_cast<CAEN_DGTZ_TriggerPolarity_t>(dig.TriggerPolarity);
+  fNRMSThreshold = dig.NRMSThreshold;
+  fIntegralThreshold = dig.IntegralThreshold;
+  fWaitTimeS = dig.WaitTimeS;
+  fSamplingRateStr = dig.SamplingRate;
+  fExtTriggerMode = dig.ExtTriggerMode;
+  fNNoiseEvents = dig.NNoiseEvents;
+  fNEvents = dig.NEvents;
+  fDuration = dig.Duration;
+  fEventsPerBLT = dig.EventsPerBLT;
+  fMaxTransferS = dig.MaxTransferMs * 1e-3;
+  fRunNumber = dig.RunNumber;
+  fSaveRaw = out.SaveRaw;
+  fOutputDir = out.OutputDir;
+  fOutputFileName = out.OutputFile;
+  // the run number is shared, see Crate::AllocateRunNumber()
+  fBoardSuffix = fBoard > 0 ? "_b" + std::to_string(fBoard) : "";
+
+  // === ChannelList (already validated by Config) ===
+  fChannelList = dig.ChannelList;
+
+  fNActiveChannels = fChannelList.size();
+  fChannelMask = 0;
+  for (uint32_t ch : fChannelList)
+    fChannelMask |= (1 << ch);
+
+  Log::OutSummary("→ Active channels (" + std::to_string(fNActiveChannels) + "):");
+  for (auto& ch : fChannelList)
+    Log::OutSummary("    ch" + std::to_string(ch));
+  //Log::OutSummary("→ ChannelMask = " + IntToHex(fChannelMask));
+
+  fSelfTriggerMode = fSelfTrigger ? CAEN_DGTZ_TRGMODE_ACQ_ONLY : CAEN_DGTZ_TRGMODE_DISABLED;
+  fExternalTriggerMode = fExternalTrigger ? CAEN_DGTZ_TRGMODE_ACQ_ONLY : CAEN_DGTZ_TRGMODE_DISABLED;
+
+  const std::string& outputformat = out.OutputFormat;
+  Log::OutSummary("OutputFormat read from config = '" + outputformat + "'");
+  if (outputformat == "ROOT")
+    fOutputFormat = kROOT;
+  else if (outputformat == "ASCII")
+    fOutputFormat = kASCII;
+  else if (outputformat == "HDF5")
+    fOutputFormat = kHDF5;
+  else if (outputformat == "BIN")
+    fOutputFormat = kBIN;
+  else
+    throw std::runtime_error("output format " + outputformat + " does not exist");
+}
 
-    fNActiveChannels = fChannelList.size();
-    fChannelMask = 0;
-    for (uint32_t ch : fChannelList)
-      fChannelMask |= (1 << ch);
+// Apply a reloaded configuration to an open board, between runs. The
+// connection parameters are not changed: reconnecting needs a restart.
+void Digitizer::Reconfigure()
+{
+  // replay: the recorded runs set the acquisition parameters, see PrepareReplay()
+  if (fReplayMode) {
+    LoadSettings();
+    if (!fConfig.GetReplay().Enable)
+      Log::OutWarning("[replay] disabled: restart the DAQ to use the digitizer.");
+    fReplayIndex = 0;
+    return;
+  }
 
-    Log::OutSummary("→ Active channels (" + std::to_string(fNActiveChannels) + "):");
-    for (auto& ch : fChannelList)
-      Log::OutSummary("    ch" + std::to_string(ch));
-    //Log::OutSummary("→ ChannelMask = " + IntToHex(fChannelMask));
+  const std::string ip = fIPAddress;
+  const uint32_t base = fVMEBaseAddress;
 
-    fSelfTriggerMode = fSelfTrigger ? CAEN_DGTZ_TRGMODE_ACQ_ONLY : CAEN_DGTZ_TRGMODE_DISABLED;
-    fExternalTriggerMode = fExternalTrigger ? CAEN_DGTZ_TRGMODE_ACQ_ONLY : CAEN_DGTZ_TRGMODE_DISABLED;
+  LoadSettings();
+  if (fIPAddress != ip || fVMEBaseAddress != base)
+    Log::OutWarning("Digitizer connection parameters changed: restart the DAQ to apply them.");
 
-    std::string outputformat = fConfig.GetEntry<std::string>("digitizer", "OutputFormat", "");
-    Log::OutSummary("OutputFormat read from config = '" + outputformat + "'");
-    if (outputformat == "ROOT")
-      fOutputFormat = kROOT;
-    else if (outputformat == "ASCII")
-      fOutputFormat = kASCII;
-    else if (outputformat == "HDF5")
-      fOutputFormat = kHDF5;
-    else {
-      Log::OutError("Output format " + outputformat + " does not exist. Abort.");
-      exit(1);
-    }
-  }
+  Configure();
+  // buffers and the monitor ring depend on record length and channel list
+  InitAcquisition();
+}
 
 Digitizer::~Digitizer() {
   Close();
@@ -145,11 +204,13 @@ void Digitizer::SelectBoard()
 
   if(re == CAEN_DGTZ_Success)
     {
-      Log::OutSummary("Digitizer connected.");
+      Log::OutSummary(fTag + "Digitizer connected.");
+      fRegisters.Attach(fHandle, fBridge, fVMEBaseAddress);
+      fApplied.clear();
       re = CAEN_DGTZ_GetInfo(fHandle, &fBoardInfo);
-      Log::OutSummary("Digitizer model: " + std::string(fBoardInfo.ModelName));
-      Log::OutSummary("ROC firmware release: " + std::string(fBoardInfo.ROC_FirmwareRel));
-      Log::OutSummary("AMC firmware release: " + std::string(fBoardInfo.AMC_FirmwareRel));
+      Log::OutSummary(fTag + "Digitizer model: " + std::string(fBoardInfo.ModelName));
+      Log::OutSummary(fTag + "ROC firmware release: " + std::string(fBoardInfo.ROC_FirmwareRel));
+      Log::OutSummary(fTag + "AMC firmware release: " + std::string(fBoardInfo.AMC_FirmwareRel));
       //Log::OutSummary("Serial number: " + std::to_string(fBoardInfo.SerialNumber));
       // === Imposta il Sampling Rate dal file TOML ===
       CAEN_DGTZ_DRS4Frequency_t drs4Freq = CAEN_DGTZ_DRS4_5GHz;
@@ -165,30 +226,30 @@ void Digitizer::SelectBoard()
 	drs4Freq = CAEN_DGTZ_DRS4_1GHz;
 	sampling_ns = 1.0e-9;
       } else {
-	Log::OutWarning("Unknown SamplingRate = '" + fSamplingRateStr + "'. Defaulting to 5 GHz.");
+	Log::OutWarning(fTag + "Unknown SamplingRate = '" + fSamplingRateStr + "'. Defaulting to 5 GHz.");
       }
   
       CAEN_DGTZ_ErrorCode freqCode = CAEN_DGTZ_SetDRS4SamplingFrequency(fHandle, drs4Freq);
       if (freqCode == CAEN_DGTZ_Success) {
 	fSamplingTime = sampling_ns;
-	Log::OutSummary("→ Sampling frequency set to " + fSamplingRateStr + " (" + std::to_string(fSamplingTime * 1e9) + " ns per sample)");
+	Log::OutSummary(fTag + "→ Sampling frequency set to " + fSamplingRateStr + " (" + std::to_string(fSamplingTime * 1e9) + " ns per sample)");
       } else {
-	Log::OutWarning("→ Failed to set DRS4 sampling frequency (code = " + std::to_string(freqCode) + "). Using default 5 GHz.");
+	Log::OutWarning(fTag + "→ Failed to set DRS4 sampling frequency (code = " + std::to_string(freqCode) + "). Using default 5 GHz.");
 	fSamplingTime = 0.2e-9;
       }
       re = CAEN_DGTZ_LoadDRS4CorrectionData(fHandle, drs4Freq);
       if (re == CAEN_DGTZ_Success){
-	Log::OutSummary("→ PLL / DRS4 calibration loaded.");
+	Log::OutSummary(fTag + "→ PLL / DRS4 calibration loaded.");
       }        else{
-	Log::OutWarning("→ PLL calibration not supported or failed (code = " + std::to_string(re) + ").");
+	Log::OutWarning(fTag + "→ PLL calibration not supported or failed (code = " + std::to_string(re) + ").");
       }
       CAEN_DGTZ_Calibrate(fHandle);
-      Log::OutSummary("PLL calibratiion done.");
+      Log::OutSummary(fTag + "PLL calibratiion done.");
     }
   else
     {
-      Log::OutError("Cannot connect to the digitizer. Error code: " + std::to_string(re) + ".");
-      exit(1);
+      throw std::runtime_error("cannot connect to the digitizer at " + IntToHex(fVMEBaseAddress) +
+                               " (error code " + std::to_string(re) + ")");
     }
   
 }
@@ -197,19 +258,39 @@ void Digitizer::SelectBoard()
 
 void Digitizer::Reset() {
   CAEN_DGTZ_ErrorCode re = CAEN_DGTZ_Reset(fHandle);
+  fRegisters.Invalidate();
+  fApplied.clear();
   if (re == CAEN_DGTZ_Success)
-    Log::OutSummary("Digitizer reset.");
+    Log::OutSummary(fTag + "Digitizer reset.");
   else {
-    Log::OutError("Cannot reset digitizer. Error code: " + std::to_string(re));
-    exit(1);
+    throw std::runtime_error("cannot reset the digitizer at " + IntToHex(fVMEBaseAddress) +
+                             " (error code " + std::to_string(re) + ")");
   }
 }
 
+// Settings go through the library setters, each only when its value differs
+// from the one last applied (fApplied): a reconfiguration between runs sends
+// just what changed. The front-panel I/O level is a plain register of
+// fRegisters, written together with the status read-back.
 void Digitizer::Configure() {
-  Log::OutSummary("Configuring digitizer parameters...");
+  Log::OutSummary(fTag + "Configuring digitizer parameters...");
+  const auto t_start = std::chrono::steady_clock::now();
+  uint32_t nSent = 0, nUnchanged = 0;
+  auto apply = [&](const std::string& setting, int64_t value, auto&& set) {
+    if (!Changed(setting, value)) {
+      nUnchanged++;
+      return;
+    }
+    nSent++;
+    CAEN_DGTZ_ErrorCode re = set();
+    if (re != CAEN_DGTZ_Success) {
+      Log::OutWarning(fTag + "→ " + setting + " failed (code = " + std::to_string(re) + ").");
+      fApplied.erase(setting);
+    }
+  };
 
   // Record Length
-  CAEN_DGTZ_SetRecordLength(fHandle, fRecordLength);
+  apply("RecordLength", fRecordLength, [&] { return CAEN_DGTZ_SetRecordLength(fHandle, fRecordLength); });
 
   // Gruppi: attiva solo i gruppi necessari (0–7)
   fGroupMask = 0;
@@ -217,40 +298,52 @@ void Digitizer::Configure() {
     int group = ch / 4;  // ogni gruppo ha 4 canali
     fGroupMask |= (1 << group);
   }
-  CAEN_DGTZ_SetGroupEnableMask(fHandle, fGroupMask);
+  apply("GroupEnableMask", fGroupMask, [&] { return CAEN_DGTZ_SetGroupEnableMask(fHandle, fGroupMask); });
 
   // Canali abilitati
-  CAEN_DGTZ_SetChannelEnableMask(fHandle, fChannelMask);
+  apply("ChannelEnableMask", fChannelMask, [&] { return CAEN_DGTZ_SetChannelEnableMask(fHandle, fChannelMask); });
 
   // PostTrigger
-  CAEN_DGTZ_SetPostTriggerSize(fHandle, fPostTriggerSize);
+  apply("PostTriggerSize", fPostTriggerSize, [&] { return CAEN_DGTZ_SetPostTriggerSize(fHandle, fPostTriggerSize); });
   //Log::OutDebug("→ PostTrigger size set to " + std::to_string(fPostTriggerSize) + "%");
 
-  // Modalità acquisizione
-  CAEN_DGTZ_SetAcquisitionMode(fHandle, CAEN_DGTZ_SW_CONTROLLED);
-  //CAEN_DGTZ_SetAcquisitionMode(fHandle, CAEN_DGTZ_S_IN_CONTROLLED);
-
-  // IO Level NIM
-  CAEN_DGTZ_SetIOLevel(fHandle, CAEN_DGTZ_IOLevel_NIM);
-
-  // profondita' della FIFO del digitizer
-  CAEN_DGTZ_SetMaxNumEventsBLT(fHandle, 2048);
+  // Modalità acquisizione: con SyncStart la scheda 0 parte via software e
+  // porta il RUN su TRG-OUT, le altre partono quando si alza il loro S-IN.
+  // Tutte restano SW_CONTROLLED per la baseline: ArmReadout() passa le
+  // altre in S_IN_CONTROLLED subito prima del run
+  const CAEN_DGTZ_AcqMode_t acqMode = CAEN_DGTZ_SW_CONTROLLED;
+  apply("AcquisitionMode", acqMode, [&] { return CAEN_DGTZ_SetAcquisitionMode(fHandle, acqMode); });
+  if (fSyncStart)
+    apply("RunSynchronization", CAEN_DGTZ_RUN_SYNC_TrgOutSinDaisyChain,
+          [&] { return CAEN_DGTZ_SetRunSynchronizationMode(fHandle, CAEN_DGTZ_RUN_SYNC_TrgOutSinDaisyChain); });
+
+  // eventi per trasferimento BLT: con EventsPerBLT = 0 il buffer di lettura
+  // e' allocato per il massimo e il valore e' scelto durante il run (ReadoutTuner)
+  const uint32_t eventsPerBLT = fEventsPerBLT ? fEventsPerBLT : MAX_EVENTS_BLT;
+  apply("EventsPerBLT", eventsPerBLT, [&] { return CAEN_DGTZ_SetMaxNumEventsBLT(fHandle, eventsPerBLT); });
   
   // Trigger Polarity
   for (auto ch : fChannelList)
-    CAEN_DGTZ_SetTriggerPolarity(fHandle, ch, fTriggerPolarity);
+    apply("TriggerPolarity/" + std::to_string(ch), fTriggerPolarity, [&] { return CAEN_DGTZ_SetTriggerPolarity(fHandle, ch, fTriggerPolarity); });
 
   // Offset per ogni canale
-  for (auto ch : fChannelList) {
-    CAEN_DGTZ_SetChannelDCOffset(fHandle, ch, 0x7000);  // segnali negativi
-    uint32_t offset = 0;
-    CAEN_DGTZ_GetChannelDCOffset(fHandle, ch, &offset);
-    // Log::OutDebug("→ DC offset ch" + std::to_string(ch) + " = " + std::to_string(offset));
-  }
+  for (auto ch : fChannelList)
+    apply("DCOffset/" + std::to_string(ch), 0x7000, [&] { return CAEN_DGTZ_SetChannelDCOffset(fHandle, ch, 0x7000); });  // segnali negativi
 
-  
+  // IO Level (NIM / TTL) e stato della scheda, in un solo accesso
+  try {
+    fRegisters.Read({ FRONT_PANEL_IO_REG, ACQ_STATUS_REG }, true);
+    fRegisters.WriteBits(FRONT_PANEL_IO_REG, 0x1, fExtTriggerMode == "TTL" ? 0x1 : 0x0);
+    fRegisters.Flush();
+    const uint32_t status = fRegisters.Get(ACQ_STATUS_REG);
+    if (!(status & ACQ_STATUS_PLL_LOCKED))
+      Log::OutWarning(fTag + "→ PLL not locked (acquisition status " + IntToHex(status) + ").");
+    if (!(status & ACQ_STATUS_BOARD_READY))
+      Log::OutWarning(fTag + "→ Board not ready (acquisition status " + IntToHex(status) + ").");
+  } catch (const std::exception& e) {
+    Log::OutWarning(fTag + std::string("→ Register access failed: ") + e.what());
+  }
 
-  
 #ifdef CAEN_DGTZ_SetCoupling
   for (auto ch : fChannelList) {
     CAEN_DGTZ_CouplingTypes_t coupling;
@@ -260,7 +353,11 @@ void Digitizer::Configure() {
   }
 #endif
 
-  Log::OutSummary("Digitizer configuration complete.");
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+  std::ostringstream took;
+  took << std::fixed << std::setprecision(1) << ms;
+  Log::OutSummary(fTag + "Digitizer configuration complete (" + std::to_string(nSent) + " settings sent, " +
+                  std::to_string(nUnchanged) + " unchanged, " + took.str() + " ms).");
 }
 void Digitizer::GetVMElibVersion() {
   std::cout << "CAEN VMElib version: "
@@ -270,6 +367,22 @@ void Digitizer::GetVMElibVersion() {
 }
 
 void Digitizer::Close() {
+  delete fEventRing;
+  fEventRing = nullptr;
+  delete fJournal;
+  fJournal = nullptr;
+  delete fBinWriter;
+  fBinWriter = nullptr;
+  delete fRunRegistry;
+  fRunRegistry = nullptr;
+  delete fRunCatalog;   // waits for the pending catalog rows
+  fRunCatalog = nullptr;
+  delete fReplay;
+  fReplay = nullptr;
+  delete fTuner;
+  fTuner = nullptr;
+  delete fHistograms;
+  fHistograms = nullptr;
   if (fVoidEvent)
     CAEN_DGTZ_FreeEvent(fHandle, &fVoidEvent);
   if (fBuffer)
@@ -283,36 +396,96 @@ void Digitizer::Close() {
 
 void Digitizer::InitAcquisition() {
   CAEN_DGTZ_ErrorCode re;
-  re = CAEN_DGTZ_MallocReadoutBuffer(fHandle, &fBuffer, &fBufferSize);
-  if (re != CAEN_DGTZ_Success) {
-    Log::OutError("Failed to allocate buffer.");
-    exit(1);
-  }
+  if (fVoidEvent)
+    CAEN_DGTZ_FreeEvent(fHandle, &fVoidEvent);
+  if (fBuffer)
+    CAEN_DGTZ_FreeReadoutBuffer(&fBuffer);
+  fVoidEvent = nullptr;
+  fBuffer = nullptr;
+  delete fEventRing;
+  fEventRing = nullptr;
 
-  re = CAEN_DGTZ_AllocateEvent(fHandle, &fVoidEvent);
-  if (re != CAEN_DGTZ_Success) {
-    Log::OutError("Failed to allocate event.");
-    exit(1);
+  if (!fReplayMode) {
+    re = CAEN_DGTZ_MallocReadoutBuffer(fHandle, &fBuffer, &fBufferSize);
+    if (re != CAEN_DGTZ_Success) {
+      throw std::runtime_error("failed to allocate the readout buffer");
+    }
+    // allocated by the CAEN library: huge pages only by advice, before the first touch
+    BufferPool::Advise(fBuffer, fBufferSize);
+    if (ThreadPlacement::IsEnabled()) {
+      // first touch from the (pinned) readout thread: pages on its NUMA node
+      ThreadPlacement::Touch(fBuffer, fBufferSize);
+      const int node = ThreadPlacement::NodeOf(fBuffer);
+      if (node >= 0 && ThreadPlacement::GetNode() >= 0 && node != ThreadPlacement::GetNode())
+        Log::OutWarning(fTag + "→ Readout buffer on NUMA node " + std::to_string(node) +
+                        ", network interface on node " + std::to_string(ThreadPlacement::GetNode()));
+      else if (node >= 0)
+        Log::OutDebug(fTag + "→ Readout buffer on NUMA node " + std::to_string(node));
+    }
+
+    re = CAEN_DGTZ_AllocateEvent(fHandle, &fVoidEvent);
+    if (re != CAEN_DGTZ_Success) {
+      throw std::runtime_error("failed to allocate the event");
+    }
+
+    fEvent = reinterpret_cast<CAEN_DGTZ_X742_EVENT_t*>(fVoidEvent);
+
+    // the buffer was sized for the ceiling: the tuner moves below it
+    delete fTuner;
+    fTuner = nullptr;
+    if (fEventsPerBLT == 0) {
+      fTuner = new ReadoutTuner(MAX_EVENTS_BLT, TUNER_START_EVENTS_BLT, fMaxTransferS);
+      CAEN_DGTZ_SetMaxNumEventsBLT(fHandle, fTuner->GetEventsPerTransfer());
+      fApplied["EventsPerBLT"] = fTuner->GetEventsPerTransfer();
+      Log::OutSummary(fTag + "→ Readout buffer " + std::to_string(fBufferSize >> 10) + " kB, events per BLT tuned during the run (from " +
+                      std::to_string(fTuner->GetEventsPerTransfer()) + ")");
+    } else
+      Log::OutSummary(fTag + "→ Readout buffer " + std::to_string(fBufferSize >> 10) + " kB, " + std::to_string(fEventsPerBLT) + " events per BLT");
   }
 
-  fEvent = reinterpret_cast<CAEN_DGTZ_X742_EVENT_t*>(fVoidEvent);
+  const MonitorSettings& mon = fConfig.GetMonitor();
+  if (mon.Enable) {
+    try {
+      const std::string shm = mon.SharedMemoryName + (fBoard > 0 ? "-b" + std::to_string(fBoard) : "");
+      fEventRing = new EventRingWriter(shm, mon.Slots, fNActiveChannels * fRecordLength);
+      fEventRing->SetRunInfo(fRunNumber, fRecordLength, fSamplingTime, fChannelList);
+      Log::OutSummary(fTag + "→ Publishing events to shared memory " + shm +
+                      " (" + std::to_string(mon.Slots) + " slots)");
+    } catch (const std::exception& e) {
+      Log::OutWarning(std::string(e.what()) + ". Online monitoring disabled.");
+      fEventRing = nullptr;
+    }
+  }
 
-  Log::OutSummary("Acquisition initialized.");
+  Log::OutSummary(fTag + "Acquisition initialized.");
 }
+// The board runs only for the software trigger of the baseline: a
+// synchronized board is put back in SW_CONTROLLED mode, where it does not
+// depend on the RUN of board 0, and every board is stopped (and its
+// buffer cleared) afterwards, so none is acquiring when the run is armed.
 void Digitizer::SetTriggerThreshold(double offset)
 {
   (void)offset;
 
+  if (!SelectAcquisitionMode(CAEN_DGTZ_SW_CONTROLLED)) {
+    Log::OutError(fTag + "Cannot select software-controlled acquisition for the baseline.");
+    return;
+  }
+  fArmed = false;
   CAEN_DGTZ_ErrorCode re = CAEN_DGTZ_SWStartAcquisition(fHandle);
   if (re != CAEN_DGTZ_Success) {
-    Log::OutError("Start acquisition failed.");
+    Log::OutError(fTag + "Start acquisition failed.");
     return;
   }
-  else {
-    Log::OutSummary("Calculating channels baseline...");
-  }
+  Log::OutSummary(fTag + "Calculating channels baseline...");
+  ReadBaseline();
+  CAEN_DGTZ_SWStopAcquisition(fHandle);
+  CAEN_DGTZ_ClearData(fHandle);
+}
 
-  re = CAEN_DGTZ_SendSWtrigger(fHandle);
+void Digitizer::ReadBaseline()
+{
+  CAEN_DGTZ_ErrorCode re = CAEN_DGTZ_SendSWtrigger(fHandle);
   if (re != CAEN_DGTZ_Success) {
     Log::OutError("Software trigger failed.");
     return;
@@ -347,15 +520,9 @@ void Digitizer::SetTriggerThreshold(double offset)
     fEvent = reinterpret_cast<CAEN_DGTZ_X742_EVENT_t*>(fVoidEvent);
 
     for (uint32_t ch : fChannelList) {
-      int group = ch / 4;
-      int local_ch = ch % 4;
-
-      if (group >= 4 || local_ch >= 4)
-        continue;
-
-      uint32_t nsamples = fEvent->DataGroup[group].ChSize[local_ch];
-      float* waveform = fEvent->DataGroup[group].DataChannel[local_ch];
-      if (nsamples < MIN_SAMPLES || nsamples > MAX_SAMPLES || waveform == nullptr) {
+      uint32_t nsamples = 0;
+      const float* waveform = X742Event::Waveform(*fEvent, ch, nsamples);
+      if (waveform == nullptr) {
         //Log::OutDebug("  → canale " + std::to_string(ch) + " skip: nsamples=" + std::to_string(nsamples));
         continue;
       }
@@ -372,140 +539,586 @@ void Digitizer::SetTriggerThreshold(double offset)
 }
 
 void Digitizer::AcquireEvents() {
-  CAEN_DGTZ_ErrorCode re = CAEN_DGTZ_SWStartAcquisition(fHandle);
-  if (re != CAEN_DGTZ_Success) {
-    Log::OutError("Start acquisition failed.");
+  // an armed board starts with board 0, from its S-IN
+  const bool armed = fArmed;
+  fArmed = false;
+  if (!armed && !StartReadout()) {
+    Log::OutError(fTag + "Start acquisition failed.");
+    if (fStartGate && IsSyncSlave())
+      fStartGate->Leave();
     return;
   }
 
-  Log::OutSummary("→ Acquisition started (waiting for external triggers)");
+  if (fReplay)
+    Log::OutSummary(fTag + "→ Replay started: " + fReplay->GetPath());
+  else
+    Log::OutSummary(fTag + (armed ? "→ Acquisition armed, starts with board 0 (waiting for external triggers)" :
+                            "→ Acquisition started (waiting for external triggers)"));
   std::cout << std::endl; // per andare a capo alla fine del run
 
+  // with several boards the first one reports the run progress
+  if (fBoard == 0) {
+    RunControl::SetRun(fRunNumber, fNEvents);
+    RunControl::SetState(RunControl::kRunning);
+  }
 
   // Start timing acquisition
   auto t_start = std::chrono::high_resolution_clock::now();
+  double pausedS = 0.0;
 
   uint32_t totalEvents = 0;
   const uint32_t maxEvents = fNEvents;
-  const int maxRetries = 5000;
-  int retry = 0;
+  const int maxRetries = 5000;    // seconds without data before giving up
+  const int pollMs = 10;          // stop/pause requests are noticed within this time
+  int idleMs = 0;
+  std::string stopReason = "NEvents";
+  fReadLatency = LatencyHistogram();
+  fWakeLatency = LatencyHistogram();
+  fBaselines = X742Event::Baselines(fChannelList, fBaselineMean);
+  fBatch.Reshape(BATCH_EVENTS, std::max<uint32_t>(1, fChannelList.size()),
+                 std::max(X742Event::kMinSamples, fRecordLength), fSaveRaw);
+  fConvert = X742Event::SelectConvert(fRecordLength, fChannelList.size());
+  LOG_OUT_DEBUG(fTag + "Conversion: " + (fConvert == X742Event::Convert ? std::string("generic loop") :
+                std::to_string(fChannelList.size()) + " x " + std::to_string(fRecordLength) + " samples kernel"));
+
+  delete fHistograms;
+  fHistograms = nullptr;
+  const HistogramSettings& hist = fConfig.GetHistograms();
+  if (hist.Enable) {
+    for (uint32_t ch : hist.CorrelationChannels)
+      if (std::find(fChannelList.begin(), fChannelList.end(), ch) == fChannelList.end())
+        Log::OutWarning(fTag + "[histograms] CorrelationChannels: channel " + std::to_string(ch) +
+                        " is not in ChannelList, ignored.");
+    HistogramService::Clear(fBoard);
+    fHistograms = new RunHistograms(fChannelList, hist, fRecordLength, fSamplingTime,
+                                    fPulsePolarity == CAEN_DGTZ_PulsePolarityNegative);
+    fLastMerge = std::chrono::steady_clock::now();
+  }
 
-  while (totalEvents < maxEvents && retry < maxRetries) {
-    re = CAEN_DGTZ_ReadData(fHandle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, fBuffer, &fBufferSize);
-    if (re != CAEN_DGTZ_Success) {
-      Log::OutError("ReadData failed.");
+  // the loop only reads the RunControl atomics: no syscalls besides the readout
+  while (totalEvents < maxEvents) {
+    if (RunControl::StopRequested()) {
+      stopReason = "Stopped";
+      break;
+    }
+
+    if (RunControl::PauseRequested()) {
+      StopReadout();
+      DrainReadout(totalEvents, maxEvents);
+      if (fBoard == 0)
+        RunControl::SetState(RunControl::kPaused);
+      Log::OutSummary(fTag + "→ Run paused after " + std::to_string(totalEvents) + " events");
+      auto t_pause = std::chrono::high_resolution_clock::now();
+      while (RunControl::PauseRequested() && !RunControl::StopRequested())
+        std::this_thread::sleep_for(std::chrono::milliseconds(pollMs));
+      pausedS += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_pause).count();
+      if (RunControl::StopRequested())
+        continue;
+      if (!RestartReadout()) {
+        Log::OutError(fTag + "Restart acquisition failed.");
+        stopReason = "ReadoutError";
+        break;
+      }
+      if (fBoard == 0)
+        RunControl::SetState(RunControl::kRunning);
+      Log::OutSummary(fTag + "→ Run resumed");
+      continue;
+    }
+
+    const int ready = ReadBlock();
+    if (ready < 0) {
+      Log::OutError(fTag + "ReadData failed.");
+      stopReason = "ReadoutError";
       break;
     }
 
-    if (fBufferSize == 0) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-      retry++;
+    if (ready == 0) {
+      if (fReplay && fReplay->IsFinished()) {
+        stopReason = "EndOfReplay";
+        break;
+      }
+      if (idleMs >= maxRetries * 1000) {
+        stopReason = "NoTriggers";
+        break;
+      }
+      Checkpoint();
+      const auto t_sleep = std::chrono::steady_clock::now();
+      std::this_thread::sleep_for(std::chrono::milliseconds(pollMs));
+      const double slept = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t_sleep).count();
+      fWakeLatency.Fill(std::max(0.0, slept - pollMs * 1000.0));
+      idleMs += pollMs;
       continue;
     }
 
-    uint32_t nEvents = 0;
-    re = CAEN_DGTZ_GetNumEvents(fHandle, fBuffer, fBufferSize, &nEvents);
+    ProcessBuffer(totalEvents, maxEvents);
+    idleMs = 0;
+  }
+
+  StopReadout();
+  if (fStartGate && IsSyncSlave())
+    fStartGate->Leave();
+  if (stopReason == "Stopped") {
+    if (fBoard == 0)
+      RunControl::SetState(RunControl::kStopping);
+    Log::OutSummary(fTag + "→ Stop requested, draining the board");
+    DrainReadout(totalEvents, maxEvents);
+  }
+
+  // Stop timing acquisition
+  auto t_end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = t_end - t_start;
+  double elapsed_s = elapsed.count() - pausedS;
+  double rate_kHz = (elapsed_s > 0) ? (totalEvents / elapsed_s / 1000.0) : 0.0;
+
+  std::cout << std::endl; 
+  std::cout << std::endl; 
+  Log::OutSummary(fTag + "Acquisition complete (" + stopReason + ").");
+  Log::OutSummary(fTag + "→ Total events recorded: " + std::to_string(totalEvents));
+  Log::OutSummary(fTag + "→ Acquisition time: " + std::to_string(elapsed_s) + " s");
+  Log::OutSummary(fTag + "→ Trigger rate: " + std::to_string(rate_kHz) + " kHz");
+  if (fTuner)
+    Log::OutSummary(fTag + "→ Readout: " + fTuner->Summary());
+  // scheduling jitter, to compare runs with and without [threads]
+  if (fReadLatency.fN > 0)
+    Log::OutSummary(fTag + "→ ReadData latency: " + fReadLatency.ToString());
+  if (fWakeLatency.fN > 0)
+    Log::OutSummary(fTag + "→ Poll wake-up delay: " + fWakeLatency.ToString());
+  if (fBoard == 0)
+    Log::OutSummary("→ Data buffers: " + BufferPool::Summary());
+ 
+  WriteRunStatistics(totalEvents, elapsed_s, rate_kHz, stopReason);
+  WriteHistograms();
+  CloseOutputFile();
+  if (fRunRegistry) {
+    try {
+      fRunRegistry->RecordStop(fRunNumber, fOutputPath, totalEvents, stopReason, fConfig.GetHash());
+    } catch (const std::exception& e) {
+      Log::OutWarning(e.what());
+    }
+  }
+  CatalogStop(totalEvents, elapsed_s, rate_kHz, stopReason);
+  if (fBoard == 0)
+    RunControl::SetState(RunControl::kIdle);
+}
+
+// SyncStart: a board in S_IN_CONTROLLED mode only runs once armed; it must
+// be armed before board 0 starts and raises its S-IN.
+void Digitizer::ArmReadout() {
+  fArmed = false;
+  if (!IsSyncSlave() || fReplay)
+    return;
+  if (!SelectAcquisitionMode(CAEN_DGTZ_S_IN_CONTROLLED))
+    throw std::runtime_error("cannot select S_IN_CONTROLLED on the digitizer at " + IntToHex(fVMEBaseAddress));
+  CAEN_DGTZ_ErrorCode re = CAEN_DGTZ_SWStartAcquisition(fHandle);
+  if (re != CAEN_DGTZ_Success)
+    throw std::runtime_error("cannot arm the digitizer at " + IntToHex(fVMEBaseAddress) +
+                             " (error code " + std::to_string(re) + ")");
+  fArmed = true;
+}
+
+// A board armed by ArmReadout() that will not acquire this run.
+void Digitizer::Disarm() {
+  if (fStartGate && IsSyncSlave())
+    fStartGate->Leave();
+  if (!fArmed)
+    return;
+  fArmed = false;
+  StopReadout();
+}
+
+// Acquisition mode through the fApplied bookkeeping of Configure().
+bool Digitizer::SelectAcquisitionMode(CAEN_DGTZ_AcqMode_t mode) {
+  if (!Changed("AcquisitionMode", mode))
+    return true;
+  if (CAEN_DGTZ_SetAcquisitionMode(fHandle, mode) == CAEN_DGTZ_Success)
+    return true;
+  fApplied.erase("AcquisitionMode");
+  return false;
+}
+
+// Board readout (SWStart/StopAcquisition, ReadData), or the replayed run.
+// For a synchronized board SWStart only arms it again (resume after a pause).
+bool Digitizer::StartReadout() {
+  if (fReplay) {
+    fReplay->Start();
+    return true;
+  }
+  return CAEN_DGTZ_SWStartAcquisition(fHandle) == CAEN_DGTZ_Success;
+}
+
+// Resume after a pause. SyncStart: the other boards are armed again before
+// board 0 restarts, as at the start of the run (Crate::Arm()).
+bool Digitizer::RestartReadout() {
+  if (!fStartGate || !fSyncStart || fReplay)
+    return StartReadout();
+  if (IsSyncSlave()) {
+    const bool armed = StartReadout();   // S_IN_CONTROLLED: waits for board 0
+    fStartGate->Arrive();
+    return armed;
+  }
+  // stopped while waiting: the acquisition loop ends the run
+  if (!fStartGate->Wait([] { return RunControl::StopRequested(); }))
+    return true;
+  return StartReadout();
+}
+
+void Digitizer::StopReadout() {
+  if (fReplay)
+    fReplay->Pause();
+  else
+    CAEN_DGTZ_SWStopAcquisition(fHandle);
+}
+
+// Read the next block: bytes from the board (fBuffer) or replayed events
+// (fReplayBlock). Returns 0 when nothing is ready, -1 on readout errors.
+int Digitizer::ReadBlock() {
+  if (fReplay) {
+    fReplayCount = fReplay->Read(fReplayBlock, REPLAY_BLOCK_EVENTS);
+    return static_cast<int>(fReplayCount);
+  }
+  const auto t0 = std::chrono::steady_clock::now();
+  CAEN_DGTZ_ErrorCode re = CAEN_DGTZ_ReadData(fHandle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, fBuffer, &fBufferSize);
+  fLastReadS = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  fReadLatency.Fill(fLastReadS * 1e6);
+  if (re != CAEN_DGTZ_Success)
+    return -1;
+  return fBufferSize > 0 ? 1 : 0;
+}
+
+// Decode every event of the last ReadBlock() into fBatch and store them.
+void Digitizer::ProcessBuffer(uint32_t& totalEvents, uint32_t maxEvents) {
+  if (fReplay) {
+    for (size_t j = 0; j < fReplayCount && totalEvents + fBatch.GetSize() < maxEvents; j++) {
+      FillReplayEvent(fReplayBlock[j]);
+      AddEvent(totalEvents, maxEvents);
+    }
+    ProcessBatch(totalEvents, maxEvents);
+    Checkpoint();
+    return;
+  }
+
+  uint32_t nEvents = 0;
+  CAEN_DGTZ_ErrorCode re = CAEN_DGTZ_GetNumEvents(fHandle, fBuffer, fBufferSize, &nEvents);
+  if (re != CAEN_DGTZ_Success) {
+    Log::OutError("GetNumEvents failed.");
+    return;
+  }
+
+  //Log::OutSummary("→ Eventi ricevuti: " + std::to_string(nEvents));
+  if (fTuner)
+    TuneReadout(nEvents);
+
+  for (uint32_t j = 0; j < nEvents && totalEvents + fBatch.GetSize() < maxEvents; j++) {
+    re = CAEN_DGTZ_GetEventInfo(fHandle, fBuffer, fBufferSize, j, &fEventInfo, &fEventPtr);
+    if (re != CAEN_DGTZ_Success || !fEventPtr) {
+      Log::OutError("GetEventInfo failed.");
+      continue;
+    }
+
+    re = CAEN_DGTZ_DecodeEvent(fHandle, fEventPtr, &fVoidEvent);
     if (re != CAEN_DGTZ_Success) {
-      Log::OutError("GetNumEvents failed.");
+      Log::OutError("DecodeEvent failed.");
       continue;
     }
 
-    //Log::OutSummary("→ Eventi ricevuti: " + std::to_string(nEvents));
+    fEvent = reinterpret_cast<CAEN_DGTZ_X742_EVENT_t*>(fVoidEvent);
+    AddEvent(totalEvents, maxEvents);
+  }
 
-    for (uint32_t j = 0; j < nEvents && totalEvents < maxEvents; j++) {
-      re = CAEN_DGTZ_GetEventInfo(fHandle, fBuffer, fBufferSize, j, &fEventInfo, &fEventPtr);
-      if (re != CAEN_DGTZ_Success || !fEventPtr) {
-        Log::OutError("GetEventInfo failed.");
-        continue;
-      }
+  ProcessBatch(totalEvents, maxEvents);
+  Checkpoint();
+}
 
-      re = CAEN_DGTZ_DecodeEvent(fHandle, fEventPtr, &fVoidEvent);
-      if (re != CAEN_DGTZ_Success) {
-        Log::OutError("DecodeEvent failed.");
-        continue;
+// Record value as applied to setting; false if it already was.
+bool Digitizer::Changed(const std::string& setting, int64_t value) {
+  auto it = fApplied.find(setting);
+  if (it != fApplied.end() && it->second == value)
+    return false;
+  fApplied[setting] = value;
+  return true;
+}
+
+// Feed the last transfer to the tuner and apply its choice; the value only
+// bounds the next transfers, the buffer already fits the ceiling.
+void Digitizer::TuneReadout(uint32_t nEvents) {
+  const bool settled = fTuner->IsSettled();
+  if (!fTuner->AddTransfer(fBufferSize, nEvents, fLastReadS)) {
+    if (fTuner->IsSettled() && !settled)
+      Log::OutSummary(fTag + "→ Readout tuned: " + fTuner->Summary());
+    return;
+  }
+
+  const uint32_t value = fTuner->GetEventsPerTransfer();
+  if (CAEN_DGTZ_SetMaxNumEventsBLT(fHandle, value) != CAEN_DGTZ_Success) {
+    Log::OutWarning(fTag + "SetMaxNumEventsBLT(" + std::to_string(value) + ") failed, readout tuning disabled.");
+    delete fTuner;
+    fTuner = nullptr;
+    fApplied.erase("EventsPerBLT");
+    return;
+  }
+  fApplied["EventsPerBLT"] = value;
+  if (fTuner->IsSettled())
+    Log::OutSummary(fTag + "→ Readout tuned: " + fTuner->Summary());
+  else
+    LOG_OUT_DEBUG(fTag + "Readout tuner: trying " + fTuner->Summary());
+}
+
+// Baseline correction of the decoded event in fEvent / fEventInfo into the
+// next event of fBatch. A full batch, or one whose rows are too short for
+// the event, is stored first.
+void Digitizer::AddEvent(uint32_t& totalEvents, uint32_t maxEvents) {
+  const uint32_t length = X742Event::Length(*fEvent, fChannelList);
+  if (fBatch.IsFull() || length > fBatch.GetMaxSamples()) {
+    ProcessBatch(totalEvents, maxEvents);
+    if (length > fBatch.GetMaxSamples())
+      fBatch.Reshape(fBatch.GetCapacity(), fBatch.GetNChannels(), length, fSaveRaw);
+  }
+
+  const uint32_t e = fBatch.Append(totalEvents + fBatch.GetSize(), fEventInfo.TriggerTimeTag);
+  fConvert(*fEvent, fChannelList, fBaselines, fBatch, e);
+}
+
+// Output of the events in fBatch, each stage taking the whole batch; the
+// batch is empty afterwards.
+void Digitizer::ProcessBatch(uint32_t& totalEvents, uint32_t maxEvents) {
+  const uint32_t nevents = fBatch.GetSize();
+  if (nevents == 0)
+    return;
+
+  if (fAlignment)
+    for (uint32_t e = 0; e < nevents && fBatch.GetEventNumber(e) < TimeAlignment::kTriggers; e++)
+      fAlignment->Add(fBoard, fBatch.GetEventNumber(e), fBatch.GetTriggerTimeTag(e));
+
+  // === Scrittura BIN / HDF5 ===
+  if (fBinWriter != nullptr) {
+    fBinWriter->WriteBatch(fBatch);
+  } else if (fOutputFormat == kHDF5 && fH5Writer != nullptr) {
+    try {
+      fH5Writer->WriteBatch(fBatch);
+    } catch (const H5::Exception& e) {
+      Log::OutError("HDF5 write error: " + std::string(e.getDetailMsg()));
+    }
+  } else if (fOutputFormat == kHDF5 && fH5File != nullptr) {
+    // one dataset per event: flat copies
+    for (uint32_t e = 0; e < nevents; e++) {
+      fBatch.Gather(e, fSamplesCorr, fSamplesRaw);
+      try {
+        HDF5Writer::WritePerEvent(*fH5File, fBatch.GetEventNumber(e), fSamplesCorr, fSaveRaw ? &fSamplesRaw : nullptr);
+      } catch (const H5::Exception& ex) {
+        Log::OutError("HDF5 write error: " + std::string(ex.getDetailMsg()));
       }
+    }
+  }
 
-      fEvent = reinterpret_cast<CAEN_DGTZ_X742_EVENT_t*>(fVoidEvent);
+  if (fJournal)
+    fJournal->AddBatch(fBatch);
 
-      std::vector<int16_t> allSamplesCorr;
-      std::vector<uint16_t> allSamplesRaw;
+  if (fEventRing)
+    fEventRing->PublishBatch(fBatch);
 
-      for (uint32_t ch : fChannelList) {
-        int group = ch / 4;
-        int local_ch = ch % 4;
+  if (fHistograms) {
+    fHistograms->Fill(fBatch);
+    const auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - fLastMerge).count() >= fConfig.GetHistograms().MergeIntervalS) {
+      HistogramService::Merge(fBoard, *fHistograms);
+      fLastMerge = now;
+    }
+  }
 
-        if (group >= 4 || local_ch >= 4)
-          continue;
+  for (uint32_t e = 0; e < nevents && RunControl::DumpPending(); e++)
+    if (RunControl::ConsumeDump())
+      DumpEvent(e);
 
-        uint32_t nsamples = fEvent->DataGroup[group].ChSize[local_ch];
-        float* waveform = fEvent->DataGroup[group].DataChannel[local_ch];
+  totalEvents += nevents;
+  fPendingCheckpoint += nevents;
+  fBatch.Clear();
 
-        if (nsamples < MIN_SAMPLES || nsamples > MAX_SAMPLES || waveform == nullptr) {
-	  //  Log::OutDebug("  → ch" + std::to_string(ch) + " [INVALID] nsamples=" + std::to_string(nsamples));
-          continue;
-        }
+  // Aggiorna in-place il contatore eventi nella stessa riga (senza newline)
+  if (fBoard == 0) {
+    std::cout << "\r→ Events decoded: " << std::setw(6) << totalEvents
+		  << "/" << maxEvents << std::flush;
+    RunControl::SetEvents(totalEvents);
+  }
+}
 
-        double baseline = fBaselineMean.count(ch) ? fBaselineMean[ch] : 0.0;
+// Make everything written so far survive a crash: append the pending events
+// to the journal (fdatasync) and flush the HDF5 file, which also publishes
+// them to SWMR readers. Done every [output] CheckpointEvents events or
+// CheckpointIntervalS seconds.
+void Digitizer::Checkpoint(bool force) {
+  if ((fJournal == nullptr && fH5Writer == nullptr && fBinWriter == nullptr) || fPendingCheckpoint == 0)
+    return;
 
-        for (uint32_t i = 0; i < nsamples; ++i) {
-          float corrected = waveform[i] - baseline;
-          allSamplesCorr.push_back(static_cast<int16_t>(corrected));
-          if (fSaveRaw)
-            allSamplesRaw.push_back(static_cast<uint16_t>(waveform[i]));
-        }
+  const OutputSettings& out = fConfig.GetOutput();
+  auto now = std::chrono::steady_clock::now();
+  if (!force && (out.CheckpointEvents == 0 || fPendingCheckpoint < out.CheckpointEvents) &&
+      std::chrono::duration<double>(now - fLastCheckpoint).count() < out.CheckpointIntervalS)
+    return;
 
-	//      Log::OutDebug("  → ch" + std::to_string(ch) + " [OK] nsamples=" + std::to_string(nsamples));
-      }
+  const uint32_t nevents = fPendingCheckpoint;
+  fPendingCheckpoint = 0;
+  if (fJournal && !fJournal->Commit())
+    Log::OutWarning("→ Journal write failed (" + fJournal->GetPath() + "), crash recovery may be incomplete.");
+  if (fBinWriter && !fBinWriter->Flush())
+    Log::OutError("BIN write error on " + fOutputPath);
+  if (fH5File != nullptr) {
+    try {
+      if (fH5Writer)
+        fH5Writer->Flush();
+      fH5File->flush(H5F_SCOPE_GLOBAL);
+    } catch (const H5::Exception& e) {
+      Log::OutError("HDF5 flush error: " + std::string(e.getDetailMsg()));
+    }
+  }
+  fLastCheckpoint = now;
+  LOG_OUT_DEBUG("Checkpoint: " + std::to_string(nevents) + " events committed.");
+}
 
-      // Aggiorna in-place il contatore eventi nella stessa riga (senza newline)
-      std::cout << "\r→ Events decoded: " << std::setw(6) << totalEvents + 1
-		<< "/" << maxEvents << std::flush;
-
-      // === Scrittura HDF5 ===
-      if (fOutputFormat == kHDF5 && fH5File != nullptr) {
-        try {
-          std::string dsname = "/events/event" + std::to_string(totalEvents);
-          hsize_t dim_corr = allSamplesCorr.size();
-          H5::DataSpace dataspace_corr(1, &dim_corr);
-          H5::DataSet ds_corr = fH5Group->createDataSet(dsname, H5::PredType::NATIVE_INT16, dataspace_corr);
-          ds_corr.write(allSamplesCorr.data(), H5::PredType::NATIVE_INT16);
-
-          if (fSaveRaw) {
-            std::string rawname = "/events_raw/event" + std::to_string(totalEvents);
-            hsize_t dim_raw = allSamplesRaw.size();
-            H5::DataSpace dataspace_raw(1, &dim_raw);
-            H5::Group rawGroup = fH5File->openGroup("/events_raw");
-            H5::DataSet ds_raw = rawGroup.createDataSet(rawname, H5::PredType::NATIVE_UINT16, dataspace_raw);
-            ds_raw.write(allSamplesRaw.data(), H5::PredType::NATIVE_UINT16);
-          }
-
-        } catch (const H5::Exception& e) {
-          Log::OutError("HDF5 write error: " + std::string(e.getDetailMsg()));
-        }
-      }
+// After SWStopAcquisition the board may still hold triggered events: read
+// them out, bounded by [control] ShutdownTimeoutS.
+void Digitizer::DrainReadout(uint32_t& totalEvents, uint32_t maxEvents) {
+  // a replayed run holds nothing in flight
+  if (fReplay)
+    return;
 
-      totalEvents++;
+  const auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(fConfig.GetControl().ShutdownTimeoutS));
+
+  while (totalEvents < maxEvents) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      Log::OutWarning("→ Shutdown timeout reached, events still in the board are discarded.");
+      return;
     }
+    if (ReadBlock() <= 0)
+      return;
+    ProcessBuffer(totalEvents, maxEvents);
+  }
+}
 
-    retry = 0;
+// Run-control "dump N": short per-channel summary of event e of fBatch.
+void Digitizer::DumpEvent(uint32_t e) {
+  Log::OutSummary("Event " + std::to_string(fBatch.GetEventNumber(e)) + ", TTT " +
+                  std::to_string(fBatch.GetTriggerTimeTag(e)));
+  const uint32_t nsamples = fBatch.GetNSamples(e);
+  uint32_t i = 0;
+  for (uint32_t ch : fChannelList) {
+    if (!(fBatch.GetChannelMask(e) & (1u << ch)))
+      continue;
+    auto range = std::minmax_element(fBatch.Corr(e, i), fBatch.Corr(e, i) + nsamples);
+    Log::OutSummary("    ch" + std::to_string(ch) + ": min " + std::to_string(*range.first) +
+                    ", max " + std::to_string(*range.second));
+    i++;
   }
+}
 
-  // Stop timing acquisition
-  auto t_end = std::chrono::high_resolution_clock::now();
-  std::chrono::duration<double> elapsed = t_end - t_start;
-  double elapsed_s = elapsed.count();
-  double rate_kHz = (elapsed_s > 0) ? (totalEvents / elapsed_s / 1000.0) : 0.0;
+void Digitizer::WriteRunStatistics(uint32_t nevents, double elapsed_s, double rate_kHz,
+                                   const std::string& stopreason) {
+  if (fBinWriter != nullptr) {
+    fBinWriter->SetRunStatistics(elapsed_s, rate_kHz, stopreason);
+    return;
+  }
+  if (fOutputFormat != kHDF5 || fH5File == nullptr)
+    return;
 
-  CAEN_DGTZ_SWStopAcquisition(fHandle);
+  if (fH5Writer) {
+    try {
+      fH5Writer->Flush();
+      if (fH5Writer->GetCompressionRatio() > 0) {
+        std::ostringstream ratio;
+        ratio << std::fixed << std::setprecision(2) << fH5Writer->GetCompressionRatio();
+        Log::OutSummary(fTag + "→ Samples compressed " + ratio.str() + ":1");
+        if (fBoard == 0 && TaskPool::GetShared())
+          Log::OutSummary("→ Compression pool: " + TaskPool::GetShared()->Summary());
+      }
+    } catch (const H5::Exception& e) {
+      Log::OutError("HDF5 write failed: " + std::string(e.getDetailMsg()));
+    }
+  }
 
-  std::cout << std::endl; 
-  std::cout << std::endl; 
-  Log::OutSummary("Acquisition complete.");
-  Log::OutSummary("→ Total events recorded: " + std::to_string(totalEvents));
-  Log::OutSummary("→ Acquisition time: " + std::to_string(elapsed_s) + " s");
-  Log::OutSummary("→ Trigger rate: " + std::to_string(rate_kHz) + " kHz");
- 
-  CloseOutputFile();
+  // attributes cannot be added in SWMR mode: reopen the file normally; on
+  // failure the handles are released here and the file is left as flushed
+  if (fH5Writer && fConfig.GetOutput().SWMR) {
+    delete fH5Writer;
+    fH5Writer = nullptr;
+    std::unique_ptr<H5::Group> group(fH5Group);
+    std::unique_ptr<H5::H5File> file(fH5File);
+    fH5Group = nullptr;
+    fH5File = nullptr;
+    try {
+      group->close();
+      file->close();
+      file.reset(new H5::H5File(fOutputPath, H5F_ACC_RDWR));
+      group.reset(new H5::Group(file->openGroup("/events")));
+    } catch (const H5::Exception& e) {
+      Log::OutError("Cannot reopen " + fOutputPath + " after SWMR: " + std::string(e.getDetailMsg()) +
+                    ". Run statistics not written.");
+      return;
+    }
+    fH5File = file.release();
+    fH5Group = group.release();
+  }
+
+  try {
+    H5::Group header = fH5File->openGroup("/config");
+    header.createAttribute("NEventsRecorded", H5::PredType::NATIVE_UINT,
+                           H5::DataSpace()).write(H5::PredType::NATIVE_UINT, &nevents);
+    header.createAttribute("AcquisitionTime", H5::PredType::NATIVE_DOUBLE,
+                           H5::DataSpace()).write(H5::PredType::NATIVE_DOUBLE, &elapsed_s);
+    header.createAttribute("TriggerRate_kHz", H5::PredType::NATIVE_DOUBLE,
+                           H5::DataSpace()).write(H5::PredType::NATIVE_DOUBLE, &rate_kHz);
+    header.createAttribute("StopReason", H5::StrType(0, H5T_VARIABLE),
+                           H5::DataSpace()).write(H5::StrType(0, H5T_VARIABLE), stopreason);
+    // time tag of board 0 for the same trigger = TriggerTimeTag - TimeOffset
+    if (fAlignment && fAlignment->IsComplete()) {
+      const int64_t offset = fAlignment->GetOffset(fBoard);
+      const uint8_t aligned = fAlignment->IsAligned();
+      header.createAttribute("Board", H5::PredType::NATIVE_UINT,
+                             H5::DataSpace()).write(H5::PredType::NATIVE_UINT, &fBoard);
+      header.createAttribute("TimeOffset", H5::PredType::NATIVE_INT64,
+                             H5::DataSpace()).write(H5::PredType::NATIVE_INT64, &offset);
+      header.createAttribute("TimeAligned", H5::PredType::NATIVE_UINT8,
+                             H5::DataSpace()).write(H5::PredType::NATIVE_UINT8, &aligned);
+    }
+  } catch (const H5::Exception& e) {
+    Log::OutError("Cannot write run statistics: " + std::string(e.getDetailMsg()));
+  }
+}
+
+// Final merge of the run histograms, written to /histograms of the HDF5
+// file or, for BIN output, to "<run>.hist.h5" next to it. The merged copy
+// stays readable by "daq-ctl histograms" until the next run starts.
+void Digitizer::WriteHistograms() {
+  if (fHistograms == nullptr)
+    return;
+  HistogramService::Merge(fBoard, *fHistograms);
+  RunHistograms merged = *fHistograms;
+  if (!HistogramService::Get(fBoard, merged))
+    return;
+  Log::OutSummary(fTag + "→ Histograms of " + std::to_string(merged.GetEvents()) + " events:");
+  std::istringstream lines(merged.Summary());
+  for (std::string line; std::getline(lines, line);)
+    Log::OutSummary(fTag + "    " + line);
+
+  if (fOutputFormat == kHDF5) {
+    if (fH5File == nullptr)
+      return;
+    try {
+      HDF5Writer::WriteHistograms(*fH5File, merged);
+    } catch (const H5::Exception& e) {
+      Log::OutError("Cannot write histograms: " + std::string(e.getDetailMsg()));
+    }
+  } else if (fOutputFormat == kBIN && !fOutputPath.empty()) {
+    const size_t dot = fOutputPath.rfind('.');
+    const std::string path = fOutputPath.substr(0, dot) + ".hist.h5";
+    try {
+      H5::H5File file(path, H5F_ACC_TRUNC);
+      HDF5Writer::WriteHistograms(file, merged);
+      Log::OutSummary(fTag + "→ Histograms written to " + path);
+    } catch (const H5::Exception& e) {
+      Log::OutError("Cannot write histograms to " + path + ": " + std::string(e.getDetailMsg()));
+    }
+  }
 }
 
 long Digitizer::GetTime() {
@@ -523,48 +1136,17 @@ bool Digitizer::CheckAccepted(std::map<uint32_t,uint32_t>& nAccepted) {
 
 
 void Digitizer::PrepareOutput() {
-  if (fOutputFormat != kHDF5)
+  if (fOutputFormat != kHDF5 && fOutputFormat != kBIN)
     return;
 
-  if (!std::filesystem::exists(fOutputDir)) {
-    Log::OutError("Output directory does not exist: " + fOutputDir);
-    exit(1);
-  }
+  // === Numero di run: dal registro, o quello della scheda 0 ===
+  if (!fRunAllocated)
+    AllocateRunNumber();
+  fRunAllocated = false;
 
   std::string base = fOutputFileName;
   std::ostringstream fileStream;
 
-  // === Trova il prossimo numero di run, controllando anche i file .h5.gz ===
-  int maxRun = -1;
-  try {
-    for (const auto& entry : std::filesystem::directory_iterator(fOutputDir)) {
-      if (!entry.is_regular_file())
-        continue;
-
-      std::string name = entry.path().filename().string();
-
-      // Filtra solo file che iniziano con il nome base e contengono ".h5" o ".h5.gz"
-      if (name.rfind(base + "_", 0) == 0 &&
-          (name.find(".h5") != std::string::npos)) {
-
-        // cerca pattern tipo "_0123"
-        size_t pos = name.find("_");
-        if (pos != std::string::npos && name.size() >= pos + 5) {
-          std::string runStr = name.substr(pos + 1, 4);
-          if (std::all_of(runStr.begin(), runStr.end(), ::isdigit)) {
-            int runVal = std::stoi(runStr);
-            if (runVal > maxRun)
-              maxRun = runVal;
-          }
-        }
-      }
-    }
-  } catch (...) {
-    Log::OutWarning("→ Unable to scan existing runs, defaulting to RunNumber = 0.");
-  }
-
-  fRunNumber = maxRun + 1;
-
   // === Costruisci il nome del file ===
   std::string rateTag = "_unkRate";
   if (fSamplingRateStr == "5GHz") rateTag = "_5Gs";
@@ -583,18 +1165,66 @@ void Digitizer::PrepareOutput() {
 
   fileStream << fOutputDir << "/" << base << "_"
              << std::setw(4) << std::setfill('0') << fRunNumber
-             << rateTag << postTrigTag.str() << ".h5";
+             << rateTag << postTrigTag.str() << fBoardSuffix << (fOutputFormat == kBIN ? ".bin" : ".h5");
 
   fOutputPath = fileStream.str();
-  Log::OutSummary("→ HDF5 output path selected: " + fOutputPath);
+  Log::OutSummary("→ Output path selected: " + fOutputPath);
+  try {
+    fRunRegistry->RecordStart(fRunNumber, fOutputPath, fConfig.GetHash());
+  } catch (const std::exception& e) {
+    Log::OutWarning(e.what());
+  }
+  CatalogStart();
+
+  if (fEventRing)
+    fEventRing->SetRunInfo(fRunNumber, fRecordLength, fSamplingTime, fChannelList);
+
+  std::string trig_mode = fExternalTrigger ? "External" :
+                          (fSelfTrigger ? "Self" : "Disabled");
+
+  // === File BIN (vedi RunBinary.h) ===
+  if (fOutputFormat == kBIN) {
+    RunBinary::FileHeader header = {};
+    header.fNChannels = fNActiveChannels;
+    header.fNSamples = fRecordLength;
+    for (uint32_t i = 0; i < fNActiveChannels && i < RunBinary::kMaxChannels; i++)
+      header.fChannelList[i] = fChannelList[i];
+    header.fHasRaw = fSaveRaw;
+    header.fRunNumber = fRunNumber;
+    header.fPostTriggerSize = fPostTriggerSize;
+    header.fSamplingTime = fSamplingTime;
+    std::strncpy(header.fSamplingRate, fSamplingRateStr.c_str(), sizeof(header.fSamplingRate) - 1);
+    std::strncpy(header.fTriggerMode, trig_mode.c_str(), sizeof(header.fTriggerMode) - 1);
+    const OutputSettings& out = fConfig.GetOutput();
+    const size_t blocksize = size_t(out.BlockSizeMB) << 20;
+    try {
+      try {
+        fBinWriter = new RunBinaryWriter(fOutputPath, header, out.WriteMode, out.WriteEngine, blocksize, out.WriteBuffers);
+      } catch (const std::exception& e) {
+        if (out.WriteMode == "buffered" && out.WriteEngine == "auto")
+          throw;
+        Log::OutWarning(std::string(e.what()) + ", falling back to buffered writes");
+        fBinWriter = new RunBinaryWriter(fOutputPath, header, "buffered", "auto", blocksize, out.WriteBuffers);
+      }
+    } catch (const std::exception& e) {
+      AbortOutput(e.what());
+    }
+    fPendingCheckpoint = 0;
+    fLastCheckpoint = std::chrono::steady_clock::now();
+    return;
+  }
 
   // === Creazione file HDF5 ===
+  std::string step = "creating " + fOutputPath;
   try {
-    fH5File = new H5::H5File(fOutputPath, H5F_ACC_TRUNC);
+    const OutputSettings& out = fConfig.GetOutput();
+    const bool swmr = out.SWMR;
+    fH5File = swmr ? HDF5Writer::CreateFile(fOutputPath) : new H5::H5File(fOutputPath, H5F_ACC_TRUNC);
     fH5Group = new H5::Group(fH5File->createGroup("/events"));
     fH5File->createGroup("/events_raw");
 
     // === Gruppo di configurazione ===
+    step = "writing /config";
     H5::Group header = fH5File->createGroup("/config");
 
     header.createAttribute("RunNumber", H5::PredType::NATIVE_INT,
@@ -610,10 +1240,11 @@ void Digitizer::PrepareOutput() {
     header.createAttribute("OutputFormat", H5::StrType(0, H5T_VARIABLE),
                            H5::DataSpace()).write(H5::StrType(0, H5T_VARIABLE), std::string("HDF5"));
 
-    std::string trig_mode = fExternalTrigger ? "External" :
-                            (fSelfTrigger ? "Self" : "Disabled");
     header.createAttribute("TriggerMode", H5::StrType(0, H5T_VARIABLE),
                            H5::DataSpace()).write(H5::StrType(0, H5T_VARIABLE), trig_mode);
+    if (fReplay)
+      header.createAttribute("ReplayOf", H5::StrType(0, H5T_VARIABLE),
+                             H5::DataSpace()).write(H5::StrType(0, H5T_VARIABLE), fReplay->GetPath());
 
     if (!fChannelList.empty()) {
       hsize_t dim = fChannelList.size();
@@ -623,18 +1254,272 @@ void Digitizer::PrepareOutput() {
       chattr.write(H5::PredType::NATIVE_UINT, fChannelList.data());
     }
 
+    // SWMR: every object must exist before the writer switches mode
+    if (swmr || out.Compression > 0) {
+      step = "creating the appendable datasets";
+      fH5Writer = new HDF5Writer(*fH5File, fSaveRaw, fNActiveChannels * fRecordLength,
+                                 out.Compression, out.CompressionThreads);
+      if (out.Compression > 0)
+        Log::OutSummary("→ Chunk compression: deflate level " + std::to_string(out.Compression));
+    }
+    if (swmr) {
+      step = "switching to SWMR";
+      fH5Writer->StartSWMR();
+      Log::OutSummary("→ SWMR enabled: readers can follow " + fOutputPath + " during the run");
+    }
+    fPendingCheckpoint = 0;
+    fLastCheckpoint = std::chrono::steady_clock::now();
+
+    // SWMR files are consistent after a crash up to the last flush already
+    if (out.Journal && !swmr && out.CheckpointEvents > 0) {
+      RunJournalInfo info;
+      info.RunNumber = fRunNumber;
+      info.RecordLength = fRecordLength;
+      info.PostTriggerSize = fPostTriggerSize;
+      info.SamplingTime = fSamplingTime;
+      info.SamplingRate = fSamplingRateStr;
+      info.TriggerMode = trig_mode;
+      info.SaveRaw = fSaveRaw;
+      info.ChannelList = fChannelList;
+      try {
+        fJournal = new RunJournalWriter(fOutputPath + ".journal", info);
+      } catch (const std::exception& e) {
+        Log::OutWarning(std::string(e.what()) + ". Running without crash recovery.");
+        fJournal = nullptr;
+      }
+    }
+
+  } catch (const std::exception& e) {
+    AbortOutput("HDF5 output setup failed while " + step + ": " + std::string(e.what()));
+  } catch (const H5::Exception& e) {
+    AbortOutput("HDF5 output setup failed while " + step + ": " + std::string(e.getDetailMsg()));
+  }
+}
+
+// Next run number from the registry of the output directory (see
+// RunRegistry.h), for the next PrepareOutput().
+int Digitizer::AllocateRunNumber() {
+  if (fOutputFormat != kHDF5 && fOutputFormat != kBIN)
+    return fRunNumber;
+  if (!std::filesystem::exists(fOutputDir))
+    throw std::runtime_error("output directory does not exist: " + fOutputDir);
+
+  delete fRunRegistry;
+  fRunRegistry = new RunRegistry(fOutputDir, fOutputFileName);
+  fRunNumber = fRunRegistry->Allocate();      // throws std::runtime_error
+  fRunAllocated = true;
+  return fRunNumber;
+}
+
+// Run number allocated by board 0; the run is recorded in the same registry.
+void Digitizer::SetRunNumber(int run) {
+  delete fRunRegistry;
+  fRunRegistry = new RunRegistry(fOutputDir, fOutputFileName);
+  fRunNumber = run;
+  fRunAllocated = true;
+}
+
+// PrepareOutput() failed once the run number was handed out: drop what was
+// created, close the registry and catalog entries of the run, and throw
+// error. The board does not acquire this run.
+void Digitizer::AbortOutput(const std::string& error) {
+  try {
+    delete fH5Writer;
+    delete fH5Group;
+    delete fH5File;
+  } catch (const H5::Exception&) {
+    // the file is abandoned anyway
+  }
+  fH5Writer = nullptr;
+  fH5Group = nullptr;
+  fH5File = nullptr;
+  delete fJournal;
+  fJournal = nullptr;
+  delete fBinWriter;
+  fBinWriter = nullptr;
+
+  if (fRunRegistry) {
+    try {
+      fRunRegistry->RecordStop(fRunNumber, fOutputPath, 0, "OutputError", fConfig.GetHash());
+    } catch (const std::exception& e) {
+      Log::OutWarning(e.what());
+    }
+  }
+  CatalogStop(0, 0.0, 0.0, "OutputError");
+  throw std::runtime_error(error);
+}
+
+
+// Catalog row of the run being started (see RunCatalog.h); the catalog is
+// (re)opened here because OutputDir may change with a reconfigure.
+void Digitizer::CatalogStart() {
+  const std::string name = fConfig.GetOutput().RunCatalog;
+  const std::string path = name.empty() || name[0] == '/' ? name : fOutputDir + "/" + name;
+  if (fRunCatalog && fRunCatalog->GetPath() != path) {
+    delete fRunCatalog;
+    fRunCatalog = nullptr;
+  }
+  if (path.empty())
+    return;
+  if (!fRunCatalog) {
+    try {
+      fRunCatalog = new RunCatalog(path);
+    } catch (const std::exception& e) {
+      Log::OutWarning(std::string(e.what()) + ". Running without run catalog.");
+      return;
+    }
+  }
+
+  fRunRecord = RunRecord();
+  fRunRecord.Base = fOutputFileName + fBoardSuffix;      // one row per file
+  fRunRecord.Run = fRunNumber;
+  fRunRecord.Path = std::filesystem::absolute(fOutputPath).string();
+  fRunRecord.Format = fConfig.GetOutput().OutputFormat;
+  fRunRecord.Status = "running";
+  fRunRecord.StartTime = std::time(nullptr);
+  fRunRecord.SamplingRate = fSamplingRateStr;
+  fRunRecord.SamplingTime = fSamplingTime;
+  fRunRecord.RecordLength = fRecordLength;
+  fRunRecord.PostTriggerSize = fPostTriggerSize;
+  fRunRecord.TriggerMode = fExternalTrigger ? "External" : (fSelfTrigger ? "Self" : "Disabled");
+  for (size_t i = 0; i < fChannelList.size(); i++)
+    fRunRecord.ChannelList += (i ? "," : "") + std::to_string(fChannelList[i]);
+  fRunRecord.SaveRaw = fSaveRaw;
+  fRunRecord.ConfigHash = fConfig.GetHash();
+  fRunRecord.ConfigFile = fConfig.GetFileName();
+  fRunCatalog->Submit(fRunRecord);
+}
+
+void Digitizer::CatalogStop(uint32_t nevents, double elapsed_s, double rate_kHz,
+                            const std::string& stopreason) {
+  if (!fRunCatalog || fRunRecord.Run != fRunNumber)
+    return;
+  fRunRecord.Path = std::filesystem::absolute(fOutputPath).string();
+  fRunRecord.Status = "done";
+  fRunRecord.StopTime = std::time(nullptr);
+  fRunRecord.NEvents = nevents;
+  fRunRecord.AcquisitionTime = elapsed_s;
+  fRunRecord.TriggerRate_kHz = rate_kHz;
+  fRunRecord.StopReason = stopreason;
+  std::error_code ec;
+  const auto size = std::filesystem::file_size(fOutputPath, ec);
+  fRunRecord.FileSize = ec ? 0 : size;
+  fRunCatalog->Submit(fRunRecord);
+}
+
+// [replay]: open the next file of Files and take its acquisition
+// parameters, so that the output describes the replayed data.
+void Digitizer::PrepareReplay() {
+  const ReplaySettings& rep = fConfig.GetReplay();
+  if (rep.Files.empty())
+    throw std::runtime_error("[replay] Files is empty");
+  const std::string& file = rep.Files[fReplayIndex++ % rep.Files.size()];
+
+  delete fReplay;
+  fReplay = nullptr;
+  try {
+    fReplay = new RunReplay(file, rep.Speed, rep.Loop);
   } catch (const H5::Exception& e) {
-    Log::OutError("HDF5 file creation failed: " + std::string(e.getDetailMsg()));
-    exit(1);
+    throw std::runtime_error("cannot replay " + file + ": " + std::string(e.getDetailMsg()));
+  } catch (const std::exception& e) {
+    throw std::runtime_error("cannot replay " + file + ": " + std::string(e.what()));
   }
+
+  const uint32_t maxSamples = fNActiveChannels * fRecordLength;
+  fChannelList = fReplay->GetChannelList();
+  fNActiveChannels = fChannelList.size();
+  fChannelMask = 0;
+  for (uint32_t ch : fChannelList)
+    fChannelMask |= (1 << ch);
+  fRecordLength = fReplay->GetRecordLength();
+  fPostTriggerSize = fReplay->GetPostTriggerSize();
+  fSamplingRateStr = fReplay->GetSamplingRate();
+  fSamplingTime = fReplay->GetSamplingTime();
+  fExternalTrigger = fReplay->GetTriggerMode() == "External";
+  fSelfTrigger = fReplay->GetTriggerMode() == "Self";
+
+  fSaveRaw = fConfig.GetOutput().SaveRaw && fReplay->HasRaw();
+  if (fConfig.GetOutput().SaveRaw && !fReplay->HasRaw())
+    Log::OutWarning("→ " + file + " has no raw samples: SaveRaw ignored.");
+
+  // the waveforms of the replay are rebuilt around the original baseline
+  fBaselineMean.clear();
+  for (uint32_t ch : fChannelList)
+    fBaselineMean[ch] = fReplay->GetBaseline(ch);
+
+  std::ostringstream speed;
+  if (rep.Speed > 0)
+    speed << "x" << rep.Speed << (fReplay->HasTiming() ? " of the trigger time tags" : " of the mean rate");
+  else
+    speed << "as fast as possible";
+  Log::OutSummary("→ Replaying " + file + " (" + fReplay->GetLayout() + ", run " +
+                  std::to_string(fReplay->GetRunNumber()) + ", " + std::to_string(fReplay->GetNEvents()) +
+                  " events, " + speed.str() + (rep.Loop ? ", looping" : "") + ")");
+
+  // the monitor ring is sized for the channels and record length
+  if (fConfig.GetMonitor().Enable && (!fEventRing || fNActiveChannels * fRecordLength > maxSamples))
+    InitAcquisition();
 }
 
+// Present a replayed event as the decoder would: its float waveforms in
+// an X742 event.
+void Digitizer::FillReplayEvent(ReplayEvent& event) {
+  std::memset(&fReplayEvent, 0, sizeof(fReplayEvent));
+
+  size_t offset = 0;
+  for (uint32_t ch : fChannelList) {
+    if (!(event.ChannelMask & (1u << ch)) || offset + event.NSamples > event.Waveforms.size())
+      continue;
+    float* waveform = event.Waveforms.data() + offset;
+    offset += event.NSamples;
+
+    int group, local_ch;
+    if (!X742Event::Slot(ch, group, local_ch))
+      continue;
+    fReplayEvent.GrPresent[group] = 1;
+    fReplayEvent.DataGroup[group].ChSize[local_ch] = event.NSamples;
+    fReplayEvent.DataGroup[group].DataChannel[local_ch] = waveform;
+  }
+
+  fEvent = &fReplayEvent;
+  fEventInfo.TriggerTimeTag = event.TriggerTimeTag;
+}
 
 void Digitizer::CloseOutputFile() {
-  if (fOutputFormat != kHDF5 || fH5File == nullptr)
+  // BIN files stay uncompressed: they are meant to be mapped in place
+  if (fBinWriter != nullptr) {
+    if (fBinWriter->Close()) {
+      const SinkStatistics stats = fBinWriter->GetStatistics();
+      std::ostringstream rate;
+      rate << std::fixed << std::setprecision(1) << stats.MBps();
+      Log::OutSummary("→ BIN file closed: " + fOutputPath + " (" + std::to_string(fBinWriter->GetNEvents()) + " events)");
+      Log::OutSummary("→ Disk writes (" + fBinWriter->GetWriteEngine() + ", " + fBinWriter->GetWriteMode() + "): " + rate.str() + " MB/s over " +
+                      std::to_string(stats.fWrites) + " blocks, latency " + stats.fLatency.ToString());
+    } else
+      Log::OutError("→ BIN file close failed: " + fOutputPath);
+    delete fBinWriter;
+    fBinWriter = nullptr;
     return;
+  }
+
+  if (fOutputFormat != kHDF5)
+    return;
+  if (fH5File == nullptr) {
+    // the file was lost (see WriteRunStatistics): the journal still holds the run
+    if (fJournal) {
+      Log::OutWarning("→ " + fOutputPath + " not closed cleanly, journal kept for daq-recover: " + fJournal->GetPath());
+      fJournal->Close(false);
+      delete fJournal;
+      fJournal = nullptr;
+    }
+    return;
+  }
+
+  Checkpoint(true);
 
   try {
+    delete fH5Writer;
+    fH5Writer = nullptr;
     fH5Group->close();
     fH5File->close();
 
@@ -643,6 +1528,21 @@ void Digitizer::CloseOutputFile() {
     fH5Group = nullptr;
     fH5File = nullptr;
 
+    // the file is complete: the journal is not needed any more
+    if (fJournal) {
+      fJournal->Close(true);
+      delete fJournal;
+      fJournal = nullptr;
+    }
+
+    // with chunk compression the file is compressed already and stays
+    // readable by the HDF5 tools; a SWMR file stays where its readers
+    // follow it
+    if (fConfig.GetOutput().Compression > 0 || fConfig.GetOutput().SWMR) {
+      Log::OutSummary("→ HDF5 file closed: " + fOutputPath);
+      return;
+    }
+
     // Compressione con gzip
     std::string originalFile = fOutputPath;
     std::string gzippedFile = fOutputPath + ".gz";
@@ -661,6 +1561,11 @@ void Digitizer::CloseOutputFile() {
     Log::OutSummary("→ HDF5 file closed and cleaned up.");
   } catch (const H5::Exception& e) {
     Log::OutError("→ HDF5 file close failed: " + std::string(e.getDetailMsg()));
+    if (fJournal) {
+      Log::OutError("→ Events kept in " + fJournal->GetPath() + ", use daq-recover to rebuild the run.");
+      delete fJournal;
+      fJournal = nullptr;
+    }
   }
 }
 std::string Digitizer::IntToHex(uint32_t val) {
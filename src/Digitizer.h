@@ -19,18 +19,49 @@
 #include "TParameter.h"
 
 #include "Config.h"
+#include "EventRing.h"
+#include "RunJournal.h"
+#include "HDF5Writer.hpp"
+#include "RunBinaryWriter.h"
+#include "RunRegistry.h"
+#include "RunCatalog.h"
+#include "RunReplay.h"
+#include "ReadoutTuner.h"
+#include "X742Event.h"
+#include "BoardRegisters.h"
+#include "TimeAlignment.h"
+#include "StartGate.h"
+#include "Histograms.h"
+
+class Bridge;
 
 class Digitizer {
 public:
-    enum OutputFormat { kROOT, kASCII, kHDF5 };
+    enum OutputFormat { kROOT, kASCII, kHDF5, kBIN };
 
-    Digitizer();
+    /// board: index into [digitizer] VMEBaseAddress
+    explicit Digitizer(uint32_t board = 0);
     ~Digitizer();
   int GetHandle() const { return fHandle; }
+  uint32_t GetBoard() const { return fBoard; }
+  uint32_t GetVMEBaseAddress() const { return fVMEBaseAddress; }
 
   void InitAcquisition();
+  /// Baseline of every channel from one software trigger; the board is
+  /// stopped again afterwards.
   void SetTriggerThreshold(double offset = 0.1);
+  /// Output file and run number of the next run. Throws
+  /// std::runtime_error; the board must not acquire then.
   void PrepareOutput();
+  /// Run number of the next PrepareOutput(), from the registry of the
+  /// output directory; PrepareOutput() allocates it when not done before.
+  /// Throws std::runtime_error.
+  int AllocateRunNumber();
+  /// Run number allocated by another board, see Crate::AllocateRunNumber().
+  void SetRunNumber(int run);
+  /// [replay] next recorded run. Throws std::runtime_error.
+  void PrepareReplay();
+  bool IsReplay() const { return fReplayMode; }
   void AcquireEvents();
   void CloseOutputFile();
   void CountExternalTriggers(int seconds);
@@ -40,16 +71,38 @@ public:
   void SafeCleanup();
   void SelectBoard();
   void Configure();
+  void Reconfigure();
+  /// VME bridge for batched register accesses, see BoardRegisters.h
+  void SetBridge(Bridge* bridge) { fBridge = bridge; }
+  /// [digitizer] SyncStart: boards after the first start from their S-IN
+  bool IsSyncSlave() const { return fSyncStart && fBoard > 0; }
+  /// SyncStart: switch to S_IN_CONTROLLED and arm; AcquireEvents() then
+  /// waits for board 0 instead of starting the board.
+  void ArmReadout();
+  /// Undo ArmReadout() for a board that does not acquire this run.
+  void Disarm();
+  /// time tags of the first events of each run go there, see TimeAlignment.h
+  void SetAlignment(TimeAlignment* alignment) { fAlignment = alignment; }
+  /// SyncStart: restart order after a pause, see StartGate.h
+  void SetStartGate(StartGate* gate) { fStartGate = gate; }
   
 private:
   Config& fConfig;
   bool fIsRunning;
+  uint32_t fBoard;
+  std::string fTag;     ///< "[bN] " in front of the log lines when there are several boards
   
   std::string IntToHex(uint32_t val);
   
   static constexpr uint32_t MAX_CHANNELS = 64;
-  static constexpr uint32_t MAX_SAMPLES = 100000;
-  static constexpr uint32_t MIN_SAMPLES = 10;
+  static constexpr uint32_t REPLAY_BLOCK_EVENTS = 256;
+  static constexpr uint32_t BATCH_EVENTS = 256;          ///< events processed together, see EventBatch.h
+  static constexpr uint32_t MAX_EVENTS_BLT = 2048;       ///< ceiling of the readout tuner, sizes fBuffer
+  static constexpr uint32_t TUNER_START_EVENTS_BLT = 16;
+  static constexpr uint32_t FRONT_PANEL_IO_REG = 0x811C;     ///< bit 0: LEMO level, 0 NIM / 1 TTL
+  static constexpr uint32_t ACQ_STATUS_REG = 0x8104;
+  static constexpr uint32_t ACQ_STATUS_PLL_LOCKED = 1u << 7;
+  static constexpr uint32_t ACQ_STATUS_BOARD_READY = 1u << 8;
   CAEN_DGTZ_ConnectionType fConnectionType;
   std::string fIPAddress;
   int fConetNode;
@@ -78,6 +131,11 @@ private:
 
     std::map<uint32_t, uint32_t> fTriggerThreshold;
     std::map<uint32_t, double> fBaselineMean;
+    std::vector<double> fBaselines;      ///< fBaselineMean in fChannelList order, for X742Event::Convert
+    EventBatch fBatch;                   ///< events of the current readout block
+    X742Event::ConvertKernel fConvert = X742Event::Convert;  ///< for fRecordLength x fChannelList
+    std::vector<int16_t> fSamplesCorr;   ///< one event of fBatch, flat (per-event HDF5 layout)
+    std::vector<uint16_t> fSamplesRaw;
     std::map<uint32_t, double> fBaselineVar;
     std::map<uint32_t, double> fBaselineRMS;
     double fNRMSThreshold;
@@ -93,6 +151,7 @@ private:
   double fWaitTimeS;
   double fSamplingTime;
   std::string fSamplingRateStr;
+  std::string fExtTriggerMode;
   double fSamplingRateGHz;
   std::chrono::seconds fACQT;
   double fDeadT;
@@ -103,9 +162,11 @@ private:
     OutputFormat fOutputFormat;
     std::string fOutputDir;
     std::string fOutputFileName;
+    std::string fBoardSuffix;           ///< "_bN" at the end of the file names, boards after the first
   std::string fOutputPath; 
 
     int fRunNumber;
+    bool fRunAllocated = false;         ///< fRunNumber is the one of the next run
     TFile* fROOTFile;
     TTree* fChannelTree;
     TTree* fEventTree;
@@ -116,13 +177,86 @@ private:
     unsigned long int fTimestamp_ns;
     unsigned long int fTriggerTime;
 
+    void LoadSettings();
+    bool StartReadout();
+    bool RestartReadout();
+    bool SelectAcquisitionMode(CAEN_DGTZ_AcqMode_t mode);
+    void ReadBaseline();
+    void StopReadout();
+    int ReadBlock();
+    void ProcessBuffer(uint32_t& totalEvents, uint32_t maxEvents);
+    void AddEvent(uint32_t& totalEvents, uint32_t maxEvents);
+    void ProcessBatch(uint32_t& totalEvents, uint32_t maxEvents);
+    void TuneReadout(uint32_t nEvents);
+    bool Changed(const std::string& setting, int64_t value);
+    void FillReplayEvent(ReplayEvent& event);
+    void DrainReadout(uint32_t& totalEvents, uint32_t maxEvents);
+    void Checkpoint(bool force = false);
+    void DumpEvent(uint32_t e);
+    void WriteRunStatistics(uint32_t nevents, double elapsed_s, double rate_kHz,
+                            const std::string& stopreason);
+    void WriteHistograms();
+    void CatalogStart();
+    void CatalogStop(uint32_t nevents, double elapsed_s, double rate_kHz,
+                     const std::string& stopreason);
+    void AbortOutput(const std::string& error);
+
     bool CheckAccepted(std::map<uint32_t, uint32_t>& nAccepted);
     static long GetTime();
 
+    // online monitoring (shared memory)
+    EventRingWriter* fEventRing = nullptr;
+
+    // [histograms]: filled by this thread, merged every MergeIntervalS
+    RunHistograms* fHistograms = nullptr;
+    std::chrono::steady_clock::time_point fLastMerge;
+
+    // crash recovery: events since the last checkpoint, see RunJournal.h
+    RunJournalWriter* fJournal = nullptr;
+    std::chrono::steady_clock::time_point fLastCheckpoint;
+    uint32_t fPendingCheckpoint = 0;
+
     // HDF5
     H5::H5File* fH5File = nullptr;
   //H5::Group fH5Group;
   H5::Group* fH5Group = nullptr;
+    HDF5Writer* fH5Writer = nullptr;   ///< appendable layout, with [output] SWMR or Compression
+
+    // BIN
+    RunBinaryWriter* fBinWriter = nullptr;
+
+    // run numbers and catalog of fOutputDir
+    RunRegistry* fRunRegistry = nullptr;
+    RunCatalog* fRunCatalog = nullptr;
+    RunRecord fRunRecord;
+
+    // board state: value last applied through each library setter, and the
+    // registers handled directly; both forgotten on reset and reconnection
+    Bridge* fBridge = nullptr;
+    BoardRegisters fRegisters;
+    std::map<std::string, int64_t> fApplied;
+
+    // several boards: common start and time tag offsets, see Crate.h
+    bool fSyncStart = false;
+    bool fArmed = false;                 ///< ArmReadout() done for the next run
+    TimeAlignment* fAlignment = nullptr;
+    StartGate* fStartGate = nullptr;
+
+    // block transfers: [digitizer] EventsPerBLT, or chosen by fTuner when 0
+    uint32_t fEventsPerBLT = 0;
+    double fMaxTransferS = 0.02;
+    ReadoutTuner* fTuner = nullptr;
+    double fLastReadS = 0.0;             ///< duration of the last ReadData
+    LatencyHistogram fReadLatency;       ///< ReadData durations of the run
+    LatencyHistogram fWakeLatency;       ///< poll sleeps: delay past the requested time
+
+    // [replay]: recorded runs instead of the board, see RunReplay.h
+    bool fReplayMode = false;
+    size_t fReplayIndex = 0;
+    RunReplay* fReplay = nullptr;
+    std::vector<ReplayEvent> fReplayBlock;
+    size_t fReplayCount = 0;
+    CAEN_DGTZ_X742_EVENT_t fReplayEvent = {};
 };
 
 #endif
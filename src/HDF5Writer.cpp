@@ -1,54 +1,314 @@
 #include "HDF5Writer.hpp"
-#include <sstream>
+#include <algorithm>
+#include <stdexcept>
 
-HDF5Writer::HDF5Writer(const std::string& filename)
-    : m_file(filename, H5F_ACC_TRUNC)
-{}
+namespace {
+
+    // ~1 MB chunks for the samples, 4096 entries for the per-event index
+    constexpr hsize_t kChunkBytes = 1 << 20;
+    constexpr hsize_t kIndexChunk = 4096;
+
+    H5::DataSet CreateAppendable(H5::H5File& file, const std::string& name,
+                                 const H5::PredType& type, hsize_t chunk, int compression = 0) {
+        hsize_t dims[1] = { 0 };
+        hsize_t maxdims[1] = { H5S_UNLIMITED };
+        H5::DataSpace space(1, dims, maxdims);
+        H5::DSetCreatPropList plist;
+        plist.setChunk(1, &chunk);
+        // filter order matters: ChunkCompressor produces exactly this pipeline
+        if (compression > 0) {
+            plist.setShuffle();
+            plist.setDeflate(compression);
+        }
+        return file.createDataSet(name, type, space, plist);
+    }
+
+    template <typename T>
+    void WriteAttribute(H5::H5Object& object, const std::string& name, const H5::PredType& type, T value) {
+        object.createAttribute(name, type, H5::DataSpace()).write(type, &value);
+    }
+
+    H5::DataSet WriteCounts(H5::Group& group, const std::string& name, const std::vector<uint64_t>& counts,
+                            int rank, const hsize_t* dims) {
+        H5::DataSet ds = group.createDataSet(name, H5::PredType::NATIVE_UINT64, H5::DataSpace(rank, dims));
+        ds.write(counts.data(), H5::PredType::NATIVE_UINT64);
+        return ds;
+    }
+
+    void Write1D(H5::Group& group, const std::string& name, const Histogram1D& h, const std::string& unit) {
+        hsize_t dims[1] = { h.fCounts.size() };
+        H5::DataSet ds = WriteCounts(group, name, h.fCounts, 1, dims);
+        WriteAttribute(ds, "Low", H5::PredType::NATIVE_DOUBLE, h.fLow);
+        WriteAttribute(ds, "High", H5::PredType::NATIVE_DOUBLE, h.fHigh);
+        WriteAttribute(ds, "Underflow", H5::PredType::NATIVE_UINT64, h.fUnderflow);
+        WriteAttribute(ds, "Overflow", H5::PredType::NATIVE_UINT64, h.fOverflow);
+        ds.createAttribute("Unit", H5::StrType(0, H5T_VARIABLE), H5::DataSpace())
+            .write(H5::StrType(0, H5T_VARIABLE), unit);
+    }
+
+}
+
+H5::H5File* HDF5Writer::CreateFile(const std::string& filename) {
+    H5::FileAccPropList fapl;
+    fapl.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+    return new H5::H5File(filename, H5F_ACC_TRUNC, H5::FileCreatPropList::DEFAULT, fapl);
+}
+
+void HDF5Writer::WritePerEvent(H5::H5File& file, uint64_t eventnumber,
+                               const std::vector<int16_t>& corr, const std::vector<uint16_t>* raw) {
+    hsize_t dim_corr = corr.size();
+    H5::DataSpace dataspace_corr(1, &dim_corr);
+    H5::DataSet ds_corr = file.createDataSet("/events/event" + std::to_string(eventnumber),
+                                             H5::PredType::NATIVE_INT16, dataspace_corr);
+    ds_corr.write(corr.data(), H5::PredType::NATIVE_INT16);
+
+    if (raw) {
+        hsize_t dim_raw = raw->size();
+        H5::DataSpace dataspace_raw(1, &dim_raw);
+        H5::DataSet ds_raw = file.createDataSet("/events_raw/event" + std::to_string(eventnumber),
+                                                H5::PredType::NATIVE_UINT16, dataspace_raw);
+        ds_raw.write(raw->data(), H5::PredType::NATIVE_UINT16);
+    }
+}
+
+HDF5Writer::HDF5Writer(H5::H5File& file, bool saveraw, hsize_t samplesperevent,
+                       int compression, unsigned nthreads)
+    : m_file(file),
+      m_saveraw(saveraw),
+      m_swmr(false),
+      m_chunkevents(std::max<hsize_t>(1, kChunkBytes / (2 * std::max<hsize_t>(1, samplesperevent)))),
+      m_samplechunk(m_chunkevents * std::max<hsize_t>(1, samplesperevent)),
+      m_chunkstart(0),
+      m_nsamples(0),
+      m_nraw(0),
+      m_nindex(0),
+      m_nevents(0)
+{
+    m_samples = CreateAppendable(m_file, "/events/samples", H5::PredType::NATIVE_INT16, m_samplechunk, compression);
+    m_offset = CreateAppendable(m_file, "/events/offset", H5::PredType::NATIVE_UINT64, kIndexChunk);
+    m_ttt = CreateAppendable(m_file, "/events/ttt", H5::PredType::NATIVE_UINT32, kIndexChunk);
+    m_mask = CreateAppendable(m_file, "/events/channelmask", H5::PredType::NATIVE_UINT32, kIndexChunk);
+    if (m_saveraw)
+        m_raw = CreateAppendable(m_file, "/events_raw/samples", H5::PredType::NATIVE_UINT16, m_samplechunk, compression);
+
+    if (compression > 0)
+        m_compressor.reset(new ChunkCompressor(compression, sizeof(int16_t), nthreads));
+
+    m_bufsamples.reserve(m_samplechunk);
+    if (m_saveraw)
+        m_bufraw.reserve(m_samplechunk);
+}
 
 HDF5Writer::~HDF5Writer() {
-    m_file.close();
+    try {
+        if (m_compressor) {
+            SubmitChunks(true);
+            Collect(true);
+        } else {
+            Append();
+        }
+    } catch (const H5::Exception&) {
+        // the caller reports errors through Flush(); nothing to do while unwinding
+    }
 }
 
-void HDF5Writer::WriteEvent(uint32_t eventID,
-                            const std::map<uint32_t, std::vector<float>>& channelData,
-                            const std::map<uint32_t, double>& baselines,
-                            const std::map<uint32_t, uint64_t>& timestamps) {
-    std::ostringstream groupPath;
-    groupPath << "/events/event" << eventID;
-    std::string groupName = groupPath.str();
+void HDF5Writer::StartSWMR() {
+    if (H5Fstart_swmr_write(m_file.getId()) < 0)
+        throw std::runtime_error("H5Fstart_swmr_write failed");
+    m_swmr = true;
+}
 
-    H5::Group eventGroup = m_file.createGroup(groupName);
+void HDF5Writer::WriteEvent(uint32_t triggertimetag, uint32_t channelmask,
+                            const std::vector<int16_t>& corr, const std::vector<uint16_t>& raw) {
+    BeginEvent(triggertimetag, channelmask);
+    m_bufsamples.insert(m_bufsamples.end(), corr.begin(), corr.end());
+    if (m_saveraw)
+        m_bufraw.insert(m_bufraw.end(), raw.begin(), raw.end());
+    EndEvent();
+}
 
-    // Write waveforms
-    for (const auto& [ch, waveform] : channelData) {
-        std::ostringstream name;
-        name << "ch" << ch;
+void HDF5Writer::WriteBatch(const EventBatch& batch) {
+    const bool raw = m_saveraw && batch.HasRaw();
+    for (uint32_t e = 0; e < batch.GetSize(); e++) {
+        const uint32_t n = batch.GetNSamples(e);
+        BeginEvent(batch.GetTriggerTimeTag(e), batch.GetChannelMask(e));
+        for (uint32_t i = 0; i < batch.GetNPresent(e); i++) {
+            m_bufsamples.insert(m_bufsamples.end(), batch.Corr(e, i), batch.Corr(e, i) + n);
+            if (raw)
+                m_bufraw.insert(m_bufraw.end(), batch.Raw(e, i), batch.Raw(e, i) + n);
+        }
+        EndEvent();
+    }
+}
 
-        hsize_t dims[1] = { waveform.size() };
-        H5::DataSpace dataspace(1, dims);
-        H5::DataSet dataset = eventGroup.createDataSet(name.str(), H5::PredType::NATIVE_FLOAT, dataspace);
-        dataset.write(waveform.data(), H5::PredType::NATIVE_FLOAT);
+// index entries of the next event; its samples follow in m_bufsamples
+void HDF5Writer::BeginEvent(uint32_t triggertimetag, uint32_t channelmask) {
+    m_bufoffset.push_back((m_compressor ? m_chunkstart : m_nsamples) + m_bufsamples.size());
+    m_bufttt.push_back(triggertimetag);
+    m_bufmask.push_back(channelmask);
+}
+
+void HDF5Writer::EndEvent() {
+    m_nevents++;
+
+    if (!m_compressor) {
+        if (m_bufoffset.size() >= m_chunkevents)
+            Append();
+        return;
+    }
+
+    m_bufend.push_back(m_chunkstart + m_bufsamples.size());
+    if (m_bufsamples.size() >= m_samplechunk)
+        SubmitChunks(false);
+    // keep the pool busy but bounded: block only when it falls behind
+    Collect(false);
+    while (m_compressor->GetPending() > 2 * m_compressor->GetNThreads() + 2)
+        Collect(true);
+}
+
+template <typename T>
+void HDF5Writer::Extend(H5::DataSet& dataset, const H5::PredType& type, hsize_t& size,
+                        const T* data, size_t n) {
+    if (n == 0)
+        return;
+    hsize_t newsize[1] = { size + n };
+    dataset.extend(newsize);
+    H5::DataSpace filespace = dataset.getSpace();
+    hsize_t start[1] = { size };
+    hsize_t count[1] = { n };
+    filespace.selectHyperslab(H5S_SELECT_SET, count, start);
+    H5::DataSpace memspace(1, count);
+    dataset.write(data, type, memspace, filespace);
+    size += n;
+}
+
+void HDF5Writer::Append() {
+    if (m_bufoffset.empty())
+        return;
+
+    // samples first: a reader that sees an offset always finds its samples
+    Extend(m_samples, H5::PredType::NATIVE_INT16, m_nsamples, m_bufsamples.data(), m_bufsamples.size());
+    if (m_saveraw)
+        Extend(m_raw, H5::PredType::NATIVE_UINT16, m_nraw, m_bufraw.data(), m_bufraw.size());
+    AppendIndex(m_bufoffset.size());
+
+    m_bufsamples.clear();
+    m_bufraw.clear();
+}
+
+void HDF5Writer::AppendIndex(size_t n) {
+    if (n == 0)
+        return;
+    hsize_t nindex = m_nindex;
+    Extend(m_ttt, H5::PredType::NATIVE_UINT32, nindex, m_bufttt.data(), n);
+    nindex = m_nindex;
+    Extend(m_mask, H5::PredType::NATIVE_UINT32, nindex, m_bufmask.data(), n);
+    Extend(m_offset, H5::PredType::NATIVE_UINT64, m_nindex, m_bufoffset.data(), n);
+
+    m_bufoffset.erase(m_bufoffset.begin(), m_bufoffset.begin() + n);
+    m_bufttt.erase(m_bufttt.begin(), m_bufttt.begin() + n);
+    m_bufmask.erase(m_bufmask.begin(), m_bufmask.begin() + n);
+    if (!m_bufend.empty())
+        m_bufend.erase(m_bufend.begin(), m_bufend.begin() + n);
+}
+
+// Queue the full chunks of the buffers for compression; with partial=true
+// also the incomplete last one, zero-padded, which stays in the buffers.
+void HDF5Writer::SubmitChunks(bool partial) {
+    while (m_bufsamples.size() >= m_samplechunk) {
+        const hsize_t extent = m_chunkstart + m_samplechunk;
+        m_compressor->Submit(m_bufsamples.data(), m_samplechunk * sizeof(int16_t));
+        m_pending.push_back({ &m_samples, &m_nsamples, m_chunkstart, extent });
+        m_bufsamples.erase(m_bufsamples.begin(), m_bufsamples.begin() + m_samplechunk);
+        if (m_saveraw) {
+            m_compressor->Submit(m_bufraw.data(), m_samplechunk * sizeof(uint16_t));
+            m_pending.push_back({ &m_raw, &m_nraw, m_chunkstart, extent });
+            m_bufraw.erase(m_bufraw.begin(), m_bufraw.begin() + m_samplechunk);
+        }
+        m_chunkstart = extent;
     }
 
-    // Write baselines
-    for (const auto& [ch, baseline] : baselines) {
-        std::ostringstream name;
-        name << "ch" << ch << "_baseline";
+    if (!partial || m_bufsamples.empty())
+        return;
+    const hsize_t extent = m_chunkstart + m_bufsamples.size();
+    std::vector<int16_t> padded(m_samplechunk, 0);
+    std::copy(m_bufsamples.begin(), m_bufsamples.end(), padded.begin());
+    m_compressor->Submit(padded.data(), m_samplechunk * sizeof(int16_t));
+    m_pending.push_back({ &m_samples, &m_nsamples, m_chunkstart, extent });
+    if (m_saveraw) {
+        std::vector<uint16_t> paddedraw(m_samplechunk, 0);
+        std::copy(m_bufraw.begin(), m_bufraw.end(), paddedraw.begin());
+        m_compressor->Submit(paddedraw.data(), m_samplechunk * sizeof(uint16_t));
+        m_pending.push_back({ &m_raw, &m_nraw, m_chunkstart, extent });
+    }
+}
 
-        hsize_t dims[1] = { 1 };
-        H5::DataSpace dataspace(1, dims);
-        H5::DataSet dataset = eventGroup.createDataSet(name.str(), H5::PredType::NATIVE_DOUBLE, dataspace);
-        dataset.write(&baseline, H5::PredType::NATIVE_DOUBLE);
+// Store the compressed chunks in submission order, then the index entries
+// of the events whose samples are all stored.
+void HDF5Writer::Collect(bool all) {
+    ChunkCompressor::Chunk chunk;
+    while (!m_pending.empty() && m_compressor->Next(chunk, all)) {
+        const PendingChunk p = m_pending.front();
+        m_pending.pop_front();
+        if (p.extent > *p.committed) {
+            hsize_t newsize[1] = { p.extent };
+            p.dataset->extend(newsize);
+        }
+        hsize_t offset[1] = { p.offset };
+        if (H5Dwrite_chunk(p.dataset->getId(), H5P_DEFAULT, chunk.fFilterMask, offset,
+                           chunk.fData.size(), chunk.fData.data()) < 0)
+            throw H5::DataSetIException("HDF5Writer::Collect", "H5Dwrite_chunk failed");
+        *p.committed = std::max(*p.committed, p.extent);
     }
 
-    // Write timestamps
-    for (const auto& [ch, ts] : timestamps) {
-        std::ostringstream name;
-        name << "ch" << ch << "_timestamp";
+    const hsize_t stored = m_saveraw ? std::min(m_nsamples, m_nraw) : m_nsamples;
+    const size_t n = std::upper_bound(m_bufend.begin(), m_bufend.end(), stored) - m_bufend.begin();
+    AppendIndex(n);
+}
+
+void HDF5Writer::WriteHistograms(H5::H5File& file, const RunHistograms& histograms) {
+    H5::Group top = file.createGroup("/histograms");
+    WriteAttribute(top, "Events", H5::PredType::NATIVE_UINT64, histograms.GetEvents());
 
-        hsize_t dims[1] = { 1 };
-        H5::DataSpace dataspace(1, dims);
-        H5::DataSet dataset = eventGroup.createDataSet(name.str(), H5::PredType::NATIVE_UINT64, dataspace);
-        dataset.write(&ts, H5::PredType::NATIVE_UINT64);
+    for (const RunHistograms::Channel& c : histograms.GetChannels()) {
+        H5::Group group = top.createGroup("ch" + std::to_string(c.fChannel));
+        Write1D(group, "amplitude", c.fAmplitude, "ADC");
+        Write1D(group, "integral", c.fIntegral, "ADC ns");
+        Write1D(group, "time", c.fTime, "ns");
     }
+
+    for (const RunHistograms::Correlation& c : histograms.GetCorrelations()) {
+        const Histogram2D& h = c.fAmplitude;
+        hsize_t dims[2] = { h.fNY, h.fNX };
+        H5::DataSet ds = WriteCounts(top, "ch" + std::to_string(c.fChannelX) + "_ch" + std::to_string(c.fChannelY),
+                                     h.fCounts, 2, dims);
+        WriteAttribute(ds, "XLow", H5::PredType::NATIVE_DOUBLE, h.fXLow);
+        WriteAttribute(ds, "XHigh", H5::PredType::NATIVE_DOUBLE, h.fXHigh);
+        WriteAttribute(ds, "YLow", H5::PredType::NATIVE_DOUBLE, h.fYLow);
+        WriteAttribute(ds, "YHigh", H5::PredType::NATIVE_DOUBLE, h.fYHigh);
+        WriteAttribute(ds, "Outside", H5::PredType::NATIVE_UINT64, h.fOutside);
+    }
+}
+
+void HDF5Writer::Flush() {
+    if (m_compressor) {
+        SubmitChunks(true);
+        Collect(true);
+    } else {
+        Append();
+    }
+    if (!m_swmr)
+        return;
+    H5Dflush(m_samples.getId());
+    if (m_saveraw)
+        H5Dflush(m_raw.getId());
+    H5Dflush(m_ttt.getId());
+    H5Dflush(m_mask.getId());
+    H5Dflush(m_offset.getId());
+}
+
+double HDF5Writer::GetCompressionRatio() const {
+    if (!m_compressor || m_compressor->GetCompressedBytes() == 0)
+        return 0.0;
+    return double(m_compressor->GetRawBytes()) / m_compressor->GetCompressedBytes();
 }
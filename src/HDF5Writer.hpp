@@ -1,24 +1,126 @@
 #ifndef HDF5WRITER_HPP
 #define HDF5WRITER_HPP
 
+// Appendable run layout for HDF5 SWMR (single writer, multiple readers).
+//
+// SWMR forbids creating objects once the writer has switched mode, so the
+// per-event datasets of the default layout cannot be used. Instead all
+// events go into a few 1-D chunked datasets that only grow:
+//
+//   /events/samples       int16   baseline-corrected samples of all events
+//   /events/offset        uint64  index in samples of the first sample of event i
+//   /events/ttt           uint32  trigger time tag of event i
+//   /events/channelmask   uint32  channels present in event i (ChannelList order)
+//   /events_raw/samples   uint16  raw samples, same offsets (only with SaveRaw)
+//
+// Events are buffered and appended one chunk at a time; Flush() makes them
+// visible to readers (H5Dflush). Readers open the file with
+// H5F_ACC_RDONLY | H5F_ACC_SWMR_READ and call H5Drefresh() to follow it.
+//
+// With compression > 0 the samples datasets carry the shuffle + deflate
+// filters, but the chunks are compressed by a ChunkCompressor pool and
+// stored with H5Dwrite_chunk(): the library never compresses on the writer
+// thread. The index entries of an event are written only once its samples
+// are, so readers never see an event without data. At Flush() the last,
+// partial chunk is written zero-padded and rewritten once it fills up.
+
 #include <H5Cpp.h>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
-#include <map>
 #include <cstdint>
 
+#include "BufferPool.h"
+#include "ChunkCompressor.h"
+#include "EventBatch.h"
+#include "Histograms.h"
+
 class HDF5Writer {
 public:
-    explicit HDF5Writer(const std::string& filename);
+    /// Create a file in the latest library format, required by SWMR.
+    static H5::H5File* CreateFile(const std::string& filename);
+
+    /// Default (per-event) layout: /events/event<N> and, with raw,
+    /// /events_raw/event<N>. Both groups must exist.
+    static void WritePerEvent(H5::H5File& file, uint64_t eventnumber,
+                              const std::vector<int16_t>& corr, const std::vector<uint16_t>* raw);
+
+    /// Online histograms of the run (Histograms.h), in a new group
+    /// /histograms: ch<N>/amplitude, ch<N>/integral, ch<N>/time (uint64 bin
+    /// counts, attributes Low, High, Underflow, Overflow, Unit) and
+    /// ch<X>_ch<Y> (uint64 [y][x], attributes XLow, XHigh, YLow, YHigh,
+    /// Outside). Not in SWMR mode.
+    static void WriteHistograms(H5::H5File& file, const RunHistograms& histograms);
+
+    /// Create the datasets; call StartSWMR() once every other object
+    /// (groups, attributes) of the file exists.
+    /// compression: deflate level 1-9, 0 writes uncompressed chunks;
+    /// nthreads: compression threads, 0 = every core but one.
+    HDF5Writer(H5::H5File& file, bool saveraw, hsize_t samplesperevent,
+               int compression = 0, unsigned nthreads = 0);
     ~HDF5Writer();
 
-    void WriteEvent(uint32_t eventID,
-                    const std::map<uint32_t, std::vector<float>>& waveforms,
-                    const std::map<uint32_t, double>& baselines,
-                    const std::map<uint32_t, uint64_t>& timestamps);
+    void StartSWMR();
+
+    void WriteEvent(uint32_t triggertimetag, uint32_t channelmask,
+                    const std::vector<int16_t>& corr, const std::vector<uint16_t>& raw);
+    /// Every event of batch, as WriteEvent().
+    void WriteBatch(const EventBatch& batch);
+
+    /// Append buffered events and make them visible to readers.
+    void Flush();
+
+    uint64_t GetNEvents() const { return m_nevents; }
+
+    /// Uncompressed / stored bytes of the samples so far, 0 without compression.
+    double GetCompressionRatio() const;
 
 private:
-    H5::H5File m_file;
+    struct PendingChunk {
+        H5::DataSet* dataset;
+        hsize_t* committed;                  ///< m_nsamples or m_nraw
+        hsize_t offset;
+        hsize_t extent;                      ///< dataset size once the chunk is stored
+    };
+
+    void BeginEvent(uint32_t triggertimetag, uint32_t channelmask);
+    void EndEvent();
+    void Append();
+    void SubmitChunks(bool partial);
+    void Collect(bool all);
+    void AppendIndex(size_t n);
+
+    template <typename T>
+    static void Extend(H5::DataSet& dataset, const H5::PredType& type, hsize_t& size,
+                       const T* data, size_t n);
+
+    H5::H5File& m_file;
+    bool m_saveraw;
+    bool m_swmr;
+    hsize_t m_chunkevents;
+    hsize_t m_samplechunk;
+    std::unique_ptr<ChunkCompressor> m_compressor;
+    std::deque<PendingChunk> m_pending;
+    hsize_t m_chunkstart;                    ///< sample index of m_bufsamples[0] (compressed)
+
+    H5::DataSet m_samples;
+    H5::DataSet m_raw;
+    H5::DataSet m_offset;
+    H5::DataSet m_ttt;
+    H5::DataSet m_mask;
+
+    hsize_t m_nsamples;
+    hsize_t m_nraw;
+    hsize_t m_nindex;
+    uint64_t m_nevents;
+
+    HugeVector<int16_t> m_bufsamples;        ///< one chunk, on huge pages (BufferPool.h)
+    HugeVector<uint16_t> m_bufraw;
+    std::vector<uint64_t> m_bufoffset;
+    std::vector<uint32_t> m_bufttt;
+    std::vector<uint32_t> m_bufmask;
+    std::vector<uint64_t> m_bufend;
 };
 
 #endif // HDF5WRITER_HPP
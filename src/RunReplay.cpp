@@ -0,0 +1,512 @@
+#include "RunReplay.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "Log.h"
+#include "RunBinary.h"
+
+namespace {
+
+    bool EndsWith(const std::string& s, const std::string& suffix) {
+        return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    template <typename T>
+    T ReadAttribute(const H5::Group& group, const std::string& name, const H5::PredType& type, T defvalue) {
+        if (!group.attrExists(name))
+            return defvalue;
+        T value;
+        group.openAttribute(name).read(type, &value);
+        return value;
+    }
+
+    std::string ReadAttribute(const H5::Group& group, const std::string& name) {
+        std::string value;
+        if (group.attrExists(name)) {
+            H5::Attribute attr = group.openAttribute(name);
+            attr.read(attr.getStrType(), value);
+        }
+        return value;
+    }
+
+    template <typename T>
+    void ReadDataSet(const H5::DataSet& dataset, const H5::PredType& type, hsize_t start, hsize_t count,
+                     std::vector<T>& data) {
+        data.resize(count);
+        if (count == 0)
+            return;
+        H5::DataSpace filespace = dataset.getSpace();
+        filespace.selectHyperslab(H5S_SELECT_SET, &count, &start);
+        H5::DataSpace memspace(1, &count);
+        dataset.read(data.data(), type, memspace, filespace);
+    }
+
+    hsize_t Extent(const H5::DataSet& dataset) {
+        hsize_t size = 0;
+        dataset.getSpace().getSimpleExtentDims(&size);
+        return size;
+    }
+
+    std::string CString(const char* s, size_t n) {
+        return std::string(s, strnlen(s, n));
+    }
+
+    // Range of x with static_cast<int16_t>(x) == corr (truncation toward zero)
+    void TruncRange(int16_t corr, double& lo, double& hi) {
+        lo = corr > 0 ? corr : corr - 1.0;
+        hi = corr < 0 ? corr : corr + 1.0;
+    }
+
+    // HDF5 cannot read a gzip stream: inflate the run to a temporary file
+    std::string Gunzip(const std::string& path) {
+        const char* tmpdir = std::getenv("TMPDIR");
+        std::string name = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/daq-replay-XXXXXX";
+        int fd = mkstemp(&name[0]);
+        if (fd < 0)
+            throw std::runtime_error("cannot create a temporary file in " + name + ": " + std::strerror(errno));
+
+        gzFile in = gzopen(path.c_str(), "rb");
+        bool ok = in != nullptr;
+        if (ok) {
+            gzbuffer(in, 1 << 20);
+            std::vector<char> buf(1 << 20);
+            int n;
+            while ((n = gzread(in, buf.data(), buf.size())) > 0) {
+                if (write(fd, buf.data(), n) != n) {
+                    ok = false;
+                    break;
+                }
+            }
+            ok = ok && n == 0;
+            gzclose(in);
+        }
+        close(fd);
+        if (!ok) {
+            unlink(name.c_str());
+            throw std::runtime_error("cannot uncompress " + path);
+        }
+        return name;
+    }
+
+}
+
+// ---------------------------------------------------------------
+// Layouts
+// ---------------------------------------------------------------
+
+struct ReplayInfo {
+    int RunNumber = 0;
+    std::vector<uint32_t> ChannelList;
+    uint32_t RecordLength = 0;
+    uint32_t PostTriggerSize = 0;
+    double SamplingTime = 0.0;
+    std::string SamplingRate;
+    std::string TriggerMode;
+    double AcquisitionTime = 0.0;
+    double TriggerRate_kHz = 0.0;
+};
+
+class ReplayLayout {
+public:
+    virtual ~ReplayLayout() {}
+
+    /// 0 when the layout does not store trigger time tags.
+    virtual uint32_t TriggerTimeTag(uint64_t i) const = 0;
+    virtual void Get(uint64_t i, ReplayEvent& event) = 0;
+
+    std::string fName;
+    uint64_t fNEvents = 0;
+    bool fHasRaw = false;
+    ReplayInfo fInfo;
+};
+
+namespace {
+
+    void ReadInfo(const H5::H5File& file, ReplayInfo& info) {
+        H5::Group config = file.openGroup("/config");
+        info.RunNumber = ReadAttribute<int>(config, "RunNumber", H5::PredType::NATIVE_INT, 0);
+        info.RecordLength = ReadAttribute<uint32_t>(config, "RecordLength", H5::PredType::NATIVE_UINT, 1024);
+        info.PostTriggerSize = ReadAttribute<uint32_t>(config, "PostTriggerSize", H5::PredType::NATIVE_UINT, 0);
+        info.SamplingTime = ReadAttribute<double>(config, "SamplingTime", H5::PredType::NATIVE_DOUBLE, 0.0);
+        info.AcquisitionTime = ReadAttribute<double>(config, "AcquisitionTime", H5::PredType::NATIVE_DOUBLE, 0.0);
+        info.TriggerRate_kHz = ReadAttribute<double>(config, "TriggerRate_kHz", H5::PredType::NATIVE_DOUBLE, 0.0);
+        info.SamplingRate = ReadAttribute(config, "SamplingRate");
+        info.TriggerMode = ReadAttribute(config, "TriggerMode");
+        if (config.attrExists("ChannelList")) {
+            H5::Attribute attr = config.openAttribute("ChannelList");
+            hsize_t n = 0;
+            attr.getSpace().getSimpleExtentDims(&n);
+            info.ChannelList.resize(n);
+            attr.read(H5::PredType::NATIVE_UINT, info.ChannelList.data());
+        }
+    }
+
+    // /events/eventN: the channels present, concatenated; neither trigger
+    // time tag nor channel mask is stored (same assumption as daq-convert)
+    class PerEventLayout : public ReplayLayout {
+    public:
+        PerEventLayout(const std::string& path, const ReplayInfo& info) : m_file(path, H5F_ACC_RDONLY) {
+            fName = "per-event HDF5";
+            fInfo = info;
+            fNEvents = m_file.openGroup("/events").getNumObjs();
+            fHasRaw = H5Lexists(m_file.getId(), "/events_raw/event0", H5P_DEFAULT) > 0;
+        }
+
+        uint32_t TriggerTimeTag(uint64_t) const override { return 0; }
+
+        void Get(uint64_t i, ReplayEvent& event) override {
+            const std::string name = "event" + std::to_string(i);
+            H5::DataSet ds = m_file.openDataSet("/events/" + name);
+            ReadDataSet(ds, H5::PredType::NATIVE_INT16, 0, Extent(ds), event.Samples);
+            event.Raw.clear();
+            const std::string rawname = "/events_raw/" + name;
+            if (fHasRaw && H5Lexists(m_file.getId(), rawname.c_str(), H5P_DEFAULT) > 0) {
+                H5::DataSet raw = m_file.openDataSet(rawname);
+                ReadDataSet(raw, H5::PredType::NATIVE_UINT16, 0, Extent(raw), event.Raw);
+                if (event.Raw.size() != event.Samples.size())
+                    event.Raw.clear();
+            }
+            const uint32_t nsamples = std::max<uint32_t>(1, fInfo.RecordLength);
+            const size_t npresent = std::min(fInfo.ChannelList.size(), event.Samples.size() / nsamples);
+            event.TriggerTimeTag = 0;
+            event.NSamples = nsamples;
+            event.ChannelMask = 0;
+            for (size_t k = 0; k < npresent; k++)
+                event.ChannelMask |= 1u << fInfo.ChannelList[k];
+            event.Samples.resize(npresent * nsamples);
+            if (!event.Raw.empty())
+                event.Raw.resize(npresent * nsamples);
+        }
+
+    private:
+        H5::H5File m_file;
+    };
+
+    // /events/samples + offset, ttt, channelmask (HDF5Writer.hpp). The
+    // index is read at once, the samples through a ~1M-sample window.
+    class AppendableLayout : public ReplayLayout {
+    public:
+        static constexpr hsize_t kWindow = 1 << 20;
+
+        AppendableLayout(const std::string& path, const ReplayInfo& info) : m_file(path, H5F_ACC_RDONLY) {
+            fName = "appendable HDF5";
+            fInfo = info;
+            m_samples = m_file.openDataSet("/events/samples");
+            m_total = Extent(m_samples);
+            ReadDataSet(m_file.openDataSet("/events/offset"), H5::PredType::NATIVE_UINT64, 0,
+                        Extent(m_file.openDataSet("/events/offset")), m_offset);
+            ReadDataSet(m_file.openDataSet("/events/ttt"), H5::PredType::NATIVE_UINT32, 0,
+                        Extent(m_file.openDataSet("/events/ttt")), m_ttt);
+            ReadDataSet(m_file.openDataSet("/events/channelmask"), H5::PredType::NATIVE_UINT32, 0,
+                        Extent(m_file.openDataSet("/events/channelmask")), m_mask);
+            fNEvents = std::min({ m_offset.size(), m_ttt.size(), m_mask.size() });
+            fHasRaw = H5Lexists(m_file.getId(), "/events_raw/samples", H5P_DEFAULT) > 0;
+            if (fHasRaw)
+                m_raw = m_file.openDataSet("/events_raw/samples");
+        }
+
+        uint32_t TriggerTimeTag(uint64_t i) const override { return m_ttt[i]; }
+
+        void Get(uint64_t i, ReplayEvent& event) override {
+            const hsize_t start = m_offset[i];
+            const hsize_t end = std::max(start, i + 1 < m_offset.size() ? m_offset[i + 1] : m_total);
+            if (start < m_winstart || end > m_winstart + m_winsamples.size()) {
+                m_winstart = start;
+                const hsize_t count = std::min(m_total, start + std::max(kWindow, end - start)) - start;
+                ReadDataSet(m_samples, H5::PredType::NATIVE_INT16, start, count, m_winsamples);
+                if (fHasRaw)
+                    ReadDataSet(m_raw, H5::PredType::NATIVE_UINT16, start, count, m_winraw);
+            }
+            const hsize_t from = start - m_winstart;
+            const hsize_t n = end - start;
+            event.Samples.assign(m_winsamples.begin() + from, m_winsamples.begin() + from + n);
+            if (fHasRaw)
+                event.Raw.assign(m_winraw.begin() + from, m_winraw.begin() + from + n);
+            else
+                event.Raw.clear();
+            const uint32_t npresent = __builtin_popcount(m_mask[i]);
+            event.TriggerTimeTag = m_ttt[i];
+            event.ChannelMask = m_mask[i];
+            event.NSamples = npresent ? static_cast<uint32_t>(n / npresent) : 0;
+        }
+
+    private:
+        H5::H5File m_file;
+        H5::DataSet m_samples;
+        H5::DataSet m_raw;
+        hsize_t m_total = 0;
+        std::vector<uint64_t> m_offset;
+        std::vector<uint32_t> m_ttt;
+        std::vector<uint32_t> m_mask;
+        hsize_t m_winstart = 0;
+        std::vector<int16_t> m_winsamples;
+        std::vector<uint16_t> m_winraw;
+    };
+
+    // Fixed-stride records, read in place from the mapping
+    class BinLayout : public ReplayLayout {
+    public:
+        explicit BinLayout(const std::string& path) : m_run(path) {
+            const RunBinary::FileHeader& h = m_run.GetHeader();
+            fName = "BIN";
+            fNEvents = m_run.GetNEvents();
+            fHasRaw = h.fHasRaw;
+            fInfo.RunNumber = h.fRunNumber;
+            fInfo.ChannelList.assign(h.fChannelList, h.fChannelList + h.fNChannels);
+            fInfo.RecordLength = h.fNSamples;
+            fInfo.PostTriggerSize = h.fPostTriggerSize;
+            fInfo.SamplingTime = h.fSamplingTime;
+            fInfo.SamplingRate = CString(h.fSamplingRate, sizeof(h.fSamplingRate));
+            fInfo.TriggerMode = CString(h.fTriggerMode, sizeof(h.fTriggerMode));
+            fInfo.AcquisitionTime = h.fAcquisitionTime;
+            fInfo.TriggerRate_kHz = h.fTriggerRate_kHz;
+        }
+
+        uint32_t TriggerTimeTag(uint64_t i) const override { return m_run.Record(i).fTriggerTimeTag; }
+
+        void Get(uint64_t i, ReplayEvent& event) override {
+            const RunBinary::FileHeader& h = m_run.GetHeader();
+            const RunBinary::RecordHeader& rec = m_run.Record(i);
+            const uint32_t nsamples = std::min(rec.fNSamples, h.fNSamples);
+            event.TriggerTimeTag = rec.fTriggerTimeTag;
+            event.ChannelMask = rec.fChannelMask;
+            event.NSamples = nsamples;
+            event.Samples.clear();
+            event.Raw.clear();
+            for (uint32_t slot = 0; slot < h.fNChannels; slot++) {
+                if (!(rec.fChannelMask & (1u << h.fChannelList[slot])))
+                    continue;
+                const int16_t* wf = m_run.Samples(i, slot);
+                event.Samples.insert(event.Samples.end(), wf, wf + nsamples);
+                if (fHasRaw) {
+                    const uint16_t* rwf = m_run.RawSamples(i, slot);
+                    event.Raw.insert(event.Raw.end(), rwf, rwf + nsamples);
+                }
+            }
+        }
+
+    private:
+        RunBinary::Reader m_run;
+    };
+
+}
+
+// ---------------------------------------------------------------
+// RunReplay
+// ---------------------------------------------------------------
+
+RunReplay::RunReplay(const std::string& path, double speed, bool loop)
+    : fPath(path),
+      fSpeed(speed),
+      fLoop(loop),
+      fRunNumber(0),
+      fRecordLength(0),
+      fPostTriggerSize(0),
+      fSamplingTime(0.0),
+      fHasTiming(false),
+      fInterval(0.0),
+      fNext(0),
+      fCount(0),
+      fTime(0.0),
+      fLastTTT(0),
+      fFirst(true),
+      fRunning(false),
+      fPausedElapsed(0.0)
+{
+    try {
+        Open();
+    } catch (...) {
+        fLayout.reset();
+        if (!fTempPath.empty())
+            unlink(fTempPath.c_str());
+        throw;
+    }
+}
+
+RunReplay::~RunReplay() {
+    fLayout.reset();
+    if (!fTempPath.empty())
+        unlink(fTempPath.c_str());
+}
+
+void RunReplay::Open() {
+    if (EndsWith(fPath, ".bin")) {
+        fLayout.reset(new BinLayout(fPath));
+    } else {
+        std::string h5path = fPath;
+        if (EndsWith(fPath, ".gz")) {
+            fTempPath = Gunzip(fPath);
+            h5path = fTempPath;
+        }
+        ReplayInfo info;
+        bool appendable = false;
+        {
+            H5::H5File file(h5path, H5F_ACC_RDONLY);
+            ReadInfo(file, info);
+            appendable = H5Lexists(file.getId(), "/events/samples", H5P_DEFAULT) > 0;
+        }
+        if (appendable)
+            fLayout.reset(new AppendableLayout(h5path, info));
+        else
+            fLayout.reset(new PerEventLayout(h5path, info));
+    }
+
+    const ReplayInfo& info = fLayout->fInfo;
+    if (info.ChannelList.empty())
+        throw std::runtime_error(fPath + ": missing /config ChannelList");
+    fRunNumber = info.RunNumber;
+    fChannelList = info.ChannelList;
+    fRecordLength = info.RecordLength;
+    fPostTriggerSize = info.PostTriggerSize;
+    fSamplingTime = info.SamplingTime;
+    fSamplingRate = info.SamplingRate;
+    fTriggerMode = info.TriggerMode;
+
+    const uint64_t nevents = fLayout->fNEvents;
+    for (uint64_t i = 0; i < std::min<uint64_t>(nevents, 1000) && !fHasTiming; i++)
+        fHasTiming = fLayout->TriggerTimeTag(i) != 0;
+
+    // mean interval: the recorded rate, else the span of the time tags
+    if (info.AcquisitionTime > 0 && nevents > 0)
+        fInterval = info.AcquisitionTime / nevents;
+    else if (info.TriggerRate_kHz > 0)
+        fInterval = 1e-3 / info.TriggerRate_kHz;
+    else if (fHasTiming && nevents > 1) {
+        double span = 0.0;
+        for (uint64_t i = 1; i < nevents; i++)
+            span += ((fLayout->TriggerTimeTag(i) - fLayout->TriggerTimeTag(i - 1)) & kTTTMask) * kTTTTick;
+        fInterval = span / (nevents - 1);
+    }
+    if (!fHasTiming && fInterval <= 0 && fSpeed > 0)
+        Log::OutWarning("→ " + fPath + " has neither trigger time tags nor a recorded rate: replaying as fast as possible");
+
+    // The baseline the original run subtracted, from its first event:
+    // raw = trunc(w) and corr = trunc(w - b) bound b for every sample, the
+    // intersection of the bounds is narrow (middle taken; mean as fallback)
+    if (fLayout->fHasRaw && nevents > 0) {
+        ReplayEvent event;
+        fLayout->Get(0, event);
+        size_t offset = 0;
+        for (uint32_t ch : fChannelList) {
+            if (!(event.ChannelMask & (1u << ch)) || offset + event.NSamples > event.Raw.size())
+                continue;
+            double lo = -1e9, hi = 1e9, sum = 0.0;
+            for (uint32_t s = 0; s < event.NSamples; s++) {
+                const double raw = event.Raw[offset + s];
+                double xlo, xhi;
+                TruncRange(event.Samples[offset + s], xlo, xhi);
+                lo = std::max(lo, raw - xhi);
+                hi = std::min(hi, raw + 1.0 - xlo);
+                sum += raw - event.Samples[offset + s];
+            }
+            fBaseline[ch] = lo < hi ? 0.5 * (lo + hi) : (event.NSamples ? sum / event.NSamples : 0.0);
+            offset += event.NSamples;
+        }
+    }
+}
+
+void RunReplay::MakeWaveforms(ReplayEvent& event) const {
+    event.Waveforms.resize(event.Samples.size());
+    if (event.Raw.size() != event.Samples.size()) {
+        std::copy(event.Samples.begin(), event.Samples.end(), event.Waveforms.begin());
+        return;
+    }
+    size_t offset = 0;
+    for (uint32_t ch : fChannelList) {
+        if (!(event.ChannelMask & (1u << ch)) || offset + event.NSamples > event.Samples.size())
+            continue;
+        const double b = GetBaseline(ch);
+        for (uint32_t s = 0; s < event.NSamples; s++, offset++) {
+            // w in [raw, raw + 1) with trunc(w - b) == corr
+            double xlo, xhi;
+            TruncRange(event.Samples[offset], xlo, xhi);
+            const double lo = std::max<double>(event.Raw[offset], xlo + b);
+            const double hi = std::min<double>(event.Raw[offset] + 1.0, xhi + b);
+            event.Waveforms[offset] = lo < hi ? 0.5 * (lo + hi) : event.Raw[offset] + 0.5;
+        }
+    }
+}
+
+const std::string& RunReplay::GetLayout() const {
+    return fLayout->fName;
+}
+
+uint64_t RunReplay::GetNEvents() const {
+    return fLayout->fNEvents;
+}
+
+bool RunReplay::HasRaw() const {
+    return fLayout->fHasRaw;
+}
+
+double RunReplay::GetBaseline(uint32_t channel) const {
+    auto it = fBaseline.find(channel);
+    return it == fBaseline.end() ? 0.0 : it->second;
+}
+
+void RunReplay::Start() {
+    if (fRunning)
+        return;
+    fStart = std::chrono::steady_clock::now();
+    fRunning = true;
+}
+
+void RunReplay::Pause() {
+    if (!fRunning)
+        return;
+    fPausedElapsed = Elapsed();
+    fRunning = false;
+}
+
+double RunReplay::Elapsed() const {
+    if (!fRunning)
+        return fPausedElapsed;
+    return fPausedElapsed + std::chrono::duration<double>(std::chrono::steady_clock::now() - fStart).count();
+}
+
+bool RunReplay::IsFinished() const {
+    return fNext >= fLayout->fNEvents && (!fLoop || fLayout->fNEvents == 0);
+}
+
+// Original time of event fNext, relative to the first event of the replay
+double RunReplay::NextTime() const {
+    if (fCount == 0)
+        return 0.0;
+    if (fFirst || !fHasTiming)
+        return fTime + fInterval;
+    return fTime + ((fLayout->TriggerTimeTag(fNext) - fLastTTT) & kTTTMask) * kTTTTick;
+}
+
+size_t RunReplay::Read(std::vector<ReplayEvent>& block, size_t maxevents) {
+    if (block.size() < maxevents)
+        block.resize(maxevents);
+
+    const double now = fSpeed > 0 ? Elapsed() * fSpeed : 0.0;
+    size_t n = 0;
+    while (n < maxevents) {
+        if (fNext >= fLayout->fNEvents) {
+            if (!fLoop || fLayout->fNEvents == 0)
+                break;
+            fNext = 0;
+            fFirst = true;
+        }
+        const double t = NextTime();
+        if (fSpeed > 0 && t > now)
+            break;
+        fLayout->Get(fNext, block[n]);
+        MakeWaveforms(block[n]);
+        fLastTTT = fLayout->TriggerTimeTag(fNext);
+        fTime = t;
+        fFirst = false;
+        fNext++;
+        fCount++;
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,126 @@
+#ifndef RUNREPLAY_H
+#define RUNREPLAY_H
+
+// Input backend that reads a recorded run instead of the digitizer
+// ([replay] Enable). Supported files:
+//
+//   .h5      per-event layout (/events/eventN) or appendable layout
+//            (/events/samples, SWMR / Compression)
+//   .h5.gz   gunzipped to a temporary file first
+//   .bin     flat BIN records (RunBinary.h)
+//
+// Read() hands out the events whose time has come, like a readout block
+// of the board. Event times come from the trigger time tags (8.5 ns ticks,
+// wrap-around handled for gaps below ~9 s); the per-event layout has no
+// tags, so its events are spread evenly at the recorded mean rate.
+// speed 1 replays at the original timing, 2 twice as fast, 0 as fast as
+// possible. With loop the file is rewound until the caller stops.
+//
+// Each event also carries the float waveforms the decoder would have
+// produced. With raw samples they are rebuilt so that the baseline
+// correction of Digitizer gives back both recorded values (the baseline of
+// the original run is recovered from the first event); otherwise they are
+// the corrected samples, replayed with a zero baseline.
+
+#include <H5Cpp.h>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TimeAlignment.h"
+
+struct ReplayEvent {
+    uint32_t TriggerTimeTag = 0;
+    uint32_t ChannelMask = 0;                ///< bit ch set for each channel present
+    uint32_t NSamples = 0;                   ///< per channel
+    std::vector<int16_t> Samples;            ///< channels present in ChannelList order
+    std::vector<uint16_t> Raw;               ///< same shape, empty if not recorded
+    std::vector<float> Waveforms;            ///< same shape, as decoded by the board
+};
+
+class ReplayLayout;
+
+class RunReplay {
+public:
+    static constexpr double kTTTTick = 8.5e-9;          ///< seconds per trigger time tag count
+    static constexpr uint32_t kTTTMask = TimeAlignment::kTTTMask;
+
+    /// Open a recorded run. Throws std::runtime_error / H5::Exception.
+    RunReplay(const std::string& path, double speed = 1.0, bool loop = false);
+    ~RunReplay();
+
+    RunReplay(const RunReplay&) = delete;
+    RunReplay& operator=(const RunReplay&) = delete;
+
+    /// (Re)start the clock: at the start of the run and on resume.
+    void Start();
+    /// Freeze the clock while the run is paused.
+    void Pause();
+
+    /// Fill block[0..n) with the events due now, n <= maxevents; block is
+    /// resized to maxevents once and its buffers reused. Returns n.
+    size_t Read(std::vector<ReplayEvent>& block, size_t maxevents);
+
+    /// No more events: end of file without loop.
+    bool IsFinished() const;
+
+    const std::string& GetPath() const { return fPath; }
+    const std::string& GetLayout() const;
+    uint64_t GetNEvents() const;
+    uint64_t GetNReplayed() const { return fCount; }
+    bool HasRaw() const;
+    bool HasTiming() const { return fHasTiming; }
+    double GetMeanInterval() const { return fInterval; }
+
+    // settings of the recorded run
+    int GetRunNumber() const { return fRunNumber; }
+    const std::vector<uint32_t>& GetChannelList() const { return fChannelList; }
+    uint32_t GetRecordLength() const { return fRecordLength; }
+    uint32_t GetPostTriggerSize() const { return fPostTriggerSize; }
+    double GetSamplingTime() const { return fSamplingTime; }
+    const std::string& GetSamplingRate() const { return fSamplingRate; }
+    const std::string& GetTriggerMode() const { return fTriggerMode; }
+
+    /// Baseline subtracted in the recorded run, 0 without raw samples.
+    double GetBaseline(uint32_t channel) const;
+
+private:
+    void Open();
+    void MakeWaveforms(ReplayEvent& event) const;
+    double NextTime() const;
+    double Elapsed() const;
+
+    std::string fPath;
+    std::string fTempPath;                   ///< gunzipped copy of a .h5.gz
+    double fSpeed;
+    bool fLoop;
+
+    std::unique_ptr<ReplayLayout> fLayout;
+
+    int fRunNumber;
+    std::vector<uint32_t> fChannelList;
+    uint32_t fRecordLength;
+    uint32_t fPostTriggerSize;
+    double fSamplingTime;
+    std::string fSamplingRate;
+    std::string fTriggerMode;
+    std::map<uint32_t, double> fBaseline;
+
+    bool fHasTiming;
+    double fInterval;                        ///< mean time between events, s
+
+    uint64_t fNext;                          ///< next event of the file
+    uint64_t fCount;                         ///< events handed out
+    double fTime;                            ///< time of the last event handed out, s
+    uint32_t fLastTTT;
+    bool fFirst;                             ///< next event starts a pass over the file
+
+    bool fRunning;
+    std::chrono::steady_clock::time_point fStart;
+    double fPausedElapsed;
+};
+
+#endif // RUNREPLAY_H
@@ -0,0 +1,141 @@
+#include "X742Event.h"
+
+#include <algorithm>
+
+namespace {
+
+    // one channel, N known at compile time: fixed trip counts (multiples
+    // of 8 for all the DRS4 lengths) that the compiler unrolls and
+    // vectorizes without a remainder loop, on 64-byte aligned rows
+    template <uint32_t N>
+    void ConvertChannel(const float* waveform, double baseline, int16_t* corr, uint16_t* raw) {
+        corr = static_cast<int16_t*>(__builtin_assume_aligned(corr, EventBatch::kAlign));
+        for (uint32_t i = 0; i < N; ++i) {
+            float corrected = waveform[i] - baseline;
+            corr[i] = static_cast<int16_t>(corrected);
+        }
+        if (raw == nullptr)
+            return;
+        raw = static_cast<uint16_t*>(__builtin_assume_aligned(raw, EventBatch::kAlign));
+        for (uint32_t i = 0; i < N; ++i)
+            raw[i] = static_cast<uint16_t>(waveform[i]);
+    }
+
+    template <uint32_t N, uint32_t C>
+    uint32_t ConvertFixed(const CAEN_DGTZ_X742_EVENT_t& event, const std::vector<uint32_t>& channels,
+                          const std::vector<double>& baselines, EventBatch& batch, uint32_t e) {
+        if (channels.size() != C || batch.GetNChannels() < C || batch.GetMaxSamples() < N)
+            return X742Event::Convert(event, channels, baselines, batch, e);
+
+        const float* waveforms[C];
+        uint32_t mask = 0;
+        for (uint32_t c = 0; c < C; c++) {
+            uint32_t n;
+            waveforms[c] = X742Event::Waveform(event, channels[c], n);
+            if (waveforms[c] == nullptr || n != N)
+                return X742Event::Convert(event, channels, baselines, batch, e);
+            mask |= (1u << channels[c]);
+        }
+
+        for (uint32_t c = 0; c < C; c++)
+            ConvertChannel<N>(waveforms[c], baselines[c], batch.Corr(e, c), batch.Raw(e, c));
+        batch.SetChannels(e, mask, C, N);
+        return mask;
+    }
+
+    struct Kernel {
+        uint32_t fSamples;
+        uint32_t fChannels;
+        X742Event::ConvertKernel fConvert;
+    };
+
+#define X742_KERNELS(N) \
+    { N, 4, ConvertFixed<N, 4> }, { N, 8, ConvertFixed<N, 8> }, { N, 16, ConvertFixed<N, 16> }
+
+    // DRS4 record lengths (RecordLength) x usual channel counts, up to the
+    // 16 channels Slot() maps
+    const Kernel kKernels[] = {
+        X742_KERNELS(1024), X742_KERNELS(520), X742_KERNELS(256), X742_KERNELS(136)
+    };
+
+#undef X742_KERNELS
+
+}
+
+bool X742Event::Slot(uint32_t ch, int& group, int& local_ch) {
+    group = ch / 4;
+    local_ch = ch % 4;
+    return group < MAX_X742_GROUP_SIZE && local_ch < 4;
+}
+
+const float* X742Event::Waveform(const CAEN_DGTZ_X742_EVENT_t& event, uint32_t ch, uint32_t& nsamples) {
+    int group, local_ch;
+    if (!Slot(ch, group, local_ch))
+        return nullptr;
+
+    nsamples = event.DataGroup[group].ChSize[local_ch];
+    const float* waveform = event.DataGroup[group].DataChannel[local_ch];
+    if (nsamples < kMinSamples || nsamples > kMaxSamples)
+        return nullptr;
+    return waveform;
+}
+
+std::vector<double> X742Event::Baselines(const std::vector<uint32_t>& channels,
+                                         const std::map<uint32_t, double>& baselines) {
+    std::vector<double> result;
+    for (uint32_t ch : channels) {
+        auto it = baselines.find(ch);
+        result.push_back(it != baselines.end() ? it->second : 0.0);
+    }
+    return result;
+}
+
+uint32_t X742Event::Length(const CAEN_DGTZ_X742_EVENT_t& event, const std::vector<uint32_t>& channels) {
+    uint32_t length = 0;
+    for (uint32_t ch : channels) {
+        uint32_t n;
+        if (Waveform(event, ch, n) != nullptr)
+            length = std::max(length, n);
+    }
+    return length;
+}
+
+uint32_t X742Event::Convert(const CAEN_DGTZ_X742_EVENT_t& event, const std::vector<uint32_t>& channels,
+                            const std::vector<double>& baselines, EventBatch& batch, uint32_t e) {
+    uint32_t mask = 0;
+    uint32_t npresent = 0;
+    uint32_t nsamples = 0;
+
+    for (size_t c = 0; c < channels.size() && npresent < batch.GetNChannels(); c++) {
+        const uint32_t ch = channels[c];
+        uint32_t n;
+        const float* waveform = Waveform(event, ch, n);
+        if (waveform == nullptr)
+            continue;
+
+        n = std::min(n, batch.GetMaxSamples());
+        const double baseline = baselines[c];
+        int16_t* corr = batch.Corr(e, npresent);
+        uint16_t* raw = batch.Raw(e, npresent);
+        mask |= (1u << ch);
+        npresent++;
+        nsamples = n;
+
+        for (uint32_t i = 0; i < n; ++i) {
+            float corrected = waveform[i] - baseline;
+            corr[i] = static_cast<int16_t>(corrected);
+        }
+        if (raw)
+            for (uint32_t i = 0; i < n; ++i)
+                raw[i] = static_cast<uint16_t>(waveform[i]);
+    }
+    batch.SetChannels(e, mask, npresent, nsamples);
+    return mask;
+}
+
+X742Event::ConvertKernel X742Event::SelectConvert(uint32_t nsamples, size_t nchannels) {
+    for (const Kernel& k : kKernels)
+        if (k.fSamples == nsamples && k.fChannels == nchannels)
+            return k.fConvert;
+    return Convert;
+}
@@ -0,0 +1,59 @@
+#ifndef X742EVENT_H
+#define X742EVENT_H
+
+// From a decoded X742 event (CAEN_DGTZ_DecodeEvent) to the samples written
+// to disk: float waveforms -> baseline-corrected int16 (+ raw uint16), one
+// event of an EventBatch at a time.
+// Shared by Digitizer and daq-bench, needs no CAEN library.
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "CAENDigitizerType.h"
+#include "EventBatch.h"
+
+namespace X742Event {
+
+    constexpr uint32_t kMinSamples = 10;
+    constexpr uint32_t kMaxSamples = 100000;
+
+    /// Group and index in the group of channel ch, false if out of range.
+    /// The same mapping as the group enable mask of Digitizer::Configure().
+    bool Slot(uint32_t ch, int& group, int& local_ch);
+
+    /// Waveform of channel ch, nullptr if missing or of invalid length.
+    const float* Waveform(const CAEN_DGTZ_X742_EVENT_t& event, uint32_t ch, uint32_t& nsamples);
+
+    /// Baseline of each channel of channels, 0 if it has none: looked up
+    /// once per run rather than once per channel and event.
+    std::vector<double> Baselines(const std::vector<uint32_t>& channels,
+                                  const std::map<uint32_t, double>& baselines);
+
+    /// Longest valid waveform among channels, 0 if none: the batch must hold
+    /// it before Convert().
+    uint32_t Length(const CAEN_DGTZ_X742_EVENT_t& event, const std::vector<uint32_t>& channels);
+
+    /// Samples of the channels present, in channels order, into event e of
+    /// batch: corr = waveform - baseline, raw = waveform (if the batch has
+    /// raw samples). baselines is parallel to channels (see Baselines());
+    /// waveforms longer than the batch rows are cut. Sets and returns the
+    /// mask of the channels present.
+    uint32_t Convert(const CAEN_DGTZ_X742_EVENT_t& event, const std::vector<uint32_t>& channels,
+                     const std::vector<double>& baselines, EventBatch& batch, uint32_t e);
+
+    /// Convert() or one of its specializations.
+    using ConvertKernel = uint32_t (*)(const CAEN_DGTZ_X742_EVENT_t& event, const std::vector<uint32_t>& channels,
+                                       const std::vector<double>& baselines, EventBatch& batch, uint32_t e);
+
+    /// Kernel for nchannels channels (the size of channels) of nsamples
+    /// samples, chosen once per run. The DRS4 record lengths 1024, 520,
+    /// 256 and 136 with 4, 8 or 16 channels have a kernel compiled for
+    /// that shape, with fixed loop counts; other shapes get Convert(). A
+    /// specialized kernel hands events of another shape (channel missing,
+    /// other length) to Convert().
+    ConvertKernel SelectConvert(uint32_t nsamples, size_t nchannels);
+
+}
+
+#endif // X742EVENT_H
@@ -0,0 +1,166 @@
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Log.h"
+
+std::mutex BufferPool::fMutex;
+BufferPool::Mode BufferPool::fMode = BufferPool::kAuto;
+std::map<void*, BufferPool::Block> BufferPool::fLive;
+std::multimap<size_t, std::pair<void*, BufferPool::Kind>> BufferPool::fFree;
+uint64_t BufferPool::fBytes[3] = {};
+
+namespace {
+
+    bool gWarned = false;
+
+    size_t RoundUp(size_t size, size_t unit)
+    {
+	return (size + unit - 1) / unit * unit;
+    }
+
+    // anonymous mapping of size bytes starting on a 2 MiB boundary
+    void* MapAligned(size_t size)
+    {
+	const size_t span = size + BufferPool::kHugePage;
+	void* p = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if( p == MAP_FAILED )
+	    return nullptr;
+	char* base = static_cast<char*>(p);
+	char* aligned = reinterpret_cast<char*>(RoundUp(reinterpret_cast<uintptr_t>(base), BufferPool::kHugePage));
+	if( aligned > base )
+	    munmap(base, aligned - base);
+	const size_t tail = base + span - (aligned + size);
+	if( tail > 0 )
+	    munmap(aligned + size, tail);
+	return aligned;
+    }
+
+}
+
+void BufferPool::Configure(const std::string& mode)
+{
+    Mode m;
+    if( mode == "off" )
+	m = kOff;
+    else if( mode == "transparent" )
+	m = kTransparent;
+    else if( mode == "explicit" )
+	m = kExplicit;
+    else if( mode == "auto" )
+	m = kAuto;
+    else
+	throw std::runtime_error("BufferPool: unknown huge page mode \"" + mode + "\"");
+    Trim();
+    std::lock_guard<std::mutex> lock(fMutex);
+    fMode = m;
+    gWarned = false;
+}
+
+BufferPool::Mode BufferPool::GetMode()
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fMode;
+}
+
+// called with fMutex held
+void* BufferPool::Map(size_t size, Kind& kind)
+{
+    if( fMode == kExplicit || fMode == kAuto )
+	{
+	    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	    if( p != MAP_FAILED )
+		{
+		    kind = kHugeTLB;
+		    return p;
+		}
+	    if( fMode == kExplicit && !gWarned )
+		{
+		    gWarned = true;
+		    Log::OutWarning("No free explicit huge pages (vm.nr_hugepages), using transparent huge pages.");
+		}
+	}
+
+    void* p = MapAligned(size);
+    if( p == nullptr )
+	return nullptr;
+    kind = kNormal;
+    if( fMode != kOff && madvise(p, size, MADV_HUGEPAGE) == 0 )
+	kind = kAdvised;
+    return p;
+}
+
+void* BufferPool::Acquire(size_t size)
+{
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::lock_guard<std::mutex> lock(fMutex);
+    size = RoundUp(std::max<size_t>(size, 1), fMode == kOff ? page : kHugePage);
+
+    // a free block of the same size or up to twice as large
+    auto it = fFree.lower_bound(size);
+    if( it != fFree.end() && it->first <= 2 * size )
+	{
+	    void* p = it->second.first;
+	    fLive[p] = { it->first, it->second.second };
+	    fFree.erase(it);
+	    return p;
+	}
+
+    Kind kind;
+    void* p = Map(size, kind);
+    if( p == nullptr )
+	throw std::bad_alloc();
+    fLive[p] = { size, kind };
+    fBytes[kind] += size;
+    return p;
+}
+
+void BufferPool::Release(void* block)
+{
+    if( block == nullptr )
+	return;
+    std::lock_guard<std::mutex> lock(fMutex);
+    auto it = fLive.find(block);
+    if( it == fLive.end() )
+	return;
+    fFree.emplace(it->second.fSize, std::make_pair(block, it->second.fKind));
+    fLive.erase(it);
+}
+
+void BufferPool::Trim()
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    for( auto& [size, block]: fFree )
+	{
+	    munmap(block.first, size);
+	    fBytes[block.second] -= size;
+	}
+    fFree.clear();
+}
+
+void BufferPool::Advise(void* data, size_t size)
+{
+    if( GetMode() == kOff || data == nullptr )
+	return;
+    const uintptr_t begin = RoundUp(reinterpret_cast<uintptr_t>(data), kHugePage);
+    const uintptr_t end = (reinterpret_cast<uintptr_t>(data) + size) / kHugePage * kHugePage;
+    if( end > begin )
+	madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+}
+
+std::string BufferPool::Summary()
+{
+    static const char* modes[] = { "off", "transparent", "explicit", "auto" };
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::ostringstream s;
+    s << (fBytes[kHugeTLB] >> 20) << " MB on explicit huge pages, "
+      << (fBytes[kAdvised] >> 20) << " MB transparent, "
+      << (fBytes[kNormal] >> 20) << " MB normal (mode " << modes[fMode] << ")";
+    return s.str();
+}
@@ -0,0 +1,102 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+// Large buffers of the data path on 2 MiB pages, from [memory] HugePages:
+// the readout buffer, the HDF5 staging buffers, the BIN write blocks and
+// the monitor ring. On 4 KiB pages a few MB of samples span thousands of
+// TLB entries, and decoding and conversion miss the TLB on every channel.
+//
+//   - "explicit": MAP_HUGETLB, from the pages reserved in vm.nr_hugepages;
+//   - "transparent": madvise(MADV_HUGEPAGE), the kernel collapses the
+//     buffer into huge pages when it can (THP "always" or "madvise");
+//   - "auto": explicit while reserved pages are left, then transparent;
+//   - "off": normal pages.
+//
+// A request that cannot be met falls back to the next mode, down to normal
+// pages, and is counted in Summary(). Blocks are mapped 2 MiB-aligned and
+// kept for reuse after Release(), so a new run does not fault them in again.
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+class BufferPool {
+public:
+    enum Mode { kOff, kTransparent, kExplicit, kAuto };
+
+    static constexpr size_t kHugePage = size_t(2) << 20;
+    static constexpr size_t kMinBytes = size_t(512) << 10;     ///< smaller allocations: normal heap
+
+    /// mode: "auto", "explicit", "transparent" or "off". Drops the free blocks.
+    static void Configure(const std::string& mode);
+    static Mode GetMode();
+
+    /// At least size bytes, 2 MiB-aligned (page-aligned with "off"). Throws
+    /// std::bad_alloc when even normal pages cannot be mapped.
+    static void* Acquire(size_t size);
+    /// Back to the pool; ignores nullptr.
+    static void Release(void* block);
+    /// Unmap the free blocks.
+    static void Trim();
+
+    /// madvise(MADV_HUGEPAGE) on the 2 MiB-aligned part of memory allocated
+    /// elsewhere (CAEN readout buffer, shared memory), before it is touched.
+    static void Advise(void* data, size_t size);
+
+    /// "12 MB on explicit huge pages, 8 MB transparent, 0 MB normal (mode auto)"
+    static std::string Summary();
+
+private:
+    enum Kind { kNormal, kAdvised, kHugeTLB };
+    struct Block {
+	size_t fSize;
+	Kind fKind;
+    };
+
+    static void* Map(size_t size, Kind& kind);
+
+    static std::mutex fMutex;
+    static Mode fMode;
+    static std::map<void*, Block> fLive;
+    static std::multimap<size_t, std::pair<void*, Kind>> fFree;
+    static uint64_t fBytes[3];          ///< mapped now (live and free), per Kind
+};
+
+/// std::allocator replacement: large arrays from BufferPool, small ones
+/// from the heap.
+template <typename T>
+struct HugePageAllocator {
+    using value_type = T;
+
+    HugePageAllocator() = default;
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+	if( n * sizeof(T) >= BufferPool::kMinBytes )
+	    return static_cast<T*>(BufferPool::Acquire(n * sizeof(T)));
+	return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+	if( n * sizeof(T) >= BufferPool::kMinBytes )
+	    BufferPool::Release(p);
+	else
+	    ::operator delete(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return false; }
+
+template <typename T>
+using HugeVector = std::vector<T, HugePageAllocator<T>>;
+
+#endif // BUFFERPOOL_H
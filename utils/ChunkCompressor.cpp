@@ -0,0 +1,69 @@
+#include "ChunkCompressor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+ChunkCompressor::ChunkCompressor(int level, size_t elementsize, unsigned nthreads) :
+    fLevel(std::clamp(level, 1, 9)),
+    fElementSize(std::max<size_t>(1, elementsize)),
+    fPool(TaskPool::Shared(nthreads)),
+    fTasks(fPool),
+    fRawBytes(0),
+    fCompressedBytes(0)
+{
+}
+
+// fTasks waits for the chunks still being compressed
+ChunkCompressor::~ChunkCompressor()
+{
+}
+
+void ChunkCompressor::Submit(const void* data, size_t size)
+{
+    std::vector<char> input(static_cast<const char*>(data), static_cast<const char*>(data) + size);
+    fTasks.Submit([this, input = std::move(input)]() mutable { return Compress(input); });
+}
+
+bool ChunkCompressor::Next(Chunk& chunk, bool wait)
+{
+    if( !fTasks.Next(chunk, wait) )
+	return false;
+    fRawBytes += chunk.fRawBytes;
+    fCompressedBytes += chunk.fData.size();
+    return true;
+}
+
+ChunkCompressor::Chunk ChunkCompressor::Compress(std::vector<char>& input) const
+{
+    const size_t size = input.size();
+    Chunk out;
+    out.fRawBytes = size;
+
+    // shuffle: byte j of every element goes to plane j
+    std::vector<char> shuffled;
+    const char* src = input.data();
+    const size_t nelements = size / fElementSize;
+    if( fElementSize > 1 && nelements > 1 ) {
+	shuffled.resize(size);
+	for( size_t j = 0; j < fElementSize; j++ )
+	    for( size_t i = 0; i < nelements; i++ )
+		shuffled[j * nelements + i] = src[i * fElementSize + j];
+	// trailing bytes of a partial element are left in place, as H5Z shuffle does
+	std::memcpy(shuffled.data() + nelements * fElementSize, src + nelements * fElementSize,
+		    size - nelements * fElementSize);
+	src = shuffled.data();
+    }
+
+    uLongf destlen = compressBound(size);
+    out.fData.resize(destlen);
+    if( compress2(reinterpret_cast<Bytef*>(out.fData.data()), &destlen,
+		  reinterpret_cast<const Bytef*>(src), size, fLevel) == Z_OK && destlen < size ) {
+	out.fData.resize(destlen);
+	out.fFilterMask = 0;
+    } else {
+	out.fData = std::move(input);
+	out.fFilterMask = 0x3;               // skip shuffle and deflate
+    }
+    return out;
+}
@@ -0,0 +1,59 @@
+#ifndef CHUNKCOMPRESSOR_H
+#define CHUNKCOMPRESSOR_H
+
+// Data chunks compressed with the HDF5 shuffle + deflate pipeline, so that
+// the result can be stored as-is with H5Dwrite_chunk(): the bytes of each
+// element are regrouped (shuffle, elementsize > 1) and the chunk is deflated
+// in zlib format. The work runs on TaskPool::Shared(), shared with the
+// writers of the other boards.
+//
+// Chunks come back from Next() in submission order. A chunk that does not
+// shrink is returned unfiltered with fFilterMask set to skip both filters.
+
+#include <cstdint>
+#include <vector>
+
+#include "TaskPool.h"
+
+class ChunkCompressor {
+public:
+    struct Chunk {
+	std::vector<char> fData;
+	size_t fRawBytes = 0;
+	uint32_t fFilterMask = 0;            ///< for H5Dwrite_chunk: bit i skips filter i
+    };
+
+    /// nthreads: size of the shared pool if this starts it, 0 = every core but one.
+    ChunkCompressor(int level, size_t elementsize, unsigned nthreads = 0);
+    ~ChunkCompressor();
+
+    ChunkCompressor(const ChunkCompressor&) = delete;
+    ChunkCompressor& operator=(const ChunkCompressor&) = delete;
+
+    /// Copy size bytes and queue them for compression.
+    void Submit(const void* data, size_t size);
+
+    /// Oldest submitted chunk, once compressed. Returns false if there is
+    /// none, or if it is not done yet and wait is false.
+    bool Next(Chunk& chunk, bool wait);
+
+    size_t GetPending() { return fTasks.GetPending(); }
+    unsigned GetNThreads() const { return fPool.GetNThreads(); }
+
+    /// Total bytes in and out, for the compression ratio.
+    uint64_t GetRawBytes() const { return fRawBytes; }
+    uint64_t GetCompressedBytes() const { return fCompressedBytes; }
+
+private:
+    Chunk Compress(std::vector<char>& input) const;
+
+    int fLevel;
+    size_t fElementSize;
+    TaskPool& fPool;
+    OrderedTasks<Chunk> fTasks;             ///< after fLevel, fElementSize: waits for the running tasks first
+
+    uint64_t fRawBytes;
+    uint64_t fCompressedBytes;
+};
+
+#endif // CHUNKCOMPRESSOR_H
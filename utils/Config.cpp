@@ -1,5 +1,12 @@
 #include "Config.h"
 
+#include <functional>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+#include "ThreadPlacement.h"
+
 Config::Config(const bool& readconfig):
 fReadConfigFile(readconfig)
 {
@@ -19,15 +26,478 @@ void Config::Read( char* filename )
 	    Log::OutError( "Config::Read(): Config files disabled for this executable. Aborting." );
 	    exit(1);
 	}
-    
+
     fFileName = filename;
     Log::OutDebug( "Reading file " + std::string(fFileName) );
 
-    fTbl = toml::parse_file(fFileName);
-    std::cout << fTbl << std::endl;
+    try
+	{
+	    fTbl = toml::parse_file(fFileName);
+	}
+    catch( const toml::parse_error& err )
+	{
+	    std::ostringstream msg;
+	    msg << "Cannot parse " << fFileName << ": " << err.description()
+		<< " (line " << err.source().begin.line << ")";
+	    Log::OutError( msg.str() );
+	    exit(1);
+	}
+
+    if( !Validate() )
+	exit(1);
 
-    const int verbosity = fTbl["settings"]["verbosity"].value_or(3);
+    const int verbosity = fRunConfig.Settings.verbosity;
     Log::OpenLog(verbosity );
-  
+
+    if( !fRunConfig.Settings.LogFile.empty() )
+	Log::SetLogFile( fRunConfig.Settings.LogFile );
+
+    std::ostringstream dump;
+    dump << fTbl;
+    Log::OutDebug( "Configuration:\n" + dump.str() );
+
     return;
 }
+
+// Re-read the configuration between runs. On any error the previous table
+// and snapshot are kept and false is returned, the process goes on.
+bool Config::Reload( const std::string& filename )
+{
+    toml::table tbl;
+    try
+	{
+	    tbl = toml::parse_file(filename);
+	}
+    catch( const toml::parse_error& err )
+	{
+	    std::ostringstream msg;
+	    msg << "Cannot parse " << filename << ": " << err.description()
+		<< " (line " << err.source().begin.line << ")";
+	    Log::OutError( msg.str() );
+	    return false;
+	}
+
+    const std::string oldname = fFileName;
+    fFileName = filename;
+    std::swap( fTbl, tbl );
+    if( !Validate() )
+	{
+	    std::swap( fTbl, tbl );
+	    fFileName = oldname;
+	    Log::OutError( "Keeping the previous configuration." );
+	    return false;
+	}
+
+    Log::SetLogLevel( static_cast<Log::LogLevel>( fRunConfig.Settings.verbosity ) );
+    Log::OutSummary( "Configuration reloaded from " + fFileName );
+    return true;
+}
+
+// FNV-1a of the table written back in canonical form
+std::string Config::GetHash() const
+{
+    std::ostringstream canonical;
+    canonical << toml::toml_formatter( fTbl );
+    uint64_t hash = 14695981039346656037ull;
+    for( unsigned char c: canonical.str() )
+	{
+	    hash ^= c;
+	    hash *= 1099511628211ull;
+	}
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return out.str();
+}
+
+// ---------------------------------------------------------------
+// Schema
+// ---------------------------------------------------------------
+namespace {
+
+    // a setter parses one toml node into a snapshot field and returns an
+    // error message, or an empty string if the value is accepted
+    typedef std::function<std::string(const toml::node&)> Setter;
+
+    struct KeySpec
+    {
+	Setter set;
+	bool required;
+	const char* movedTo;    ///< non-null for keys that belong to another section
+    };
+
+    typedef std::map<std::string, KeySpec> SectionSpec;
+
+    KeySpec Key( Setter set, bool required=false )
+    {
+	return KeySpec{ set, required, nullptr };
+    }
+
+    KeySpec Moved( Setter set, const char* section )
+    {
+	return KeySpec{ set, false, section };
+    }
+
+    template <typename T>
+    Setter Integer( T& field, int64_t min, int64_t max )
+    {
+	return [&field, min, max]( const toml::node& node ) -> std::string {
+	    if( !node.is_integer() )
+		return "expected an integer";
+	    const int64_t value = node.as_integer()->get();
+	    if( value < min || value > max )
+		return "value " + std::to_string(value) + " out of range [" +
+		    std::to_string(min) + ", " + std::to_string(max) + "]";
+	    field = static_cast<T>(value);
+	    return "";
+	};
+    }
+
+    Setter OneOf( uint32_t& field, std::set<int64_t> allowed )
+    {
+	return [&field, allowed]( const toml::node& node ) -> std::string {
+	    if( !node.is_integer() )
+		return "expected an integer";
+	    const int64_t value = node.as_integer()->get();
+	    if( !allowed.count(value) )
+		{
+		    std::string list;
+		    for( auto v: allowed )
+			list += (list.empty() ? "" : ", ") + std::to_string(v);
+		    return "value " + std::to_string(value) + " not supported (allowed: " + list + ")";
+		}
+	    field = static_cast<uint32_t>(value);
+	    return "";
+	};
+    }
+
+    Setter Real( double& field, double min, double max )
+    {
+	return [&field, min, max]( const toml::node& node ) -> std::string {
+	    if( !node.is_number() )
+		return "expected a number";
+	    const double value = node.value<double>().value();
+	    if( value < min || value > max )
+		return "value " + std::to_string(value) + " out of range [" +
+		    std::to_string(min) + ", " + std::to_string(max) + "]";
+	    field = value;
+	    return "";
+	};
+    }
+
+    Setter Boolean( bool& field )
+    {
+	return [&field]( const toml::node& node ) -> std::string {
+	    if( !node.is_boolean() )
+		return "expected true or false";
+	    field = node.as_boolean()->get();
+	    return "";
+	};
+    }
+
+    Setter String( std::string& field, std::vector<std::string> allowed={} )
+    {
+	return [&field, allowed]( const toml::node& node ) -> std::string {
+	    if( !node.is_string() )
+		return "expected a string";
+	    const std::string value = node.as_string()->get();
+	    if( !allowed.empty() && std::find( allowed.begin(), allowed.end(), value ) == allowed.end() )
+		{
+		    std::string list;
+		    for( auto& v: allowed )
+			list += (list.empty() ? "\"" : ", \"") + v + "\"";
+		    return "value \"" + value + "\" not supported (allowed: " + list + ")";
+		}
+	    field = value;
+	    return "";
+	};
+    }
+
+    Setter Duration( uint32_t& field )
+    {
+	return [&field]( const toml::node& node ) -> std::string {
+	    if( node.is_time() )
+		{
+		    const toml::time t = node.as_time()->get();
+		    field = 3600*t.hour + 60*t.minute + t.second;
+		    return "";
+		}
+	    if( node.is_integer() && node.as_integer()->get() >= 0 )
+		{
+		    field = static_cast<uint32_t>( node.as_integer()->get() );
+		    return "";
+		}
+	    return "expected a time (hh:mm:ss) or a number of seconds";
+	};
+    }
+
+    Setter Channels( std::vector<uint32_t>& field, uint32_t nchannels )
+    {
+	return [&field, nchannels]( const toml::node& node ) -> std::string {
+	    const toml::array* arr = node.as_array();
+	    if( arr == nullptr || arr->empty() )
+		return "expected a non-empty list of channels";
+	    std::vector<uint32_t> list;
+	    for( const toml::node& elem: *arr )
+		{
+		    if( !elem.is_integer() )
+			return "channel indices must be integers";
+		    const int64_t ch = elem.as_integer()->get();
+		    if( ch < 0 || ch >= nchannels )
+			return "invalid channel index " + std::to_string(ch) + " (must be 0-" + std::to_string(nchannels-1) + ")";
+		    if( std::find( list.begin(), list.end(), static_cast<uint32_t>(ch) ) != list.end() )
+			return "channel " + std::to_string(ch) + " listed twice";
+		    list.push_back( static_cast<uint32_t>(ch) );
+		}
+	    field = list;
+	    return "";
+	};
+    }
+
+    // one integer, or a non-empty list of distinct ones
+    Setter Addresses( std::vector<uint32_t>& field )
+    {
+	return [&field]( const toml::node& node ) -> std::string {
+	    if( node.is_integer() )
+		{
+		    const int64_t value = node.as_integer()->get();
+		    if( value < 0 || value > 0xFFFFFFFFll )
+			return "value " + std::to_string(value) + " is not a 32-bit address";
+		    field = { static_cast<uint32_t>(value) };
+		    return "";
+		}
+	    const toml::array* arr = node.as_array();
+	    if( arr == nullptr || arr->empty() )
+		return "expected an address or a non-empty list of addresses";
+	    std::vector<uint32_t> list;
+	    for( const toml::node& elem: *arr )
+		{
+		    if( !elem.is_integer() )
+			return "addresses must be integers";
+		    const int64_t value = elem.as_integer()->get();
+		    if( value < 0 || value > 0xFFFFFFFFll )
+			return "value " + std::to_string(value) + " is not a 32-bit address";
+		    if( std::find( list.begin(), list.end(), static_cast<uint32_t>(value) ) != list.end() )
+			return "address " + std::to_string(value) + " listed twice";
+		    list.push_back( static_cast<uint32_t>(value) );
+		}
+	    field = list;
+	    return "";
+	};
+    }
+
+    Setter CPUs( std::vector<int>& field )
+    {
+	return [&field]( const toml::node& node ) -> std::string {
+	    if( node.is_string() )
+		{
+		    // "0-3,8" as in /sys and taskset
+		    const std::string text = node.as_string()->get();
+		    if( text.find_first_not_of( "0123456789,- " ) != std::string::npos )
+			return "expected a CPU list like \"0-3,8\"";
+		    field = ThreadPlacement::ParseCPUList( text );
+		    return "";
+		}
+	    const toml::array* arr = node.as_array();
+	    if( arr == nullptr )
+		return "expected a list of CPU numbers or a string like \"0-3,8\"";
+	    std::vector<int> list;
+	    for( const toml::node& elem: *arr )
+		{
+		    if( !elem.is_integer() || elem.as_integer()->get() < 0 || elem.as_integer()->get() >= 4096 )
+			return "expected a list of CPU numbers (0-4095)";
+		    list.push_back( static_cast<int>( elem.as_integer()->get() ) );
+		}
+	    field = list;
+	    return "";
+	};
+    }
+
+    Setter Strings( std::vector<std::string>& field )
+    {
+	return [&field]( const toml::node& node ) -> std::string {
+	    const toml::array* arr = node.as_array();
+	    if( arr == nullptr )
+		return "expected a list of strings";
+	    std::vector<std::string> list;
+	    for( const toml::node& elem: *arr )
+		{
+		    if( !elem.is_string() )
+			return "expected a list of strings";
+		    list.push_back( elem.as_string()->get() );
+		}
+	    field = list;
+	    return "";
+	};
+    }
+
+    std::string Where( const std::string& section, const std::string& key, const toml::node* node )
+    {
+	std::string where = "[" + section + "] " + key;
+	if( node != nullptr && node->source().begin.line > 0 )
+	    where += " (line " + std::to_string( node->source().begin.line ) + ")";
+	return where;
+    }
+
+}
+
+bool Config::Validate()
+{
+    RunConfig cfg;
+    GeneralSettings& gen = cfg.Settings;
+    DigitizerSettings& dig = cfg.Digitizer;
+    BridgeSettings& bri = cfg.Bridge;
+    OutputSettings& out = cfg.Output;
+    MonitorSettings& mon = cfg.Monitor;
+    ControlSettings& ctl = cfg.Control;
+    ReplaySettings& rep = cfg.Replay;
+    ThreadSettings& thr = cfg.Threads;
+    MemorySettings& mem = cfg.Memory;
+    HistogramSettings& his = cfg.Histograms;
+
+    const std::vector<std::string> formats = { "HDF5", "BIN", "ROOT", "ASCII" };
+
+    std::map<std::string, SectionSpec> schema;
+    schema["settings"] = {
+	{ "verbosity",         Key( Integer( gen.verbosity, Log::nothing, Log::debug ) ) },
+	{ "LogFile",           Key( String( gen.LogFile ) ) },
+    };
+    schema["digitizer"] = {
+	{ "ConnectionType",    Key( String( dig.ConnectionType, { "ETH_V4718" } ) ) },
+	{ "IPAddress",         Key( String( dig.IPAddress ) ) },
+	{ "LinkNumber",        Key( Integer( dig.LinkNumber, 0, 15 ) ) },
+	{ "ConetNode",         Key( Integer( dig.ConetNode, 0, 15 ) ) },
+	{ "VMEBaseAddress",    Key( Addresses( dig.VMEBaseAddress ) ) },
+	{ "ChannelList",       Key( Channels( dig.ChannelList, 32 ), true ) },
+	{ "SamplingRate",      Key( String( dig.SamplingRate, { "5GHz", "2.5GHz", "1GHz" } ) ) },
+	{ "RecordLength",      Key( OneOf( dig.RecordLength, { 136, 256, 520, 1024 } ) ) },
+	{ "PostTriggerSize",   Key( Integer( dig.PostTriggerSize, 0, 100 ) ) },
+	{ "RunNumber",         Key( Integer( dig.RunNumber, 0, 9999 ) ) },
+	{ "WaitTimeS",         Key( Real( dig.WaitTimeS, 0.0, 3600.0 ) ) },
+	{ "SelfTrigger",       Key( Boolean( dig.SelfTrigger ) ) },
+	{ "ExternalTrigger",   Key( Boolean( dig.ExternalTrigger ) ) },
+	{ "ExtTriggerMode",    Key( String( dig.ExtTriggerMode, { "NIM", "TTL" } ) ) },
+	{ "TriggerPolarity",   Key( Integer( dig.TriggerPolarity, 0, 1 ) ) },
+	{ "PulsePolarity",     Key( Integer( dig.PulsePolarity, 0, 1 ) ) },
+	{ "NRMSThreshold",     Key( Real( dig.NRMSThreshold, 0.0, 1e6 ) ) },
+	{ "IntegralThreshold", Key( Real( dig.IntegralThreshold, -1e12, 1e12 ) ) },
+	{ "Duration",          Key( Duration( dig.Duration ) ) },
+	{ "NEvents",           Key( Integer( dig.NEvents, 1, 0xFFFFFFFFll ) ) },
+	{ "NNoiseEvents",      Key( Integer( dig.NNoiseEvents, 0, 0xFFFFFFFFll ) ) },
+	{ "EventsPerBLT",      Key( Integer( dig.EventsPerBLT, 0, 2048 ) ) },
+	{ "MaxTransferMs",     Key( Real( dig.MaxTransferMs, 0.1, 10000.0 ) ) },
+	{ "SyncStart",         Key( Boolean( dig.SyncStart ) ) },
+	// accepted here for old config files, they belong to [output]
+	{ "SaveRaw",           Moved( Boolean( out.SaveRaw ), "output" ) },
+	{ "OutputFormat",      Moved( String( out.OutputFormat, formats ), "output" ) },
+	{ "OutputDir",         Moved( String( out.OutputDir ), "output" ) },
+	{ "OutputFile",        Moved( String( out.OutputFile ), "output" ) },
+    };
+    schema["bridge"] = {
+	{ "IPAddress",         Key( String( bri.IPAddress ) ) },
+    };
+    schema["output"] = {
+	{ "SaveRaw",           Key( Boolean( out.SaveRaw ) ) },
+	{ "OutputFormat",      Key( String( out.OutputFormat, formats ) ) },
+	{ "OutputDir",         Key( String( out.OutputDir ) ) },
+	{ "OutputFile",        Key( String( out.OutputFile ) ) },
+	{ "Journal",           Key( Boolean( out.Journal ) ) },
+	{ "CheckpointEvents",  Key( Integer( out.CheckpointEvents, 0, 1000000 ) ) },
+	{ "CheckpointIntervalS", Key( Real( out.CheckpointIntervalS, 0.1, 3600.0 ) ) },
+	{ "SWMR",              Key( Boolean( out.SWMR ) ) },
+	{ "RunCatalog",        Key( String( out.RunCatalog ) ) },
+	{ "Compression",       Key( Integer( out.Compression, 0, 9 ) ) },
+	{ "CompressionThreads", Key( Integer( out.CompressionThreads, 0, 256 ) ) },
+	{ "WriteMode",         Key( String( out.WriteMode, { "buffered", "direct" } ) ) },
+	{ "WriteEngine",       Key( String( out.WriteEngine, { "auto", "uring", "threads", "sync" } ) ) },
+	{ "BlockSizeMB",       Key( Integer( out.BlockSizeMB, 1, 256 ) ) },
+	{ "WriteBuffers",      Key( Integer( out.WriteBuffers, 2, 16 ) ) },
+    };
+    schema["monitor"] = {
+	{ "Enable",            Key( Boolean( mon.Enable ) ) },
+	{ "SharedMemoryName",  Key( String( mon.SharedMemoryName ) ) },
+	{ "Slots",             Key( Integer( mon.Slots, 2, 65536 ) ) },
+    };
+    schema["control"] = {
+	{ "Enable",            Key( Boolean( ctl.Enable ) ) },
+	{ "Socket",            Key( String( ctl.Socket ) ) },
+	{ "ShutdownTimeoutS",  Key( Real( ctl.ShutdownTimeoutS, 0.0, 600.0 ) ) },
+    };
+    schema["replay"] = {
+	{ "Enable",            Key( Boolean( rep.Enable ) ) },
+	{ "Files",             Key( Strings( rep.Files ) ) },
+	{ "Speed",             Key( Real( rep.Speed, 0.0, 1e6 ) ) },
+	{ "Loop",              Key( Boolean( rep.Loop ) ) },
+    };
+    schema["threads"] = {
+	{ "ReadoutCPUs",       Key( CPUs( thr.ReadoutCPUs ) ) },
+	{ "ReadoutPriority",   Key( Integer( thr.ReadoutPriority, 0, 99 ) ) },
+	{ "WriteCPUs",         Key( CPUs( thr.WriteCPUs ) ) },
+	{ "NetworkInterface",  Key( String( thr.NetworkInterface ) ) },
+    };
+    schema["memory"] = {
+	{ "HugePages",         Key( String( mem.HugePages, { "auto", "explicit", "transparent", "off" } ) ) },
+    };
+    schema["histograms"] = {
+	{ "Enable",              Key( Boolean( his.Enable ) ) },
+	{ "Bins",                Key( Integer( his.Bins, 1, 65536 ) ) },
+	{ "AmplitudeMax",        Key( Real( his.AmplitudeMax, 1.0, 1e6 ) ) },
+	{ "IntegralMax",         Key( Real( his.IntegralMax, 1.0, 1e12 ) ) },
+	{ "CorrelationChannels", Key( Channels( his.CorrelationChannels, 32 ) ) },
+	{ "CorrelationBins",     Key( Integer( his.CorrelationBins, 1, 1024 ) ) },
+	{ "MergeIntervalS",      Key( Real( his.MergeIntervalS, 0.0, 3600.0 ) ) },
+    };
+
+    std::vector<std::string> errors;
+
+    for( auto&& [name, node]: fTbl )
+	{
+	    const std::string section( name.str() );
+	    if( !schema.count(section) )
+		errors.push_back( "unknown section [" + section + "]" );
+	    else if( !node.is_table() )
+		errors.push_back( Where( section, "", &node ) + ": expected a table" );
+	}
+
+    for( auto& [section, keys]: schema )
+	{
+	    const toml::table* tbl = fTbl[section].as_table();
+
+	    for( auto& [key, spec]: keys )
+		if( spec.required && ( tbl == nullptr || !tbl->contains(key) ) )
+		    errors.push_back( Where( section, key, nullptr ) + ": required key missing" );
+
+	    if( tbl == nullptr )
+		continue;
+
+	    for( auto&& [k, node]: *tbl )
+		{
+		    const std::string key( k.str() );
+		    auto spec = keys.find(key);
+		    if( spec == keys.end() )
+			{
+			    errors.push_back( Where( section, key, &node ) + ": unknown key" );
+			    continue;
+			}
+		    const std::string err = spec->second.set( node );
+		    if( !err.empty() )
+			errors.push_back( Where( section, key, &node ) + ": " + err );
+		    else if( spec->second.movedTo != nullptr )
+			Log::OutWarning( "Config: " + Where( section, key, &node ) + " should be moved to [" +
+					 spec->second.movedTo + "]" );
+		}
+	}
+
+    if( rep.Enable && rep.Files.empty() )
+	errors.push_back( "[replay] Files: no run to replay" );
+
+    if( !errors.empty() )
+	{
+	    for( auto& err: errors )
+		Log::OutError( "Config: " + err );
+	    Log::OutError( "Invalid configuration in " + fFileName + " (" + std::to_string(errors.size()) + " errors)." );
+	    return false;
+	}
+
+    fRunConfig = cfg;
+    return true;
+}
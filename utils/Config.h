@@ -4,10 +4,140 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <map>
+#include <cstdint>
 
 #include "Log.h"
 #include "toml.hpp"
 
+// Typed snapshot of the configuration file. It is filled and validated once
+// by Config::Read(); afterwards code reads plain fields instead of doing
+// string-keyed lookups into the toml table.
+struct DigitizerSettings
+{
+    std::string ConnectionType = "ETH_V4718";
+    std::string IPAddress = "192.168.99.105";
+    int LinkNumber = 0;
+    int ConetNode = 0;
+    std::vector<uint32_t> VMEBaseAddress = { 0x32100000 };  ///< one board per address
+
+    std::vector<uint32_t> ChannelList;
+    std::string SamplingRate = "5GHz";
+    uint32_t RecordLength = 1024;
+    uint32_t PostTriggerSize = 50;      ///< percent of the record after the trigger
+    int RunNumber = 1;
+    double WaitTimeS = 3.0;
+
+    bool SelfTrigger = false;
+    bool ExternalTrigger = true;
+    std::string ExtTriggerMode = "NIM";
+    uint32_t TriggerPolarity = 1;
+    uint32_t PulsePolarity = 1;
+
+    double NRMSThreshold = 3.0;
+    double IntegralThreshold = -100.0;
+
+    uint32_t Duration = 0;              ///< seconds
+    uint32_t NEvents = 100;
+    uint32_t NNoiseEvents = 100;
+
+    uint32_t EventsPerBLT = 0;          ///< events per block transfer, 0 = tuned during the run
+    double MaxTransferMs = 20.0;        ///< longest ReadData the tuner accepts
+
+    bool SyncStart = false;             ///< several boards: start from S-IN, TRG-OUT daisy chain
+};
+
+struct BridgeSettings
+{
+    std::string IPAddress = "192.168.99.105";
+};
+
+struct OutputSettings
+{
+    bool SaveRaw = false;
+    std::string OutputFormat = "HDF5";
+    std::string OutputDir = "";
+    std::string OutputFile = "run";
+    bool Journal = false;                       ///< HDF5: crash-recovery journal (RunJournal.h), not with SWMR
+    uint32_t CheckpointEvents = 1000;           ///< journal + flush every N events, 0 disables
+    double CheckpointIntervalS = 10.0;          ///< ... or at least this often
+    bool SWMR = false;                          ///< appendable layout readable during the run
+    std::string RunCatalog = "runcatalog.sqlite"; ///< relative to OutputDir, "" disables
+    uint32_t Compression = 0;                   ///< HDF5: deflate level of the chunks, 0 = gzip the file at the end
+    uint32_t CompressionThreads = 0;            ///< HDF5: 0 = every core but one
+    std::string WriteMode = "buffered";         ///< BIN: "buffered" or "direct" (O_DIRECT)
+    std::string WriteEngine = "auto";           ///< BIN: "auto", "uring", "threads" or "sync"
+    uint32_t BlockSizeMB = 8;                   ///< BIN: size of each write
+    uint32_t WriteBuffers = 2;                  ///< BIN: blocks in rotation
+};
+
+struct MonitorSettings
+{
+    bool Enable = false;                        ///< publish events to shared memory
+    std::string SharedMemoryName = "/daq-wc-events";
+    uint32_t Slots = 256;
+};
+
+struct ControlSettings
+{
+    bool Enable = false;                        ///< run-control server on a Unix socket
+    std::string Socket = "/tmp/daq-wc.sock";
+    double ShutdownTimeoutS = 5.0;              ///< max time to drain the board on stop
+};
+
+struct ReplaySettings
+{
+    bool Enable = false;                        ///< read recorded runs instead of the digitizer
+    std::vector<std::string> Files;             ///< .h5, .h5.gz or .bin, one run each
+    double Speed = 1.0;                         ///< 1 = original timing, 2 = twice as fast, 0 = as fast as possible
+    bool Loop = false;                          ///< rewind the file until NEvents
+};
+
+struct ThreadSettings
+{
+    std::vector<int> ReadoutCPUs;               ///< board i on ReadoutCPUs[i % n], empty = not pinned
+    uint32_t ReadoutPriority = 0;               ///< SCHED_FIFO priority of the readout threads, 0 = normal
+    std::vector<int> WriteCPUs;                 ///< compression and write threads, empty = all but ReadoutCPUs
+    std::string NetworkInterface = "";          ///< link to the bridge: readout buffers on its NUMA node
+};
+
+struct MemorySettings
+{
+    std::string HugePages = "auto";             ///< data buffers: "auto", "explicit", "transparent", "off"
+};
+
+struct HistogramSettings
+{
+    bool Enable = false;                        ///< online spectra, see Histograms.h
+    uint32_t Bins = 1024;                       ///< of each amplitude, integral and time histogram
+    double AmplitudeMax = 4096.0;               ///< ADC counts
+    double IntegralMax = 200000.0;              ///< ADC counts x ns
+    std::vector<uint32_t> CorrelationChannels;  ///< amplitude vs amplitude for every pair, empty = none
+    uint32_t CorrelationBins = 64;              ///< per axis
+    double MergeIntervalS = 1.0;                ///< readout threads publish their histograms this often
+};
+
+struct GeneralSettings
+{
+    int verbosity = 3;
+    std::string LogFile = "";
+};
+
+struct RunConfig
+{
+    GeneralSettings Settings;
+    DigitizerSettings Digitizer;
+    BridgeSettings Bridge;
+    OutputSettings Output;
+    MonitorSettings Monitor;
+    ControlSettings Control;
+    ReplaySettings Replay;
+    ThreadSettings Threads;
+    MemorySettings Memory;
+    HistogramSettings Histograms;
+};
+
 class Config
 {
 public:
@@ -26,69 +156,39 @@ public:
     void SetNoConfigFile();
     bool ConfigFileProvided(){ return fReadConfigFile; };
     void Read( char* filename );
+    bool Reload( const std::string& filename );
     toml::table& GetTbl(){ return fTbl; };
 
-    bool CheckIfEntryExists( std::string category, bool throwerror=true )
+    /// 16 hex digits identifying the parsed configuration (comments and
+    /// formatting of the file do not matter).
+    std::string GetHash() const;
+
+    // validated snapshot, see Config::Validate()
+    const RunConfig& GetRunConfig() const { return fRunConfig; };
+    const GeneralSettings& GetSettings() const { return fRunConfig.Settings; };
+    const DigitizerSettings& GetDigitizer() const { return fRunConfig.Digitizer; };
+    const BridgeSettings& GetBridge() const { return fRunConfig.Bridge; };
+    const OutputSettings& GetOutput() const { return fRunConfig.Output; };
+    const MonitorSettings& GetMonitor() const { return fRunConfig.Monitor; };
+    const ControlSettings& GetControl() const { return fRunConfig.Control; };
+    const ReplaySettings& GetReplay() const { return fRunConfig.Replay; };
+    const ThreadSettings& GetThreads() const { return fRunConfig.Threads; };
+    const MemorySettings& GetMemory() const { return fRunConfig.Memory; };
+    const HistogramSettings& GetHistograms() const { return fRunConfig.Histograms; };
+
+    bool CheckIfEntryExists( const std::string& category, bool throwerror=true )
     {
-	std::ifstream configfile( fFileName.c_str() );
-	std::string line;
-	bool found = false;
-	while( std::getline( configfile, line ) )
-	    {
-		if( line[0] == '#' )
-		    continue;
-		if( line.find(category) != std::string::npos )
-		    found = true;
-	    }
-	if( throwerror && found == false )
-	    {
-		Log::OutError( "Category [" + category + "] not found in config file. Abort.");
-		exit(1);
-	    }
-	
-	return found;
+	return CheckIfPathExists( category, throwerror );
     }
 
-    bool CheckIfSubEntryExists( std::string category, std::string subcategory, bool throwerror=true )
+    bool CheckIfSubEntryExists( const std::string& category, const std::string& subcategory, bool throwerror=true )
     {
-	std::ifstream configfile( fFileName.c_str() );
-	std::string line;
-	bool found = false;
-	while( std::getline( configfile, line ) )
-	    {
-		if( line[0] == '#' )
-		    continue;
-		if( line.find( category + "." + subcategory) != std::string::npos )
-		    found = true;
-	    }
-	if( throwerror && found == false )
-	    {
-		Log::OutError( "Category [" + category + "." + subcategory + "] not found in config file. Abort.");
-		exit(1);
-	    }
-	
-	return found;
+	return CheckIfPathExists( category + "." + subcategory, throwerror );
     }
 
-    bool CheckIfSubSubEntryExists( std::string category, std::string subcategory, std::string subsubcategory, bool throwerror=true )
+    bool CheckIfSubSubEntryExists( const std::string& category, const std::string& subcategory, const std::string& subsubcategory, bool throwerror=true )
     {
-	std::ifstream configfile( fFileName.c_str() );
-	std::string line;
-	bool found = false;
-	while( std::getline( configfile, line ) )
-	    {
-		if( line[0] == '#' )
-		    continue;
-		if( line.find( category + "." + subcategory + "." + subsubcategory) != std::string::npos )
-		    found = true;
-	    }
-	if( throwerror && found == false )
-	    {
-		Log::OutError( "Category [" + category + "." + subcategory + "." + subsubcategory + "] not found in config file. Abort.");
-		exit(1);
-	    }
-	
-	return found;
+	return CheckIfPathExists( category + "." + subcategory + "." + subsubcategory, throwerror );
     }
     
     template <typename T>
@@ -417,9 +517,23 @@ public:
     
 private:
 
+    bool CheckIfPathExists( const std::string& path, bool throwerror )
+    {
+	const bool found = static_cast<bool>( fTbl.at_path( path ) );
+	if( throwerror && found == false )
+	    {
+		Log::OutError( "Category [" + path + "] not found in config file. Abort.");
+		exit(1);
+	    }
+	return found;
+    }
+
+    bool Validate();
+
     std::string fFileName;
     const bool fReadConfigFile;
     toml::table fTbl;
+    RunConfig fRunConfig;
 
 };
 
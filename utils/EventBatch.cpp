@@ -0,0 +1,117 @@
+#include "EventBatch.h"
+
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#include "BufferPool.h"
+
+namespace {
+
+    // kAlign-aligned; the large arrays (a readout block of 1024-sample
+    // events is a few MB) on huge pages like the other data buffers
+    void* Allocate(size_t bytes)
+    {
+	if( bytes >= BufferPool::kMinBytes )
+	    return BufferPool::Acquire(bytes);
+	void* p = std::aligned_alloc(EventBatch::kAlign, bytes);
+	if( p == nullptr )
+	    throw std::bad_alloc();
+	return p;
+    }
+
+    void Deallocate(void* p, size_t bytes)
+    {
+	if( bytes >= BufferPool::kMinBytes )
+	    BufferPool::Release(p);
+	else
+	    std::free(p);
+    }
+
+}
+
+EventBatch::EventBatch() :
+    fSize(0),
+    fCapacity(0),
+    fNChannels(0),
+    fMaxSamples(0),
+    fStride(0),
+    fBytes(0),
+    fCorr(nullptr),
+    fRaw(nullptr)
+{
+}
+
+EventBatch::EventBatch(uint32_t capacity, uint32_t nchannels, uint32_t maxsamples, bool raw) :
+    EventBatch()
+{
+    Reshape(capacity, nchannels, maxsamples, raw);
+}
+
+EventBatch::~EventBatch()
+{
+    Free();
+}
+
+void EventBatch::Free()
+{
+    if( fCorr )
+	Deallocate(fCorr, fBytes);
+    if( fRaw )
+	Deallocate(fRaw, fBytes);
+    fCorr = nullptr;
+    fRaw = nullptr;
+    fBytes = 0;
+}
+
+void EventBatch::Reshape(uint32_t capacity, uint32_t nchannels, uint32_t maxsamples, bool raw)
+{
+    if( capacity == 0 || nchannels == 0 || maxsamples == 0 )
+	throw std::runtime_error("EventBatch: empty shape");
+
+    constexpr size_t perrow = kAlign / sizeof(int16_t);
+    const size_t stride = (size_t(maxsamples) + perrow - 1) / perrow * perrow;
+    // a multiple of kAlign, as aligned_alloc wants
+    const size_t bytes = size_t(capacity) * nchannels * stride * sizeof(int16_t);
+    if( bytes > fBytes || raw != HasRaw() ) {
+	Free();
+	fCorr = static_cast<int16_t*>(Allocate(bytes));
+	if( raw )
+	    fRaw = static_cast<uint16_t*>(Allocate(bytes));
+	fBytes = bytes;
+    }
+
+    fSize = 0;
+    fCapacity = capacity;
+    fNChannels = nchannels;
+    fMaxSamples = maxsamples;
+    fStride = stride;
+    fEventNumber.resize(capacity);
+    fTriggerTimeTag.resize(capacity);
+    fChannelMask.resize(capacity);
+    fNPresent.resize(capacity);
+    fNSamples.resize(capacity);
+}
+
+uint32_t EventBatch::Append(uint64_t eventnumber, uint32_t triggertimetag)
+{
+    const uint32_t e = fSize++;
+    fEventNumber[e] = eventnumber;
+    fTriggerTimeTag[e] = triggertimetag;
+    fChannelMask[e] = 0;
+    fNPresent[e] = 0;
+    fNSamples[e] = 0;
+    return e;
+}
+
+void EventBatch::Gather(uint32_t e, std::vector<int16_t>& corr, std::vector<uint16_t>& raw) const
+{
+    const uint32_t n = fNSamples[e];
+    corr.clear();
+    raw.clear();
+    for( uint32_t i = 0; i < fNPresent[e]; i++ ) {
+	corr.insert(corr.end(), Corr(e, i), Corr(e, i) + n);
+	if( fRaw )
+	    raw.insert(raw.end(), Raw(e, i), Raw(e, i) + n);
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef EVENTBATCH_H
+#define EVENTBATCH_H
+
+// The events of one readout block, as the stages after the decoder see
+// them: baseline-corrected int16 samples (and raw uint16 ones with
+// SaveRaw) of up to GetCapacity() events, structure of arrays.
+//
+//   samples   [event][channel][sample], one contiguous array; every channel
+//             row starts on a 64-byte boundary (rows padded to a multiple
+//             of 32 samples), so that kernels can use aligned vector loads
+//   metadata  one column per field (event number, trigger time tag, mask,
+//             channels present, samples per channel), indexed by event
+//
+// Channel i of an event is the i-th channel present, in ChannelList order,
+// as in the BIN records and the HDF5 datasets. The arrays are allocated
+// once for the run (BufferPool for the large ones); Clear() only forgets
+// the events.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class EventBatch {
+public:
+    static constexpr size_t kAlign = 64;
+
+    EventBatch();
+    /// capacity events of up to nchannels x maxsamples, raw samples too with raw.
+    EventBatch(uint32_t capacity, uint32_t nchannels, uint32_t maxsamples, bool raw);
+    ~EventBatch();
+
+    EventBatch(const EventBatch&) = delete;
+    EventBatch& operator=(const EventBatch&) = delete;
+
+    /// New shape; the events are dropped, the arrays reallocated if they grow.
+    void Reshape(uint32_t capacity, uint32_t nchannels, uint32_t maxsamples, bool raw);
+    void Clear() { fSize = 0; }
+
+    /// Start an event at the end, no channel present yet; returns its index.
+    /// The batch must not be full.
+    uint32_t Append(uint64_t eventnumber, uint32_t triggertimetag);
+
+    uint32_t GetSize() const { return fSize; }
+    uint32_t GetCapacity() const { return fCapacity; }
+    bool IsEmpty() const { return fSize == 0; }
+    bool IsFull() const { return fSize == fCapacity; }
+    uint32_t GetNChannels() const { return fNChannels; }
+    uint32_t GetMaxSamples() const { return fMaxSamples; }
+    bool HasRaw() const { return fRaw != nullptr; }
+    /// Samples from one channel row to the next (>= GetMaxSamples()).
+    size_t GetChannelStride() const { return fStride; }
+
+    // metadata columns
+    uint64_t GetEventNumber(uint32_t e) const { return fEventNumber[e]; }
+    uint32_t GetTriggerTimeTag(uint32_t e) const { return fTriggerTimeTag[e]; }
+    uint32_t GetChannelMask(uint32_t e) const { return fChannelMask[e]; }
+    uint32_t GetNPresent(uint32_t e) const { return fNPresent[e]; }
+    uint32_t GetNSamples(uint32_t e) const { return fNSamples[e]; }
+    void SetEventNumber(uint32_t e, uint64_t n) { fEventNumber[e] = n; }
+    void SetTriggerTimeTag(uint32_t e, uint32_t ttt) { fTriggerTimeTag[e] = ttt; }
+    /// Channels present in event e: mask, their number and length.
+    void SetChannels(uint32_t e, uint32_t mask, uint32_t npresent, uint32_t nsamples)
+    {
+	fChannelMask[e] = mask;
+	fNPresent[e] = npresent;
+	fNSamples[e] = nsamples;
+    }
+
+    /// Row of the i-th channel present in event e, 64-byte aligned.
+    int16_t* Corr(uint32_t e, uint32_t i) { return fCorr + (size_t(e) * fNChannels + i) * fStride; }
+    const int16_t* Corr(uint32_t e, uint32_t i) const { return fCorr + (size_t(e) * fNChannels + i) * fStride; }
+    /// nullptr without raw samples.
+    uint16_t* Raw(uint32_t e, uint32_t i) { return fRaw ? fRaw + (size_t(e) * fNChannels + i) * fStride : nullptr; }
+    const uint16_t* Raw(uint32_t e, uint32_t i) const { return fRaw ? fRaw + (size_t(e) * fNChannels + i) * fStride : nullptr; }
+
+    /// The channels of event e back to back (npresent x nsamples), for the
+    /// outputs that take a flat event; raw is left empty without raw samples.
+    void Gather(uint32_t e, std::vector<int16_t>& corr, std::vector<uint16_t>& raw) const;
+
+private:
+    void Free();
+
+    uint32_t fSize;
+    uint32_t fCapacity;
+    uint32_t fNChannels;
+    uint32_t fMaxSamples;
+    size_t fStride;
+    size_t fBytes;                      ///< allocated per sample array
+
+    int16_t* fCorr;
+    uint16_t* fRaw;
+    std::vector<uint64_t> fEventNumber;
+    std::vector<uint32_t> fTriggerTimeTag;
+    std::vector<uint32_t> fChannelMask;
+    std::vector<uint32_t> fNPresent;
+    std::vector<uint32_t> fNSamples;
+};
+
+#endif // EVENTBATCH_H
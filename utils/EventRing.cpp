@@ -0,0 +1,275 @@
+#include "EventRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <ctime>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BufferPool.h"
+
+using namespace EventRingLayout;
+
+namespace {
+
+    uint64_t NowNs()
+    {
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    SlotHeader* Slot(const Header* header, uint64_t index)
+    {
+	char* base = const_cast<char*>(reinterpret_cast<const char*>(header)) + kHeaderSize;
+	return reinterpret_cast<SlotHeader*>(base + (index % header->fNSlots) * header->fSlotSize);
+    }
+
+    int16_t* Payload(SlotHeader* slot)
+    {
+	return reinterpret_cast<int16_t*>(reinterpret_cast<char*>(slot) + kSlotHeaderSize);
+    }
+
+}
+
+// ---------------------------------------------------------------
+// Writer
+// ---------------------------------------------------------------
+EventRingWriter::EventRingWriter(const std::string& name, uint32_t nslots, uint32_t maxsamples) :
+    fName(name),
+    fMap(nullptr),
+    fMapSize(0),
+    fHeader(nullptr)
+{
+    if( nslots == 0 || maxsamples == 0 )
+	throw std::runtime_error("EventRing: slots and samples must be > 0");
+
+    const size_t slotsize = (kSlotHeaderSize + size_t(maxsamples) * sizeof(int16_t) + 63) & ~size_t(63);
+    fMapSize = kHeaderSize + slotsize * nslots;
+
+    // start from a fresh segment, readers of a previous run keep their old mapping
+    shm_unlink(fName.c_str());
+    int fd = shm_open(fName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if( fd < 0 )
+	throw std::runtime_error("EventRing: shm_open(" + fName + ") failed: " + std::strerror(errno));
+    if( ftruncate(fd, static_cast<off_t>(fMapSize)) != 0 ) {
+	close(fd);
+	shm_unlink(fName.c_str());
+	throw std::runtime_error("EventRing: ftruncate failed: " + std::string(std::strerror(errno)));
+    }
+    fMap = mmap(nullptr, fMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if( fMap == MAP_FAILED ) {
+	fMap = nullptr;
+	shm_unlink(fName.c_str());
+	throw std::runtime_error("EventRing: mmap failed: " + std::string(std::strerror(errno)));
+    }
+
+    // slots on huge pages where shared memory THP is enabled (shmem_enabled)
+    BufferPool::Advise(fMap, fMapSize);
+
+    // the segment is zero-filled: only the non-zero fields need to be set
+    fHeader = new (fMap) Header();
+    fHeader->fVersion = kVersion;
+    fHeader->fNSlots = nslots;
+    fHeader->fSlotSize = slotsize;
+    fHeader->fMaxSamples = maxsamples;
+    fHeader->fRunNumber = -1;
+    fHeader->fWriterPid = static_cast<int32_t>(getpid());
+    for( uint32_t i = 0; i < nslots; i++ )
+	new (Slot(fHeader, i)) SlotHeader();
+    fHeader->fOpen.store(1, std::memory_order_relaxed);
+    fHeader->fWriteCount.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    // readers check the magic last
+    reinterpret_cast<std::atomic<uint64_t>*>(&fHeader->fMagic)->store(kMagic, std::memory_order_release);
+}
+
+EventRingWriter::~EventRingWriter()
+{
+    if( fHeader != nullptr )
+	fHeader->fOpen.store(0, std::memory_order_release);
+    if( fMap != nullptr )
+	munmap(fMap, fMapSize);
+    shm_unlink(fName.c_str());
+}
+
+void EventRingWriter::SetRunInfo(int runnumber, uint32_t recordlength, double samplingtime,
+				 const std::vector<uint32_t>& channels)
+{
+    fHeader->fRunNumber = runnumber;
+    fHeader->fRecordLength = recordlength;
+    fHeader->fSamplingTime = samplingtime;
+    fHeader->fNChannels = static_cast<uint32_t>(std::min<size_t>(channels.size(), kMaxChannels));
+    for( uint32_t i = 0; i < fHeader->fNChannels; i++ )
+	fHeader->fChannelList[i] = channels[i];
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void EventRingWriter::Publish(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+			      uint32_t nchannels, uint32_t nsamples, const int16_t* data)
+{
+    Write(eventnumber, triggertimetag, channelmask, nchannels, nsamples, data, nsamples);
+}
+
+void EventRingWriter::PublishBatch(const EventBatch& batch)
+{
+    for( uint32_t e = 0; e < batch.GetSize(); e++ )
+	Write(batch.GetEventNumber(e), batch.GetTriggerTimeTag(e), batch.GetChannelMask(e),
+	      batch.GetNPresent(e), batch.GetNSamples(e), batch.Corr(e, 0), batch.GetChannelStride());
+}
+
+void EventRingWriter::Write(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+			    uint32_t nchannels, uint32_t nsamples, const int16_t* data, size_t stride)
+{
+    if( size_t(nchannels) * nsamples > fHeader->fMaxSamples )
+	nchannels = nsamples ? fHeader->fMaxSamples / nsamples : 0;
+
+    const uint64_t index = fHeader->fWriteCount.load(std::memory_order_relaxed);
+    SlotHeader* slot = Slot(fHeader, index);
+
+    slot->fSequence.store(2*index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->fEventNumber = eventnumber;
+    slot->fTimestampNs = NowNs();
+    slot->fTriggerTimeTag = triggertimetag;
+    slot->fChannelMask = channelmask;
+    slot->fNChannels = nchannels;
+    slot->fNSamples = nsamples;
+    int16_t* payload = Payload(slot);
+    if( stride == nsamples )
+	std::memcpy(payload, data, size_t(nchannels) * nsamples * sizeof(int16_t));
+    else
+	for( uint32_t i = 0; i < nchannels; i++ )
+	    std::memcpy(payload + size_t(i) * nsamples, data + i * stride, nsamples * sizeof(int16_t));
+
+    slot->fSequence.store(2*index + 2, std::memory_order_release);
+    fHeader->fWriteCount.store(index + 1, std::memory_order_release);
+}
+
+uint64_t EventRingWriter::GetWriteCount() const
+{
+    return fHeader->fWriteCount.load(std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------
+// Reader
+// ---------------------------------------------------------------
+EventRingReader::EventRingReader(const std::string& name) :
+    fMap(nullptr),
+    fMapSize(0),
+    fHeader(nullptr),
+    fNext(0),
+    fLost(0)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if( fd < 0 )
+	return;
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < kHeaderSize ) {
+	close(fd);
+	return;
+    }
+    fMapSize = static_cast<size_t>(st.st_size);
+    fMap = mmap(nullptr, fMapSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if( fMap == MAP_FAILED ) {
+	fMap = nullptr;
+	return;
+    }
+
+    const Header* header = static_cast<const Header*>(fMap);
+    const uint64_t magic = reinterpret_cast<const std::atomic<uint64_t>*>(&header->fMagic)->load(std::memory_order_acquire);
+    if( magic != kMagic || header->fVersion != kVersion ||
+	kHeaderSize + header->fSlotSize * header->fNSlots > fMapSize ) {
+	munmap(fMap, fMapSize);
+	fMap = nullptr;
+	return;
+    }
+    fHeader = header;
+    fNext = fHeader->fWriteCount.load(std::memory_order_acquire);
+}
+
+EventRingReader::~EventRingReader()
+{
+    if( fMap != nullptr )
+	munmap(fMap, fMapSize);
+}
+
+bool EventRingReader::WriterOpen() const
+{
+    return fHeader != nullptr && fHeader->fOpen.load(std::memory_order_acquire) != 0;
+}
+
+bool EventRingReader::ReadSlot(uint64_t index, RingEvent& event) const
+{
+    const SlotHeader* slot = Slot(fHeader, index);
+    const uint64_t expected = 2*index + 2;
+
+    const uint64_t before = slot->fSequence.load(std::memory_order_acquire);
+    if( before != expected )
+	return false;
+
+    event.fEventNumber = slot->fEventNumber;
+    event.fTimestampNs = slot->fTimestampNs;
+    event.fTriggerTimeTag = slot->fTriggerTimeTag;
+    event.fChannelMask = slot->fChannelMask;
+    event.fNChannels = slot->fNChannels;
+    event.fNSamples = slot->fNSamples;
+    const size_t n = size_t(event.fNChannels) * event.fNSamples;
+    if( n > fHeader->fMaxSamples )
+	return false;
+    event.fData.resize(n);
+    std::memcpy(event.fData.data(), Payload(const_cast<SlotHeader*>(slot)), n * sizeof(int16_t));
+
+    // the writer may have started overwriting the slot while we copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->fSequence.load(std::memory_order_relaxed) == before;
+}
+
+bool EventRingReader::ReadLatest(RingEvent& event)
+{
+    if( fHeader == nullptr )
+	return false;
+    for( int attempt = 0; attempt < 4; attempt++ ) {
+	const uint64_t count = fHeader->fWriteCount.load(std::memory_order_acquire);
+	if( count == 0 )
+	    return false;
+	if( ReadSlot(count - 1, event) ) {
+	    fNext = count;
+	    return true;
+	}
+    }
+    return false;
+}
+
+bool EventRingReader::ReadNext(RingEvent& event)
+{
+    if( fHeader == nullptr )
+	return false;
+    while( true ) {
+	const uint64_t count = fHeader->fWriteCount.load(std::memory_order_acquire);
+	if( fNext >= count )
+	    return false;
+	// keep one slot of margin: the oldest slot may be being overwritten
+	const uint64_t oldest = count > fHeader->fNSlots - 1 ? count - (fHeader->fNSlots - 1) : 0;
+	if( fNext < oldest ) {
+	    fLost += oldest - fNext;
+	    fNext = oldest;
+	}
+	if( ReadSlot(fNext, event) ) {
+	    fNext++;
+	    return true;
+	}
+	// overwritten under our feet: skip it
+	fLost++;
+	fNext++;
+    }
+}
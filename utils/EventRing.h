@@ -0,0 +1,126 @@
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+// Shared-memory ring of decoded events for online monitoring.
+//
+// The DAQ (single writer) publishes every event into a POSIX shared-memory
+// segment; any number of local readers attach read-only and copy the events
+// they are interested in. Each slot is protected by a sequence number
+// (seqlock): the writer never waits for readers, a reader that falls behind
+// simply finds its slots overwritten and skips ahead.
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "EventBatch.h"
+
+namespace EventRingLayout {
+
+    constexpr uint64_t kMagic   = 0x44415157434e4752ull;   // "DAQWCRNG"
+    constexpr uint32_t kVersion = 1;
+    constexpr uint32_t kMaxChannels = 32;
+
+    struct Header {
+	uint64_t fMagic;
+	uint32_t fVersion;
+	uint32_t fNSlots;
+	uint64_t fSlotSize;                 ///< bytes per slot, header included
+	uint32_t fMaxSamples;               ///< int16 samples a slot can hold
+	uint32_t fRecordLength;
+	double fSamplingTime;               ///< seconds per sample
+	int32_t fRunNumber;
+	uint32_t fNChannels;
+	uint32_t fChannelList[kMaxChannels];
+	int32_t fWriterPid;
+	std::atomic<uint32_t> fOpen;        ///< 1 while the writer is running
+	alignas(64) std::atomic<uint64_t> fWriteCount;  ///< events published so far
+    };
+
+    struct SlotHeader {
+	std::atomic<uint64_t> fSequence;    ///< 2*index+1 while writing, 2*index+2 when complete
+	uint64_t fEventNumber;
+	uint64_t fTimestampNs;              ///< host time when the event was published
+	uint32_t fTriggerTimeTag;
+	uint32_t fChannelMask;              ///< channels present in the payload, in ChannelList order
+	uint32_t fNChannels;
+	uint32_t fNSamples;                 ///< samples per channel
+	// followed by int16_t data[fNChannels][fNSamples]
+    };
+
+    constexpr size_t kHeaderSize = (sizeof(Header) + 63) & ~size_t(63);
+    constexpr size_t kSlotHeaderSize = (sizeof(SlotHeader) + 63) & ~size_t(63);
+
+}
+
+/// One event copied out of the ring.
+struct RingEvent {
+    uint64_t fEventNumber = 0;
+    uint64_t fTimestampNs = 0;
+    uint32_t fTriggerTimeTag = 0;
+    uint32_t fChannelMask = 0;
+    uint32_t fNChannels = 0;
+    uint32_t fNSamples = 0;
+    std::vector<int16_t> fData;         ///< [channel][sample]
+
+    const int16_t* Channel(uint32_t i) const { return fData.data() + size_t(i) * fNSamples; }
+};
+
+class EventRingWriter {
+public:
+    EventRingWriter(const std::string& name, uint32_t nslots, uint32_t maxsamples);
+    ~EventRingWriter();
+
+    void SetRunInfo(int runnumber, uint32_t recordlength, double samplingtime,
+		    const std::vector<uint32_t>& channels);
+
+    /// Copy one event into the next slot. Never blocks.
+    void Publish(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+		 uint32_t nchannels, uint32_t nsamples, const int16_t* data);
+    /// Every event of batch, one slot each.
+    void PublishBatch(const EventBatch& batch);
+
+    uint64_t GetWriteCount() const;
+
+private:
+    /// channel i of the event at data + i * stride
+    void Write(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+	       uint32_t nchannels, uint32_t nsamples, const int16_t* data, size_t stride);
+
+    std::string fName;
+    void* fMap;
+    size_t fMapSize;
+    EventRingLayout::Header* fHeader;
+};
+
+class EventRingReader {
+public:
+    explicit EventRingReader(const std::string& name);
+    ~EventRingReader();
+
+    bool IsAttached() const { return fHeader != nullptr; }
+    bool WriterOpen() const;
+    const EventRingLayout::Header* GetHeader() const { return fHeader; }
+
+    /// Copy the most recent complete event. Returns false if none is available.
+    bool ReadLatest(RingEvent& event);
+
+    /// Copy the next event after the last one read; if the reader fell behind,
+    /// skips to the oldest event still in the ring and counts the lost ones.
+    bool ReadNext(RingEvent& event);
+
+    uint64_t GetLost() const { return fLost; }
+
+private:
+    bool ReadSlot(uint64_t index, RingEvent& event) const;
+
+    void* fMap;
+    size_t fMapSize;
+    const EventRingLayout::Header* fHeader;
+    uint64_t fNext;
+    uint64_t fLost;
+};
+
+#endif // EVENTRING_H
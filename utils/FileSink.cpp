@@ -0,0 +1,601 @@
+#include "FileSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "BufferPool.h"
+#include "ThreadPlacement.h"
+
+// ---------------------------------------------------------------
+// LatencyHistogram
+// ---------------------------------------------------------------
+void LatencyHistogram::Fill(double us)
+{
+    int bucket = us < 1.0 ? 0 : static_cast<int>(std::log2(us));
+    fCounts[std::min(bucket, kBuckets - 1)]++;
+    fN++;
+    fMaxUs = std::max(fMaxUs, us);
+}
+
+double LatencyHistogram::Percentile(double p) const
+{
+    if( fN == 0 )
+	return 0.0;
+    const double target = p / 100.0 * fN;
+    uint64_t sum = 0;
+    for( int i = 0; i < kBuckets; i++ ) {
+	sum += fCounts[i];
+	if( sum >= target )
+	    return std::min(std::ldexp(1.0, i + 1), std::max(fMaxUs, 1.0));
+    }
+    return fMaxUs;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+    for( int i = 0; i < kBuckets; i++ )
+	fCounts[i] += other.fCounts[i];
+    fN += other.fN;
+    fMaxUs = std::max(fMaxUs, other.fMaxUs);
+}
+
+std::string LatencyHistogram::ToString() const
+{
+    std::ostringstream out;
+    out << "p50 < " << Percentile(50) << " us, p99 < " << Percentile(99)
+	<< " us, max " << static_cast<uint64_t>(fMaxUs) << " us";
+    return out.str();
+}
+
+// ---------------------------------------------------------------
+// FileSink
+// ---------------------------------------------------------------
+namespace {
+
+    double ElapsedUs(std::chrono::steady_clock::time_point t0)
+    {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    bool PWriteAll(int fd, const char* data, size_t size, uint64_t offset)
+    {
+	while( size > 0 ) {
+	    ssize_t n = pwrite(fd, data, size, static_cast<off_t>(offset));
+	    if( n < 0 ) {
+		if( errno == EINTR )
+		    continue;
+		return false;
+	    }
+	    data += n;
+	    size -= n;
+	    offset += n;
+	}
+	return true;
+    }
+
+    /// pwrite() on the calling thread.
+    class SyncSink : public FileSink {
+    public:
+	SyncSink(const std::string& mode, int fd, size_t blocksize, unsigned nbuffers) :
+	    FileSink(mode, "sync", fd, blocksize, nbuffers) {}
+
+	bool Drain() override
+	{
+	    return !fError;
+	}
+
+    protected:
+	void Write(char* block, size_t size, uint64_t offset) override
+	{
+	    auto t0 = std::chrono::steady_clock::now();
+	    const bool ok = PWriteAll(fFd, block, size, offset);
+	    Record(size, ElapsedUs(t0), ok);
+	    Release(block);
+	}
+    };
+
+    /// pwrite() from a pool of writer threads, one per buffer.
+    class ThreadSink : public FileSink {
+    public:
+	ThreadSink(const std::string& mode, int fd, size_t blocksize, unsigned nbuffers) :
+	    FileSink(mode, "threads", fd, blocksize, nbuffers),
+	    fInFlight(0),
+	    fStop(false)
+	{
+	    for( unsigned i = 0; i < nbuffers; i++ )
+		fThreads.emplace_back(&ThreadSink::Run, this);
+	}
+
+	~ThreadSink() override
+	{
+	    {
+		std::lock_guard<std::mutex> lock(fMutex);
+		fStop = true;
+	    }
+	    fCond.notify_all();
+	    for( auto& t: fThreads )
+		t.join();
+	}
+
+	bool Drain() override
+	{
+	    std::unique_lock<std::mutex> lock(fMutex);
+	    fCond.wait(lock, [this] { return fInFlight == 0; });
+	    return !fError;
+	}
+
+    protected:
+	void Write(char* block, size_t size, uint64_t offset) override
+	{
+	    {
+		std::lock_guard<std::mutex> lock(fMutex);
+		fQueue.push_back({ block, size, offset });
+		fInFlight++;
+	    }
+	    fCond.notify_all();
+	}
+
+    private:
+	struct Request {
+	    char* fBlock;
+	    size_t fSize;
+	    uint64_t fOffset;
+	};
+
+	void Run()
+	{
+	    ThreadPlacement::Apply(ThreadPlacement::kWrite);
+	    std::unique_lock<std::mutex> lock(fMutex);
+	    while( true ) {
+		fCond.wait(lock, [this] { return fStop || !fQueue.empty(); });
+		if( fQueue.empty() )
+		    return;
+		Request req = fQueue.front();
+		fQueue.pop_front();
+		lock.unlock();
+
+		auto t0 = std::chrono::steady_clock::now();
+		const bool ok = PWriteAll(fFd, req.fBlock, req.fSize, req.fOffset);
+		Record(req.fSize, ElapsedUs(t0), ok);
+		Release(req.fBlock);
+
+		lock.lock();
+		fInFlight--;
+		fCond.notify_all();
+	    }
+	}
+
+	std::deque<Request> fQueue;
+	unsigned fInFlight;
+	bool fStop;
+	std::vector<std::thread> fThreads;
+    };
+
+    /// io_uring through the raw system calls (no liburing dependency).
+    /// Only the producer thread touches the rings: Write() queues the
+    /// segments of a block and submits them at once, completions are reaped
+    /// when a buffer is needed or on Drain().
+    class UringSink : public FileSink {
+    public:
+	UringSink(const std::string& mode, int fd, size_t blocksize, unsigned nbuffers) :
+	    FileSink(mode, "uring", fd, blocksize, nbuffers),
+	    fRing(-1),
+	    fFixed(false),
+	    fInFlight(0),
+	    fToSubmit(0)
+	{
+	    const unsigned segments = (fBlockSize + kSegment - 1) / kSegment;
+	    const unsigned entries = segments * nbuffers;
+
+	    io_uring_params p;
+	    std::memset(&p, 0, sizeof(p));
+	    fRing = syscall(__NR_io_uring_setup, entries, &p);
+	    if( fRing < 0 ) {
+		fFd = -1;       // still owned by Create(), which may try another engine
+		throw std::runtime_error(std::string("FileSink: io_uring unavailable: ") + std::strerror(errno));
+	    }
+
+	    fSqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	    fCqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	    if( p.features & IORING_FEAT_SINGLE_MMAP )
+		fSqMapSize = fCqMapSize = std::max(fSqMapSize, fCqMapSize);
+	    fSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+
+	    fSqMap = Map(fSqMapSize, IORING_OFF_SQ_RING);
+	    fCqMap = (p.features & IORING_FEAT_SINGLE_MMAP) ? fSqMap : Map(fCqMapSize, IORING_OFF_CQ_RING);
+	    fSqes = static_cast<io_uring_sqe*>(Map(fSqesSize, IORING_OFF_SQES));
+	    if( fSqMap == MAP_FAILED || fCqMap == MAP_FAILED || fSqes == MAP_FAILED ) {
+		Unmap();
+		close(fRing);
+		fFd = -1;
+		throw std::runtime_error("FileSink: cannot map the io_uring rings");
+	    }
+
+	    char* sq = static_cast<char*>(fSqMap);
+	    char* cq = static_cast<char*>(fCqMap);
+	    fSqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+	    fSqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+	    fSqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+	    fCqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+	    fCqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+	    fCqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+	    fCqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+	    // registered buffers save the page pinning on every write; fall
+	    // back to plain writes if the memlock limit does not allow it
+	    std::vector<iovec> iov;
+	    for( char* b: fBuffers )
+		iov.push_back({ b, fBlockSize });
+	    fFixed = syscall(__NR_io_uring_register, fRing, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) == 0;
+
+	    fBlocks.resize(fBuffers.size());
+	    fSegments.resize(p.sq_entries);
+	    for( unsigned i = 0; i < p.sq_entries; i++ )
+		fFreeSegments.push_back(i);
+	}
+
+	~UringSink() override
+	{
+	    try {
+		Drain();
+	    } catch( const std::runtime_error& ) {
+		// the error was reported by Close() already
+	    }
+	    Unmap();
+	    close(fRing);
+	}
+
+	char* Acquire() override
+	{
+	    while( true ) {
+		{
+		    std::lock_guard<std::mutex> lock(fMutex);
+		    if( !fFree.empty() ) {
+			char* block = fFree.back();
+			fFree.pop_back();
+			return block;
+		    }
+		}
+		Reap(true);
+	    }
+	}
+
+	bool Drain() override
+	{
+	    while( fInFlight > 0 )
+		Reap(true);
+	    return !fError;
+	}
+
+    protected:
+	void Write(char* block, size_t size, uint64_t offset) override
+	{
+	    const unsigned index = std::find(fBuffers.begin(), fBuffers.end(), block) - fBuffers.begin();
+	    Block& b = fBlocks[index];
+	    b.fSize = size;
+	    b.fPending = 0;
+	    b.fOk = true;
+	    b.fStart = std::chrono::steady_clock::now();
+	    for( size_t done = 0; done < size; done += kSegment ) {
+		const unsigned slot = fFreeSegments.back();
+		fFreeSegments.pop_back();
+		fSegments[slot] = { index, block + done, static_cast<unsigned>(std::min(kSegment, size - done)), offset + done };
+		b.fPending++;
+		Queue(slot);
+	    }
+	    Enter(0);
+	    Reap(false);
+	}
+
+    private:
+	struct Block {
+	    size_t fSize;
+	    unsigned fPending;
+	    bool fOk;
+	    std::chrono::steady_clock::time_point fStart;
+	};
+
+	struct Segment {
+	    unsigned fBlock;
+	    char* fData;
+	    unsigned fLength;
+	    uint64_t fOffset;
+	};
+
+	void* Map(size_t size, off_t offset)
+	{
+	    return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fRing, offset);
+	}
+
+	void Unmap()
+	{
+	    if( fSqes != MAP_FAILED )
+		munmap(fSqes, fSqesSize);
+	    if( fCqMap != MAP_FAILED && fCqMap != fSqMap )
+		munmap(fCqMap, fCqMapSize);
+	    if( fSqMap != MAP_FAILED )
+		munmap(fSqMap, fSqMapSize);
+	}
+
+	void Queue(unsigned slot)
+	{
+	    const Segment& seg = fSegments[slot];
+	    const unsigned tail = *fSqTail;
+	    const unsigned index = tail & fSqMask;
+	    io_uring_sqe* sqe = &fSqes[index];
+	    std::memset(sqe, 0, sizeof(*sqe));
+	    sqe->opcode = fFixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	    sqe->fd = fFd;
+	    sqe->off = seg.fOffset;
+	    sqe->addr = reinterpret_cast<uint64_t>(seg.fData);
+	    sqe->len = seg.fLength;
+	    sqe->buf_index = fFixed ? seg.fBlock : 0;
+	    sqe->user_data = slot;
+	    fSqArray[index] = index;
+	    __atomic_store_n(fSqTail, tail + 1, __ATOMIC_RELEASE);
+	    fToSubmit++;
+	    fInFlight++;
+	}
+
+	/// Submit the queued entries and optionally wait for a completion.
+	void Enter(unsigned wait)
+	{
+	    while( true ) {
+		const unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+		const long n = syscall(__NR_io_uring_enter, fRing, fToSubmit, wait, flags, nullptr, 0);
+		if( n < 0 ) {
+		    if( errno == EINTR || errno == EAGAIN || errno == EBUSY )
+			continue;
+		    throw std::runtime_error(std::string("FileSink: io_uring_enter: ") + std::strerror(errno));
+		}
+		fToSubmit -= std::min<unsigned>(fToSubmit, n);
+		if( fToSubmit == 0 )
+		    return;
+	    }
+	}
+
+	void Reap(bool wait)
+	{
+	    unsigned head = *fCqHead;
+	    if( wait && head == __atomic_load_n(fCqTail, __ATOMIC_ACQUIRE) )
+		Enter(1);
+
+	    const unsigned tail = __atomic_load_n(fCqTail, __ATOMIC_ACQUIRE);
+	    for( ; head != tail; head++ ) {
+		const io_uring_cqe& cqe = fCqes[head & fCqMask];
+		const unsigned slot = static_cast<unsigned>(cqe.user_data);
+		const int res = cqe.res;
+		Segment& seg = fSegments[slot];
+		fInFlight--;
+
+		if( res == -EINTR || res == -EAGAIN ) {
+		    Queue(slot);
+		    continue;
+		}
+		if( res > 0 && static_cast<unsigned>(res) < seg.fLength ) {
+		    // short write: queue the rest
+		    seg.fData += res;
+		    seg.fOffset += res;
+		    seg.fLength -= res;
+		    Queue(slot);
+		    continue;
+		}
+
+		Block& b = fBlocks[seg.fBlock];
+		if( res <= 0 )
+		    b.fOk = false;
+		fFreeSegments.push_back(slot);
+		if( --b.fPending == 0 ) {
+		    Record(b.fSize, ElapsedUs(b.fStart), b.fOk);
+		    Release(fBuffers[seg.fBlock]);
+		}
+	    }
+	    __atomic_store_n(fCqHead, head, __ATOMIC_RELEASE);
+	    if( fToSubmit > 0 )
+		Enter(0);
+	}
+
+	int fRing;
+	bool fFixed;
+	void* fSqMap = MAP_FAILED;
+	void* fCqMap = MAP_FAILED;
+	io_uring_sqe* fSqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	size_t fSqMapSize = 0;
+	size_t fCqMapSize = 0;
+	size_t fSqesSize = 0;
+	unsigned* fSqTail = nullptr;
+	unsigned fSqMask = 0;
+	unsigned* fSqArray = nullptr;
+	unsigned* fCqHead = nullptr;
+	unsigned* fCqTail = nullptr;
+	unsigned fCqMask = 0;
+	io_uring_cqe* fCqes = nullptr;
+
+	unsigned fInFlight;
+	unsigned fToSubmit;
+	std::vector<Block> fBlocks;
+	std::vector<Segment> fSegments;
+	std::vector<unsigned> fFreeSegments;
+    };
+
+}
+
+FileSink* FileSink::Create(const std::string& mode, const std::string& engine,
+			   const std::string& path, size_t blocksize, unsigned nbuffers)
+{
+    blocksize = std::max(kAlign, (blocksize + kAlign - 1) & ~(kAlign - 1));
+    nbuffers = std::max(2u, nbuffers);
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if( mode == "direct" )
+	flags |= O_DIRECT;
+    else if( mode != "buffered" )
+	throw std::runtime_error("FileSink: unknown write mode \"" + mode + "\"");
+    if( engine != "auto" && engine != "uring" && engine != "threads" && engine != "sync" )
+	throw std::runtime_error("FileSink: unknown write engine \"" + engine + "\"");
+
+    int fd = open(path.c_str(), flags, 0644);
+    if( fd < 0 )
+	throw std::runtime_error("FileSink: cannot create " + path + " (" + mode + "): " + std::strerror(errno));
+
+    try {
+	if( engine == "uring" )
+	    return new UringSink(mode, fd, blocksize, nbuffers);
+	if( engine == "auto" ) {
+	    try {
+		return new UringSink(mode, fd, blocksize, nbuffers);
+	    } catch( const std::runtime_error& ) {
+		return new ThreadSink(mode, fd, blocksize, nbuffers);
+	    }
+	}
+	if( engine == "threads" )
+	    return new ThreadSink(mode, fd, blocksize, nbuffers);
+	return new SyncSink(mode, fd, blocksize, nbuffers);
+    } catch( ... ) {
+	close(fd);
+	throw;
+    }
+}
+
+FileSink::FileSink(const std::string& mode, const std::string& engine, int fd,
+		   size_t blocksize, unsigned nbuffers) :
+    fMode(mode),
+    fEngine(engine),
+    fFd(fd),
+    fBlockSize(blocksize),
+    fLogicalEnd(0),
+    fScratch(nullptr),
+    fStarted(false),
+    fError(false)
+{
+    // write blocks from the huge-page pool (page-aligned, as O_DIRECT needs)
+    for( unsigned i = 0; i <= nbuffers; i++ ) {
+	char* block = nullptr;
+	try {
+	    if( i < nbuffers )
+		block = static_cast<char*>(BufferPool::Acquire(fBlockSize));
+	    else if( posix_memalign(reinterpret_cast<void**>(&block), kAlign, kAlign) != 0 )
+		throw std::bad_alloc();
+	} catch( const std::bad_alloc& ) {
+	    for( char* b: fBuffers )
+		BufferPool::Release(b);
+	    throw std::runtime_error("FileSink: cannot allocate " + std::to_string(fBlockSize) + " byte buffers");
+	}
+	if( i < nbuffers )
+	    fBuffers.push_back(block);
+	else
+	    fScratch = block;
+    }
+    fFree = fBuffers;
+}
+
+// the derived destructors have drained the writes already
+FileSink::~FileSink()
+{
+    if( fFd >= 0 )
+	close(fFd);
+    for( char* b: fBuffers )
+	BufferPool::Release(b);
+    free(fScratch);
+}
+
+char* FileSink::Acquire()
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    fCond.wait(lock, [this] { return !fFree.empty(); });
+    char* block = fFree.back();
+    fFree.pop_back();
+    return block;
+}
+
+void FileSink::Submit(char* block, size_t size, uint64_t offset)
+{
+    fLogicalEnd = std::max(fLogicalEnd, offset + size);
+    Write(block, size, offset);
+}
+
+// O_DIRECT needs aligned offset, size and memory: pad the last page with
+// zeros and cut the file back to its logical size
+bool FileSink::WriteTail(const char* data, size_t size, uint64_t offset)
+{
+    if( !Drain() )
+	return false;
+    const uint64_t end = std::max(fLogicalEnd, offset + size);
+    if( fMode != "direct" ) {
+	fLogicalEnd = end;
+	return PWriteAll(fFd, data, size, offset);
+    }
+    if( offset % kAlign != 0 )
+	return false;
+    bool ok = true;
+    for( size_t done = 0; done < size && ok; done += kAlign ) {
+	const size_t n = std::min(kAlign, size - done);
+	std::memcpy(fScratch, data + done, n);
+	std::memset(fScratch + n, 0, kAlign - n);
+	ok = PWriteAll(fFd, fScratch, kAlign, offset + done);
+    }
+    const uint64_t padded = offset + ((size + kAlign - 1) & ~(kAlign - 1));
+    if( padded > end && ftruncate(fFd, static_cast<off_t>(end)) != 0 )
+	ok = false;
+    fLogicalEnd = end;
+    return ok;
+}
+
+void FileSink::Release(char* block)
+{
+    {
+	std::lock_guard<std::mutex> lock(fMutex);
+	fFree.push_back(block);
+    }
+    fCond.notify_all();
+}
+
+void FileSink::Record(size_t bytes, double us, bool ok)
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    const auto now = std::chrono::steady_clock::now();
+    if( !fStarted ) {
+	fStart = now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+	    std::chrono::duration<double, std::micro>(us));
+	fStarted = true;
+    }
+    fStats.fBytes += bytes;
+    fStats.fWrites++;
+    fStats.fSeconds = std::chrono::duration<double>(now - fStart).count();
+    fStats.fLatency.Fill(us);
+    if( !ok )
+	fError = true;
+}
+
+SinkStatistics FileSink::GetStatistics()
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fStats;
+}
+
+bool FileSink::Close(uint64_t filesize)
+{
+    if( fFd < 0 )
+	return !fError;
+    bool ok = Drain();
+    if( ftruncate(fFd, static_cast<off_t>(filesize)) != 0 )
+	ok = false;
+    if( close(fFd) != 0 )
+	ok = false;
+    fFd = -1;
+    return ok && !fError;
+}
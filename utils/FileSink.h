@@ -0,0 +1,117 @@
+#ifndef FILESINK_H
+#define FILESINK_H
+
+// Block output for the bulk data files (BIN format).
+//
+// The producer fills large page-aligned blocks obtained from Acquire() and
+// hands them back with Submit(); the sink owns the buffers and writes each
+// block at the given offset while the producer goes on filling the next one.
+// Block sizes must be multiples of kAlign, only WriteTail() takes arbitrary
+// sizes (header, last partial page of the file).
+//
+// Two independent choices:
+//
+//   mode    "buffered"  through the page cache
+//           "direct"    O_DIRECT, not supported by every file system (tmpfs)
+//
+//   engine  "sync"      pwrite() on the calling thread
+//           "threads"   pwrite() from a pool of writer threads
+//           "uring"     io_uring: each block is split in kSegment writes,
+//                       submitted with one system call on registered buffers;
+//                       completions are reaped by the producer, no threads
+//           "auto"      "uring" if the kernel allows it, else "threads"
+//
+// Every block write is timed; GetStatistics() gives sustained MB/s and the
+// latency distribution.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Log2 histogram of write latencies, bucket i counts [2^i, 2^(i+1)) us.
+struct LatencyHistogram {
+    static constexpr int kBuckets = 32;
+    uint64_t fCounts[kBuckets] = {};
+    uint64_t fN = 0;
+    double fMaxUs = 0.0;
+
+    void Fill(double us);
+    double Percentile(double p) const;   ///< upper edge of the bucket, in us
+    void Merge(const LatencyHistogram& other);
+    std::string ToString() const;        ///< "p50 < 128 us, p99 < 4096 us, max 5210 us"
+};
+
+struct SinkStatistics {
+    uint64_t fBytes = 0;
+    uint64_t fWrites = 0;
+    double fSeconds = 0.0;               ///< from the first submit to the last completion
+    LatencyHistogram fLatency;
+
+    double MBps() const { return fSeconds > 0 ? fBytes / fSeconds / 1e6 : 0.0; }
+};
+
+class FileSink {
+public:
+    static constexpr size_t kAlign = 4096;
+    static constexpr size_t kSegment = 1 << 20;      ///< io_uring write size
+
+    /// Throws std::runtime_error on failure, e.g. "direct" on a file system
+    /// without O_DIRECT or "uring" where io_uring is disabled (seccomp).
+    static FileSink* Create(const std::string& mode, const std::string& engine,
+			    const std::string& path, size_t blocksize, unsigned nbuffers);
+
+    virtual ~FileSink();
+
+    /// A free block of GetBlockSize() bytes; blocks while all are in flight.
+    virtual char* Acquire();
+
+    /// Queue a block for writing; size is a multiple of kAlign.
+    void Submit(char* block, size_t size, uint64_t offset);
+
+    /// Wait until every submitted block has been written by the kernel.
+    /// Returns false if any write failed.
+    virtual bool Drain() = 0;
+
+    /// Synchronous write of an arbitrary range (header, last partial page)
+    /// after Drain(); the file size is set to offset+size if that extends it.
+    bool WriteTail(const char* data, size_t size, uint64_t offset);
+
+    /// Drain and set the final file size.
+    bool Close(uint64_t filesize);
+
+    size_t GetBlockSize() const { return fBlockSize; }
+    const std::string& GetMode() const { return fMode; }
+    const std::string& GetEngine() const { return fEngine; }
+    SinkStatistics GetStatistics();
+
+protected:
+    FileSink(const std::string& mode, const std::string& engine, int fd,
+	     size_t blocksize, unsigned nbuffers);
+
+    virtual void Write(char* block, size_t size, uint64_t offset) = 0;
+
+    void Release(char* block);
+    void Record(size_t bytes, double us, bool ok);
+
+    std::string fMode;
+    std::string fEngine;
+    int fFd;
+    size_t fBlockSize;
+    std::vector<char*> fBuffers;
+    uint64_t fLogicalEnd;
+    char* fScratch;
+
+    std::mutex fMutex;
+    std::condition_variable fCond;
+    std::vector<char*> fFree;
+    SinkStatistics fStats;
+    bool fStarted;
+    std::chrono::steady_clock::time_point fStart;
+    std::atomic<bool> fError;
+};
+
+#endif // FILESINK_H
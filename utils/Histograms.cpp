@@ -0,0 +1,339 @@
+#include "Histograms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#include "Config.h"
+
+std::mutex HistogramService::fMutex;
+std::map<int, RunHistograms> HistogramService::fBoards;
+
+namespace {
+
+    struct Pulse {
+	int32_t fAmplitude;
+	uint32_t fPeak;                 ///< sample of the maximum
+	int64_t fSum;
+    };
+
+    constexpr uint32_t kBlock = 32;     ///< samples of one EventBatch row alignment
+
+    // the pulse made positive: Sign = -1 for negative pulses. Extreme and
+    // sum over fixed blocks of aligned samples, which the compiler
+    // vectorizes; the peak is searched for afterwards.
+    template <int Sign>
+    Pulse FindPulse(const int16_t* w, uint32_t n)
+    {
+	w = static_cast<const int16_t*>(__builtin_assume_aligned(w, EventBatch::kAlign));
+	int16_t extreme = w[0];
+	int32_t sum = 0;                // at most 1024 samples of 16 bits
+	uint32_t i = 0;
+	for( ; i + kBlock <= n; i += kBlock ) {
+	    int16_t e = w[i];
+	    int32_t s = 0;
+	    for( uint32_t k = 0; k < kBlock; k++ ) {
+		e = Sign > 0 ? std::max(e, w[i + k]) : std::min(e, w[i + k]);
+		s += w[i + k];
+	    }
+	    extreme = Sign > 0 ? std::max(extreme, e) : std::min(extreme, e);
+	    sum += s;
+	}
+	for( ; i < n; i++ ) {
+	    extreme = Sign > 0 ? std::max(extreme, w[i]) : std::min(extreme, w[i]);
+	    sum += w[i];
+	}
+	uint32_t peak = 0;
+	while( w[peak] != extreme )
+	    peak++;
+	return { Sign * extreme, peak, Sign * sum };
+    }
+
+    // samples from the start of the record to 50% of the amplitude on the
+    // leading edge
+    template <int Sign>
+    double HalfRise(const int16_t* w, const Pulse& p)
+    {
+	const double half = 0.5 * p.fAmplitude;
+	uint32_t i = p.fPeak;
+	while( i > 0 && Sign * w[i - 1] > half )
+	    i--;
+	if( i == 0 )
+	    return 0.0;
+	const double before = Sign * w[i - 1], after = Sign * w[i];
+	return (i - 1) + (half - before) / (after - before);
+    }
+
+    void Describe1D(std::ostringstream& out, const std::string& name, const Histogram1D& h, const char* unit)
+    {
+	out << " " << name << " " << h.GetEntries() << " mean " << h.GetMean() << " rms " << h.GetRMS() << " " << unit;
+    }
+
+}
+
+// ---------------------------------------------------------------
+// Histogram1D / Histogram2D
+// ---------------------------------------------------------------
+void Histogram1D::Setup(uint32_t nbins, double low, double high)
+{
+    fLow = low;
+    fHigh = high;
+    fScale = nbins / (high - low);
+    fCounts.assign(nbins, 0);
+    Reset();
+}
+
+void Histogram1D::Add(const Histogram1D& other)
+{
+    if( other.fCounts.size() != fCounts.size() )
+	throw std::runtime_error("Histogram1D: adding histograms of different binning");
+    for( size_t i = 0; i < fCounts.size(); i++ )
+	fCounts[i] += other.fCounts[i];
+    fUnderflow += other.fUnderflow;
+    fOverflow += other.fOverflow;
+    fSum += other.fSum;
+    fSum2 += other.fSum2;
+}
+
+void Histogram1D::Reset()
+{
+    std::fill(fCounts.begin(), fCounts.end(), 0);
+    fUnderflow = 0;
+    fOverflow = 0;
+    fSum = 0.0;
+    fSum2 = 0.0;
+}
+
+uint64_t Histogram1D::GetEntries() const
+{
+    uint64_t n = 0;
+    for( uint64_t c: fCounts )
+	n += c;
+    return n;
+}
+
+double Histogram1D::GetMean() const
+{
+    const uint64_t n = GetEntries();
+    return n ? fSum / n : 0.0;
+}
+
+double Histogram1D::GetRMS() const
+{
+    const uint64_t n = GetEntries();
+    if( n == 0 )
+	return 0.0;
+    const double mean = fSum / n;
+    return std::sqrt(std::max(0.0, fSum2 / n - mean * mean));
+}
+
+void Histogram2D::Setup(uint32_t nx, double xlow, double xhigh, uint32_t ny, double ylow, double yhigh)
+{
+    fXLow = xlow;
+    fXHigh = xhigh;
+    fYLow = ylow;
+    fYHigh = yhigh;
+    fNX = nx;
+    fNY = ny;
+    fXScale = nx / (xhigh - xlow);
+    fYScale = ny / (yhigh - ylow);
+    fCounts.assign(size_t(nx) * ny, 0);
+    fOutside = 0;
+}
+
+void Histogram2D::Add(const Histogram2D& other)
+{
+    if( other.fCounts.size() != fCounts.size() )
+	throw std::runtime_error("Histogram2D: adding histograms of different binning");
+    for( size_t i = 0; i < fCounts.size(); i++ )
+	fCounts[i] += other.fCounts[i];
+    fOutside += other.fOutside;
+}
+
+void Histogram2D::Reset()
+{
+    std::fill(fCounts.begin(), fCounts.end(), 0);
+    fOutside = 0;
+}
+
+// ---------------------------------------------------------------
+// RunHistograms
+// ---------------------------------------------------------------
+RunHistograms::RunHistograms(const std::vector<uint32_t>& channels, const HistogramSettings& settings,
+			     uint32_t nsamples, double samplingtime, bool negative) :
+    fSampleNs(samplingtime * 1e9),
+    fNegative(negative),
+    fEvents(0),
+    fAmplitude(channels.size(), 0.0),
+    fPresent(channels.size(), 0)
+{
+    for( uint32_t ch: channels ) {
+	Channel c;
+	c.fChannel = ch;
+	c.fAmplitude.Setup(settings.Bins, 0.0, settings.AmplitudeMax);
+	c.fIntegral.Setup(settings.Bins, 0.0, settings.IntegralMax);
+	c.fTime.Setup(settings.Bins, 0.0, nsamples * fSampleNs);
+	fChannels.push_back(c);
+    }
+
+    // every pair of the correlation channels that are acquired
+    std::vector<size_t> slots;
+    for( uint32_t ch: settings.CorrelationChannels ) {
+	auto it = std::find(channels.begin(), channels.end(), ch);
+	if( it != channels.end() )
+	    slots.push_back(it - channels.begin());
+    }
+    for( size_t i = 0; i < slots.size(); i++ )
+	for( size_t j = i + 1; j < slots.size(); j++ ) {
+	    Correlation c;
+	    c.fSlotX = slots[i];
+	    c.fSlotY = slots[j];
+	    c.fChannelX = channels[slots[i]];
+	    c.fChannelY = channels[slots[j]];
+	    c.fAmplitude.Setup(settings.CorrelationBins, 0.0, settings.AmplitudeMax,
+			       settings.CorrelationBins, 0.0, settings.AmplitudeMax);
+	    fCorrelations.push_back(c);
+	}
+}
+
+void RunHistograms::Fill(const EventBatch& batch)
+{
+    for( uint32_t e = 0; e < batch.GetSize(); e++ ) {
+	const uint32_t mask = batch.GetChannelMask(e);
+	const uint32_t nsamples = batch.GetNSamples(e);
+	uint32_t i = 0;
+	for( size_t k = 0; k < fChannels.size(); k++ ) {
+	    Channel& c = fChannels[k];
+	    fPresent[k] = 0;
+	    if( !(mask & (1u << c.fChannel)) || i >= batch.GetNPresent(e) || nsamples == 0 )
+		continue;
+	    const int16_t* w = batch.Corr(e, i++);
+	    const Pulse p = fNegative ? FindPulse<-1>(w, nsamples) : FindPulse<1>(w, nsamples);
+	    c.fAmplitude.Fill(p.fAmplitude);
+	    c.fIntegral.Fill(p.fSum * fSampleNs);
+	    if( p.fAmplitude > 0 )
+		c.fTime.Fill((fNegative ? HalfRise<-1>(w, p) : HalfRise<1>(w, p)) * fSampleNs);
+	    fAmplitude[k] = p.fAmplitude;
+	    fPresent[k] = 1;
+	}
+	for( Correlation& c: fCorrelations )
+	    if( fPresent[c.fSlotX] && fPresent[c.fSlotY] )
+		c.fAmplitude.Fill(fAmplitude[c.fSlotX], fAmplitude[c.fSlotY]);
+	fEvents++;
+    }
+}
+
+void RunHistograms::Add(const RunHistograms& other)
+{
+    if( other.fChannels.size() != fChannels.size() || other.fCorrelations.size() != fCorrelations.size() )
+	throw std::runtime_error("RunHistograms: adding histograms of other channels");
+    for( size_t k = 0; k < fChannels.size(); k++ ) {
+	fChannels[k].fAmplitude.Add(other.fChannels[k].fAmplitude);
+	fChannels[k].fIntegral.Add(other.fChannels[k].fIntegral);
+	fChannels[k].fTime.Add(other.fChannels[k].fTime);
+    }
+    for( size_t k = 0; k < fCorrelations.size(); k++ )
+	fCorrelations[k].fAmplitude.Add(other.fCorrelations[k].fAmplitude);
+    fEvents += other.fEvents;
+}
+
+void RunHistograms::Reset()
+{
+    for( Channel& c: fChannels ) {
+	c.fAmplitude.Reset();
+	c.fIntegral.Reset();
+	c.fTime.Reset();
+    }
+    for( Correlation& c: fCorrelations )
+	c.fAmplitude.Reset();
+    fEvents = 0;
+}
+
+std::string RunHistograms::Summary(const std::string& prefix) const
+{
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(1);
+    for( size_t k = 0; k < fChannels.size(); k++ ) {
+	const Channel& c = fChannels[k];
+	out << (k ? "\n" : "") << prefix << "ch" << c.fChannel << ":";
+	Describe1D(out, "amplitude", c.fAmplitude, "ADC,");
+	Describe1D(out, "integral", c.fIntegral, "ADC ns,");
+	Describe1D(out, "time", c.fTime, "ns");
+    }
+    return out.str();
+}
+
+// ---------------------------------------------------------------
+// HistogramService
+// ---------------------------------------------------------------
+void HistogramService::Clear(int board)
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    fBoards.erase(board);
+}
+
+void HistogramService::Merge(int board, RunHistograms& local)
+{
+    {
+	std::lock_guard<std::mutex> lock(fMutex);
+	auto it = fBoards.find(board);
+	if( it == fBoards.end() )
+	    fBoards.emplace(board, local);
+	else
+	    it->second.Add(local);
+    }
+    local.Reset();
+}
+
+bool HistogramService::Get(int board, RunHistograms& histograms)
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    auto it = fBoards.find(board);
+    if( it == fBoards.end() )
+	return false;
+    histograms = it->second;
+    return true;
+}
+
+std::string HistogramService::Describe(const std::string& arg)
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    if( fBoards.empty() )
+	return "ERROR no histograms (enable [histograms])";
+
+    if( arg.empty() ) {
+	std::ostringstream out;
+	for( auto& [board, h]: fBoards )
+	    out << (board == fBoards.begin()->first ? "" : "\n") << "b" << board << " events " << h.GetEvents()
+		<< "\n" << h.Summary("b" + std::to_string(board) + " ");
+	return out.str();
+    }
+
+    std::istringstream in(arg);
+    int board = -1;
+    uint32_t channel = 0;
+    std::string kind;
+    if( !(in >> board >> channel >> kind) )
+	return "ERROR histograms takes no argument or <board> <channel> amplitude|integral|time";
+    auto it = fBoards.find(board);
+    if( it == fBoards.end() )
+	return "ERROR no histograms for board " + std::to_string(board);
+    for( const RunHistograms::Channel& c: it->second.GetChannels() ) {
+	if( c.fChannel != channel )
+	    continue;
+	const Histogram1D* h = kind == "amplitude" ? &c.fAmplitude : kind == "integral" ? &c.fIntegral :
+	    kind == "time" ? &c.fTime : nullptr;
+	if( h == nullptr )
+	    return "ERROR unknown spectrum \"" + kind + "\" (amplitude, integral, time)";
+	std::ostringstream out;
+	out << "low=" << h->fLow << " high=" << h->fHigh << " underflow=" << h->fUnderflow
+	    << " overflow=" << h->fOverflow << " counts=";
+	for( size_t i = 0; i < h->fCounts.size(); i++ )
+	    out << (i ? "," : "") << h->fCounts[i];
+	return out.str();
+    }
+    return "ERROR channel " + std::to_string(channel) + " not acquired by board " + std::to_string(board);
+}
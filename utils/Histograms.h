@@ -0,0 +1,154 @@
+#ifndef HISTOGRAMS_H
+#define HISTOGRAMS_H
+
+// Online spectra of the run, from [histograms]: for every channel the pulse
+// amplitude, integral and time, and the amplitude of pairs of channels
+// against each other, so that the calibration can be checked as soon as the
+// run ends, without reading the file back.
+//
+// Per event and channel (baseline-corrected samples, pulse of the
+// configured polarity made positive):
+//   amplitude  largest sample, ADC counts
+//   integral   sum of the samples x sampling time, ADC counts x ns
+//   time       50% of the amplitude on the leading edge (linear
+//              interpolation), ns from the start of the record
+//
+// Each readout thread fills the RunHistograms of its board, with plain
+// counters, and every MergeIntervalS adds them to HistogramService and
+// starts over. The run-control "histograms" command reads the merged copy;
+// at the end of the run it is written to /histograms of the output.
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "EventBatch.h"
+
+struct HistogramSettings;
+
+struct Histogram1D {
+    double fLow = 0.0;
+    double fHigh = 1.0;
+    std::vector<uint64_t> fCounts;
+    uint64_t fUnderflow = 0;
+    uint64_t fOverflow = 0;
+    double fSum = 0.0;                  ///< of the values in range
+    double fSum2 = 0.0;
+
+    void Setup(uint32_t nbins, double low, double high);
+    void Fill(double x)
+    {
+	const double bin = (x - fLow) * fScale;
+	if( bin < 0.0 )
+	    fUnderflow++;
+	else if( bin >= fCounts.size() )
+	    fOverflow++;
+	else {
+	    fCounts[static_cast<size_t>(bin)]++;
+	    fSum += x;
+	    fSum2 += x * x;
+	}
+    }
+    void Add(const Histogram1D& other);
+    void Reset();
+
+    uint64_t GetEntries() const;        ///< in range
+    double GetMean() const;
+    double GetRMS() const;
+
+private:
+    double fScale = 1.0;                ///< bins per unit
+};
+
+/// Counts [y][x].
+struct Histogram2D {
+    double fXLow = 0.0, fXHigh = 1.0;
+    double fYLow = 0.0, fYHigh = 1.0;
+    uint32_t fNX = 0, fNY = 0;
+    std::vector<uint64_t> fCounts;
+    uint64_t fOutside = 0;              ///< x or y out of range
+
+    void Setup(uint32_t nx, double xlow, double xhigh, uint32_t ny, double ylow, double yhigh);
+    void Fill(double x, double y)
+    {
+	const double bx = (x - fXLow) * fXScale;
+	const double by = (y - fYLow) * fYScale;
+	if( bx < 0.0 || by < 0.0 || bx >= fNX || by >= fNY )
+	    fOutside++;
+	else
+	    fCounts[size_t(by) * fNX + size_t(bx)]++;
+    }
+    void Add(const Histogram2D& other);
+    void Reset();
+
+private:
+    double fXScale = 1.0, fYScale = 1.0;
+};
+
+/// The histograms of one board, filled by one thread.
+class RunHistograms {
+public:
+    struct Channel {
+	uint32_t fChannel;
+	Histogram1D fAmplitude;
+	Histogram1D fIntegral;
+	Histogram1D fTime;
+    };
+    struct Correlation {
+	uint32_t fChannelX;
+	uint32_t fChannelY;
+	size_t fSlotX;                  ///< index in channels
+	size_t fSlotY;
+	Histogram2D fAmplitude;
+    };
+
+    /// channels: ChannelList; nsamples, samplingtime (s): the record;
+    /// negative: negative pulses (PulsePolarity 1).
+    RunHistograms(const std::vector<uint32_t>& channels, const HistogramSettings& settings,
+		  uint32_t nsamples, double samplingtime, bool negative);
+
+    void Fill(const EventBatch& batch);
+    /// Same channels and binning required.
+    void Add(const RunHistograms& other);
+    void Reset();
+
+    uint64_t GetEvents() const { return fEvents; }
+    const std::vector<Channel>& GetChannels() const { return fChannels; }
+    const std::vector<Correlation>& GetCorrelations() const { return fCorrelations; }
+
+    /// One line per channel: entries, mean and RMS of each spectrum.
+    std::string Summary(const std::string& prefix = "") const;
+
+private:
+    std::vector<Channel> fChannels;
+    std::vector<Correlation> fCorrelations;
+    double fSampleNs;
+    bool fNegative;
+    uint64_t fEvents;
+    std::vector<double> fAmplitude;     ///< of the current event, per slot (correlations)
+    std::vector<uint8_t> fPresent;
+};
+
+/// The merged histograms of every board, read by the run-control server.
+class HistogramService {
+public:
+    /// Forget the histograms of board (start of its run).
+    static void Clear(int board);
+    /// Add local to the histograms of board, then reset local.
+    static void Merge(int board, RunHistograms& local);
+    /// Copy of the histograms of board, false if it has none.
+    static bool Get(int board, RunHistograms& histograms);
+
+    /// Run-control "histograms": Summary() of every board without argument;
+    /// "<board> <channel> amplitude|integral|time" gives the bins of one
+    /// spectrum on one line.
+    static std::string Describe(const std::string& arg);
+
+private:
+    static std::mutex fMutex;
+    static std::map<int, RunHistograms> fBoards;
+};
+
+#endif // HISTOGRAMS_H
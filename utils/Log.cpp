@@ -1,7 +1,350 @@
+// Log.cpp
+// Asynchronous back-end: every thread owns a single-producer ring of
+// fixed-size records, a background thread merges the rings by timestamp and
+// writes them to the console and/or the log file. The caller never touches
+// the terminal, so an error burst in the readout loop costs one memcpy per
+// message (or nothing, once repeat suppression kicks in).
+//
 #include "Log.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 Log::LogLevel Log::fLogLevel = Log::summary;
 
+namespace {
+
+constexpr uint32_t kRingSize = 1024;   // records per thread (power of two)
+constexpr uint32_t kMaxText  = 488;    // record payload, longer messages are truncated
+
+struct LogRecord {
+    uint64_t fTimeNs;
+    uint32_t fThread;
+    uint16_t fLevel;
+    uint16_t fLength;
+    char fText[kMaxText];
+};
+
+uint64_t NowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t HashMessage(uint16_t level, const std::string& msg) {
+    uint64_t h = 1469598103934665603ull ^ level;   // FNV-1a
+    for (unsigned char c : msg) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Single producer (the owning thread), single consumer (the drain thread).
+struct LogRing {
+    alignas(64) std::atomic<uint64_t> fHead{0};
+    alignas(64) std::atomic<uint64_t> fTail{0};
+    alignas(64) std::atomic<uint64_t> fDropped{0};
+    std::atomic<uint64_t> fSuppressed{0};
+    std::atomic<uint64_t> fLastSeenNs{0};
+    std::atomic<uint16_t> fLastLevel{0};
+    std::atomic<bool> fOrphan{false};
+
+    // repeat suppression state, touched only by the producer
+    uint64_t fLastHash = 0;
+    uint64_t fLastPrintNs = 0;
+
+    uint32_t fThread = 0;
+    LogRecord fSlots[kRingSize];
+
+    bool Push(uint16_t level, uint64_t timeNs, const char* text, size_t len) {
+        uint64_t head = fHead.load(std::memory_order_relaxed);
+        if (head - fTail.load(std::memory_order_acquire) >= kRingSize) {
+            fDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        LogRecord& r = fSlots[head & (kRingSize - 1)];
+        r.fTimeNs = timeNs;
+        r.fThread = fThread;
+        r.fLevel = level;
+        if (len > kMaxText) {
+            std::memcpy(r.fText, text, kMaxText - 3);
+            std::memcpy(r.fText + kMaxText - 3, "...", 3);
+            len = kMaxText;
+        } else {
+            std::memcpy(r.fText, text, len);
+        }
+        r.fLength = static_cast<uint16_t>(len);
+        fHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void Pop(std::vector<LogRecord>& out) {
+        uint64_t tail = fTail.load(std::memory_order_relaxed);
+        const uint64_t head = fHead.load(std::memory_order_acquire);
+        for (; tail != head; ++tail)
+            out.push_back(fSlots[tail & (kRingSize - 1)]);
+        fTail.store(tail, std::memory_order_release);
+    }
+
+    bool Empty() const {
+        return fHead.load(std::memory_order_acquire) == fTail.load(std::memory_order_acquire);
+    }
+};
+
+const char* LevelColor(uint16_t level) {
+    switch (level) {
+    case Log::error:   return "\033[1;31m";
+    case Log::warning: return "\033[1;34m";
+    case Log::debug:   return "\033[32m";
+    default:           return "";
+    }
+}
+
+class LogBackend {
+public:
+    // Never destroyed: static destructors may still log after exit() starts.
+    static LogBackend& Instance() {
+        static LogBackend* backend = new LogBackend();
+        return *backend;
+    }
+
+    // nullptr once the ring of this thread is destroyed (static destructors,
+    // atexit handlers): the caller then writes synchronously
+    LogRing* ThreadRing() {
+        if (fRingDestroyed)
+            return nullptr;
+        thread_local RingHolder holder;
+        if (!holder.fRing) {
+            holder.fRing = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lk(fRingsMutex);
+            holder.fRing->fThread = fNextThread++;
+            fRings.push_back(holder.fRing);
+        }
+        return holder.fRing.get();
+    }
+
+    bool Running() const { return fRunning.load(std::memory_order_acquire); }
+
+    void Start() {
+        std::lock_guard<std::mutex> lk(fStartMutex);
+        if (fRunning.load() || fStopped)
+            return;
+        fRunning.store(true, std::memory_order_release);
+        fThread = std::thread(&LogBackend::Run, this);
+    }
+
+    void Stop() {
+        std::lock_guard<std::mutex> lk(fStartMutex);
+        if (!fRunning.load())
+            return;
+        {
+            std::lock_guard<std::mutex> wl(fWakeMutex);
+            fRunning.store(false, std::memory_order_release);
+        }
+        fWake.notify_all();
+        if (fThread.joinable())
+            fThread.join();
+        fStopped = true;
+    }
+
+    void Flush() {
+        if (!Running()) {
+            Drain(true);
+            return;
+        }
+        std::unique_lock<std::mutex> lk(fWakeMutex);
+        const uint64_t target = ++fFlushRequest;
+        fWake.notify_all();
+        fFlushed.wait(lk, [&] { return fFlushDone >= target || !Running(); });
+    }
+
+    // Used when the background thread is not running (after CloseLog).
+    void WriteNow(uint16_t level, uint64_t timeNs, const std::string& msg) {
+        LogRecord r;
+        r.fTimeNs = timeNs;
+        r.fThread = 0;
+        r.fLevel = level;
+        const size_t len = std::min<size_t>(msg.size(), kMaxText);
+        std::memcpy(r.fText, msg.data(), len);
+        r.fLength = static_cast<uint16_t>(len);
+        std::lock_guard<std::mutex> lk(fSinkMutex);
+        Write(&r, 1);
+    }
+
+    void SetFile(const std::string& path) {
+        std::lock_guard<std::mutex> lk(fSinkMutex);
+        if (fFile) {
+            std::fclose(fFile);
+            fFile = nullptr;
+        }
+        if (!path.empty()) {
+            fFile = std::fopen(path.c_str(), "a");
+            if (!fFile)
+                std::fprintf(stderr, "Log: cannot open log file %s\n", path.c_str());
+        }
+    }
+
+    void SetConsole(bool enable) {
+        std::lock_guard<std::mutex> lk(fSinkMutex);
+        fConsole = enable;
+    }
+
+    std::atomic<uint64_t> fRepeatWindowNs{1000000000ull};
+
+private:
+    struct RingHolder {
+        std::shared_ptr<LogRing> fRing;
+        ~RingHolder() {
+            fRingDestroyed = true;
+            if (fRing)
+                fRing->fOrphan.store(true, std::memory_order_release);
+        }
+    };
+    // trivially destructible, so still valid after the holder is gone
+    static thread_local bool fRingDestroyed;
+
+    LogBackend() {
+        std::atexit([] { LogBackend::Instance().Stop(); });
+    }
+
+    void Run() {
+        while (true) {
+            uint64_t target = 0;
+            {
+                std::unique_lock<std::mutex> lk(fWakeMutex);
+                fWake.wait_for(lk, std::chrono::milliseconds(5),
+                               [&] { return fFlushRequest != fFlushDone || !Running(); });
+                target = fFlushRequest;
+            }
+            const bool stopping = !Running();
+            Drain(stopping);
+            {
+                std::lock_guard<std::mutex> lk(fWakeMutex);
+                fFlushDone = target;
+            }
+            fFlushed.notify_all();
+            if (stopping)
+                break;
+        }
+    }
+
+    void Drain(bool final) {
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            std::lock_guard<std::mutex> lk(fRingsMutex);
+            rings = fRings;
+        }
+
+        fBatch.clear();
+        const uint64_t now = NowNs();
+        const uint64_t window = fRepeatWindowNs.load(std::memory_order_relaxed);
+        for (auto& ring : rings) {
+            ring->Pop(fBatch);
+
+            uint64_t dropped = ring->fDropped.exchange(0, std::memory_order_relaxed);
+            if (dropped)
+                AddNote(ring.get(), Log::warning, now,
+                        std::to_string(dropped) + " log messages dropped (queue full)");
+
+            // close a burst that ended without a different message following it
+            if (ring->fSuppressed.load(std::memory_order_relaxed) &&
+                (final || now - ring->fLastSeenNs.load(std::memory_order_relaxed) > window)) {
+                uint64_t n = ring->fSuppressed.exchange(0, std::memory_order_acq_rel);
+                if (n)
+                    AddNote(ring.get(), ring->fLastLevel.load(std::memory_order_relaxed), now,
+                            "last message repeated " + std::to_string(n) + " times");
+            }
+        }
+
+        if (!fBatch.empty()) {
+            std::stable_sort(fBatch.begin(), fBatch.end(),
+                             [](const LogRecord& a, const LogRecord& b) { return a.fTimeNs < b.fTimeNs; });
+            std::lock_guard<std::mutex> lk(fSinkMutex);
+            Write(fBatch.data(), fBatch.size());
+        }
+
+        std::lock_guard<std::mutex> lk(fRingsMutex);
+        fRings.erase(std::remove_if(fRings.begin(), fRings.end(),
+                                    [](const std::shared_ptr<LogRing>& r) {
+                                        return r->fOrphan.load(std::memory_order_acquire) && r->Empty() &&
+                                               r->fSuppressed.load(std::memory_order_relaxed) == 0;
+                                    }),
+                     fRings.end());
+    }
+
+    void AddNote(const LogRing* ring, uint16_t level, uint64_t timeNs, const std::string& msg) {
+        LogRecord r;
+        r.fTimeNs = timeNs;
+        r.fThread = ring->fThread;
+        r.fLevel = level;
+        r.fLength = static_cast<uint16_t>(std::min<size_t>(msg.size(), kMaxText));
+        std::memcpy(r.fText, msg.data(), r.fLength);
+        fBatch.push_back(r);
+    }
+
+    // caller holds fSinkMutex
+    void Write(const LogRecord* records, size_t n) {
+        char stamp[64];
+        for (size_t i = 0; i < n; i++) {
+            const LogRecord& r = records[i];
+            const time_t sec = static_cast<time_t>(r.fTimeNs / 1000000000ull);
+            const unsigned long nsec = static_cast<unsigned long>(r.fTimeNs % 1000000000ull);
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            const std::string level = Log::ToString(static_cast<Log::LogLevel>(r.fLevel));
+
+            if (fConsole) {
+                std::strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+                std::fprintf(stdout, "%s%s.%09lu %s%.*s\033[0m\n", LevelColor(r.fLevel), stamp, nsec,
+                             level.c_str(), static_cast<int>(r.fLength), r.fText);
+            }
+            if (fFile) {
+                std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+                std::fprintf(fFile, "%s.%09lu [t%u] %s%.*s\n", stamp, nsec, r.fThread, level.c_str(),
+                             static_cast<int>(r.fLength), r.fText);
+            }
+        }
+        if (fConsole)
+            std::fflush(stdout);
+        if (fFile)
+            std::fflush(fFile);
+    }
+
+    std::mutex fRingsMutex;
+    std::vector<std::shared_ptr<LogRing>> fRings;
+    uint32_t fNextThread = 0;
+    std::vector<LogRecord> fBatch;   // drain thread only
+
+    std::mutex fStartMutex;
+    std::thread fThread;
+    std::atomic<bool> fRunning{false};
+    bool fStopped = false;
+
+    std::mutex fWakeMutex;
+    std::condition_variable fWake;
+    std::condition_variable fFlushed;
+    uint64_t fFlushRequest = 0;
+    uint64_t fFlushDone = 0;
+
+    std::mutex fSinkMutex;
+    FILE* fFile = nullptr;
+    bool fConsole = true;
+};
+
+thread_local bool LogBackend::fRingDestroyed = false;
+
+} // namespace
+
 Log::Log() {
     fLogLevel = Log::summary;
 }
@@ -16,12 +359,13 @@ Log::~Log() {
 void Log::OpenLog(const Log::LogLevel& loglevel) {
 
     Log::SetLogLevel(loglevel);
+    LogBackend::Instance().Start();
 
     return;
 }
 
 void Log::OpenLog(const int& loglevel) {
-    Log::SetLogLevel(static_cast<LogLevel>(loglevel));
+    Log::OpenLog(static_cast<LogLevel>(loglevel));
 
     return;
 }
@@ -33,21 +377,71 @@ void Log::SetLogLevel(const Log::LogLevel& loglevel) {
     return;
 }
 
+void Log::SetLogFile(const std::string& filename) {
+    LogBackend::Instance().SetFile(filename);
+}
+
+void Log::SetConsole(const bool& enable) {
+    LogBackend::Instance().SetConsole(enable);
+}
+
+void Log::SetRepeatWindow(const double& seconds) {
+    LogBackend::Instance().fRepeatWindowNs.store(seconds > 0 ? static_cast<uint64_t>(seconds * 1e9) : 0);
+}
+
+void Log::Flush() {
+    LogBackend::Instance().Flush();
+}
+
+void Log::CloseLog() {
+    LogBackend::Instance().Stop();
+}
+
 void Log::Out(const Log::LogLevel& loglevel, const std::string& message) {
 
-    if (Log::fLogLevel >= loglevel) {
+    if (Log::fLogLevel < loglevel || loglevel == nothing)
+        return;
 
-        if (loglevel == Log::LogLevel::error) {
-            std::cout << "\033[1;31m";
-        } else if (loglevel == Log::LogLevel::warning) {
-            std::cout << "\033[1;34m";
-        } else if (loglevel == Log::LogLevel::debug) {
-            std::cout << "\033[32m";
+    LogBackend& backend = LogBackend::Instance();
+    const uint64_t now = NowNs();
+    if (!backend.Running()) {
+        backend.Start();
+        if (!backend.Running()) {   // already closed: write synchronously
+            backend.WriteNow(loglevel, now, message);
+            return;
         }
-        std::cout << Log::ToString(loglevel) << std::boolalpha << message;
-        std::cout << "\033[0m"<< std::endl;
     }
 
+    LogRing* ring = backend.ThreadRing();
+    if (!ring) {
+        backend.WriteNow(loglevel, now, message);
+        return;
+    }
+    const uint16_t level = static_cast<uint16_t>(loglevel);
+    const uint64_t hash = HashMessage(level, message);
+    const uint64_t window = backend.fRepeatWindowNs.load(std::memory_order_relaxed);
+
+    // rate-limited repeat suppression: the same message from the same thread is
+    // printed once per window, the skipped copies are summarized afterwards
+    if (hash == ring->fLastHash && now - ring->fLastPrintNs < window) {
+        ring->fLastSeenNs.store(now, std::memory_order_relaxed);
+        ring->fSuppressed.fetch_add(1, std::memory_order_release);
+        return;
+    }
+
+    const uint64_t suppressed = ring->fSuppressed.exchange(0, std::memory_order_acq_rel);
+    if (suppressed) {
+        char note[64];
+        const int len = std::snprintf(note, sizeof(note), "last message repeated %llu times",
+                                      static_cast<unsigned long long>(suppressed));
+        ring->Push(ring->fLastLevel.load(std::memory_order_relaxed), now, note, static_cast<size_t>(len));
+    }
+
+    ring->fLastHash = hash;
+    ring->fLastPrintNs = now;
+    ring->fLastSeenNs.store(now, std::memory_order_relaxed);
+    ring->fLastLevel.store(level, std::memory_order_relaxed);
+    ring->Push(level, now, message.data(), message.size());
 }
 
 
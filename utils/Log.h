@@ -4,8 +4,28 @@
 #include <string>
 #include <typeinfo>
 #include <vector>
-#include <iostream>
+#include <sstream>
+
+// Compile-time level stripping: calls more verbose than LOG_MAX_LEVEL are
+// removed by the compiler (e.g. -DLOG_MAX_LEVEL=3 drops every OutDebug call).
+// Their argument is still built at the call site: messages assembled on the
+// acquisition path go through LOG_OUT_DEBUG(), which builds them only when
+// they are written.
+#ifndef LOG_DEBUG
+#define LOG_DEBUG 1
+#endif
+
+#ifndef LOG_MAX_LEVEL
+#if LOG_DEBUG
+#define LOG_MAX_LEVEL 4
+#else
+#define LOG_MAX_LEVEL 3
+#endif
+#endif
 
+// Out() does not write to the terminal: it copies the message into a
+// per-thread lock-free ring and returns. A background thread drains the rings
+// to the console and/or the log file (see Log.cpp).
 class Log {
 
 public:
@@ -27,6 +47,12 @@ public:
 
     static void SetLogLevel(const Log::LogLevel& loglevel);
 
+    static void SetLogFile(const std::string& filename);   ///< "" closes the log file
+    static void SetConsole(const bool& enable);
+    static void SetRepeatWindow(const double& seconds);    ///< 0 disables repeat suppression
+    static void Flush();                                   ///< wait until all queued messages are written
+    static void CloseLog();                                ///< drain queues and stop the writer thread
+
     static void Out(const Log::LogLevel& loglevel, const std::string& message="");
     
     static void Out(const std::string& message="") {
@@ -34,37 +60,29 @@ public:
     }
 
     static void OutError(const std::string& message="") {
-        Out(error, message);
+        if constexpr (error <= LOG_MAX_LEVEL) Out(error, message);
     }
 
     static void OutWarning(const std::string& message="") {
-        Out(warning, message);
+        if constexpr (warning <= LOG_MAX_LEVEL) Out(warning, message);
     }
 
     static void OutSummary(const std::string& message="") {
-        Out(summary, message);
+        if constexpr (summary <= LOG_MAX_LEVEL) Out(summary, message);
     }
 
     static void OutDebug(const std::string& message="") {
-        Out(debug, message);
+        if constexpr (debug <= LOG_MAX_LEVEL) Out(debug, message);
     }
 
     template<typename T>
     static void Out(const Log::LogLevel& loglevel, const std::vector<T> values)
     {
 	if (Log::fLogLevel >= loglevel) {
-
-	    if (loglevel == Log::LogLevel::error) {
-		std::cout << "\033[1;31m";
-	    } else if (loglevel == Log::LogLevel::warning) {
-		std::cout << "\033[1;34m";
-	    } else if (loglevel == Log::LogLevel::debug) {
-		std::cout << "\033[32m";
-	    }
-	    std::cout << Log::ToString(loglevel);
+	    std::ostringstream line;
 	    for( auto it: values )
-		std::cout << std::boolalpha << it << "\t";
-	    std::cout << "\033[0m"<< std::endl;
+		line << std::boolalpha << it << "\t";
+	    Out(loglevel, line.str());
 	}
 	
 	return;
@@ -87,7 +105,7 @@ public:
 
     template<typename T>
     static void OutDebug( const std::vector<T> values ) {
-	Out(debug, values);
+	if constexpr (debug <= LOG_MAX_LEVEL) Out(debug, values);
     }
     
     static std::string ToString(const Log::LogLevel&);
@@ -101,4 +119,13 @@ private:
 
 };
 
+// Log::OutDebug(message), with message evaluated only when debug messages
+// are compiled in and the log level shows them.
+#define LOG_OUT_DEBUG(message) \
+    do { \
+        if constexpr (Log::debug <= LOG_MAX_LEVEL) \
+            if (Log::GetLogLevel() >= Log::debug) \
+                Log::OutDebug(message); \
+    } while (0)
+
 #endif
@@ -0,0 +1,406 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+// Bounded lock-free queues to hand data between the threads of the DAQ
+// (readout, decoding, writing, monitoring). Header only.
+//
+//   SpscQueue<T>       one producer, one consumer: a ring with the two
+//                      indices on separate cache lines, each side caching
+//                      the other's index so it only reads it when the
+//                      ring looks full (or empty);
+//   MpmcQueue<T>       any number of producers and consumers (D. Vyukov's
+//                      bounded queue: a sequence number per slot, one CAS
+//                      per operation);
+//   BlockingQueue<Q>   either of them with Push/Pop that wait: spin, then
+//                      yield, then sleep on a futex. The futex is only
+//                      touched when someone sleeps, so a busy pipeline
+//                      makes no system calls. Close() ends the waits.
+//
+// Capacities are rounded up to a power of two. T must be default
+// constructible and movable; slots are reused, not destroyed, until the
+// queue is. Each consumer sees the items of each producer in push order.
+//
+// Stress and ns/op: daq-bench --stages queue.
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace QueueDetail {
+
+    constexpr size_t kCacheLine = 64;
+
+    inline size_t RoundUpPow2(size_t n)
+    {
+	size_t p = 2;
+	while( p < n )
+	    p <<= 1;
+	return p;
+    }
+
+    inline void Pause()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+    }
+
+}
+
+template <typename T>
+class SpscQueue {
+public:
+    using value_type = T;
+
+    explicit SpscQueue(size_t capacity) :
+	fMask(QueueDetail::RoundUpPow2(capacity) - 1),
+	fSlots(new T[fMask + 1])
+    {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /// Producer only. False if full; item is moved from only on success.
+    template <typename U>
+    bool TryPush(U&& item)
+    {
+	const size_t tail = fTail.load(std::memory_order_relaxed);
+	if( tail - fCachedHead > fMask ) {
+	    fCachedHead = fHead.load(std::memory_order_acquire);
+	    if( tail - fCachedHead > fMask )
+		return false;
+	}
+	fSlots[tail & fMask] = std::forward<U>(item);
+	fTail.store(tail + 1, std::memory_order_release);
+	return true;
+    }
+
+    /// Consumer only. False if empty.
+    bool TryPop(T& item)
+    {
+	const size_t head = fHead.load(std::memory_order_relaxed);
+	if( head == fCachedTail ) {
+	    fCachedTail = fTail.load(std::memory_order_acquire);
+	    if( head == fCachedTail )
+		return false;
+	}
+	item = std::move(fSlots[head & fMask]);
+	fHead.store(head + 1, std::memory_order_release);
+	return true;
+    }
+
+    /// As many of items[0..n) as fit, one index update; returns how many.
+    size_t PushBatch(T* items, size_t n)
+    {
+	const size_t tail = fTail.load(std::memory_order_relaxed);
+	size_t space = fMask + 1 - (tail - fCachedHead);
+	if( space < n ) {
+	    fCachedHead = fHead.load(std::memory_order_acquire);
+	    space = fMask + 1 - (tail - fCachedHead);
+	}
+	n = std::min(n, space);
+	for( size_t i = 0; i < n; i++ )
+	    fSlots[(tail + i) & fMask] = std::move(items[i]);
+	fTail.store(tail + n, std::memory_order_release);
+	return n;
+    }
+
+    /// Up to n items, one index update; returns how many.
+    size_t PopBatch(T* items, size_t n)
+    {
+	const size_t head = fHead.load(std::memory_order_relaxed);
+	if( fCachedTail - head < n )
+	    fCachedTail = fTail.load(std::memory_order_acquire);
+	n = std::min(n, fCachedTail - head);
+	for( size_t i = 0; i < n; i++ )
+	    items[i] = std::move(fSlots[(head + i) & fMask]);
+	fHead.store(head + n, std::memory_order_release);
+	return n;
+    }
+
+    size_t Capacity() const { return fMask + 1; }
+    /// Exact only when neither side is running.
+    size_t SizeApprox() const
+    {
+	return fTail.load(std::memory_order_relaxed) - fHead.load(std::memory_order_relaxed);
+    }
+
+private:
+    alignas(QueueDetail::kCacheLine) std::atomic<size_t> fHead{0};     ///< consumer
+    size_t fCachedTail = 0;
+    alignas(QueueDetail::kCacheLine) std::atomic<size_t> fTail{0};     ///< producer
+    size_t fCachedHead = 0;
+    alignas(QueueDetail::kCacheLine) const size_t fMask;
+    std::unique_ptr<T[]> fSlots;
+};
+
+template <typename T>
+class MpmcQueue {
+public:
+    using value_type = T;
+
+    explicit MpmcQueue(size_t capacity) :
+	fMask(QueueDetail::RoundUpPow2(capacity) - 1),
+	fCells(new Cell[fMask + 1])
+    {
+	for( size_t i = 0; i <= fMask; i++ )
+	    fCells[i].fSeq.store(i, std::memory_order_relaxed);
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    /// False if full; item is moved from only on success.
+    template <typename U>
+    bool TryPush(U&& item)
+    {
+	size_t pos = fEnqueue.load(std::memory_order_relaxed);
+	Cell* cell;
+	for( ;; ) {
+	    cell = &fCells[pos & fMask];
+	    const size_t seq = cell->fSeq.load(std::memory_order_acquire);
+	    const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+	    if( diff == 0 ) {
+		if( fEnqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+		    break;
+	    }
+	    else if( diff < 0 )
+		return false;
+	    else
+		pos = fEnqueue.load(std::memory_order_relaxed);
+	}
+	cell->fData = std::forward<U>(item);
+	cell->fSeq.store(pos + 1, std::memory_order_release);
+	return true;
+    }
+
+    /// False if empty.
+    bool TryPop(T& item)
+    {
+	size_t pos = fDequeue.load(std::memory_order_relaxed);
+	Cell* cell;
+	for( ;; ) {
+	    cell = &fCells[pos & fMask];
+	    const size_t seq = cell->fSeq.load(std::memory_order_acquire);
+	    const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+	    if( diff == 0 ) {
+		if( fDequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+		    break;
+	    }
+	    else if( diff < 0 )
+		return false;
+	    else
+		pos = fDequeue.load(std::memory_order_relaxed);
+	}
+	item = std::move(cell->fData);
+	cell->fSeq.store(pos + fMask + 1, std::memory_order_release);
+	return true;
+    }
+
+    /// Items are claimed one by one (other producers may interleave);
+    /// stops at the first full slot. Returns how many were pushed.
+    size_t PushBatch(T* items, size_t n)
+    {
+	size_t i = 0;
+	while( i < n && TryPush(std::move(items[i])) )
+	    i++;
+	return i;
+    }
+
+    size_t PopBatch(T* items, size_t n)
+    {
+	size_t i = 0;
+	while( i < n && TryPop(items[i]) )
+	    i++;
+	return i;
+    }
+
+    size_t Capacity() const { return fMask + 1; }
+    size_t SizeApprox() const
+    {
+	const size_t in = fEnqueue.load(std::memory_order_relaxed);
+	const size_t out = fDequeue.load(std::memory_order_relaxed);
+	return in > out ? in - out : 0;
+    }
+
+private:
+    struct Cell {
+	std::atomic<size_t> fSeq;
+	T fData;
+    };
+
+    alignas(QueueDetail::kCacheLine) std::atomic<size_t> fEnqueue{0};
+    alignas(QueueDetail::kCacheLine) std::atomic<size_t> fDequeue{0};
+    alignas(QueueDetail::kCacheLine) const size_t fMask;
+    std::unique_ptr<Cell[]> fCells;
+};
+
+/// Q = SpscQueue<T> or MpmcQueue<T>; with SpscQueue only one thread may
+/// push and one may pop.
+template <typename Q>
+class BlockingQueue {
+public:
+    using value_type = typename Q::value_type;
+
+    static constexpr unsigned kSpins = 128;         ///< pause rounds before yielding
+    static constexpr unsigned kYields = 16;         ///< yield rounds before sleeping
+
+    explicit BlockingQueue(size_t capacity) : fQueue(capacity) {}
+
+    /// Wait for room. False, with item untouched, once Close()d.
+    template <typename U>
+    bool Push(U&& item)
+    {
+	for( unsigned round = 0; ; round++ ) {
+	    const uint32_t seq = fNotFull.fSeq.load(std::memory_order_acquire);
+	    if( fClosed.load(std::memory_order_acquire) )
+		return false;
+	    if( fQueue.TryPush(std::forward<U>(item)) ) {
+		Notify(fNotEmpty);
+		return true;
+	    }
+	    Backoff(fNotFull, seq, round);
+	}
+    }
+
+    /// Wait for an item. False once Close()d and drained.
+    bool Pop(value_type& item)
+    {
+	for( unsigned round = 0; ; round++ ) {
+	    const uint32_t seq = fNotEmpty.fSeq.load(std::memory_order_acquire);
+	    if( fQueue.TryPop(item) ) {
+		Notify(fNotFull);
+		return true;
+	    }
+	    if( fClosed.load(std::memory_order_acquire) )
+		return fQueue.TryPop(item);
+	    Backoff(fNotEmpty, seq, round);
+	}
+    }
+
+    /// Push all of items[0..n), one wake-up per chunk that fits. Returns how
+    /// many were pushed: n, or fewer once Close()d.
+    size_t PushBatch(value_type* items, size_t n)
+    {
+	size_t done = 0;
+	for( unsigned round = 0; done < n; round++ ) {
+	    const uint32_t seq = fNotFull.fSeq.load(std::memory_order_acquire);
+	    if( fClosed.load(std::memory_order_acquire) )
+		break;
+	    const size_t k = fQueue.PushBatch(items + done, n - done);
+	    if( k > 0 ) {
+		done += k;
+		round = 0;
+		Notify(fNotEmpty);
+		continue;
+	    }
+	    Backoff(fNotFull, seq, round);
+	}
+	return done;
+    }
+
+    /// Wait for at least one item, take up to n. 0 once Close()d and drained.
+    size_t PopBatch(value_type* items, size_t n)
+    {
+	for( unsigned round = 0; ; round++ ) {
+	    const uint32_t seq = fNotEmpty.fSeq.load(std::memory_order_acquire);
+	    const size_t k = fQueue.PopBatch(items, n);
+	    if( k > 0 ) {
+		Notify(fNotFull);
+		return k;
+	    }
+	    if( fClosed.load(std::memory_order_acquire) )
+		return fQueue.PopBatch(items, n);
+	    Backoff(fNotEmpty, seq, round);
+	}
+    }
+
+    template <typename U>
+    bool TryPush(U&& item)
+    {
+	if( !fQueue.TryPush(std::forward<U>(item)) )
+	    return false;
+	Notify(fNotEmpty);
+	return true;
+    }
+
+    bool TryPop(value_type& item)
+    {
+	if( !fQueue.TryPop(item) )
+	    return false;
+	Notify(fNotFull);
+	return true;
+    }
+
+    /// Wake every waiter: Push fails from now on, Pop drains what is left.
+    void Close()
+    {
+	fClosed.store(true, std::memory_order_release);
+	for( Event* e: { &fNotEmpty, &fNotFull } ) {
+	    e->fSeq.fetch_add(1, std::memory_order_seq_cst);
+	    Futex(e->fSeq, FUTEX_WAKE_PRIVATE, INT_MAX);
+	}
+    }
+
+    bool IsClosed() const { return fClosed.load(std::memory_order_acquire); }
+    size_t Capacity() const { return fQueue.Capacity(); }
+    size_t SizeApprox() const { return fQueue.SizeApprox(); }
+
+private:
+    struct alignas(QueueDetail::kCacheLine) Event {
+	std::atomic<uint32_t> fSeq{0};       ///< bumped at every change, the futex word
+	std::atomic<uint32_t> fWaiters{0};
+    };
+
+    static long Futex(std::atomic<uint32_t>& word, int op, uint32_t value, const timespec* timeout = nullptr)
+    {
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word");
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, value, timeout, nullptr, 0);
+    }
+
+    // the system call only when a waiter may be asleep
+    static void Notify(Event& e)
+    {
+	e.fSeq.fetch_add(1, std::memory_order_seq_cst);
+	if( e.fWaiters.load(std::memory_order_seq_cst) > 0 )
+	    Futex(e.fSeq, FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+
+    // seq was read before the failed attempt: if anything changed since,
+    // the futex returns at once, so no wake-up is lost
+    static void Backoff(Event& e, uint32_t seq, unsigned round)
+    {
+	if( round < kSpins ) {
+	    QueueDetail::Pause();
+	    return;
+	}
+	if( round < kSpins + kYields ) {
+	    std::this_thread::yield();
+	    return;
+	}
+	const timespec timeout = { 0, 100000000 };      // 100 ms at most, as a safety net
+	e.fWaiters.fetch_add(1, std::memory_order_seq_cst);
+	Futex(e.fSeq, FUTEX_WAIT_PRIVATE, seq, &timeout);
+	e.fWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    Q fQueue;
+    Event fNotEmpty;
+    Event fNotFull;
+    std::atomic<bool> fClosed{false};
+};
+
+#endif // QUEUE_H
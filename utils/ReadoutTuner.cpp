@@ -0,0 +1,84 @@
+#include "ReadoutTuner.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+ReadoutTuner::ReadoutTuner(uint32_t maxevents, uint32_t start, double maxtransfer_s) :
+    fMax(std::max<uint32_t>(1, maxevents)),
+    fMaxTransfer(maxtransfer_s),
+    fValue(1),
+    fCeiling(fMax),
+    fSettled(false),
+    fLastValue(0),
+    fPreviousValue(0)
+{
+    Set(start);
+}
+
+void ReadoutTuner::Set(uint32_t value)
+{
+    fValue = std::min(std::max<uint32_t>(1, value), fMax);
+}
+
+bool ReadoutTuner::AddTransfer(uint64_t bytes, uint32_t events, double seconds)
+{
+    fEpoch.fBytes += bytes;
+    fEpoch.fEvents += events;
+    fEpoch.fTransfers++;
+    fEpoch.fSeconds += seconds;
+    fEpoch.fMaxSeconds = std::max(fEpoch.fMaxSeconds, seconds);
+    if( fEpoch.fSeconds < kEpochS || fEpoch.fTransfers < kEpochTransfers )
+	return false;
+
+    const Epoch epoch = fEpoch;
+    fEpoch = Epoch();
+    fLast = epoch;
+    fLastValue = fValue;
+
+    // too slow a transfer delays everything else on the readout thread
+    if( epoch.fMaxSeconds > fMaxTransfer && fValue > 1 ) {
+	fPreviousValue = 0;
+	fCeiling = fValue / 2;
+	fSettled = true;
+	Set(fValue / 2);
+	return true;
+    }
+
+    // the last doubling has to pay off
+    if( fPreviousValue ) {
+	const uint32_t before = fPreviousValue;
+	fPreviousValue = 0;
+	if( epoch.Throughput() < fPrevious.Throughput() * kMinGain ) {
+	    fCeiling = before;
+	    fSettled = true;
+	    Set(before);
+	    return true;
+	}
+    }
+
+    if( epoch.Fill(fValue) >= kFullFraction && fValue < fCeiling ) {
+	fPrevious = epoch;
+	fPreviousValue = fValue;
+	fSettled = false;
+	Set(fValue * 2);
+	return true;
+    }
+
+    fSettled = true;
+    return false;
+}
+
+std::string ReadoutTuner::Summary() const
+{
+    std::ostringstream s;
+    s << fValue << " events/BLT";
+    if( fLast.fTransfers == 0 )
+	return s.str();
+    s << std::fixed << std::setprecision(1) << " (measured at " << fLastValue << ": "
+      << fLast.Throughput() / 1e6 << " MB/s, " << std::setprecision(2)
+      << 1e3 * fLast.fSeconds / fLast.fTransfers << " ms per transfer (max "
+      << 1e3 * fLast.fMaxSeconds << "), " << std::setprecision(0)
+      << 100.0 * fLast.Fill(fLastValue) << "% full)";
+    return s.str();
+}
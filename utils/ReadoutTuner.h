@@ -0,0 +1,74 @@
+#ifndef READOUTTUNER_H
+#define READOUTTUNER_H
+
+// Choice of the number of events per block transfer (MaxNumEventsBLT)
+// during the run, from the ReadData calls themselves.
+//
+// Transfers are grouped in epochs (kEpochS of readout and kEpochTransfers
+// transfers). The candidates are the powers of two up to the ceiling:
+//
+//   - blocks come back full (the board had more events waiting) and the
+//     transfers stay under the time budget: try twice as many;
+//   - the larger blocks did not raise the link throughput (bytes per second
+//     spent in ReadData) by kMinGain: go back and settle there;
+//   - a transfer took longer than the budget: halve, and settle there;
+//   - blocks come back partly filled: the trigger rate, not the transfer
+//     size, sets the throughput, keep the value.
+//
+// Once settled the epochs keep being checked: the budget still halves the
+// value and full blocks resume the search below the ceiling found.
+
+#include <cstdint>
+#include <string>
+
+class ReadoutTuner {
+public:
+    static constexpr double kEpochS = 0.2;              ///< readout time per epoch
+    static constexpr uint32_t kEpochTransfers = 20;     ///< and transfers per epoch
+    static constexpr double kFullFraction = 0.9;        ///< events / value for a "full" block
+    static constexpr double kMinGain = 1.05;            ///< throughput gain to keep a larger value
+
+    /// maxevents: ceiling (the readout buffer is sized for it); start: first value tried;
+    /// maxtransfer_s: budget of one ReadData.
+    ReadoutTuner(uint32_t maxevents, uint32_t start, double maxtransfer_s);
+
+    /// One non-empty ReadData: bytes and events read, seconds spent in it.
+    /// Returns true when GetEventsPerTransfer() changed.
+    bool AddTransfer(uint64_t bytes, uint32_t events, double seconds);
+
+    uint32_t GetEventsPerTransfer() const { return fValue; }
+    uint32_t GetMaxEvents() const { return fMax; }
+    bool IsSettled() const { return fSettled; }
+
+    /// Current value and last completed epoch, e.g. "64 events/BLT (measured at 64:
+    /// 73.0 MB/s, 11.40 ms per transfer (max 11.40), 100% full)"
+    std::string Summary() const;
+
+private:
+    struct Epoch {
+	uint64_t fBytes = 0;
+	uint64_t fEvents = 0;
+	uint32_t fTransfers = 0;
+	double fSeconds = 0.0;
+	double fMaxSeconds = 0.0;
+
+	double Throughput() const { return fSeconds > 0 ? fBytes / fSeconds : 0.0; }
+	double Fill(uint32_t value) const { return fTransfers ? double(fEvents) / fTransfers / value : 0.0; }
+    };
+
+    void Set(uint32_t value);
+
+    uint32_t fMax;
+    double fMaxTransfer;
+    uint32_t fValue;
+    uint32_t fCeiling;                       ///< no larger value is tried while settled
+    bool fSettled;
+
+    Epoch fEpoch;                            ///< being filled
+    Epoch fLast;                             ///< last completed, at fLastValue
+    uint32_t fLastValue;
+    Epoch fPrevious;                         ///< epoch before a doubling, at fPreviousValue
+    uint32_t fPreviousValue;
+};
+
+#endif // READOUTTUNER_H
@@ -0,0 +1,178 @@
+#ifndef RUNBINARY_H
+#define RUNBINARY_H
+
+// Flat binary run format (OutputFormat = "BIN"), header-only reader.
+//
+// <run>.bin   FileHeader (kHeaderSize bytes), then one fixed-stride record
+//             per event: RecordHeader + int16 samples[fNChannels][fNSamples],
+//             channels in ChannelList order, absent channels zero-filled;
+//             with fHasRaw the uint16 raw samples follow in the same shape.
+// <run>.idx   IndexHeader, then one IndexEntry per event.
+//
+// Record i starts at kHeaderSize + i * fRecordStride, so the file can be
+// mapped and used in place: no parsing, no per-event lookups.
+//
+//   RunBinary::Reader run("WC_proto_0007_1Gs_20PT.bin");
+//   for( uint64_t i = 0; i < run.GetNEvents(); i++ ) {
+//       const int16_t* wf = run.Samples(i, 0);   // first channel of ChannelList
+//       ...
+//   }
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace RunBinary {
+
+    constexpr char kMagic[8] = { 'D','A','Q','W','C','B','I','N' };
+    constexpr char kIndexMagic[8] = { 'D','A','Q','W','C','I','D','X' };
+    constexpr uint32_t kVersion = 1;
+    constexpr uint32_t kMaxChannels = 32;
+    constexpr size_t kHeaderSize = 4096;        ///< records start page aligned
+    constexpr size_t kRecordAlign = 64;
+
+    struct FileHeader {
+	char fMagic[8];
+	uint32_t fVersion;
+	uint32_t fHeaderSize;
+	uint64_t fRecordStride;                 ///< bytes per event record
+	uint64_t fNEvents;                      ///< set at close; 0 if the run did not close
+	uint32_t fNChannels;
+	uint32_t fNSamples;                     ///< samples per channel (RecordLength)
+	uint32_t fChannelList[kMaxChannels];
+	uint32_t fHasRaw;
+	int32_t fRunNumber;
+	uint32_t fPostTriggerSize;
+	uint32_t fReserved;
+	double fSamplingTime;
+	double fAcquisitionTime;
+	double fTriggerRate_kHz;
+	char fSamplingRate[16];
+	char fTriggerMode[16];
+	char fStopReason[16];
+    };
+
+    struct RecordHeader {
+	uint64_t fEventNumber;
+	uint32_t fTriggerTimeTag;
+	uint32_t fChannelMask;                  ///< channels actually read out
+	uint32_t fNSamples;                     ///< valid samples per channel (<= fNSamples of the file)
+	uint32_t fReserved[3];
+    };
+
+    struct IndexHeader {
+	char fMagic[8];
+	uint32_t fVersion;
+	uint32_t fReserved;
+    };
+
+    struct IndexEntry {
+	uint64_t fEventNumber;
+	uint64_t fOffset;                       ///< byte offset of the record in the .bin file
+	uint32_t fTriggerTimeTag;
+	uint32_t fChannelMask;
+    };
+
+    static_assert(sizeof(FileHeader) <= kHeaderSize, "FileHeader too large");
+    static_assert(sizeof(RecordHeader) == 32, "RecordHeader layout");
+
+    inline uint64_t RecordStride(uint32_t nchannels, uint32_t nsamples, bool hasraw)
+    {
+	const uint64_t bytes = sizeof(RecordHeader) + uint64_t(nchannels) * nsamples * sizeof(int16_t) * (hasraw ? 2 : 1);
+	return (bytes + kRecordAlign - 1) & ~uint64_t(kRecordAlign - 1);
+    }
+
+    inline std::string IndexPath(const std::string& binpath)
+    {
+	const std::string ext = ".bin";
+	if( binpath.size() > ext.size() && binpath.compare(binpath.size() - ext.size(), ext.size(), ext) == 0 )
+	    return binpath.substr(0, binpath.size() - ext.size()) + ".idx";
+	return binpath + ".idx";
+    }
+
+    /// Read-only memory map of a .bin file.
+    class Reader {
+    public:
+	explicit Reader(const std::string& path) :
+	    fMap(nullptr), fSize(0), fHeader(nullptr), fNEvents(0)
+	{
+	    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	    if( fd < 0 )
+		throw std::runtime_error("cannot open " + path);
+	    struct stat st;
+	    if( fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < kHeaderSize ) {
+		close(fd);
+		throw std::runtime_error(path + " is too short for a BIN run file");
+	    }
+	    fSize = static_cast<size_t>(st.st_size);
+	    fMap = mmap(nullptr, fSize, PROT_READ, MAP_SHARED, fd, 0);
+	    close(fd);
+	    if( fMap == MAP_FAILED ) {
+		fMap = nullptr;
+		throw std::runtime_error("cannot map " + path);
+	    }
+	    fHeader = static_cast<const FileHeader*>(fMap);
+	    if( std::memcmp(fHeader->fMagic, kMagic, sizeof(kMagic)) != 0 || fHeader->fVersion != kVersion ||
+		fHeader->fRecordStride == 0 || fHeader->fNChannels > kMaxChannels ) {
+		munmap(fMap, fSize);
+		throw std::runtime_error(path + " is not a BIN run file");
+	    }
+	    // a run that did not close has fNEvents = 0: count the complete records
+	    const uint64_t complete = (fSize - fHeader->fHeaderSize) / fHeader->fRecordStride;
+	    fNEvents = fHeader->fNEvents ? std::min<uint64_t>(fHeader->fNEvents, complete) : complete;
+	    madvise(fMap, fSize, MADV_SEQUENTIAL);
+	}
+
+	~Reader()
+	{
+	    if( fMap != nullptr )
+		munmap(fMap, fSize);
+	}
+
+	Reader(const Reader&) = delete;
+	Reader& operator=(const Reader&) = delete;
+
+	const FileHeader& GetHeader() const { return *fHeader; }
+	uint64_t GetNEvents() const { return fNEvents; }
+	bool IsComplete() const { return fHeader->fNEvents != 0; }
+
+	const RecordHeader& Record(uint64_t i) const
+	{
+	    return *reinterpret_cast<const RecordHeader*>(Base(i));
+	}
+
+	/// Samples of the channel at position slot of the ChannelList.
+	const int16_t* Samples(uint64_t i, uint32_t slot) const
+	{
+	    return reinterpret_cast<const int16_t*>(Base(i) + sizeof(RecordHeader)) + size_t(slot) * fHeader->fNSamples;
+	}
+
+	const uint16_t* RawSamples(uint64_t i, uint32_t slot) const
+	{
+	    if( !fHeader->fHasRaw )
+		return nullptr;
+	    return reinterpret_cast<const uint16_t*>(Base(i) + sizeof(RecordHeader)) +
+		size_t(fHeader->fNChannels + slot) * fHeader->fNSamples;
+	}
+
+    private:
+	const char* Base(uint64_t i) const
+	{
+	    return static_cast<const char*>(fMap) + fHeader->fHeaderSize + i * fHeader->fRecordStride;
+	}
+
+	void* fMap;
+	size_t fSize;
+	const FileHeader* fHeader;
+	uint64_t fNEvents;
+    };
+
+}
+
+#endif // RUNBINARY_H
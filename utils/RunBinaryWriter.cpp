@@ -0,0 +1,170 @@
+#include "RunBinaryWriter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace RunBinary;
+
+RunBinaryWriter::RunBinaryWriter(const std::string& path, const FileHeader& header,
+				 const std::string& writemode, const std::string& engine,
+				 size_t blocksize, unsigned nblocks) :
+    fPath(path),
+    fSink(nullptr),
+    fIndexFd(-1),
+    fHeader(header),
+    fBuffer(nullptr),
+    fBufferUsed(0),
+    fFileOffset(kHeaderSize),
+    fNEvents(0),
+    fError(false)
+{
+    std::memcpy(fHeader.fMagic, kMagic, sizeof(kMagic));
+    fHeader.fVersion = kVersion;
+    fHeader.fHeaderSize = kHeaderSize;
+    fHeader.fRecordStride = RecordStride(fHeader.fNChannels, fHeader.fNSamples, fHeader.fHasRaw);
+    fHeader.fNEvents = 0;
+
+    // room for at least a few records per block
+    blocksize = std::max(blocksize, size_t(4 * fHeader.fRecordStride));
+    fSink = FileSink::Create(writemode, engine, fPath, blocksize, nblocks);
+
+    const std::string indexpath = IndexPath(fPath);
+    fIndexFd = open(indexpath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if( fIndexFd < 0 ) {
+	delete fSink;
+	throw std::runtime_error("RunBinary: cannot create " + indexpath + ": " + std::strerror(errno));
+    }
+
+    // header page, rewritten at Close() with the event count
+    std::vector<char> page(kHeaderSize, 0);
+    std::memcpy(page.data(), &fHeader, sizeof(fHeader));
+    IndexHeader index;
+    std::memset(&index, 0, sizeof(index));
+    std::memcpy(index.fMagic, kIndexMagic, sizeof(kIndexMagic));
+    index.fVersion = kVersion;
+    if( !fSink->WriteTail(page.data(), page.size(), 0) || write(fIndexFd, &index, sizeof(index)) != sizeof(index) ) {
+	close(fIndexFd);
+	delete fSink;
+	throw std::runtime_error("RunBinary: cannot write " + fPath + ": " + std::strerror(errno));
+    }
+
+    fBuffer = fSink->Acquire();
+}
+
+RunBinaryWriter::~RunBinaryWriter()
+{
+    Close();
+    delete fSink;
+}
+
+void RunBinaryWriter::WriteEvent(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+				 uint32_t nsamples, const int16_t* corr, const uint16_t* raw)
+{
+    WriteRecord(eventnumber, triggertimetag, channelmask, nsamples, corr, raw, nsamples);
+}
+
+void RunBinaryWriter::WriteBatch(const EventBatch& batch)
+{
+    for( uint32_t e = 0; e < batch.GetSize(); e++ )
+	WriteRecord(batch.GetEventNumber(e), batch.GetTriggerTimeTag(e), batch.GetChannelMask(e),
+		    batch.GetNSamples(e), batch.Corr(e, 0), batch.Raw(e, 0), batch.GetChannelStride());
+}
+
+void RunBinaryWriter::WriteRecord(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+				  uint32_t nsamples, const int16_t* corr, const uint16_t* raw, size_t stride)
+{
+    if( fIndexFd < 0 )
+	return;
+    if( fBufferUsed + fHeader.fRecordStride > fSink->GetBlockSize() )
+	SubmitBlock();
+
+    char* record = fBuffer + fBufferUsed;
+    std::memset(record, 0, fHeader.fRecordStride);
+
+    RecordHeader* rh = reinterpret_cast<RecordHeader*>(record);
+    rh->fEventNumber = eventnumber;
+    rh->fTriggerTimeTag = triggertimetag;
+    rh->fChannelMask = channelmask;
+    rh->fNSamples = std::min(nsamples, fHeader.fNSamples);
+
+    int16_t* samples = reinterpret_cast<int16_t*>(record + sizeof(RecordHeader));
+    uint16_t* rawsamples = reinterpret_cast<uint16_t*>(samples + size_t(fHeader.fNChannels) * fHeader.fNSamples);
+    size_t present = 0;
+    for( uint32_t slot = 0; slot < fHeader.fNChannels; slot++ ) {
+	if( !(channelmask & (1u << fHeader.fChannelList[slot])) )
+	    continue;
+	std::memcpy(samples + size_t(slot) * fHeader.fNSamples, corr + present * stride,
+		    rh->fNSamples * sizeof(int16_t));
+	if( fHeader.fHasRaw && raw != nullptr )
+	    std::memcpy(rawsamples + size_t(slot) * fHeader.fNSamples, raw + present * stride,
+			rh->fNSamples * sizeof(uint16_t));
+	present++;
+    }
+
+    fIndex.push_back({ eventnumber, fFileOffset + fBufferUsed, triggertimetag, channelmask });
+    fBufferUsed += fHeader.fRecordStride;
+    fNEvents++;
+}
+
+// Hand the complete pages of the current block to the sink and carry the
+// partial last page over into a fresh block.
+void RunBinaryWriter::SubmitBlock()
+{
+    const size_t full = fBufferUsed & ~(FileSink::kAlign - 1);
+    if( full == 0 )
+	return;
+    char* next = fSink->Acquire();
+    std::memcpy(next, fBuffer + full, fBufferUsed - full);
+    fSink->Submit(fBuffer, full, fFileOffset);
+    fFileOffset += full;
+    fBufferUsed -= full;
+    fBuffer = next;
+}
+
+// The partial page stays in the block: the next full write covers it again.
+bool RunBinaryWriter::Flush()
+{
+    if( fIndexFd < 0 )
+	return false;
+    SubmitBlock();
+    if( !fSink->Drain() )
+	fError = true;
+    if( fBufferUsed > 0 && !fSink->WriteTail(fBuffer, fBufferUsed, fFileOffset) )
+	fError = true;
+    if( !fIndex.empty() ) {
+	const size_t bytes = fIndex.size() * sizeof(IndexEntry);
+	if( write(fIndexFd, fIndex.data(), bytes) != static_cast<ssize_t>(bytes) )
+	    fError = true;
+	fIndex.clear();
+    }
+    return !fError;
+}
+
+void RunBinaryWriter::SetRunStatistics(double acquisitiontime, double rate_kHz, const std::string& stopreason)
+{
+    fHeader.fAcquisitionTime = acquisitiontime;
+    fHeader.fTriggerRate_kHz = rate_kHz;
+    std::memset(fHeader.fStopReason, 0, sizeof(fHeader.fStopReason));
+    std::memcpy(fHeader.fStopReason, stopreason.c_str(), std::min(stopreason.size(), sizeof(fHeader.fStopReason) - 1));
+}
+
+bool RunBinaryWriter::Close()
+{
+    if( fIndexFd < 0 )
+	return !fError;
+    Flush();
+    fHeader.fNEvents = fNEvents;
+    std::vector<char> page(kHeaderSize, 0);
+    std::memcpy(page.data(), &fHeader, sizeof(fHeader));
+    if( !fSink->WriteTail(page.data(), page.size(), 0) )
+	fError = true;
+    if( !fSink->Close(fFileOffset + fBufferUsed) )
+	fError = true;
+    close(fIndexFd);
+    fIndexFd = -1;
+    return !fError;
+}
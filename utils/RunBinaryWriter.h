@@ -0,0 +1,63 @@
+#ifndef RUNBINARYWRITER_H
+#define RUNBINARYWRITER_H
+
+// Writer of the flat binary run format, see RunBinary.h. Records are
+// assembled in large page-aligned blocks handed to a FileSink, which keeps
+// them in flight while the next one is filled; the header is rewritten at Close().
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "EventBatch.h"
+#include "FileSink.h"
+#include "RunBinary.h"
+
+class RunBinaryWriter {
+public:
+    /// Throws std::runtime_error if the files cannot be created. writemode,
+    /// engine and the block settings are passed to FileSink::Create().
+    RunBinaryWriter(const std::string& path, const RunBinary::FileHeader& header,
+		    const std::string& writemode = "buffered", const std::string& engine = "auto",
+		    size_t blocksize = 8 << 20, unsigned nblocks = 2);
+    ~RunBinaryWriter();
+
+    /// corr/raw hold the channels of channelmask only, in ChannelList order,
+    /// nsamples each (as produced by the decoder).
+    void WriteEvent(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+		    uint32_t nsamples, const int16_t* corr, const uint16_t* raw);
+    /// Every event of batch (raw samples if both have them).
+    void WriteBatch(const EventBatch& batch);
+
+    /// Write out the buffered records and index entries. Returns false on I/O errors.
+    bool Flush();
+
+    void SetRunStatistics(double acquisitiontime, double rate_kHz, const std::string& stopreason);
+
+    /// Flush, store the event count and statistics in the header, close the files.
+    bool Close();
+
+    uint64_t GetNEvents() const { return fNEvents; }
+    const std::string& GetWriteMode() const { return fSink->GetMode(); }
+    const std::string& GetWriteEngine() const { return fSink->GetEngine(); }
+    SinkStatistics GetStatistics() const { return fSink->GetStatistics(); }
+
+private:
+    /// channel i of the event at corr + i * stride (raw alike)
+    void WriteRecord(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+		     uint32_t nsamples, const int16_t* corr, const uint16_t* raw, size_t stride);
+    void SubmitBlock();
+
+    std::string fPath;
+    FileSink* fSink;
+    int fIndexFd;
+    RunBinary::FileHeader fHeader;
+    char* fBuffer;
+    size_t fBufferUsed;
+    uint64_t fFileOffset;
+    uint64_t fNEvents;
+    std::vector<RunBinary::IndexEntry> fIndex;
+    bool fError;
+};
+
+#endif // RUNBINARYWRITER_H
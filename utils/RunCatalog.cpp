@@ -0,0 +1,253 @@
+#include "RunCatalog.h"
+
+#include <stdexcept>
+#include <sqlite3.h>
+
+#include "Log.h"
+#include "ThreadPlacement.h"
+
+namespace {
+
+    const char* kSchema =
+	"CREATE TABLE IF NOT EXISTS runs ("
+	"  base TEXT NOT NULL,"
+	"  run INTEGER NOT NULL,"
+	"  path TEXT,"
+	"  format TEXT,"
+	"  status TEXT,"
+	"  start_time INTEGER,"
+	"  stop_time INTEGER,"
+	"  nevents INTEGER,"
+	"  acquisition_time REAL,"
+	"  trigger_rate_khz REAL,"
+	"  stop_reason TEXT,"
+	"  sampling_rate TEXT,"
+	"  sampling_time REAL,"
+	"  record_length INTEGER,"
+	"  post_trigger INTEGER,"
+	"  trigger_mode TEXT,"
+	"  channel_list TEXT,"
+	"  save_raw INTEGER,"
+	"  config_hash TEXT,"
+	"  config_file TEXT,"
+	"  file_size INTEGER,"
+	"  PRIMARY KEY (base, run));"
+	"CREATE INDEX IF NOT EXISTS runs_start ON runs(start_time);"
+	"CREATE INDEX IF NOT EXISTS runs_rate_pt ON runs(sampling_rate, post_trigger, start_time);"
+	"CREATE INDEX IF NOT EXISTS runs_config ON runs(config_hash);";
+
+    const char* kColumns =
+	"base, run, path, format, status, start_time, stop_time, nevents, acquisition_time,"
+	" trigger_rate_khz, stop_reason, sampling_rate, sampling_time, record_length, post_trigger,"
+	" trigger_mode, channel_list, save_raw, config_hash, config_file, file_size";
+
+    std::string Text(sqlite3_stmt* stmt, int col)
+    {
+	const unsigned char* s = sqlite3_column_text(stmt, col);
+	return s ? reinterpret_cast<const char*>(s) : "";
+    }
+
+    /// Prepared statement, finalized on scope exit.
+    class Statement {
+    public:
+	Statement(sqlite3* db, const std::string& sql) : fStmt(nullptr)
+	{
+	    if( sqlite3_prepare_v2(db, sql.c_str(), -1, &fStmt, nullptr) != SQLITE_OK )
+		throw std::runtime_error(std::string("RunCatalog: ") + sqlite3_errmsg(db));
+	}
+	~Statement() { sqlite3_finalize(fStmt); }
+
+	void Bind(int i, const std::string& v) { sqlite3_bind_text(fStmt, i, v.c_str(), -1, SQLITE_TRANSIENT); }
+	void Bind(int i, int64_t v) { sqlite3_bind_int64(fStmt, i, v); }
+	void Bind(int i, double v) { sqlite3_bind_double(fStmt, i, v); }
+
+	sqlite3_stmt* Get() { return fStmt; }
+
+    private:
+	sqlite3_stmt* fStmt;
+    };
+
+}
+
+RunCatalog::RunCatalog(const std::string& path, bool readonly) :
+    fPath(path),
+    fDb(nullptr),
+    fStop(false)
+{
+    const int flags = (readonly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) |
+		      SQLITE_OPEN_FULLMUTEX;
+    if( sqlite3_open_v2(fPath.c_str(), &fDb, flags, nullptr) != SQLITE_OK ) {
+	const std::string msg = "RunCatalog: cannot open " + fPath + ": " + sqlite3_errmsg(fDb);
+	sqlite3_close(fDb);
+	throw std::runtime_error(msg);
+    }
+    // a writer of another DAQ process holds the lock for milliseconds
+    sqlite3_busy_timeout(fDb, 5000);
+    if( readonly )
+	return;
+
+    try {
+	Exec("PRAGMA journal_mode=WAL;");
+	Exec("PRAGMA synchronous=NORMAL;");
+	Exec(kSchema);
+    } catch( ... ) {
+	sqlite3_close(fDb);
+	throw;
+    }
+    fThread = std::thread(&RunCatalog::Run, this);
+}
+
+RunCatalog::~RunCatalog()
+{
+    {
+	std::lock_guard<std::mutex> lock(fMutex);
+	fStop = true;
+    }
+    fCond.notify_all();
+    if( fThread.joinable() )
+	fThread.join();
+    sqlite3_close(fDb);
+}
+
+void RunCatalog::Exec(const std::string& sql)
+{
+    char* err = nullptr;
+    if( sqlite3_exec(fDb, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK ) {
+	const std::string msg = "RunCatalog: " + std::string(err ? err : "error") + " in " + fPath;
+	sqlite3_free(err);
+	throw std::runtime_error(msg);
+    }
+}
+
+void RunCatalog::Submit(const RunRecord& record)
+{
+    {
+	std::lock_guard<std::mutex> lock(fMutex);
+	fQueue.push_back(record);
+    }
+    fCond.notify_all();
+}
+
+void RunCatalog::Run()
+{
+    ThreadPlacement::Apply(ThreadPlacement::kWrite);
+    std::unique_lock<std::mutex> lock(fMutex);
+    while( true ) {
+	fCond.wait(lock, [this] { return fStop || !fQueue.empty(); });
+	if( fQueue.empty() )
+	    return;
+	RunRecord record = fQueue.front();
+	fQueue.pop_front();
+	lock.unlock();
+	try {
+	    Store(record);
+	} catch( const std::exception& e ) {
+	    Log::OutWarning(e.what());
+	}
+	lock.lock();
+    }
+}
+
+void RunCatalog::Store(const RunRecord& r)
+{
+    Statement st(fDb, std::string("INSERT OR REPLACE INTO runs (") + kColumns + ") VALUES "
+		 "(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21)");
+    st.Bind(1, r.Base);
+    st.Bind(2, int64_t(r.Run));
+    st.Bind(3, r.Path);
+    st.Bind(4, r.Format);
+    st.Bind(5, r.Status);
+    st.Bind(6, r.StartTime);
+    st.Bind(7, r.StopTime);
+    st.Bind(8, int64_t(r.NEvents));
+    st.Bind(9, r.AcquisitionTime);
+    st.Bind(10, r.TriggerRate_kHz);
+    st.Bind(11, r.StopReason);
+    st.Bind(12, r.SamplingRate);
+    st.Bind(13, r.SamplingTime);
+    st.Bind(14, int64_t(r.RecordLength));
+    st.Bind(15, int64_t(r.PostTriggerSize));
+    st.Bind(16, r.TriggerMode);
+    st.Bind(17, r.ChannelList);
+    st.Bind(18, int64_t(r.SaveRaw));
+    st.Bind(19, r.ConfigHash);
+    st.Bind(20, r.ConfigFile);
+    st.Bind(21, int64_t(r.FileSize));
+    if( sqlite3_step(st.Get()) != SQLITE_DONE )
+	throw std::runtime_error("RunCatalog: cannot store run " + std::to_string(r.Run) + ": " + sqlite3_errmsg(fDb));
+}
+
+std::vector<RunRecord> RunCatalog::Query(const RunQuery& q)
+{
+    std::string sql = std::string("SELECT ") + kColumns + " FROM runs WHERE 1";
+    std::vector<std::string> texts;
+    std::vector<int64_t> ints;
+    // parameters are numbered in the order the conditions are added
+    std::vector<std::pair<bool, size_t>> params;
+    auto text = [&](const std::string& cond, const std::string& v) {
+	sql += " AND " + cond + " ?" + std::to_string(params.size() + 1);
+	texts.push_back(v);
+	params.push_back({ true, texts.size() - 1 });
+    };
+    auto integer = [&](const std::string& cond, int64_t v) {
+	sql += " AND " + cond + " ?" + std::to_string(params.size() + 1);
+	ints.push_back(v);
+	params.push_back({ false, ints.size() - 1 });
+    };
+
+    if( !q.Base.empty() )         text("base =", q.Base);
+    if( !q.SamplingRate.empty() ) text("sampling_rate =", q.SamplingRate);
+    if( q.PostTriggerSize >= 0 )  integer("post_trigger =", q.PostTriggerSize);
+    if( q.RunMin >= 0 )           integer("run >=", q.RunMin);
+    if( q.RunMax >= 0 )           integer("run <=", q.RunMax);
+    if( q.Since > 0 )             integer("start_time >=", q.Since);
+    if( q.Until > 0 )             integer("start_time <", q.Until);
+    if( !q.StopReason.empty() )   text("stop_reason =", q.StopReason);
+    if( !q.TriggerMode.empty() )  text("trigger_mode =", q.TriggerMode);
+    if( !q.ConfigHash.empty() )   text("config_hash =", q.ConfigHash);
+    if( q.MinEvents >= 0 )        integer("nevents >=", q.MinEvents);
+    if( !q.Status.empty() )       text("status =", q.Status);
+    sql += " ORDER BY start_time, base, run";
+    if( q.Limit > 0 )
+	sql += " LIMIT " + std::to_string(q.Limit);
+
+    Statement st(fDb, sql);
+    for( size_t i = 0; i < params.size(); i++ ) {
+	if( params[i].first )
+	    st.Bind(i + 1, texts[params[i].second]);
+	else
+	    st.Bind(i + 1, ints[params[i].second]);
+    }
+
+    std::vector<RunRecord> runs;
+    int rc;
+    while( (rc = sqlite3_step(st.Get())) == SQLITE_ROW ) {
+	sqlite3_stmt* s = st.Get();
+	RunRecord r;
+	r.Base = Text(s, 0);
+	r.Run = sqlite3_column_int(s, 1);
+	r.Path = Text(s, 2);
+	r.Format = Text(s, 3);
+	r.Status = Text(s, 4);
+	r.StartTime = sqlite3_column_int64(s, 5);
+	r.StopTime = sqlite3_column_int64(s, 6);
+	r.NEvents = sqlite3_column_int64(s, 7);
+	r.AcquisitionTime = sqlite3_column_double(s, 8);
+	r.TriggerRate_kHz = sqlite3_column_double(s, 9);
+	r.StopReason = Text(s, 10);
+	r.SamplingRate = Text(s, 11);
+	r.SamplingTime = sqlite3_column_double(s, 12);
+	r.RecordLength = sqlite3_column_int(s, 13);
+	r.PostTriggerSize = sqlite3_column_int(s, 14);
+	r.TriggerMode = Text(s, 15);
+	r.ChannelList = Text(s, 16);
+	r.SaveRaw = sqlite3_column_int(s, 17) != 0;
+	r.ConfigHash = Text(s, 18);
+	r.ConfigFile = Text(s, 19);
+	r.FileSize = sqlite3_column_int64(s, 20);
+	runs.push_back(r);
+    }
+    if( rc != SQLITE_DONE )
+	throw std::runtime_error(std::string("RunCatalog: query failed: ") + sqlite3_errmsg(fDb));
+    return runs;
+}
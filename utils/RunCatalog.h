@@ -0,0 +1,99 @@
+#ifndef RUNCATALOG_H
+#define RUNCATALOG_H
+
+// Indexed catalog of the runs of an output directory, in an SQLite file
+// ([output] RunCatalog, default <OutputDir>/runcatalog.sqlite). One row per
+// run with the /config attributes and the run statistics, indexed on the
+// usual search keys, so queries do not have to open the data files:
+//
+//   daq-runs --dir data --rate 5GHz --pts 90 --since 7d
+//
+// DAQ-WC hands the rows to Submit(), which returns at once: a background
+// thread writes them (WAL journal, so daq-runs can read at the same time).
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct sqlite3;
+
+struct RunRecord {
+    std::string Base;                    ///< OutputFile, with _bN for the boards after the first
+    int Run = -1;
+    std::string Path;
+    std::string Format;                  ///< HDF5, BIN
+    std::string Status;                  ///< running, done
+    int64_t StartTime = 0;               ///< unix time
+    int64_t StopTime = 0;
+    uint64_t NEvents = 0;
+    double AcquisitionTime = 0.0;
+    double TriggerRate_kHz = 0.0;
+    std::string StopReason;
+    std::string SamplingRate;
+    double SamplingTime = 0.0;
+    uint32_t RecordLength = 0;
+    uint32_t PostTriggerSize = 0;
+    std::string TriggerMode;
+    std::string ChannelList;             ///< "0,1,2,3"
+    bool SaveRaw = false;
+    std::string ConfigHash;
+    std::string ConfigFile;
+    uint64_t FileSize = 0;
+};
+
+/// Filters of RunCatalog::Query(); empty / negative values do not filter.
+struct RunQuery {
+    std::string Base;
+    std::string SamplingRate;
+    int PostTriggerSize = -1;
+    int RunMin = -1;
+    int RunMax = -1;
+    int64_t Since = 0;                   ///< start time >= Since
+    int64_t Until = 0;                   ///< start time < Until
+    std::string StopReason;
+    std::string TriggerMode;
+    std::string ConfigHash;
+    int64_t MinEvents = -1;
+    std::string Status;
+    int Limit = 0;
+};
+
+class RunCatalog {
+public:
+    /// Open or create the catalog. Throws std::runtime_error.
+    explicit RunCatalog(const std::string& path, bool readonly = false);
+    ~RunCatalog();
+
+    RunCatalog(const RunCatalog&) = delete;
+    RunCatalog& operator=(const RunCatalog&) = delete;
+
+    /// Queue an insert-or-replace of the row (Base, Run); never blocks on the database.
+    void Submit(const RunRecord& record);
+
+    /// Synchronous insert-or-replace. Throws std::runtime_error.
+    void Store(const RunRecord& record);
+
+    /// Runs matching the query, ordered by start time.
+    std::vector<RunRecord> Query(const RunQuery& query);
+
+    const std::string& GetPath() const { return fPath; }
+
+private:
+    void Run();
+    void Exec(const std::string& sql);
+
+    std::string fPath;
+    sqlite3* fDb;
+
+    std::thread fThread;
+    std::mutex fMutex;
+    std::condition_variable fCond;
+    std::deque<RunRecord> fQueue;
+    bool fStop;
+};
+
+#endif // RUNCATALOG_H
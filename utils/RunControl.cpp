@@ -0,0 +1,310 @@
+#include "RunControl.h"
+#include "Histograms.h"
+#include "Log.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+std::atomic<bool> RunControl::fStop(false);
+std::atomic<bool> RunControl::fPause(false);
+std::atomic<bool> RunControl::fQuit(false);
+std::atomic<uint32_t> RunControl::fDump(0);
+std::atomic<RunControl::State> RunControl::fState(RunControl::kIdle);
+std::atomic<int> RunControl::fRunNumber(-1);
+std::atomic<uint64_t> RunControl::fEvents(0);
+std::atomic<uint32_t> RunControl::fMaxEvents(0);
+
+std::string RunControl::fSocketPath;
+int RunControl::fListenFd = -1;
+int RunControl::fWakePipe[2] = { -1, -1 };
+std::thread RunControl::fServer;
+bool RunControl::fCommands = false;
+
+std::mutex RunControl::fQueueMutex;
+std::condition_variable RunControl::fQueueCond;
+std::deque<RunControl::Command> RunControl::fQueue;
+
+namespace {
+
+    // only async-signal-safe work in here: the acquisition loop notices the
+    // flags, a second signal falls back to the default action
+    void HandleSignal(int sig)
+    {
+	RunControl::RequestStop();
+	std::signal(sig, SIG_DFL);
+    }
+
+}
+
+void RunControl::InstallSignalHandlers()
+{
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = HandleSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+void RunControl::RequestStop()
+{
+    fStop.store(true, std::memory_order_relaxed);
+    fQuit.store(true, std::memory_order_relaxed);
+    fPause.store(false, std::memory_order_relaxed);
+    // a server waiting for commands must wake up as well; write() is
+    // async-signal-safe
+    if( fWakePipe[1] >= 0 ) {
+	const char c = 'q';
+	ssize_t n = write(fWakePipe[1], &c, 1);
+	(void)n;
+    }
+}
+
+void RunControl::ClearStop()
+{
+    // a signal is not undone by the next start: the process is exiting
+    if( !QuitRequested() )
+	fStop.store(false, std::memory_order_relaxed);
+    fPause.store(false, std::memory_order_relaxed);
+    fDump.store(0, std::memory_order_relaxed);
+}
+
+bool RunControl::ConsumeDump()
+{
+    uint32_t n = fDump.load(std::memory_order_relaxed);
+    while( n != 0 ) {
+	if( fDump.compare_exchange_weak(n, n - 1, std::memory_order_relaxed) )
+	    return true;
+    }
+    return false;
+}
+
+void RunControl::SetRun(int runnumber, uint32_t maxevents)
+{
+    fRunNumber.store(runnumber, std::memory_order_relaxed);
+    fMaxEvents.store(maxevents, std::memory_order_relaxed);
+    fEvents.store(0, std::memory_order_relaxed);
+}
+
+std::string RunControl::ToString(const State& state)
+{
+    switch( state ) {
+    case kIdle:        return "idle";
+    case kConfiguring: return "configuring";
+    case kRunning:     return "running";
+    case kPaused:      return "paused";
+    case kStopping:    return "stopping";
+    }
+    return "unknown";
+}
+
+// ---------------------------------------------------------------
+// Server
+// ---------------------------------------------------------------
+bool RunControl::StartServer(const std::string& socketpath, bool commands)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if( socketpath.size() >= sizeof(addr.sun_path) ) {
+	Log::OutError("RunControl: socket path too long: " + socketpath);
+	return false;
+    }
+    std::strncpy(addr.sun_path, socketpath.c_str(), sizeof(addr.sun_path) - 1);
+
+    if( pipe(fWakePipe) != 0 ) {
+	Log::OutError("RunControl: pipe() failed: " + std::string(std::strerror(errno)));
+	return false;
+    }
+    fcntl(fWakePipe[1], F_SETFL, O_NONBLOCK);
+
+    fListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if( fListenFd < 0 ) {
+	Log::OutError("RunControl: socket() failed: " + std::string(std::strerror(errno)));
+	return false;
+    }
+    unlink(socketpath.c_str());
+    if( bind(fListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+	listen(fListenFd, 4) != 0 ) {
+	Log::OutError("RunControl: cannot listen on " + socketpath + ": " + std::strerror(errno));
+	close(fListenFd);
+	fListenFd = -1;
+	return false;
+    }
+    fSocketPath = socketpath;
+    fCommands = commands;
+    fServer = std::thread(&RunControl::Serve);
+    Log::OutSummary("RunControl: listening on " + socketpath);
+    return true;
+}
+
+void RunControl::StopServer()
+{
+    if( fServer.joinable() ) {
+	fQuit.store(true, std::memory_order_relaxed);
+	const char c = 'q';
+	ssize_t n = write(fWakePipe[1], &c, 1);
+	(void)n;
+	fServer.join();
+    }
+    if( fListenFd >= 0 ) {
+	close(fListenFd);
+	fListenFd = -1;
+	unlink(fSocketPath.c_str());
+    }
+}
+
+void RunControl::Serve()
+{
+    while( !QuitRequested() ) {
+	pollfd fds[2] = { { fListenFd, POLLIN, 0 }, { fWakePipe[0], POLLIN, 0 } };
+	if( poll(fds, 2, -1) < 0 ) {
+	    if( errno == EINTR )
+		continue;
+	    Log::OutError("RunControl: poll() failed: " + std::string(std::strerror(errno)));
+	    break;
+	}
+	if( fds[1].revents )
+	    break;
+	if( !(fds[0].revents & POLLIN) )
+	    continue;
+
+	int client = accept4(fListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+	if( client < 0 )
+	    continue;
+
+	// one command per connection, terminated by newline or EOF
+	timeval tv = { 2, 0 };
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	std::string line;
+	char buf[256];
+	ssize_t n;
+	while( line.find('\n') == std::string::npos && line.size() < 4096 &&
+	       (n = read(client, buf, sizeof(buf))) > 0 )
+	    line.append(buf, n);
+	line = line.substr(0, line.find('\n'));
+	if( !line.empty() && line.back() == '\r' )
+	    line.pop_back();
+
+	// the replies of "histograms" can be larger than one write
+	const std::string reply = Execute(line) + "\n";
+	size_t sent = 0;
+	ssize_t w;
+	while( sent < reply.size() && (w = write(client, reply.data() + sent, reply.size() - sent)) > 0 )
+	    sent += w;
+	close(client);
+    }
+    // wake up anybody waiting for a command
+    fQueueCond.notify_all();
+}
+
+std::string RunControl::Execute(const std::string& line)
+{
+    std::istringstream in(line);
+    std::string cmd, arg;
+    in >> cmd;
+    std::getline(in >> std::ws, arg);
+    Log::OutSummary("RunControl: received \"" + line + "\"");
+
+    const State state = GetState();
+    const bool active = state == kRunning || state == kPaused;
+
+    if( cmd == "status" ) {
+	std::ostringstream out;
+	out << "state=" << ToString(state) << " run=" << fRunNumber.load(std::memory_order_relaxed)
+	    << " events=" << fEvents.load(std::memory_order_relaxed)
+	    << " max=" << fMaxEvents.load(std::memory_order_relaxed);
+	return out.str();
+    }
+    if( cmd == "start" ) {
+	if( !fCommands )
+	    return "ERROR start needs the DAQ in --server mode";
+	if( state != kIdle )
+	    return "ERROR run already " + ToString(state);
+	SetState(kConfiguring);
+	Push({ kStart, "" });
+	return "OK";
+    }
+    if( cmd == "stop" ) {
+	if( !active )
+	    return "ERROR no run in progress";
+	fPause.store(false, std::memory_order_relaxed);
+	fStop.store(true, std::memory_order_relaxed);
+	return "OK";
+    }
+    if( cmd == "pause" ) {
+	if( state != kRunning )
+	    return "ERROR run is " + ToString(state);
+	fPause.store(true, std::memory_order_relaxed);
+	return "OK";
+    }
+    if( cmd == "resume" ) {
+	if( state != kPaused && !PauseRequested() )
+	    return "ERROR run is not paused";
+	fPause.store(false, std::memory_order_relaxed);
+	return "OK";
+    }
+    if( cmd == "dump" ) {
+	if( !active )
+	    return "ERROR no run in progress";
+	const long n = arg.empty() ? 1 : std::strtol(arg.c_str(), nullptr, 10);
+	if( n <= 0 || n > 1000 )
+	    return "ERROR dump takes a number of events between 1 and 1000";
+	fDump.fetch_add(static_cast<uint32_t>(n), std::memory_order_relaxed);
+	return "OK";
+    }
+    if( cmd == "histograms" )
+	return HistogramService::Describe(arg);
+    if( cmd == "reconfigure" ) {
+	if( !fCommands )
+	    return "ERROR reconfigure needs the DAQ in --server mode";
+	if( state != kIdle )
+	    return "ERROR stop the run before reconfiguring";
+	if( arg.empty() )
+	    return "ERROR reconfigure needs a config file";
+	Push({ kReconfigure, arg });
+	return "OK";
+    }
+    if( cmd == "quit" ) {
+	// single run: stopping it ends the process
+	if( !fCommands && !active )
+	    return "ERROR no run in progress";
+	if( active )
+	    fStop.store(true, std::memory_order_relaxed);
+	if( fCommands )
+	    Push({ kQuit, "" });
+	return "OK";
+    }
+    return "ERROR unknown command \"" + cmd + "\" (start, stop, pause, resume, status, reconfigure <file>, dump <N>, histograms, quit)";
+}
+
+void RunControl::Push(const Command& command)
+{
+    {
+	std::lock_guard<std::mutex> lock(fQueueMutex);
+	fQueue.push_back(command);
+    }
+    fQueueCond.notify_all();
+}
+
+bool RunControl::WaitCommand(Command& command)
+{
+    std::unique_lock<std::mutex> lock(fQueueMutex);
+    // the signal handler cannot notify the condition variable: poll the quit flag
+    while( fQueue.empty() && !QuitRequested() )
+	fQueueCond.wait_for(lock, std::chrono::milliseconds(200));
+    // after a signal, commands still queued are dropped
+    if( QuitRequested() || fQueue.empty() )
+	return false;
+    command = fQueue.front();
+    fQueue.pop_front();
+    return command.fType != kQuit;
+}
@@ -0,0 +1,93 @@
+#ifndef RUNCONTROL_H
+#define RUNCONTROL_H
+
+// Run control: stop/pause flags shared between the acquisition loop, the
+// signal handlers (SIGINT/SIGTERM) and a control server listening on a Unix
+// domain socket. The acquisition loop only reads atomics, the socket is
+// served by its own thread.
+//
+// Protocol: one text command per connection, one reply line ("histograms"
+// without argument: one line per channel).
+//   start | stop | pause | resume | status | reconfigure <file> | dump <N> |
+//   histograms [<board> <channel> amplitude|integral|time] | quit
+//
+// start and reconfigure need the WaitCommand() loop of --server mode; a
+// server started for a single run ([control] Enable) rejects them and
+// takes quit as stop.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class RunControl {
+
+public:
+    enum State { kIdle, kConfiguring, kRunning, kPaused, kStopping };
+
+    enum CommandType { kStart, kReconfigure, kQuit };
+
+    struct Command {
+	CommandType fType;
+	std::string fArgument;
+    };
+
+    static void InstallSignalHandlers();
+
+    /// commands: the caller consumes start/reconfigure/quit with WaitCommand().
+    static bool StartServer(const std::string& socketpath, bool commands);
+    static void StopServer();
+
+    // --- polled by the acquisition loop (atomic loads only) ---
+    static bool StopRequested() { return fStop.load(std::memory_order_relaxed); }
+    static bool PauseRequested() { return fPause.load(std::memory_order_relaxed); }
+    static bool QuitRequested() { return fQuit.load(std::memory_order_relaxed); }
+    static bool DumpPending() { return fDump.load(std::memory_order_relaxed) != 0; }
+    static bool ConsumeDump();
+
+    static void RequestStop();
+    /// Before a new run; keeps the stop of a signal (QuitRequested()).
+    static void ClearStop();
+
+    // --- progress reported by the acquisition loop ---
+    static void SetState(State state) { fState.store(state, std::memory_order_relaxed); }
+    static State GetState() { return fState.load(std::memory_order_relaxed); }
+    static void SetRun(int runnumber, uint32_t maxevents);
+    static void SetEvents(uint64_t nevents) { fEvents.store(nevents, std::memory_order_relaxed); }
+
+    /// Server mode: block until a start/reconfigure/quit command arrives.
+    /// Returns false when the process should exit, also after SIGINT or
+    /// SIGTERM with commands still queued.
+    static bool WaitCommand(Command& command);
+
+    static std::string ToString(const State& state);
+
+private:
+    static void Serve();
+    static std::string Execute(const std::string& line);
+    static void Push(const Command& command);
+
+    static std::atomic<bool> fStop;
+    static std::atomic<bool> fPause;
+    static std::atomic<bool> fQuit;
+    static std::atomic<uint32_t> fDump;
+    static std::atomic<State> fState;
+    static std::atomic<int> fRunNumber;
+    static std::atomic<uint64_t> fEvents;
+    static std::atomic<uint32_t> fMaxEvents;
+
+    static std::string fSocketPath;
+    static int fListenFd;
+    static int fWakePipe[2];
+    static std::thread fServer;
+    static bool fCommands;              ///< a WaitCommand() loop consumes the queue
+
+    static std::mutex fQueueMutex;
+    static std::condition_variable fQueueCond;
+    static std::deque<Command> fQueue;
+};
+
+#endif // RUNCONTROL_H
@@ -0,0 +1,284 @@
+#include "RunJournal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace RunJournalLayout;
+
+namespace {
+
+    bool WriteAll(int fd, const void* data, size_t size)
+    {
+	const char* p = static_cast<const char*>(data);
+	while( size > 0 ) {
+	    ssize_t n = write(fd, p, size);
+	    if( n < 0 ) {
+		if( errno == EINTR )
+		    continue;
+		return false;
+	    }
+	    p += n;
+	    size -= n;
+	}
+	return true;
+    }
+
+    bool ReadAll(int fd, void* data, size_t size)
+    {
+	char* p = static_cast<char*>(data);
+	while( size > 0 ) {
+	    ssize_t n = read(fd, p, size);
+	    if( n < 0 && errno == EINTR )
+		continue;
+	    if( n <= 0 )
+		return false;
+	    p += n;
+	    size -= n;
+	}
+	return true;
+    }
+
+    template <typename T>
+    void Append(std::vector<char>& buf, const T* data, size_t n)
+    {
+	const char* p = reinterpret_cast<const char*>(data);
+	buf.insert(buf.end(), p, p + n * sizeof(T));
+    }
+
+    void CopyString(char* dst, size_t size, const std::string& src)
+    {
+	std::memset(dst, 0, size);
+	std::memcpy(dst, src.c_str(), std::min(size - 1, src.size()));
+    }
+
+}
+
+// ---------------------------------------------------------------
+// Writer
+// ---------------------------------------------------------------
+RunJournalWriter::RunJournalWriter(const std::string& path, const RunJournalInfo& info) :
+    fPath(path),
+    fFd(-1),
+    fPending(0),
+    fFailed(false),
+    fFirstPending(0)
+{
+    fFd = open(fPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if( fFd < 0 )
+	throw std::runtime_error("RunJournal: cannot create " + fPath + ": " + std::strerror(errno));
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.fMagic, kMagic, sizeof(kMagic));
+    header.fVersion = kVersion;
+    header.fRunNumber = info.RunNumber;
+    header.fRecordLength = info.RecordLength;
+    header.fPostTriggerSize = info.PostTriggerSize;
+    header.fSamplingTime = info.SamplingTime;
+    CopyString(header.fSamplingRate, sizeof(header.fSamplingRate), info.SamplingRate);
+    CopyString(header.fTriggerMode, sizeof(header.fTriggerMode), info.TriggerMode);
+    header.fSaveRaw = info.SaveRaw;
+    header.fNChannels = static_cast<uint32_t>(info.ChannelList.size());
+
+    if( !WriteAll(fFd, &header, sizeof(header)) ||
+	!WriteAll(fFd, info.ChannelList.data(), info.ChannelList.size() * sizeof(uint32_t)) ||
+	fdatasync(fFd) != 0 ) {
+	close(fFd);
+	unlink(fPath.c_str());
+	throw std::runtime_error("RunJournal: cannot write " + fPath + ": " + std::strerror(errno));
+    }
+}
+
+RunJournalWriter::~RunJournalWriter()
+{
+    Close(false);
+}
+
+void RunJournalWriter::Add(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+			   const std::vector<int16_t>& corr, const std::vector<uint16_t>& raw)
+{
+    if( fPending == 0 )
+	fFirstPending = eventnumber;
+
+    EventHeader event = { eventnumber, triggertimetag, channelmask,
+			  static_cast<uint32_t>(corr.size()), static_cast<uint32_t>(raw.size()) };
+    Append(fPayload, &event, 1);
+    Append(fPayload, corr.data(), corr.size());
+    Append(fPayload, raw.data(), raw.size());
+    fPending++;
+    if( fPayload.size() >= kMaxPendingBytes && !CommitChunk() )
+	fFailed = true;
+}
+
+void RunJournalWriter::AddBatch(const EventBatch& batch)
+{
+    for( uint32_t e = 0; e < batch.GetSize(); e++ ) {
+	if( fPending == 0 )
+	    fFirstPending = batch.GetEventNumber(e);
+
+	const uint32_t npresent = batch.GetNPresent(e);
+	const uint32_t nsamples = batch.GetNSamples(e);
+	EventHeader event = { batch.GetEventNumber(e), batch.GetTriggerTimeTag(e), batch.GetChannelMask(e),
+			      npresent * nsamples, batch.HasRaw() ? npresent * nsamples : 0 };
+	Append(fPayload, &event, 1);
+	for( uint32_t i = 0; i < npresent; i++ )
+	    Append(fPayload, batch.Corr(e, i), nsamples);
+	if( batch.HasRaw() )
+	    for( uint32_t i = 0; i < npresent; i++ )
+		Append(fPayload, batch.Raw(e, i), nsamples);
+	fPending++;
+	if( fPayload.size() >= kMaxPendingBytes && !CommitChunk() )
+	    fFailed = true;
+    }
+}
+
+bool RunJournalWriter::Commit()
+{
+    const bool ok = CommitChunk() && !fFailed;
+    fFailed = false;
+    return ok;
+}
+
+bool RunJournalWriter::CommitChunk()
+{
+    if( fFd < 0 )
+	return false;
+    if( fPending == 0 )
+	return true;
+
+    ChunkHeader chunk;
+    chunk.fMagic = kChunkMagic;
+    chunk.fNEvents = fPending;
+    chunk.fFirstEvent = fFirstPending;
+    chunk.fPayloadBytes = fPayload.size();
+    chunk.fCRC = static_cast<uint32_t>(crc32_z(0L, reinterpret_cast<const Bytef*>(fPayload.data()),
+					       fPayload.size()));
+    chunk.fReserved = 0;
+
+    const bool ok = WriteAll(fFd, &chunk, sizeof(chunk)) &&
+	WriteAll(fFd, fPayload.data(), fPayload.size()) &&
+	fdatasync(fFd) == 0;
+
+    fPayload.clear();
+    fPending = 0;
+    return ok;
+}
+
+void RunJournalWriter::Close(bool remove)
+{
+    if( fFd < 0 )
+	return;
+    close(fFd);
+    fFd = -1;
+    if( remove )
+	unlink(fPath.c_str());
+}
+
+// ---------------------------------------------------------------
+// Reader
+// ---------------------------------------------------------------
+RunJournalReader::RunJournalReader(const std::string& path) :
+    fFd(-1),
+    fOffset(0),
+    fSize(0),
+    fChunks(0)
+{
+    fFd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if( fFd < 0 )
+	throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+
+    struct stat st;
+    fstat(fFd, &st);
+    fSize = static_cast<uint64_t>(st.st_size);
+
+    FileHeader header;
+    if( !ReadAll(fFd, &header, sizeof(header)) ||
+	std::memcmp(header.fMagic, kMagic, sizeof(kMagic)) != 0 ) {
+	close(fFd);
+	throw std::runtime_error(path + " is not a run journal");
+    }
+    if( header.fVersion != kVersion ) {
+	close(fFd);
+	throw std::runtime_error(path + ": unsupported journal version " + std::to_string(header.fVersion));
+    }
+
+    header.fSamplingRate[sizeof(header.fSamplingRate) - 1] = '\0';
+    header.fTriggerMode[sizeof(header.fTriggerMode) - 1] = '\0';
+    fInfo.RunNumber = header.fRunNumber;
+    fInfo.RecordLength = header.fRecordLength;
+    fInfo.PostTriggerSize = header.fPostTriggerSize;
+    fInfo.SamplingTime = header.fSamplingTime;
+    fInfo.SamplingRate = header.fSamplingRate;
+    fInfo.TriggerMode = header.fTriggerMode;
+    fInfo.SaveRaw = header.fSaveRaw != 0;
+    fInfo.ChannelList.resize(std::min<uint32_t>(header.fNChannels, 64));
+    if( !ReadAll(fFd, fInfo.ChannelList.data(), fInfo.ChannelList.size() * sizeof(uint32_t)) ) {
+	close(fFd);
+	throw std::runtime_error(path + ": truncated journal header");
+    }
+    fOffset = sizeof(header) + fInfo.ChannelList.size() * sizeof(uint32_t);
+}
+
+RunJournalReader::~RunJournalReader()
+{
+    if( fFd >= 0 )
+	close(fFd);
+}
+
+uint64_t RunJournalReader::GetDiscardedBytes() const
+{
+    return fSize > fOffset ? fSize - fOffset : 0;
+}
+
+bool RunJournalReader::NextChunk(std::vector<JournalEvent>& events)
+{
+    events.clear();
+
+    ChunkHeader chunk;
+    if( fSize - fOffset < sizeof(chunk) || pread(fFd, &chunk, sizeof(chunk), fOffset) != sizeof(chunk) )
+	return false;
+    if( chunk.fMagic != kChunkMagic || chunk.fPayloadBytes > fSize - fOffset - sizeof(chunk) )
+	return false;
+
+    std::vector<char> payload(chunk.fPayloadBytes);
+    if( pread(fFd, payload.data(), payload.size(), fOffset + sizeof(chunk)) != static_cast<ssize_t>(payload.size()) )
+	return false;
+    const uint32_t crc = static_cast<uint32_t>(crc32_z(0L, reinterpret_cast<const Bytef*>(payload.data()),
+						       payload.size()));
+    if( crc != chunk.fCRC )
+	return false;
+
+    size_t pos = 0;
+    for( uint32_t i = 0; i < chunk.fNEvents; i++ ) {
+	EventHeader header;
+	if( pos + sizeof(header) > payload.size() )
+	    return false;
+	std::memcpy(&header, payload.data() + pos, sizeof(header));
+	pos += sizeof(header);
+	const size_t bytes = header.fNCorr * sizeof(int16_t) + header.fNRaw * sizeof(uint16_t);
+	if( pos + bytes > payload.size() )
+	    return false;
+
+	JournalEvent event;
+	event.fEventNumber = header.fEventNumber;
+	event.fTriggerTimeTag = header.fTriggerTimeTag;
+	event.fChannelMask = header.fChannelMask;
+	event.fCorr.resize(header.fNCorr);
+	event.fRaw.resize(header.fNRaw);
+	std::memcpy(event.fCorr.data(), payload.data() + pos, header.fNCorr * sizeof(int16_t));
+	pos += header.fNCorr * sizeof(int16_t);
+	std::memcpy(event.fRaw.data(), payload.data() + pos, header.fNRaw * sizeof(uint16_t));
+	pos += header.fNRaw * sizeof(uint16_t);
+	events.push_back(std::move(event));
+    }
+
+    fOffset += sizeof(chunk) + chunk.fPayloadBytes;
+    fChunks++;
+    return true;
+}
@@ -0,0 +1,143 @@
+#ifndef RUNJOURNAL_H
+#define RUNJOURNAL_H
+
+// Append-only journal of the events of a run, written next to the output
+// file (<output>.journal) and removed when the run is closed cleanly.
+//
+// Events are buffered in memory and appended as checkpoint chunks, each
+// with its own CRC and followed by fdatasync(): after a crash every chunk
+// that made it to disk is intact, a torn chunk at the end is discarded.
+// A chunk is also committed as soon as kMaxPendingBytes are buffered.
+// daq-recover rebuilds the output file from the journal.
+//
+// Layout: FileHeader, channel list (uint32[fNChannels]),
+//         then { ChunkHeader, payload }...
+// Payload: { EventHeader, int16 corrected[fNCorr], uint16 raw[fNRaw] }...
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "EventBatch.h"
+
+namespace RunJournalLayout {
+
+    constexpr char kMagic[8] = { 'D','A','Q','W','C','J','N','L' };
+    constexpr uint32_t kVersion = 1;
+    constexpr uint32_t kChunkMagic = 0x4b4e4843;   // "CHNK"
+
+    struct FileHeader {
+	char fMagic[8];
+	uint32_t fVersion;
+	int32_t fRunNumber;
+	uint32_t fRecordLength;
+	uint32_t fPostTriggerSize;
+	double fSamplingTime;
+	char fSamplingRate[16];
+	char fTriggerMode[16];
+	uint32_t fSaveRaw;
+	uint32_t fNChannels;
+    };
+
+    struct ChunkHeader {
+	uint32_t fMagic;
+	uint32_t fNEvents;
+	uint64_t fFirstEvent;
+	uint64_t fPayloadBytes;
+	uint32_t fCRC;                  ///< zlib crc32 of the payload
+	uint32_t fReserved;
+    };
+
+    struct EventHeader {
+	uint64_t fEventNumber;
+	uint32_t fTriggerTimeTag;
+	uint32_t fChannelMask;
+	uint32_t fNCorr;
+	uint32_t fNRaw;
+    };
+
+}
+
+/// Run parameters stored in the journal header.
+struct RunJournalInfo {
+    int RunNumber = 0;
+    uint32_t RecordLength = 0;
+    uint32_t PostTriggerSize = 0;
+    double SamplingTime = 0.0;
+    std::string SamplingRate;
+    std::string TriggerMode;
+    bool SaveRaw = false;
+    std::vector<uint32_t> ChannelList;
+};
+
+/// One event read back from the journal.
+struct JournalEvent {
+    uint64_t fEventNumber = 0;
+    uint32_t fTriggerTimeTag = 0;
+    uint32_t fChannelMask = 0;
+    std::vector<int16_t> fCorr;
+    std::vector<uint16_t> fRaw;
+};
+
+class RunJournalWriter {
+public:
+    static constexpr size_t kMaxPendingBytes = size_t(64) << 20;
+
+
+    /// Throws std::runtime_error if the file cannot be created.
+    RunJournalWriter(const std::string& path, const RunJournalInfo& info);
+    ~RunJournalWriter();
+
+    /// Buffer one event; nothing is written until Commit() or until
+    /// kMaxPendingBytes are buffered.
+    void Add(uint64_t eventnumber, uint32_t triggertimetag, uint32_t channelmask,
+	     const std::vector<int16_t>& corr, const std::vector<uint16_t>& raw);
+    /// Buffer every event of batch.
+    void AddBatch(const EventBatch& batch);
+
+    /// Append the buffered events as one chunk and fdatasync(). Returns false
+    /// on I/O errors, also of the chunks committed early since the last call.
+    bool Commit();
+
+    /// Close the journal; with remove=true the file is deleted (run closed cleanly).
+    void Close(bool remove);
+
+    uint32_t GetPending() const { return fPending; }
+    const std::string& GetPath() const { return fPath; }
+
+private:
+    std::string fPath;
+    int fFd;
+    bool CommitChunk();
+
+    std::vector<char> fPayload;
+    uint32_t fPending;
+    bool fFailed;                       ///< an early commit failed, reported by Commit()
+    uint64_t fFirstPending;
+};
+
+class RunJournalReader {
+public:
+    /// Throws std::runtime_error if the file is not a journal.
+    explicit RunJournalReader(const std::string& path);
+    ~RunJournalReader();
+
+    const RunJournalInfo& GetInfo() const { return fInfo; }
+
+    /// Read the next intact chunk. Returns false at the end of the file or
+    /// at the first truncated/corrupted chunk.
+    bool NextChunk(std::vector<JournalEvent>& events);
+
+    uint64_t GetChunks() const { return fChunks; }
+    /// bytes after the last intact chunk (torn write at crash time)
+    uint64_t GetDiscardedBytes() const;
+
+private:
+    int fFd;
+    RunJournalInfo fInfo;
+    uint64_t fOffset;
+    uint64_t fSize;
+    uint64_t fChunks;
+};
+
+#endif // RUNJOURNAL_H
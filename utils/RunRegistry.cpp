@@ -0,0 +1,158 @@
+#include "RunRegistry.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+    std::string Error(const std::string& what, const std::string& path)
+    {
+	return "RunRegistry: " + what + " " + path + ": " + std::strerror(errno);
+    }
+
+    std::string UtcNow()
+    {
+	char buf[32];
+	std::time_t now = std::time(nullptr);
+	std::tm tm;
+	gmtime_r(&now, &tm);
+	std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+	return buf;
+    }
+
+    /// Run number of "<base>_NNNN...", -1 if the name does not match.
+    int RunOf(const std::string& name, const std::string& base)
+    {
+	if( name.size() <= base.size() + 1 || name.compare(0, base.size(), base) != 0 || name[base.size()] != '_' )
+	    return -1;
+	size_t end = base.size() + 1;
+	while( end < name.size() && std::isdigit(static_cast<unsigned char>(name[end])) && end - base.size() <= 9 )
+	    end++;
+	if( end == base.size() + 1 )
+	    return -1;
+	return std::stoi(name.substr(base.size() + 1, end - base.size() - 1));
+    }
+
+}
+
+RunRegistry::RunRegistry(const std::string& dir, const std::string& base) :
+    fDir(dir),
+    fBase(base),
+    fCounterPath(dir + "/" + base + ".runnumber"),
+    fCatalogPath(dir + "/" + base + ".runs.tsv")
+{
+}
+
+// The lock goes away with the descriptor: callers close() it when done.
+int RunRegistry::OpenLocked() const
+{
+    int fd = open(fCounterPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if( fd < 0 )
+	throw std::runtime_error(Error("cannot open", fCounterPath));
+    struct flock lock;
+    std::memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    while( fcntl(fd, F_SETLKW, &lock) != 0 ) {
+	if( errno == EINTR )
+	    continue;
+	const std::string msg = Error("cannot lock", fCounterPath);
+	close(fd);
+	throw std::runtime_error(msg);
+    }
+    return fd;
+}
+
+int RunRegistry::Allocate()
+{
+    int fd = OpenLocked();
+
+    char buf[32] = {};
+    const ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    char* end = nullptr;
+    long next = n > 0 ? std::strtol(buf, &end, 10) : -1;
+    if( n <= 0 || end == buf || next < 0 ) {
+	// first use (or damaged counter): start after everything already there
+	next = std::max(ScanDirectory(fDir, fBase), MaxCatalogRun()) + 1;
+    }
+
+    const std::string text = std::to_string(next + 1) + "\n";
+    const bool ok = pwrite(fd, text.data(), text.size(), 0) == static_cast<ssize_t>(text.size()) &&
+		    ftruncate(fd, text.size()) == 0 && fdatasync(fd) == 0;
+    const std::string msg = ok ? "" : Error("cannot update", fCounterPath);
+    close(fd);
+    if( !ok )
+	throw std::runtime_error(msg);
+    return static_cast<int>(next);
+}
+
+void RunRegistry::RecordStart(int run, const std::string& path, const std::string& confighash)
+{
+    Append(run, "start", 0, confighash, "-", path);
+}
+
+void RunRegistry::RecordStop(int run, const std::string& path, uint64_t nevents,
+			     const std::string& stopreason, const std::string& confighash)
+{
+    Append(run, "stop", nevents, confighash, stopreason.empty() ? "-" : stopreason, path);
+}
+
+void RunRegistry::Append(int run, const std::string& status, uint64_t nevents, const std::string& confighash,
+			 const std::string& reason, const std::string& path)
+{
+    std::ostringstream line;
+    line << run << '\t' << status << '\t' << UtcNow() << '\t' << nevents << '\t'
+	 << (confighash.empty() ? "-" : confighash) << '\t' << reason << '\t' << path << '\n';
+    const std::string text = line.str();
+
+    int lockfd = OpenLocked();
+    int fd = open(fCatalogPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    if( ok && lseek(fd, 0, SEEK_END) == 0 ) {
+	const std::string header = "# run\tstatus\ttime\tevents\tconfig\treason\tpath\n";
+	ok = write(fd, header.data(), header.size()) == static_cast<ssize_t>(header.size());
+    }
+    ok = ok && write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()) && fdatasync(fd) == 0;
+    const std::string msg = ok ? "" : Error("cannot append to", fCatalogPath);
+    if( fd >= 0 )
+	close(fd);
+    close(lockfd);
+    if( !ok )
+	throw std::runtime_error(msg);
+}
+
+int RunRegistry::ScanDirectory(const std::string& dir, const std::string& base)
+{
+    int maxrun = -1;
+    std::error_code ec;
+    for( const auto& entry: std::filesystem::directory_iterator(dir, ec) ) {
+	const std::string name = entry.path().filename().string();
+	if( name.find(".h5") == std::string::npos && name.find(".bin") == std::string::npos )
+	    continue;
+	maxrun = std::max(maxrun, RunOf(name, base));
+    }
+    return maxrun;
+}
+
+int RunRegistry::MaxCatalogRun() const
+{
+    int maxrun = -1;
+    std::ifstream in(fCatalogPath);
+    std::string line;
+    while( std::getline(in, line) ) {
+	if( line.empty() || line[0] == '#' )
+	    continue;
+	maxrun = std::max(maxrun, std::atoi(line.c_str()));
+    }
+    return maxrun;
+}
@@ -0,0 +1,51 @@
+#ifndef RUNREGISTRY_H
+#define RUNREGISTRY_H
+
+// Run numbers and run catalog of an output directory, per OutputFile base
+// name:
+//
+//   <base>.runnumber   next run number to hand out (text)
+//   <base>.runs.tsv    append-only catalog, one line when a run starts and
+//                      one when it stops:
+//                      run  status  time(UTC)  events  config  reason  path
+//
+// Every access holds a POSIX record lock on the counter file (fcntl, which
+// also works on NFS), so DAQ processes sharing the directory never get the
+// same number. Allocation reads and rewrites one small file: O(1) whatever
+// the number of runs. The directory is scanned once, when the counter file
+// does not exist yet.
+
+#include <cstdint>
+#include <string>
+
+class RunRegistry {
+public:
+    RunRegistry(const std::string& dir, const std::string& base);
+
+    /// Reserve the next run number. Throws std::runtime_error.
+    int Allocate();
+
+    /// Catalog entries. Throw std::runtime_error.
+    void RecordStart(int run, const std::string& path, const std::string& confighash);
+    void RecordStop(int run, const std::string& path, uint64_t nevents,
+		    const std::string& stopreason, const std::string& confighash);
+
+    const std::string& GetCounterPath() const { return fCounterPath; }
+    const std::string& GetCatalogPath() const { return fCatalogPath; }
+
+    /// Highest run number of files named <base>_NNNN* in dir, -1 if none.
+    static int ScanDirectory(const std::string& dir, const std::string& base);
+
+private:
+    int OpenLocked() const;
+    int MaxCatalogRun() const;
+    void Append(int run, const std::string& status, uint64_t nevents, const std::string& confighash,
+		const std::string& reason, const std::string& path);
+
+    std::string fDir;
+    std::string fBase;
+    std::string fCounterPath;
+    std::string fCatalogPath;
+};
+
+#endif // RUNREGISTRY_H
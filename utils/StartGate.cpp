@@ -0,0 +1,42 @@
+#include "StartGate.h"
+
+#include <chrono>
+
+void StartGate::Reset(uint32_t nboards)
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    fExpected = nboards;
+    fArrived = 0;
+}
+
+void StartGate::Arrive()
+{
+    {
+	std::lock_guard<std::mutex> lock(fMutex);
+	fArrived++;
+    }
+    fCond.notify_all();
+}
+
+void StartGate::Leave()
+{
+    {
+	std::lock_guard<std::mutex> lock(fMutex);
+	if( fExpected > 0 )
+	    fExpected--;
+    }
+    fCond.notify_all();
+}
+
+bool StartGate::Wait(const std::function<bool()>& abort)
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    // abort() reads the run-control flags, nobody notifies for them: poll
+    while( fArrived < fExpected ) {
+	if( abort() )
+	    return false;
+	fCond.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    fArrived = 0;
+    return true;
+}
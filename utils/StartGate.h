@@ -0,0 +1,38 @@
+#ifndef STARTGATE_H
+#define STARTGATE_H
+
+// SyncStart: board 0 starts the other boards through their S-IN, so they
+// must be armed before board 0 starts or they miss its edge. At the start
+// of a run Crate::Arm() arms them on the calling thread; when a paused run
+// resumes, every board restarts on its own readout thread and goes through
+// here instead: the other boards Arrive() once armed again, board 0 Wait()s
+// for all of them and starts last. A board that ends its run Leave()s, so
+// that board 0 does not wait for it.
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+class StartGate {
+public:
+    /// Before each run: nboards boards besides board 0.
+    void Reset(uint32_t nboards);
+
+    /// Armed again after a pause.
+    void Arrive();
+    /// Out of the run (finished, failed, or not acquiring at all).
+    void Leave();
+
+    /// Board 0: wait until every board still in the run arrived, and
+    /// consume the arrivals. Returns false if abort() became true first.
+    bool Wait(const std::function<bool()>& abort);
+
+private:
+    std::mutex fMutex;
+    std::condition_variable fCond;
+    uint32_t fExpected = 0;
+    uint32_t fArrived = 0;
+};
+
+#endif // STARTGATE_H
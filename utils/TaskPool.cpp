@@ -0,0 +1,161 @@
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "ThreadPlacement.h"
+
+namespace {
+
+    std::mutex gSharedMutex;
+    std::unique_ptr<TaskPool> gShared;
+
+    // the pool and worker index of this thread, -1 outside a pool
+    thread_local const TaskPool* tPool = nullptr;
+    thread_local int tWorker = -1;
+
+}
+
+TaskPool::TaskPool(unsigned nthreads) :
+    fQueued(0),
+    fNextWorker(0),
+    fStop(false),
+    fStart(std::chrono::steady_clock::now())
+{
+    if( nthreads == 0 )
+	nthreads = std::max(1u, std::thread::hardware_concurrency() - 1);
+    for( unsigned i = 0; i < nthreads; i++ )
+	fWorkers.emplace_back(new Worker);
+    for( unsigned i = 0; i < nthreads; i++ )
+	fWorkers[i]->fThread = std::thread(&TaskPool::Run, this, i);
+}
+
+TaskPool::~TaskPool()
+{
+    {
+	std::lock_guard<std::mutex> lock(fSleepMutex);
+	fStop = true;
+    }
+    fWake.notify_all();
+    for( auto& w: fWorkers )
+	w->fThread.join();
+}
+
+TaskPool& TaskPool::Shared(unsigned nthreads)
+{
+    std::lock_guard<std::mutex> lock(gSharedMutex);
+    if( !gShared )
+	gShared.reset(new TaskPool(nthreads));
+    return *gShared;
+}
+
+TaskPool* TaskPool::GetShared()
+{
+    std::lock_guard<std::mutex> lock(gSharedMutex);
+    return gShared.get();
+}
+
+void TaskPool::Submit(Task task)
+{
+    // a worker keeps what it spawns; others deal round-robin
+    const unsigned index = tPool == this && tWorker >= 0 ? tWorker :
+	fNextWorker.fetch_add(1, std::memory_order_relaxed) % fWorkers.size();
+    {
+	std::lock_guard<std::mutex> lock(fWorkers[index]->fMutex);
+	fWorkers[index]->fTasks.push_back(std::move(task));
+    }
+    {
+	// under the sleep mutex: a worker about to sleep sees the count
+	std::lock_guard<std::mutex> lock(fSleepMutex);
+	fQueued++;
+    }
+    fWake.notify_one();
+}
+
+// own deque first (oldest task: the writer waits for it), then the newest
+// task of the others, starting after this worker
+bool TaskPool::Take(unsigned index, Task& task)
+{
+    Worker& self = *fWorkers[index];
+    {
+	std::lock_guard<std::mutex> lock(self.fMutex);
+	if( !self.fTasks.empty() ) {
+	    task = std::move(self.fTasks.front());
+	    self.fTasks.pop_front();
+	    fQueued--;
+	    return true;
+	}
+    }
+    for( size_t k = 1; k < fWorkers.size(); k++ ) {
+	Worker& victim = *fWorkers[(index + k) % fWorkers.size()];
+	std::lock_guard<std::mutex> lock(victim.fMutex);
+	if( !victim.fTasks.empty() ) {
+	    task = std::move(victim.fTasks.back());
+	    victim.fTasks.pop_back();
+	    fQueued--;
+	    self.fStolen++;
+	    return true;
+	}
+    }
+    return false;
+}
+
+void TaskPool::Run(unsigned index)
+{
+    ThreadPlacement::Apply(ThreadPlacement::kWrite);
+    tPool = this;
+    tWorker = index;
+    Worker& self = *fWorkers[index];
+
+    Task task;
+    while( true ) {
+	if( !Take(index, task) ) {
+	    std::unique_lock<std::mutex> lock(fSleepMutex);
+	    fWake.wait(lock, [this] { return fStop || fQueued > 0; });
+	    if( fStop && fQueued <= 0 )
+		return;
+	    continue;
+	}
+	const auto t0 = std::chrono::steady_clock::now();
+	task();
+	task = nullptr;
+	self.fBusyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+	self.fDone++;
+    }
+}
+
+std::vector<TaskPool::WorkerStatistics> TaskPool::GetStatistics() const
+{
+    std::vector<WorkerStatistics> stats(fWorkers.size());
+    for( size_t i = 0; i < fWorkers.size(); i++ ) {
+	stats[i].fTasks = fWorkers[i]->fDone;
+	stats[i].fStolen = fWorkers[i]->fStolen;
+	stats[i].fBusyS = fWorkers[i]->fBusyNs * 1e-9;
+    }
+    return stats;
+}
+
+double TaskPool::GetElapsed() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - fStart).count();
+}
+
+std::string TaskPool::Summary() const
+{
+    const std::vector<WorkerStatistics> stats = GetStatistics();
+    const double elapsed = std::max(GetElapsed(), 1e-9);
+    uint64_t tasks = 0, stolen = 0;
+    double busy = 0.0;
+    std::ostringstream workers;
+    for( size_t i = 0; i < stats.size(); i++ ) {
+	tasks += stats[i].fTasks;
+	stolen += stats[i].fStolen;
+	busy += stats[i].fBusyS;
+	workers << (i ? ", " : "") << "w" << i << " " << static_cast<int>(100.0 * stats[i].fBusyS / elapsed + 0.5) << "%";
+    }
+    std::ostringstream s;
+    s << stats.size() << " workers " << static_cast<int>(100.0 * busy / elapsed / stats.size() + 0.5)
+      << "% busy (" << workers.str() << "), " << tasks << " tasks, "
+      << static_cast<int>(tasks ? 100.0 * stolen / tasks + 0.5 : 0.0) << "% stolen";
+    return s.str();
+}
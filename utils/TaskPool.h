@@ -0,0 +1,156 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+// Work-stealing pool for the processing stages after the readout (chunk
+// compression today). Their cost per task is uneven: a chunk of empty
+// channels deflates in a fraction of the time of a chunk full of pulses,
+// so a fixed split of the tasks between threads leaves cores idle.
+//
+// Every worker has its own deque. Tasks submitted from outside the pool are
+// dealt round-robin; tasks submitted by a worker stay on its deque. A worker
+// runs its own tasks oldest first, and when it has none it steals the newest
+// task of another worker. Idle workers sleep until something is submitted.
+//
+// OrderedTasks gives the results back in submission order, as the writer
+// needs them, whatever the order they complete in.
+//
+// TaskPool::Shared() is the pool of the process: with several boards their
+// writers share it instead of starting one set of threads each. Workers are
+// write-stage threads for ThreadPlacement.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TaskPool {
+public:
+    using Task = std::function<void()>;
+
+    /// nthreads = 0 uses every core but one.
+    explicit TaskPool(unsigned nthreads = 0);
+    /// Runs the tasks still queued, then stops the workers.
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    /// The pool of the process, created by the first call with nthreads.
+    static TaskPool& Shared(unsigned nthreads = 0);
+    /// nullptr until Shared() was called.
+    static TaskPool* GetShared();
+
+    void Submit(Task task);
+    unsigned GetNThreads() const { return fWorkers.size(); }
+
+    struct WorkerStatistics {
+	uint64_t fTasks = 0;
+	uint64_t fStolen = 0;                ///< of fTasks, taken from another worker
+	double fBusyS = 0.0;
+    };
+    std::vector<WorkerStatistics> GetStatistics() const;
+    /// Seconds since the pool started.
+    double GetElapsed() const;
+    /// "4 workers 87% busy (w0 91%, w1 85%, ...), 1200 tasks, 6% stolen"
+    std::string Summary() const;
+
+private:
+    struct alignas(64) Worker {
+	std::mutex fMutex;
+	std::deque<Task> fTasks;
+	std::atomic<uint64_t> fDone{0};
+	std::atomic<uint64_t> fStolen{0};
+	std::atomic<uint64_t> fBusyNs{0};
+	std::thread fThread;
+    };
+
+    void Run(unsigned index);
+    bool Take(unsigned index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> fWorkers;
+    std::atomic<long> fQueued;               ///< submitted, not yet taken; -1 while a take overtakes a Submit
+    std::atomic<unsigned> fNextWorker;
+    std::mutex fSleepMutex;
+    std::condition_variable fWake;
+    bool fStop;
+    std::chrono::steady_clock::time_point fStart;
+};
+
+/// Tasks returning an R, results collected in submission order.
+template <typename R>
+class OrderedTasks {
+public:
+    explicit OrderedTasks(TaskPool& pool) : fPool(pool), fRunning(0) {}
+
+    /// Waits for the tasks still running: they refer to this object.
+    ~OrderedTasks()
+    {
+	std::unique_lock<std::mutex> lock(fMutex);
+	fCond.wait(lock, [this] { return fRunning == 0; });
+    }
+
+    OrderedTasks(const OrderedTasks&) = delete;
+    OrderedTasks& operator=(const OrderedTasks&) = delete;
+
+    void Submit(std::function<R()> work)
+    {
+	auto slot = std::make_shared<Slot>();
+	{
+	    std::lock_guard<std::mutex> lock(fMutex);
+	    fSlots.push_back(slot);
+	    fRunning++;
+	}
+	fPool.Submit([this, slot, work = std::move(work)]() {
+	    R result = work();
+	    std::lock_guard<std::mutex> lock(fMutex);
+	    slot->fResult = std::move(result);
+	    slot->fDone = true;
+	    fRunning--;
+	    fCond.notify_all();
+	});
+    }
+
+    /// Oldest submitted result, once done. False if there is none, or if it
+    /// is not done yet and wait is false.
+    bool Next(R& result, bool wait)
+    {
+	std::unique_lock<std::mutex> lock(fMutex);
+	if( fSlots.empty() )
+	    return false;
+	if( wait )
+	    fCond.wait(lock, [this] { return fSlots.front()->fDone; });
+	else if( !fSlots.front()->fDone )
+	    return false;
+	result = std::move(fSlots.front()->fResult);
+	fSlots.pop_front();
+	return true;
+    }
+
+    /// Submitted and not yet returned by Next().
+    size_t GetPending()
+    {
+	std::lock_guard<std::mutex> lock(fMutex);
+	return fSlots.size();
+    }
+
+private:
+    struct Slot {
+	R fResult;
+	bool fDone = false;
+    };
+
+    TaskPool& fPool;
+    std::mutex fMutex;
+    std::condition_variable fCond;
+    std::deque<std::shared_ptr<Slot>> fSlots;
+    size_t fRunning;
+};
+
+#endif // TASKPOOL_H
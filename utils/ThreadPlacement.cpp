@@ -0,0 +1,204 @@
+#include "ThreadPlacement.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Log.h"
+
+bool ThreadPlacement::fEnabled = false;
+std::vector<int> ThreadPlacement::fReadout;
+std::vector<int> ThreadPlacement::fWrite;
+int ThreadPlacement::fPriority = 0;
+int ThreadPlacement::fNode = -1;
+
+namespace {
+
+    std::string ReadLine(const std::string& path)
+    {
+	std::ifstream in(path);
+	std::string line;
+	std::getline(in, line);
+	return line;
+    }
+
+    std::atomic<bool> gWarned[2];
+
+    void WarnOnce(ThreadPlacement::Stage stage, const std::string& message)
+    {
+	if( !gWarned[stage].exchange(true) )
+	    Log::OutWarning(message);
+    }
+
+    // 0 or errno
+    int SetAffinity(const std::vector<int>& cpus)
+    {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for( int cpu: cpus )
+	    if( cpu >= 0 && cpu < CPU_SETSIZE )
+		CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+}
+
+void ThreadPlacement::Configure(const std::vector<int>& readout, const std::vector<int>& write,
+				int priority, int node)
+{
+    fReadout = readout;
+    fPriority = priority;
+    fNode = node;
+    fEnabled = !readout.empty() || !write.empty() || priority > 0 || node >= 0;
+    if( !fEnabled )
+	return;
+
+    // write threads: never on the readout CPUs unless asked to
+    fWrite = write;
+    if( fWrite.empty() )
+	{
+	    const std::vector<int> busy = readout.empty() && node >= 0 ? std::vector<int>() : readout;
+	    for( int cpu: OnlineCPUs() )
+		if( std::find(busy.begin(), busy.end(), cpu) == busy.end() )
+		    fWrite.push_back(cpu);
+	    if( fWrite.empty() )
+		fWrite = OnlineCPUs();
+	}
+
+    std::string readoutcpus = !readout.empty() ? ToString(readout) :
+	node >= 0 ? ToString(NodeCPUs(node)) + " (node " + std::to_string(node) + ")" : "any";
+    Log::OutSummary("Thread placement: readout on CPUs " + readoutcpus +
+		    (priority > 0 ? ", SCHED_FIFO " + std::to_string(priority) : "") +
+		    "; write on CPUs " + ToString(fWrite));
+    if( node >= 0 && !readout.empty() )
+	{
+	    const std::vector<int> local = NodeCPUs(node);
+	    for( int cpu: readout )
+		if( std::find(local.begin(), local.end(), cpu) == local.end() )
+		    Log::OutWarning("Readout CPU " + std::to_string(cpu) + " is not on NUMA node " +
+				    std::to_string(node) + " of the network interface.");
+	}
+}
+
+void ThreadPlacement::Apply(Stage stage, uint32_t index)
+{
+    if( !fEnabled )
+	return;
+
+    std::vector<int> cpus;
+    if( stage == kReadout )
+	{
+	    if( !fReadout.empty() )
+		cpus.push_back(fReadout[index % fReadout.size()]);
+	    else if( fNode >= 0 )
+		cpus = NodeCPUs(fNode);
+	}
+    else
+	cpus = fWrite;
+
+    if( !cpus.empty() )
+	{
+	    const int err = SetAffinity(cpus);
+	    if( err != 0 )
+		WarnOnce(stage, "Cannot pin thread to CPUs " + ToString(cpus) + ": " + std::strerror(err));
+	}
+
+    sched_param param = {};
+    int policy = SCHED_OTHER;
+    if( stage == kReadout && fPriority > 0 )
+	{
+	    policy = SCHED_FIFO;
+	    param.sched_priority = fPriority;
+	}
+    const int err = pthread_setschedparam(pthread_self(), policy, &param);
+    if( err != 0 )
+	WarnOnce(stage, std::string("Cannot set SCHED_FIFO priority: ") + std::strerror(err) +
+		 " (needs CAP_SYS_NICE or an rtprio limit, see README)");
+}
+
+int ThreadPlacement::InterfaceNode(const std::string& iface)
+{
+    if( iface.empty() )
+	return -1;
+    const std::string line = ReadLine("/sys/class/net/" + iface + "/device/numa_node");
+    if( line.empty() )
+	return -1;
+    return std::max(-1, std::atoi(line.c_str()));
+}
+
+std::vector<int> ThreadPlacement::NodeCPUs(int node)
+{
+    if( node < 0 )
+	return {};
+    return ParseCPUList(ReadLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+}
+
+std::vector<int> ThreadPlacement::OnlineCPUs()
+{
+    std::vector<int> cpus = ParseCPUList(ReadLine("/sys/devices/system/cpu/online"));
+    if( cpus.empty() )
+	for( unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++ )
+	    cpus.push_back(i);
+    return cpus;
+}
+
+int ThreadPlacement::NodeOf(const void* address)
+{
+    // get_mempolicy(MPOL_F_NODE | MPOL_F_ADDR): node of the page at address
+    const unsigned long kNode = 1, kAddr = 2;
+    int node = -1;
+    if( syscall(SYS_get_mempolicy, &node, nullptr, 0, address, kNode | kAddr) != 0 )
+	return -1;
+    return node;
+}
+
+void ThreadPlacement::Touch(void* data, size_t size)
+{
+    const size_t page = std::max(1L, sysconf(_SC_PAGESIZE));
+    volatile char* p = static_cast<volatile char*>(data);
+    for( size_t i = 0; i < size; i += page )
+	p[i] = p[i];
+}
+
+std::vector<int> ThreadPlacement::ParseCPUList(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream in(list);
+    std::string range;
+    while( std::getline(in, range, ',') )
+	{
+	    if( range.empty() )
+		continue;
+	    const size_t dash = range.find('-');
+	    const int first = std::atoi(range.substr(0, dash).c_str());
+	    const int last = dash == std::string::npos ? first : std::atoi(range.substr(dash + 1).c_str());
+	    for( int cpu = first; cpu <= last; cpu++ )
+		cpus.push_back(cpu);
+	}
+    return cpus;
+}
+
+std::string ThreadPlacement::ToString(const std::vector<int>& cpus)
+{
+    std::string out;
+    for( size_t i = 0; i < cpus.size(); )
+	{
+	    size_t j = i;
+	    while( j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1 )
+		j++;
+	    out += (out.empty() ? "" : ",") + std::to_string(cpus[i]);
+	    if( j > i )
+		out += "-" + std::to_string(cpus[j]);
+	    i = j + 1;
+	}
+    return out.empty() ? "none" : out;
+}
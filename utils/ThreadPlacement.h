@@ -0,0 +1,61 @@
+#ifndef THREADPLACEMENT_H
+#define THREADPLACEMENT_H
+
+// CPU affinity and scheduling of the DAQ threads, from [threads]:
+//
+//   - readout: the acquisition thread of each board (ReadData, decoding,
+//     conversion, journal and monitor ring), board i on ReadoutCPUs[i % n],
+//     optionally SCHED_FIFO;
+//   - write: compression, write and catalog threads, on WriteCPUs or on
+//     every CPU but the readout ones. They are started from the readout
+//     thread and would otherwise inherit its CPU and priority.
+//
+// Memory is placed by first touch: the readout thread runs on the NUMA node
+// of the network interface (NetworkInterface) when it allocates and first
+// writes its buffers, so the kernel takes the pages from that node. No
+// libnuma is needed; NodeOf() checks where a page ended up.
+//
+// Nothing is changed until Configure() is called with something to do.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPlacement {
+public:
+    enum Stage { kReadout, kWrite };
+
+    /// readout, write: CPU lists, empty = not pinned (readout: the CPUs of
+    /// node if known); priority: SCHED_FIFO priority of the readout threads,
+    /// 0 = normal scheduling; node: NUMA node of the readout link, -1 = unknown.
+    static void Configure(const std::vector<int>& readout, const std::vector<int>& write,
+			  int priority, int node);
+    static bool IsEnabled() { return fEnabled; }
+    static int GetNode() { return fNode; }
+
+    /// Place the calling thread; index selects the readout CPU. Failures
+    /// are logged once per stage and otherwise ignored.
+    static void Apply(Stage stage, uint32_t index = 0);
+
+    /// NUMA node of a network interface, -1 if unknown (virtual, no NUMA).
+    static int InterfaceNode(const std::string& iface);
+    static std::vector<int> NodeCPUs(int node);
+    static std::vector<int> OnlineCPUs();
+    /// NUMA node of the page holding address, -1 if unknown.
+    static int NodeOf(const void* address);
+    /// Write every page of [data, data + size) from the calling thread.
+    static void Touch(void* data, size_t size);
+
+    /// "0-3,8" style, as in /sys
+    static std::vector<int> ParseCPUList(const std::string& list);
+    static std::string ToString(const std::vector<int>& cpus);
+
+private:
+    static bool fEnabled;
+    static std::vector<int> fReadout;
+    static std::vector<int> fWrite;             ///< resolved: never empty once enabled
+    static int fPriority;
+    static int fNode;
+};
+
+#endif // THREADPLACEMENT_H
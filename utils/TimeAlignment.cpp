@@ -0,0 +1,120 @@
+#include "TimeAlignment.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+TimeAlignment::TimeAlignment(uint32_t nboards) :
+    fTimes(nboards),
+    fOffsets(nboards, 0),
+    fSpreads(nboards, 0),
+    fComplete(false),
+    fAligned(false)
+{
+}
+
+void TimeAlignment::Reset()
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    for( auto& times: fTimes )
+	times.clear();
+    std::fill(fOffsets.begin(), fOffsets.end(), 0);
+    std::fill(fSpreads.begin(), fSpreads.end(), 0);
+    fComplete = false;
+    fAligned = false;
+}
+
+void TimeAlignment::Add(uint32_t board, uint32_t index, uint32_t ttt)
+{
+    if( index >= kTriggers || board >= fTimes.size() )
+	return;
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::vector<uint32_t>& times = fTimes[board];
+    if( times.size() != index )
+	return;
+    times.push_back(ttt);
+    if( times.size() < kTriggers )
+	return;
+    for( auto& t: fTimes )
+	if( t.size() < kTriggers )
+	    return;
+    Evaluate();
+}
+
+int64_t TimeAlignment::Difference(uint32_t a, uint32_t b)
+{
+    const uint64_t modulo = uint64_t(1) << kTTTBits;
+    int64_t d = int64_t((uint64_t(a) - uint64_t(b)) & (modulo - 1));
+    if( d > int64_t(modulo / 2) )
+	d -= int64_t(modulo);
+    return d;
+}
+
+// offset = median of the differences, robust to one lost trigger at the end
+void TimeAlignment::Evaluate()
+{
+    fAligned = true;
+    for( size_t b = 1; b < fTimes.size(); b++ )
+	{
+	    std::vector<int64_t> d(kTriggers);
+	    for( uint32_t i = 0; i < kTriggers; i++ )
+		d[i] = Difference(fTimes[b][i], fTimes[0][i]);
+	    std::vector<int64_t> sorted(d);
+	    std::nth_element(sorted.begin(), sorted.begin() + kTriggers / 2, sorted.end());
+	    fOffsets[b] = sorted[kTriggers / 2];
+	    fSpreads[b] = 0;
+	    for( int64_t x: d )
+		fSpreads[b] = std::max<int64_t>(fSpreads[b], std::llabs(x - fOffsets[b]));
+	    if( fSpreads[b] > kToleranceTicks )
+		fAligned = false;
+	}
+    fComplete = true;
+}
+
+bool TimeAlignment::IsComplete() const
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fComplete;
+}
+
+bool TimeAlignment::IsAligned() const
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fComplete && fAligned;
+}
+
+int64_t TimeAlignment::GetOffset(uint32_t board) const
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return board < fOffsets.size() ? fOffsets[board] : 0;
+}
+
+int64_t TimeAlignment::GetSpread(uint32_t board) const
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return board < fSpreads.size() ? fSpreads[board] : 0;
+}
+
+std::string TimeAlignment::Summary() const
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::ostringstream s;
+    if( !fComplete )
+	{
+	    s << "not measured (fewer than " << kTriggers << " events on";
+	    for( size_t b = 0; b < fTimes.size(); b++ )
+		if( fTimes[b].size() < kTriggers )
+		    s << " [b" << b << "]";
+	    s << ")";
+	    return s.str();
+	}
+    int64_t spread = 0;
+    s << (fAligned ? "aligned" : "NOT aligned") << ", offsets";
+    for( size_t b = 1; b < fOffsets.size(); b++ )
+	{
+	    s << " [b" << b << "] " << std::showpos << fOffsets[b] << std::noshowpos;
+	    spread = std::max(spread, fSpreads[b]);
+	}
+    s << " ticks (spread <= " << spread << ")";
+    return s.str();
+}
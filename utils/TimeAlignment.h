@@ -0,0 +1,63 @@
+#ifndef TIMEALIGNMENT_H
+#define TIMEALIGNMENT_H
+
+// Trigger time tag offsets between the boards of a crate, from the first
+// kTriggers events of a run. Every board sees the same triggers, so event i
+// of board b and event i of board 0 are the same trigger and
+//
+//   offset(b) = TTT(b, i) - TTT(0, i)
+//
+// must be the same for every i, within kToleranceTicks. A spread above the
+// tolerance means a board lost or gained a trigger, or its clock is not the
+// one of board 0. Once aligned, TTT - offset(b) identifies the trigger
+// across boards directly, without searching a time window.
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class TimeAlignment {
+public:
+    static constexpr uint32_t kTriggers = 16;           ///< common triggers compared
+    static constexpr int64_t kToleranceTicks = 2;       ///< accepted spread of offset(b)
+    /// V1742 trigger time tag width: the counter bits common to all
+    /// firmwares, where it wraps. Shared with RunReplay and daq-bench.
+    static constexpr uint32_t kTTTBits = 30;
+    static constexpr uint32_t kTTTMask = (1u << kTTTBits) - 1;
+
+    explicit TimeAlignment(uint32_t nboards);
+
+    /// Forget the previous run.
+    void Reset();
+
+    /// Time tag of event index of the run on board; later events are
+    /// ignored. Called from the readout thread of each board.
+    void Add(uint32_t board, uint32_t index, uint32_t ttt);
+
+    /// Every board has kTriggers events.
+    bool IsComplete() const;
+    bool IsAligned() const;
+    /// ticks; 0 for board 0
+    int64_t GetOffset(uint32_t board) const;
+    /// largest |TTT(b, i) - TTT(0, i) - offset(b)|, ticks
+    int64_t GetSpread(uint32_t board) const;
+
+    /// e.g. "aligned, offsets [b1] +3 [b2] -1 ticks (spread <= 1)"
+    std::string Summary() const;
+
+    /// a - b modulo the time tag counter, in (-2^30, 2^30]
+    static int64_t Difference(uint32_t a, uint32_t b);
+
+private:
+    void Evaluate();
+
+    mutable std::mutex fMutex;
+    std::vector<std::vector<uint32_t>> fTimes;      ///< [board][event]
+    std::vector<int64_t> fOffsets;
+    std::vector<int64_t> fSpreads;
+    bool fComplete;
+    bool fAligned;
+};
+
+#endif // TIMEALIGNMENT_H